@@ -8,6 +8,7 @@
 #   -c, --cpu        CPU speed in MHz: 378 (default), 504
 #   --usb-hid        Enable USB HID keyboard (disables USB CDC)
 #   --debug          Enable debug output
+#   --profile        Enable i386 opcode/hot-spot profiler (386/profile.txt)
 #   -clean           Clean build directory first
 #   -h, --help       Show this help
 #
@@ -101,7 +102,7 @@ while [[ $# -gt 0 ]]; do
             shift
             ;;
         -h|--help)
-            head -15 "$0" | tail -13
+            head -16 "$0" | tail -14
             exit 0
             ;;
         *)
@@ -23,8 +23,7 @@
  */
 #include "pc.h"
 #include "audio.h"
-#include "dss.h"
-#include "adlib.h"
+#include "mixer.h"
 #include "board_config.h"
 #include <pico/time.h>
 
@@ -55,8 +54,10 @@ i2s_config_t i2s_get_default_config(void) {
 }
 
 /**
- * Initialize the I2S driver. Must be called before calling i2s_write or i2s_dma_write
- * i2s_config: I2S context obtained by i2s_get_default_config()
+ * Initialize the I2S driver and start the DMA. Must be called before calling i2s_write
+ * i2s_config: I2S context obtained by i2s_get_default_config(), with dma_buf
+ *             set to a ring of dma_trans_count 32 bits frames (a power of two),
+ *             aligned to its size in bytes
  */
 void i2s_init(i2s_config_t *i2s_config) {
     uint8_t func;
@@ -85,16 +86,19 @@ void i2s_init(i2s_config_t *i2s_config) {
     pio_sm_set_clkdiv_int_frac(i2s_config->pio, i2s_config->sm, divider >> 8u, divider & 0xffu);
 
     pio_sm_set_enabled(i2s_config->pio, i2s_config->sm, false);
-    /* Allocate memory for the DMA buffer */
-    i2s_config->dma_buf = malloc(i2s_config->dma_trans_count * sizeof(uint32_t));
 
-    /* Direct Memory Access setup */
+    /* Direct Memory Access setup: the data channel plays dma_buf as a
+     * ring and chains to a control channel that re-arms its count, so the
+     * ring loops forever without CPU help. */
     i2s_config->dma_channel = dma_claim_unused_channel(true);
+    i2s_config->dma_ctrl_channel = dma_claim_unused_channel(true);
 
     dma_channel_config dma_config = dma_channel_get_default_config(i2s_config->dma_channel);
     channel_config_set_read_increment(&dma_config, true);
     channel_config_set_write_increment(&dma_config, false);
     channel_config_set_transfer_data_size(&dma_config, DMA_SIZE_32);
+    channel_config_set_ring(&dma_config, false, __builtin_ctz(i2s_config->dma_trans_count * sizeof(uint32_t)));
+    channel_config_set_chain_to(&dma_config, i2s_config->dma_ctrl_channel);
 
     volatile uint32_t *addr_write_DMA = &(i2s_config->pio->txf[i2s_config->sm]);
     channel_config_set_dreq(&dma_config, pio_get_dreq(i2s_config->pio, i2s_config->sm, true));
@@ -105,7 +109,32 @@ void i2s_init(i2s_config_t *i2s_config) {
                           i2s_config->dma_trans_count,                // Number of 32 bits words to transfer
                           false                                       // Start immediately
     );
+
+    static uint32_t ring_count;
+    ring_count = i2s_config->dma_trans_count;
+    dma_channel_config ctrl_config = dma_channel_get_default_config(i2s_config->dma_ctrl_channel);
+    channel_config_set_read_increment(&ctrl_config, false);
+    channel_config_set_write_increment(&ctrl_config, false);
+    channel_config_set_transfer_data_size(&ctrl_config, DMA_SIZE_32);
+    dma_channel_configure(i2s_config->dma_ctrl_channel,
+                          &ctrl_config,
+                          &dma_hw->ch[i2s_config->dma_channel].al1_transfer_count_trig,
+                          &ring_count,
+                          1,
+                          false
+    );
+
     pio_sm_set_enabled(i2s_config->pio, i2s_config->sm, true);
+    dma_channel_start(i2s_config->dma_channel);
+}
+
+/**
+ * Index of the next ring frame the DMA will send to the PIO
+ * i2s_config: I2S context obtained by i2s_get_default_config()
+ */
+static inline uint32_t i2s_read_pos(const i2s_config_t *i2s_config) {
+    return (dma_hw->ch[i2s_config->dma_channel].read_addr - (uintptr_t)i2s_config->dma_buf)
+           / sizeof(uint32_t);
 }
 
 /**
@@ -122,24 +151,6 @@ void i2s_write(const i2s_config_t *i2s_config, const int16_t *samples, const siz
     }
 }
 
-/**
- * Write samples to DMA buffer and initiate DMA transfer (non blocking)
- * i2s_config: I2S context obtained by i2s_get_default_config()
- *     sample: pointer to an array of dma_trans_count x 32 bits samples
- */
-void __not_in_flash_func(i2s_dma_write)(i2s_config_t *i2s_config, const int16_t *samples) {
-    /* Wait the completion of the previous DMA transfer */
-    dma_channel_wait_for_finish_blocking(i2s_config->dma_channel);
-    /* Copy samples into the DMA buffer */
-    for (int i = 0; i < i2s_config->dma_trans_count * 2; ++i) {
-        i2s_config->dma_buf[i] = samples[i] >> volume;
-    }
-    /* Initiate the DMA transfer */
-    dma_channel_transfer_from_buffer_now(i2s_config->dma_channel,
-                                         i2s_config->dma_buf,
-                                         i2s_config->dma_trans_count);
-}
-
 /**
  * Adjust the output volume
  * i2s_config: I2S context obtained by i2s_get_default_config()
@@ -171,8 +182,21 @@ void i2s_decrease_volume(i2s_config_t *i2s_config) {
 static i2s_config_t i2s_config;
 #elif FEATURE_AUDIO_PWM || FEATURE_AUDIO_HW
 static pwm_config pwm;
+#define PWM_SILENCE 2048
 #endif
 
+/*
+ * Mixed output frames, played in order by the I2S DMA or the PWM timer.
+ * Core 1 keeps it filled a few mixer blocks ahead of the read position.
+ * I2S frames are the 16 bits right sample in the low half and the left one
+ * in the high half. PWM frames are the 12 bits right and left levels in
+ * bits 0-11 and 12-23, and an 8 bits beeper level on top.
+ */
+#define AUDIO_RING_FRAMES (MIXER_BLOCK * 4)
+static uint32_t audio_ring[AUDIO_RING_FRAMES]
+    __attribute__((aligned(AUDIO_RING_FRAMES * sizeof(uint32_t))));
+static uint32_t audio_wr;       // next frame core 1 renders
+
 static uint8_t prev = 0;
 void audio_set_enabled(bool v) {
     if (v) {
@@ -196,11 +220,14 @@ void audio_init(void) {
 #if FEATURE_AUDIO_I2S
     i2s_config = i2s_get_default_config();
     i2s_config.sample_freq = SOUND_FREQUENCY;
-    i2s_config.dma_trans_count = 1;
+    i2s_config.dma_trans_count = AUDIO_RING_FRAMES;
+    i2s_config.dma_buf = audio_ring;
     i2s_volume(&i2s_config, 0);
     i2s_init(&i2s_config);
     sleep_ms(100);
 #elif FEATURE_AUDIO_PWM
+    for (int i = 0; i < AUDIO_RING_FRAMES; i++)
+        audio_ring[i] = PWM_SILENCE | PWM_SILENCE << 12;
     pwm = pwm_get_default_config();
     gpio_set_function(PWM_LEFT_PIN, GPIO_FUNC_PWM);
     gpio_set_function(PWM_RIGHT_PIN, GPIO_FUNC_PWM);
@@ -227,85 +254,82 @@ void audio_init(void) {
 #endif
 }
 
-static int16_t samples[2] = { 0 };
+#if !FEATURE_AUDIO_I2S
+static volatile uint32_t pwm_rd;
 
 //=============================================================================
-// Core 1 Entry Point (Audio processing)
+// PWM sample clock: plays one ready frame, all mixing happens in audio_pump
 //=============================================================================
-bool __not_in_flash_func(timer_callback)(repeating_timer_t *rt) {
-    static uint64_t t_dss = 0;
-    static int dss_v = 0;
-    PC* pc = (PC*)rt->user_data;
-    // Disney Sound Source 7 kHz
-    if (pc->dss_enabled) {
-        uint64_t t = time_us_64();
-        if (t - t_dss >= 1000000 / 7000) { // 142 us for 7 kHz
-            t_dss = t;
-            dss_v = dss_sample();
-        }
-    }
-    // output:
-    int b_v = 0;
-    int r_v = 0;
-    int l_v = 0;
-    if (pc->pcspk_enabled) {
-        b_v = pcspk_sample(pc->pcspk);
-    }
-    if (pc->covox_enabled && pc->covox_sample) {
-        int16_t sample = ((int16_t)pc->covox_sample - 127) << 8;
-        r_v += sample;
-        l_v += sample;
-    }
-    if (pc->tandy_enabled) {
-        int16_t sample = sn76489_sample(); // 16-bit
-        r_v += sample;
-        l_v += sample;
-    }
-    if (pc->mpu401_enabled) {
-        int16_t sample = midi_sample();
-        r_v += sample;
-        l_v += sample;
-    }
-    if (pc->adlib_enabled) {
-        int16_t sample = adlib_getsample(pc->adlib);
-        r_v += sample;
-        l_v += sample;
-    }
-    if (pc->sb16_enabled) {
-        sb16_getsample(pc->sb16, &r_v, &l_v);
-    }
-    r_v += dss_v;
-    l_v += dss_v;
+bool __not_in_flash_func(audio_pwm_tick)(repeating_timer_t *rt) {
+    uint32_t rd = pwm_rd;
+    uint32_t frame = audio_ring[rd];
     #if FEATURE_AUDIO_PWM
-        r_v >>= volume;
-        l_v >>= volume;
-        uint16_t ur_v = (r_v + 32768) >> 4; // 16 signed bit to 12 unsigned
-        uint16_t ul_v = (l_v + 32768) >> 4;
-        if (ur_v > 4095) ur_v = 4095;
-        if (ul_v > 4095) ul_v = 4095;
+        pwm_set_gpio_level(PWM_RIGHT_PIN, frame & 0xfff);
+        pwm_set_gpio_level(PWM_LEFT_PIN, (frame >> 12) & 0xfff);
         #ifdef BEEPER_PIN
-            b_v = b_v ? (4095 >> volume) : 0;
-            pwm_set_gpio_level(BEEPER_PIN, b_v);
-        #else
-            if (b_v) { r_v = l_v = 32767; }
+            pwm_set_gpio_level(BEEPER_PIN, (frame >> 24 << 4) >> volume);
         #endif
-        pwm_set_gpio_level(PWM_RIGHT_PIN, ur_v);
-        pwm_set_gpio_level(PWM_LEFT_PIN, ul_v);
-    #elif FEATURE_AUDIO_I2S
-        if (b_v) { r_v = l_v = 32767; }
-        if (r_v > 32767) r_v = 32767;
-        if (r_v < -32768) r_v = -32768;
-        if (l_v > 32767) l_v = 32767;
-        if (l_v < -32768) l_v = -32768;
-        samples[0] = r_v;
-        samples[1] = l_v;
     #endif
+    pwm_rd = (rd + 1) & (AUDIO_RING_FRAMES - 1);
     return true;
 }
+#endif
 
-// to call DMA-wait not from ISR for timer
-bool __not_in_flash_func(repeat_me_often)(void) {
+void audio_start(void) {
+#if !FEATURE_AUDIO_I2S
+    static repeating_timer_t pwm_timer;
+    add_repeating_timer_us(-1000000 / SOUND_FREQUENCY, audio_pwm_tick, NULL, &pwm_timer);
+#endif
+}
+
+static inline int32_t clip16(int32_t v) {
+    return v > 32767 ? 32767 : v < -32768 ? -32768 : v;
+}
+
+/* Clip, apply the volume and pack one mixer block into output frames */
+static void __not_in_flash_func(audio_pack)(const MixerBlock *b, uint32_t *out, int n) {
+    const int vol = volume;
+    for (int i = 0; i < n; i++) {
+        int32_t l = b->l[i];
+        int32_t r = b->r[i];
     #if FEATURE_AUDIO_I2S
-        i2s_dma_write(&i2s_config, samples);
+        r = clip16(r + b->spk[i]) >> vol;
+        l = clip16(l + b->spk[i]) >> vol;
+        out[i] = (uint16_t)r | (uint32_t)(uint16_t)l << 16;
+    #else
+        #ifdef BEEPER_PIN
+            /* the beeper idles at 0 as it always did: a silent speaker
+             * sits at 0 after the DC filter, and only the half of the wave
+             * above it drives the pin */
+            int32_t spk = b->spk[i] * 255 / (PCSPK_AMPLITUDE / 2);
+            uint32_t beep = (spk < 0 ? 0 : spk > 255 ? 255 : spk) << 24;
+        #else
+            uint32_t beep = 0;
+            r += b->spk[i];
+            l += b->spk[i];
+        #endif
+        r = (clip16(r) >> vol) + 32768; // 16 signed bit to 12 unsigned
+        l = (clip16(l) >> vol) + 32768;
+        out[i] = (r >> 4) | (uint32_t)(l >> 4) << 12 | beep;
     #endif
+    }
+}
+
+//=============================================================================
+// Core 1: render the next block once the output has room for it
+//=============================================================================
+void __not_in_flash_func(audio_pump)(void *opaque) {
+    static MixerBlock block;
+    PC *pc = opaque;
+#if FEATURE_AUDIO_I2S
+    uint32_t rd = i2s_read_pos(&i2s_config);
+#else
+    uint32_t rd = pwm_rd;
+#endif
+    uint32_t ahead = (audio_wr - rd) & (AUDIO_RING_FRAMES - 1);
+    if (ahead + MIXER_BLOCK >= AUDIO_RING_FRAMES)
+        return;
+    mixer_render(pc, &block, MIXER_BLOCK, time_us_32());
+    audio_pack(&block, audio_ring + audio_wr, MIXER_BLOCK);
+    audio_wr = (audio_wr + MIXER_BLOCK) & (AUDIO_RING_FRAMES - 1);
 }
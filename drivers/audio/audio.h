@@ -42,14 +42,14 @@ typedef struct i2s_config {
     PIO pio;
     uint8_t sm;
     uint8_t dma_channel;
+    uint8_t dma_ctrl_channel;
     uint16_t dma_trans_count;
-    uint16_t *dma_buf;
+    uint32_t *dma_buf;
 } i2s_config_t;
 
 i2s_config_t i2s_get_default_config(void);
 void i2s_init(i2s_config_t *i2s_config);
 void i2s_write(const i2s_config_t *i2s_config, const int16_t *samples, const size_t len);
-void i2s_dma_write(i2s_config_t *i2s_config, const int16_t *samples);
 void i2s_volume(i2s_config_t *i2s_config, uint8_t volume);
 void i2s_increase_volume(i2s_config_t *i2s_config);
 void i2s_decrease_volume(i2s_config_t *i2s_config);
@@ -58,6 +58,10 @@ void audio_set_enabled(bool);
 void audio_set_volume(uint8_t);
 uint8_t audio_get_volume(void);
 void audio_init(void);
+/* Start the output sample clock (PWM); I2S runs from audio_init on */
+void audio_start(void);
+/* Mix the next block of the PC's sound devices if the output has room */
+void audio_pump(void *pc);
 
 #ifdef __cplusplus
 }
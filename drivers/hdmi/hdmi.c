@@ -8,12 +8,12 @@
 #include <pico/multicore.h>
 #include <hardware/clocks.h>
 #include "hardware/structs/bus_ctrl.h"
-#include <arm_acle.h>
 
 #include "vga.h"
 #include "vga_osd.h"
 #include "hdmi.h"
 #include "font8x16.h"
+#include "scanline.h"
 
 //PIO параметры
 static uint offs_prg0 = 0;
@@ -32,13 +32,7 @@ extern uint32_t palette_a[256];
 #define SCREEN_WIDTH (320)
 #define SCREEN_HEIGHT (240)
 
-#define GFX_BUFFER_SIZE (256 * 1024)
-extern uint8_t gfx_buffer[GFX_BUFFER_SIZE];
 extern uint8_t text_buffer_sram[80 * 25 * 2];
-extern int text_cols;
-// Stride in *character cells* (uint32_t per cell in gfx_buffer text layout).
-// For VGA CRTC Offset (0x13): cells_per_row = cr13 * 2 (80-col -> 40*2, 40-col -> 20*2).
-extern int text_stride_cells;
 // Direct pointer to VGA register state (set once by core0 after vga_init).
 // ISR reads cr[], ar[] directly at the right moment — no volatile intermediates.
 extern VGAState *vga_state;
@@ -46,19 +40,11 @@ extern VGAState *vga_state;
 extern uint16_t frame_vram_offset;
 extern uint8_t  frame_pixel_panning;
 extern int      frame_line_compare;
-// Cursor state
-extern int cursor_x, cursor_y;
-extern int cursor_start, cursor_end;
-extern int cursor_blink_state;
 
 extern int active_start;
 extern int active_end;
 
 extern int gfx_submode;
-extern int gfx_width;
-extern int gfx_height;
-extern int gfx_line_offset;  // Words per line (40 for 320px EGA, 80 for 640px)
-extern int gfx_sram_stride;  // Words per line in SRAM buffer (width/8 + 1)
 
 extern volatile uint32_t frame_update_request;
 
@@ -240,124 +226,6 @@ static inline void* __not_in_flash_func(nf_memset)(void* ptr, int value, size_t
 #define is_hdmi_sync(c) (c >= HDMI_CTRL_0)
 #define ob(x) { register uint8_t c = x; *output_buffer++ = is_hdmi_sync(c) ? (HDMI_CTRL_0 - 1) : c; }
 
-static void __time_critical_func(render_text_line)(uint32_t line, uint8_t *output_buffer) {
-    uint32_t char_row = line >> 4; // div 16
-    uint32_t glyph_line = line & 15;
-
-    int cols = text_cols;
-    int double_h = (cols == 40);  // 40 columns => 2x horizontal scaling
-
-    if (char_row < 25) {
-        // Use snapped start address for the frame (prevents mid-frame tearing).
-        const uint32_t *base = (const uint32_t *)(gfx_buffer + ((uint32_t)frame_vram_offset << 2));
-        const uint32_t *text_row = base + (char_row * (uint32_t)text_stride_cells);
-
-        for (int col = 0; col < cols; col++) {
-            uint16_t cell = text_row[col];
-            uint8_t ch   = (uint8_t)(cell & 0xFF);
-            uint8_t attr = (uint8_t)(cell >> 8);
-            register uint8_t glyph;
-            if (cursor_blink_state && col == cursor_x &&
-                char_row == (uint32_t)cursor_y &&
-                glyph_line >= (uint32_t)cursor_start &&
-                glyph_line <= (uint32_t)cursor_end) {
-                glyph = 0xFF;
-            } else {
-                const uint8_t *fp = vga_get_font_ptr(vga_state, ch, (attr >> 3) & 1);
-                if (fp) {
-                    glyph = __rbit(fp[glyph_line * 4]) >> 24;
-                } else {
-                    glyph = font_8x16[ch * 16 + glyph_line];
-                }
-            }
-           // uint8_t blink_or_highlite_bg = attr & 0b10000000; // TODO: use it?
-            register uint8_t fg_color0 = attr & 0b00001111;
-            register uint8_t bg_color1 = attr & 0b01110000;
-            register uint8_t bg_color0 = bg_color1 >> 4;
-            register uint8_t fg_color1 = fg_color0 << 4;
-            if (!double_h) {
-                ob( ((glyph & 0b00000001) ? fg_color1 : bg_color1) | ((glyph & 0b00000010) ? fg_color0 : bg_color0) );
-                ob( ((glyph & 0b00000100) ? fg_color1 : bg_color1) | ((glyph & 0b00001000) ? fg_color0 : bg_color0) );
-                ob( ((glyph & 0b00010000) ? fg_color1 : bg_color1) | ((glyph & 0b00100000) ? fg_color0 : bg_color0) );
-                ob( ((glyph & 0b01000000) ? fg_color1 : bg_color1) | ((glyph & 0b10000000) ? fg_color0 : bg_color0) );
-            } else {
-                // TODO: optimize it
-                ob( ((glyph & 0b00000001) ? fg_color1 : bg_color1) | ((glyph & 0b00000001) ? fg_color0 : bg_color0) );
-                ob( ((glyph & 0b00000010) ? fg_color1 : bg_color1) | ((glyph & 0b00000010) ? fg_color0 : bg_color0) );
-                ob( ((glyph & 0b00000100) ? fg_color1 : bg_color1) | ((glyph & 0b00000100) ? fg_color0 : bg_color0) );
-                ob( ((glyph & 0b00001000) ? fg_color1 : bg_color1) | ((glyph & 0b00001000) ? fg_color0 : bg_color0) );
-                ob( ((glyph & 0b00010000) ? fg_color1 : bg_color1) | ((glyph & 0b00010000) ? fg_color0 : bg_color0) );
-                ob( ((glyph & 0b00100000) ? fg_color1 : bg_color1) | ((glyph & 0b00100000) ? fg_color0 : bg_color0) );
-                ob( ((glyph & 0b01000000) ? fg_color1 : bg_color1) | ((glyph & 0b01000000) ? fg_color0 : bg_color0) );
-                ob( ((glyph & 0b10000000) ? fg_color1 : bg_color1) | ((glyph & 0b10000000) ? fg_color0 : bg_color0) );
-            }
-        }
-    }
-}
-
-static void __time_critical_func(render_gfx_line_from_sram)(uint32_t line, uint8_t *output_buffer) {
-    // Determine source line based on graphics height
-    // If height > 200 (e.g. 400 in Mode X), map 1:1
-    // If height <= 200 (e.g. 320x200), double lines
-    uint32_t src_line = (gfx_height > 200) ? line : (line >> 1);
-
-    if (src_line >= gfx_height && gfx_height > 0) {
-        // Blank line below visible area
-        nf_memset(output_buffer, 0, SCREEN_WIDTH);
-    } else if (src_line >= 200 && gfx_height <= 0) {
-        // Fallback if gfx_height not set
-        nf_memset(output_buffer, 0, SCREEN_WIDTH);
-    } else {
-        // Read from VRAM (stable during active video)
-        // Stride comes from CRTC Offset (CR13) which is in words for VGA.
-        // We use 32-bit words for fetch, so convert words->dwords.
-        uint32_t off = gfx_line_offset;
-        uint32_t stride = (off > 0) ? (off << 1) : 80u;
-        uint32_t offset;
-        if (frame_line_compare >= 0 && src_line >= (uint32_t)frame_line_compare) {
-            offset = (src_line - frame_line_compare) * stride;
-        } else {
-            offset = frame_vram_offset + src_line * stride;
-        }
-        offset &= 0xFFFF;
-        // chain4: pixels are stored linearly, addr IS the byte offset
-        const uint8_t *src = gfx_buffer + (offset << 2);
-        for (int i = 0; i < SCREEN_WIDTH; ++i) {
-            ob( *src++ );
-        }
-    }
-}
-
-// Render VGA 256-color planar (Mode X: 320x200x256, unchained)
-// VRAM layout in our emulator: packed planes in dwords.
-// Each dword holds 4 bytes: plane0..plane3, and those bytes are pixels x%4.
-static void __time_critical_func(render_gfx_line_vga_planar256)(uint32_t line, uint8_t *output_buffer) {
-    int active_lines = active_end - active_start;
-    uint32_t src_line = (gfx_height * 2 <= active_lines) ? (line >> 1) : line;
-    if (src_line >= (uint32_t)gfx_height) {
-        nf_memset(output_buffer, 0, SCREEN_WIDTH);
-        return;
-    }
-    // CRTC Offset (CR13) in words -> dword stride
-    uint32_t stride = (gfx_line_offset > 0) ? ((uint32_t)gfx_line_offset * 2u) : 80u;
-    uint32_t base;
-    // frame_line_compare is in display-line units (same as `line` parameter).
-    // Compare against `line` (not src_line) to get the right split point.
-    if (frame_line_compare >= 0 && (int)line >= frame_line_compare) {
-        uint32_t lc_src = (gfx_height * 2 <= active_lines) ? (uint32_t)frame_line_compare >> 1
-                                                           : (uint32_t)frame_line_compare;
-        base = (src_line - lc_src) * stride;
-    } else {
-        base = frame_vram_offset + src_line * stride;
-    }
-    base &= 0xFFFF;
-    // base is in dwords; gfx_buffer is bytes, so byte offset = base * 4
-    const uint8_t *src = gfx_buffer + (base << 2);
-    for (int i = 0; i < SCREEN_WIDTH; ++i) {
-        ob( *src++ );
-    }
-}
-
 // Render OSD overlay onto a scanline
 // This is called from the ISR, so it must be fast
 void __time_critical_func(osd_render_line_hdmi)(uint32_t line, uint8_t *output_buffer) {
@@ -392,249 +260,8 @@ void __time_critical_func(osd_render_line_hdmi)(uint32_t line, uint8_t *output_b
     }
 }
 
-// Render CGA 4-color graphics line (320x200, 2 bits per pixel, interleaved)
-// VGA stores CGA data in odd/even mode with interleaved planes
-static void __time_critical_func(render_gfx_line_cga)(uint32_t line, uint8_t *output_buffer) {
-    // CGA 320x200 mode (doubled to 640x400)
-    uint32_t src_line = line >> 1;
-    if (src_line >= 200) {
-        // Blank line
-        nf_memset(output_buffer, 0, SCREEN_WIDTH);
-    } else {
-        // CGA interleaved scanlines:
-        // Even lines (0,2,4,...) at offset 0x0000
-        // Odd lines (1,3,5,...) at offset 0x2000
-        uint32_t cga_bank = (src_line & 1) ? 0x2000 : 0x0000;
-        uint32_t cga_row = src_line >> 1;  // Which row within bank (0-99)
-        uint32_t cga_line_offset;
-        if (frame_line_compare >= 0 && src_line >= (uint32_t)frame_line_compare) {
-            cga_line_offset = cga_bank + (src_line - frame_line_compare) * 80;
-        } else {
-            cga_line_offset = frame_vram_offset + cga_bank + cga_row * 80;
-        }
-        cga_line_offset &= 0xFFFF;
-
-        const uint8_t *src = gfx_buffer;
-
-        // In CGA/odd-even mode, data is stored linearly in planes 0 and 1
-        // Even bytes go to plane 0, odd bytes go to plane 1
-        // VGA address = ((cga_addr & ~1) << 1) | (cga_addr & 1)
-        // This spreads byte pairs across 4-byte boundaries
-
-        // 80 bytes per CGA scanline = 320 pixels, doubled to 640
-        uint32_t cga_addr = cga_line_offset;
-        for (int i = 0; i < 80; i++, cga_addr++) {
-            uint32_t vga_addr = ((cga_addr & ~1) << 1) | (cga_addr & 1);
-            uint8_t byte = src[vga_addr];
-            // Extract 4 pixels (2 bits each), MSB first
-            *output_buffer++ = (byte >> 6) & 3;
-            *output_buffer++ = (byte >> 4) & 3;
-            *output_buffer++ = (byte >> 2) & 3;
-            *output_buffer++ = byte & 3;
-        }
-    }
-}
-
-// Render CGA 2-color graphics line (640x200, 1 bit per pixel, interleaved)
-// Mode 6: 640x200 monochrome CGA mode
-// Memory layout: planar (4 bytes per screen byte), plane 0 only contains data
-// Row interleaving: even rows at bank 0, odd rows at bank 1 (0x2000 offset)
-static void __time_critical_func(render_gfx_line_cga2)(uint32_t line, uint8_t *output_buffer) {
-    // CGA 640x200 mode (doubled to 640x400)
-    uint32_t src_line = line >> 1;
-    if (src_line >= 200) {
-        // Blank line
-        nf_memset(output_buffer, 0, SCREEN_WIDTH);
-    } else {
-        // CGA interleaved scanlines:
-        // Even lines (0,2,4,...) at offset 0x0000
-        // Odd lines (1,3,5,...) at offset 0x2000 (which is 0x800 words)
-        // Each "byte" of screen data is stored at 4-byte boundaries (planar layout)
-        uint32_t bank_offset = (src_line & 1) ? 0x2000 : 0x0000;
-        uint32_t row_in_bank = src_line >> 1;  // Which row within bank (0-99)
-        // Base address for this scanline (in bytes): bank + row * 80 bytes/row
-        // In planar layout: multiply by 4 to get actual byte offset
-        uint32_t offset;
-        if (frame_line_compare >= 0 && src_line >= (uint32_t)frame_line_compare) {
-            offset = bank_offset + (src_line - frame_line_compare) * 80;
-        } else {
-            offset = frame_vram_offset + bank_offset + row_in_bank * 80;
-        }
-        offset &= 0xFFFF;
-        uint32_t base_addr = offset * 4;
-        const uint8_t *src = gfx_buffer;
-        // 80 bytes per CGA scanline = 640 pixels (1 bit per pixel)
-        // Data is in plane 0 (every 4th byte in planar layout)
-        for (int i = 0; i < 80; i++) {
-            // In planar layout, plane 0 is at offset 0, 4, 8, 12, ...
-            uint8_t byte = src[base_addr + i * 4];
-
-            // Extract 8 pixels (1 bit each), MSB first
-            // Output directly (no horizontal doubling since 640 is native width)
-            *output_buffer++ = ((byte >> 7) << 1) | ((byte >> 6) & 1);
-            *output_buffer++ = (((byte >> 5) & 1) << 1) | ((byte >> 4) & 1);
-            *output_buffer++ = (((byte >> 3) & 1) << 1) | ((byte >> 2) & 1);
-            *output_buffer++ = (((byte >> 1) & 1) << 1) | (byte & 1);
-        }
-    }
-}
-
-// Spread 8 bits of a byte into positions 0,4,8,...28
-extern uint32_t spread8_lut[256];
-
-// Merge 4 plane bytes [P3|P2|P1|P0] into 8 nibbles (pixel color indices).
-static inline uint32_t ega_pack8_from_planes(const uint32_t ega_planes) {
-    return
-     spread8_lut[(uint8_t)ega_planes] |
-     spread8_lut[(uint8_t)(ega_planes >> 8)] << 1 |
-     spread8_lut[(uint8_t)(ega_planes >> 16)] << 2 |
-     spread8_lut[(uint8_t)(ega_planes >> 24)] << 3;
-}
-
-static inline uint32_t ega_pair(uint8_t ab) {
-    return ((uint32_t)(ab & 15) << 8) | (uint32_t)(ab >> 4);
-}
-
-// Render EGA planar 16-color graphics line
-// Supports both 320x200 (doubled) and 640x350 (native) modes
-// Reads from SRAM buffer (copied from PSRAM during main loop)
-static void __time_critical_func(render_gfx_line_ega320)(uint32_t line, uint8_t *output_buffer) {
-    // Determine source line with appropriate scaling
-    // 400 display lines -> gfx_height source lines
-    // gfx_height is the actual number of unique scanlines in VRAM
-    uint32_t src_line;
-    int height = gfx_height > 0 ? gfx_height : 200;
-
-    // Calculate vertical scale factor: how many display lines per source line
-    // For 400 display lines and 200 source lines: scale = 2 (double each line)
-    // For 400 display lines and 100 source lines: scale = 4 (quadruple each line)
-    // For 400 display lines and 350 source lines: scale ≈ 1.14
-    if (height <= 100) {
-        // Very low res (e.g., 640x100 doubled twice): each source line shows 4x
-        src_line = line >> 2;
-    } else if (height <= 200) {
-        // 200-line mode: double vertically (400/2 = 200)
-        src_line = line >> 1;
-    } else if (height <= 350) {
-        // 350-line mode: map active display lines to 350 source lines
-        // Scale: src = line * 350 / 400 = line * 7 / 8
-        int ega_active_lines = active_end - active_start;
-        src_line = (line * height) / ega_active_lines;
-    } else {
-        // 400-line mode: 1:1 mapping
-        src_line = line;
-    }
-
-    // Check if source line is beyond the actual height
-    if (src_line >= (uint32_t)height) {
-        // Blank line - fast fill
-        nf_memset(output_buffer, 0, SCREEN_WIDTH);
-        return;
-    }
-    uint32_t gfx_width8 = gfx_width >> 3;
-    uint32_t stride = gfx_line_offset > 0 ? (gfx_line_offset << 1) : gfx_width8;
-
-    uint32_t offset;
-    if (frame_line_compare >= 0 && src_line >= (uint32_t)frame_line_compare) {
-        offset = (src_line - frame_line_compare) * stride;
-    } else {
-        offset = frame_vram_offset + src_line * stride;
-    }
-
-    offset &= 0xFFFF;
-
-    register const uint32_t *src32 = (const uint32_t *)(gfx_buffer + (offset << 2));
-    register int panning = frame_pixel_panning;
-    register uint8_t shift1 = panning << 2;
-    register uint8_t shift2 = 32 - shift1;
-
-    // Loop over display width
-    int words_to_render = gfx_width8;
-    if (words_to_render > 80) words_to_render = 80; // Cap at 640px
-
-    register uint32_t* out32 = (uint32_t*)output_buffer;
-    // 320-wide mode: double each pixel horizontally
-    for (int i = 0; i < words_to_render; ++i) {
-        register uint32_t eight_pixels = ega_pack8_from_planes(src32[i]);
-        if (panning > 0) {
-            eight_pixels = (eight_pixels << shift1) | (ega_pack8_from_planes(src32[i+1]) >> shift2);
-        }
-        *out32++ = ega_pair(eight_pixels >> 24) | (ega_pair(eight_pixels >> 16) << 16);
-        *out32++ = ega_pair(eight_pixels >> 8) | (ega_pair(eight_pixels) << 16);
-    }
-}
-
-static void __time_critical_func(render_gfx_line_ega640)(uint32_t line, uint8_t *output_buffer) {
-    // Determine source line with appropriate scaling
-    // 400 display lines -> gfx_height source lines
-    // gfx_height is the actual number of unique scanlines in VRAM
-    uint32_t src_line;
-    int height = gfx_height > 0 ? gfx_height : 200;
-
-    // Calculate vertical scale factor: how many display lines per source line
-    // For 400 display lines and 200 source lines: scale = 2 (double each line)
-    // For 400 display lines and 100 source lines: scale = 4 (quadruple each line)
-    // For 400 display lines and 350 source lines: scale ≈ 1.14
-    if (height <= 100) {
-        // Very low res (e.g., 640x100 doubled twice): each source line shows 4x
-        src_line = line >> 2;
-    } else if (height <= 200) {
-        // 200-line mode: double vertically (400/2 = 200)
-        src_line = line >> 1;
-    } else if (height <= 350) {
-        // 350-line mode: map active display lines to 350 source lines
-        // Scale: src = line * 350 / 400 = line * 7 / 8
-        int ega_active_lines = active_end - active_start;
-        src_line = (line * height) / ega_active_lines;
-    } else {
-        // 400-line mode: 1:1 mapping
-        src_line = line;
-    }
-
-    // Check if source line is beyond the actual height
-    if (src_line >= (uint32_t)height) {
-        // Blank line - fast fill
-        nf_memset(output_buffer, 0, SCREEN_WIDTH);
-        return;
-    }
-    uint32_t gfx_width8 = gfx_width >> 3;
-    uint32_t stride = gfx_line_offset > 0 ? (gfx_line_offset << 1) : gfx_width8;
-
-    uint32_t offset;
-    if (frame_line_compare >= 0 && src_line >= (uint32_t)frame_line_compare) {
-        offset = (src_line - frame_line_compare) * stride;
-    } else {
-        offset = frame_vram_offset + src_line * stride;
-    }
-
-    offset &= 0xFFFF;
-
-    register const uint32_t *src32 = (const uint32_t *)(gfx_buffer + (offset << 2));
-    register int panning = frame_pixel_panning;
-    register uint8_t shift1 = panning << 2;
-    register uint8_t shift2 = 32 - shift1;
-
-    // Loop over display width
-    int words_to_render = gfx_width8;
-    if (words_to_render > 80) words_to_render = 80; // Cap at 640px
-
-    // 640-wide mode: no horizontal doubling
-    for (register int i = 0; i < words_to_render; i++) {
-        register uint32_t eight_pixels = ega_pack8_from_planes(src32[i]);
-
-        if (panning > 0) {
-            eight_pixels = (eight_pixels << shift1) | (ega_pack8_from_planes(src32[i+1]) >> shift2);
-        }
-/// TODO: compose palleter for this case
-        // Lookup each pixel (no doubling)
-        ob ( (eight_pixels >> 24) );
-        ob ( (eight_pixels >> 16) );
-        ob ( (eight_pixels >> 8) );
-        ob ( eight_pixels );
-    }
-}
-
 void pre_render_line(void);
+void vga_hw_scanline_frame(ScanlineFrame *f);
 static void __time_critical_func(render_line)(uint32_t line, uint8_t *output_buffer) {
     // Before emulator init: output black, avoid calling any flash-resident
     // functions that could cause XIP contention with Core 0's BIOS loading.
@@ -647,40 +274,34 @@ static void __time_critical_func(render_line)(uint32_t line, uint8_t *output_buf
         return osd_render_line_hdmi(line, output_buffer);
     }
     int mode = current_mode;
-    if (mode == 1) {
-        // Text mode now rendered from linear framebuffer
-        return render_text_line(line, output_buffer);
-    }
-    if (mode == 2) {
+    if (mode == 1 || mode == 2) {
+        ScanlineFrame f;
+        vga_hw_scanline_frame(&f);
+        if (mode == 1) {
+            // Text mode now rendered from linear framebuffer
+            return scanline_text_hdmi(&f, line, output_buffer);
+        }
         uint8_t submode = gfx_submode;
         // Graphics mode - choose renderer based on submode
         if (submode == 2) {
             // EGA planar 16-color 640*
-            render_gfx_line_ega640(line, output_buffer);
-            return;
-        }
-        if (submode == 6) {
+            scanline_ega640_hdmi(&f, line, output_buffer);
+        } else if (submode == 6) {
             // EGA planar 16-color 320*
-            render_gfx_line_ega320(line, output_buffer);
-            return;
-        }
-        if (submode == 1) {
+            scanline_ega320_hdmi(&f, line, output_buffer);
+        } else if (submode == 1) {
             // CGA 4-color
-            render_gfx_line_cga(line, output_buffer);
-            return;
-        }
-        if (submode == 4) {
+            scanline_cga4_hdmi(&f, line, output_buffer);
+        } else if (submode == 4) {
             // CGA 2-color (640x200 monochrome)
-            render_gfx_line_cga2(line, output_buffer);
-            return;
-        }
-        if (submode == 5) {
+            scanline_cga2_hdmi(&f, line, output_buffer);
+        } else if (submode == 5) {
             // VGA 256-color planar (Mode X)
-            render_gfx_line_vga_planar256(line, output_buffer);
-            return;
+            scanline_planar256_hdmi(&f, line, output_buffer);
+        } else {
+            // VGA 256-color (mode 13h) - default
+            scanline_chain4_hdmi(&f, line, output_buffer);
         }
-        // VGA 256-color (mode 13h) - default
-        render_gfx_line_from_sram(line, output_buffer);
         return;
     }
     // mode 0 - blank screen (gray)
@@ -2,7 +2,7 @@
 #include <pico.h>
 
 // Place font in RAM for faster access during IRQ rendering
-const uint8_t __attribute__((section(".data"))) font_8x16[4096] = {
+const uint8_t __not_in_flash("font") font_8x16[4096] = {
         0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,//(0x00)0
         0x00, 0x00, 0x7E, 0x81, 0xA5, 0xA5, 0xA5, 0x81, 0x81, 0xBD, 0x99, 0x81, 0x7E, 0x00, 0x00, 0x00,//(0x01)1  
         0x00, 0x00, 0x7E, 0xFF, 0xDB, 0xDB, 0xDB, 0xFF, 0xFF, 0xC3, 0xE7, 0xFF, 0x7E, 0x00, 0x00, 0x00,//(0x02)2  
@@ -1,3 +1,3 @@
 #include <stdint.h>
-// Place font in RAM for faster access during IRQ rendering
-extern const uint8_t __attribute__((section(".data"))) font_8x16[4096];
\ No newline at end of file
+// Defined in RAM (__not_in_flash) for faster access during IRQ rendering
+extern const uint8_t font_8x16[4096];
\ No newline at end of file
@@ -0,0 +1,570 @@
+/**
+ * frank-386 - i386 PC Emulator for RP2350
+ *
+ * Scanline renderers shared by the VGA and HDMI drivers. Each mode has one
+ * source-line and address mapping used by both outputs, so the two drivers
+ * cannot disagree about what is on screen, only about how it is encoded.
+ *
+ * Copyright (c) 2026 Mikhail Matveev <xtreme@rh1.tech>
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma GCC optimize("Ofast")
+
+#include <pico.h>
+
+#include "scanline.h"
+#include "font8x16.h"
+
+#if defined(__arm__)
+#include <arm_acle.h>
+#define rev8(b) (__rbit(b) >> 24)
+#else
+static inline uint32_t rev8(uint32_t b) {
+    b = ((b & 0xF0u) >> 4) | ((b & 0x0Fu) << 4);
+    b = ((b & 0xCCu) >> 2) | ((b & 0x33u) << 2);
+    return ((b & 0xAAu) >> 1) | ((b & 0x55u) << 1);
+}
+#endif
+
+// ============================================================================
+// Shared line and address mapping
+// ============================================================================
+
+static inline void fill32(uint32_t *out, uint32_t v, int n) {
+    for (int i = 0; i < n; i++)
+        out[i] = v;
+}
+
+// Address of a source line for the linear modes: CRTC start, or 0 below
+// the split-screen line. In dwords, wrapped to the 64K CRTC address space.
+static inline uint32_t line_address(const ScanlineFrame *f, uint32_t src_line,
+                                    uint32_t stride) {
+    uint32_t addr;
+    if (f->line_compare >= 0 && src_line >= (uint32_t)f->line_compare)
+        addr = (src_line - f->line_compare) * stride;
+    else
+        addr = f->start + src_line * stride;
+    return addr & 0xFFFF;
+}
+
+// Mode 13h: 200-line modes are doubled, taller ones map 1:1.
+// Returns -1 below the picture.
+static inline int32_t chain4_src_line(const ScanlineFrame *f, uint32_t line) {
+    uint32_t src_line = (f->height > 200) ? line : (line >> 1);
+    if (f->height > 0 ? src_line >= (uint32_t)f->height : src_line >= 200)
+        return -1;
+    return src_line;
+}
+
+static inline uint32_t chain4_address(const ScanlineFrame *f, uint32_t src_line) {
+    // CRTC Offset (CR13) is in words; we fetch dwords
+    uint32_t stride = (f->line_offset > 0) ? ((uint32_t)f->line_offset << 1) : 80u;
+    return line_address(f, src_line, stride);
+}
+
+// Mode X is doubled when the picture fits twice into the active area
+static inline int planar256_doubled(const ScanlineFrame *f) {
+    return f->height * 2 <= f->active_lines;
+}
+
+static inline int32_t planar256_src_line(const ScanlineFrame *f, uint32_t line) {
+    uint32_t src_line = planar256_doubled(f) ? (line >> 1) : line;
+    return src_line < (uint32_t)f->height ? (int32_t)src_line : -1;
+}
+
+static inline uint32_t planar256_address(const ScanlineFrame *f, uint32_t line,
+                                         uint32_t src_line) {
+    uint32_t stride = (f->line_offset > 0) ? ((uint32_t)f->line_offset * 2u) : 80u;
+    uint32_t base;
+    // line_compare is in display-line units, so the split is tested against
+    // the display line rather than the source line
+    if (f->line_compare >= 0 && (int)line >= f->line_compare) {
+        uint32_t lc_src = planar256_doubled(f) ? (uint32_t)f->line_compare >> 1
+                                               : (uint32_t)f->line_compare;
+        base = (src_line - lc_src) * stride;
+    } else {
+        base = f->start + src_line * stride;
+    }
+    return base & 0xFFFF;
+}
+
+// CGA modes: 200 lines doubled, even lines in bank 0, odd lines at 0x2000.
+// Returns the CGA byte address of the line, or -1 below the picture.
+static inline int32_t cga_address(const ScanlineFrame *f, uint32_t line) {
+    uint32_t src_line = line >> 1;
+    if (src_line >= 200)
+        return -1;
+    uint32_t bank = (src_line & 1) ? 0x2000 : 0x0000;
+    uint32_t row = src_line >> 1;
+    uint32_t addr;
+    if (f->line_compare >= 0 && src_line >= (uint32_t)f->line_compare)
+        addr = bank + (src_line - f->line_compare) * 80;
+    else
+        addr = f->start + bank + row * 80;
+    return addr & 0xFFFF;
+}
+
+// 16-colour planar: scale the source height onto the active area
+static inline int32_t ega_src_line(const ScanlineFrame *f, uint32_t line) {
+    int height = f->height > 0 ? f->height : 200;
+    uint32_t src_line;
+    if (height <= 100)
+        src_line = line >> 2;
+    else if (height <= 200)
+        src_line = line >> 1;
+    else if (height <= 350)
+        src_line = (line * height) / f->active_lines;   // 350 -> 400 lines
+    else
+        src_line = line;
+    return src_line < (uint32_t)height ? (int32_t)src_line : -1;
+}
+
+static inline uint32_t ega_address(const ScanlineFrame *f, uint32_t src_line) {
+    uint32_t stride = f->line_offset > 0 ? ((uint32_t)f->line_offset << 1)
+                                         : (uint32_t)f->width >> 3;
+    return line_address(f, src_line, stride);
+}
+
+static inline int ega_words(const ScanlineFrame *f) {
+    int words = f->width >> 3;
+    return words > 80 ? 80 : words;     // cap at 640px
+}
+
+uint32_t __scratch_y("spread8_lut") spread8_lut[256];
+
+// Spread 8 bits of a byte into positions 0,4,8,...28
+static inline uint32_t spread8(uint32_t plane) {
+    plane = (plane | (plane << 12)) & 0x000F000Fu;
+    plane = (plane | (plane <<  6)) & 0x03030303u;
+    plane = (plane | (plane <<  3)) & 0x11111111u;
+    return plane;
+}
+
+static void text_pairs_init(void);
+
+void scanline_init(void) {
+    for (uint32_t i = 0; i < 256; ++i)
+        spread8_lut[i] = spread8(i);
+    text_pairs_init();
+}
+
+// Merge 4 plane bytes [P3|P2|P1|P0] into 8 nibbles (pixel colour indices),
+// leftmost pixel in the top nibble
+static inline uint32_t ega_pack8_from_planes(const uint32_t ega_planes) {
+    return spread8_lut[ega_planes & 0xFFu] |
+           spread8_lut[(ega_planes >> 8) & 0xFFu] << 1 |
+           spread8_lut[(ega_planes >> 16) & 0xFFu] << 2 |
+           spread8_lut[ega_planes >> 24] << 3;
+}
+
+// Eight pixels starting at src32[i], shifted left by the pixel panning
+static inline uint32_t ega_fetch8(const uint32_t *src32, int i, int panning) {
+    uint32_t eight_pixels = ega_pack8_from_planes(src32[i]);
+    if (panning > 0) {
+        int shift = panning * 4;
+        eight_pixels = (eight_pixels << shift) |
+                       (ega_pack8_from_planes(src32[i + 1]) >> (32 - shift));
+    }
+    return eight_pixels;
+}
+
+// Text rows are decoded once per character row and reused for its 16
+// scanlines: each cell keeps a pointer to row 0 of its glyph and its
+// attribute, so a scanline only reads one font byte per cell. Glyph line 0
+// always rebuilds, so each frame picks up VRAM and font changes.
+#define TEXT_MAX_COLS 80
+
+static struct {
+    int32_t char_row;               ///< row held, -1 = none
+    const uint32_t *cells;          ///< VRAM the row was decoded from
+    int cols;
+    int builtin;                    ///< glyphs from font_8x16, not plane 2
+    const uint8_t *glyph[TEXT_MAX_COLS];
+    uint8_t attr[TEXT_MAX_COLS];
+} text_cache = { .char_row = -1 };
+
+static inline const uint32_t *text_row(const ScanlineFrame *f, uint32_t char_row) {
+    const uint32_t *base = (const uint32_t *)(f->vram + (f->start << 2));
+    return base + char_row * (uint32_t)f->text_stride;
+}
+
+static void __time_critical_func(text_decode_row)(const ScanlineFrame *f, uint32_t char_row,
+                                                 uint32_t glyph_line) {
+    const uint32_t *row = text_row(f, char_row);
+    int cols = f->text_cols > TEXT_MAX_COLS ? TEXT_MAX_COLS : f->text_cols;
+    if (glyph_line != 0 && text_cache.char_row == (int32_t)char_row &&
+        text_cache.cells == row && text_cache.cols == cols)
+        return;
+
+    text_cache.char_row = char_row;
+    text_cache.cells = row;
+    text_cache.cols = cols;
+    text_cache.builtin = f->vga == NULL;
+    for (int col = 0; col < cols; col++) {
+        uint16_t cell = row[col];
+        uint8_t ch = (uint8_t)cell;
+        uint8_t attr = (uint8_t)(cell >> 8);
+        // Font from VGA plane 2 (supports loaded fonts via SR3), 4 bytes per row
+        text_cache.glyph[col] = text_cache.builtin ? &font_8x16[ch * 16]
+                                : vga_get_font_ptr(f->vga, ch, (attr >> 3) & 1);
+        text_cache.attr[col] = attr;
+    }
+}
+
+// Column of the cursor if it covers this scanline, else -1
+static inline int text_cursor_col(const ScanlineFrame *f, uint32_t char_row,
+                                  uint32_t glyph_line) {
+    if (f->cursor_on && char_row == (uint32_t)f->cursor_y &&
+        glyph_line >= (uint32_t)f->cursor_start &&
+        glyph_line <= (uint32_t)f->cursor_end)
+        return f->cursor_x;
+    return -1;
+}
+
+// Glyph row of a decoded cell, bit 0 = leftmost pixel
+static inline uint32_t text_glyph(int col, uint32_t glyph_line, int cursor_col) {
+    if (col == cursor_col)
+        return 0xFF;
+    if (text_cache.builtin)
+        return text_cache.glyph[col][glyph_line];
+    return rev8(text_cache.glyph[col][glyph_line * 4]);
+}
+
+// ============================================================================
+// VGA output
+// ============================================================================
+
+// 40 cols: true 2x horizontal scaling per pixel, A B -> A A B B
+static inline uint16_t *out16_2x_per_pixel(uint16_t *p, uint16_t v) {
+    uint8_t a = (uint8_t)(v & 0xFF);
+    uint8_t b = (uint8_t)(v >> 8);
+    *p++ = (uint16_t)a | ((uint16_t)a << 8);
+    *p++ = (uint16_t)b | ((uint16_t)b << 8);
+    return p;
+}
+
+void __time_critical_func(scanline_text_vga)(const ScanlineFrame *f, uint32_t line,
+                                             uint16_t *out, const uint16_t *pal) {
+    uint32_t char_row = line >> 4;
+    uint32_t glyph_line = line & 15;
+    if (char_row >= 25)
+        return;
+
+    text_decode_row(f, char_row, glyph_line);
+    int cursor_col = text_cursor_col(f, char_row, glyph_line);
+    int cols = text_cache.cols;
+
+    if (cols != 40) {
+        for (int col = 0; col < cols; col++) {
+            uint32_t glyph = text_glyph(col, glyph_line, cursor_col);
+            const uint16_t *p = &pal[(text_cache.attr[col] & 0x7F) * 4];
+            // 8px glyph -> 4 x uint16, each one a pixel pair
+            *out++ = p[glyph & 3];
+            *out++ = p[(glyph >> 2) & 3];
+            *out++ = p[(glyph >> 4) & 3];
+            *out++ = p[(glyph >> 6) & 3];
+        }
+    } else {
+        for (int col = 0; col < cols; col++) {
+            uint32_t glyph = text_glyph(col, glyph_line, cursor_col);
+            const uint16_t *p = &pal[(text_cache.attr[col] & 0x7F) * 4];
+            out = out16_2x_per_pixel(out, p[glyph & 3]);
+            out = out16_2x_per_pixel(out, p[(glyph >> 2) & 3]);
+            out = out16_2x_per_pixel(out, p[(glyph >> 4) & 3]);
+            out = out16_2x_per_pixel(out, p[(glyph >> 6) & 3]);
+        }
+    }
+}
+
+// 320 palette-indexed bytes -> 640 doubled pixels through the dither tables
+static inline void render_256_vga(const uint32_t *src32, uint32_t *out,
+                                  const uint16_t *pal) {
+    for (int i = 0; i < 80; i++) {
+        uint32_t pixels = src32[i];
+        uint16_t p0 = pal[pixels & 0xFF];
+        uint16_t p1 = pal[(pixels >> 8) & 0xFF];
+        uint16_t p2 = pal[(pixels >> 16) & 0xFF];
+        uint16_t p3 = pal[(pixels >> 24) & 0xFF];
+        *out++ = (uint32_t)p0 | ((uint32_t)p1 << 16);
+        *out++ = (uint32_t)p2 | ((uint32_t)p3 << 16);
+    }
+}
+
+void __time_critical_func(scanline_chain4_vga)(const ScanlineFrame *f, uint32_t line,
+                                               uint32_t *out, const uint16_t *pal_even,
+                                               const uint16_t *pal_odd, uint32_t blank) {
+    int32_t src_line = chain4_src_line(f, line);
+    if (src_line < 0) {
+        fill32(out, blank, SCANLINE_VGA_WIDTH / 4);
+        return;
+    }
+    const uint32_t *src32 = (const uint32_t *)(f->vram + chain4_address(f, src_line) * 4);
+    render_256_vga(src32, out, (src_line & 1) ? pal_odd : pal_even);
+}
+
+// Unchained: each dword holds pixels x%4 == 0..3 in planes 0..3, so the
+// bytes come out in screen order exactly like chain-4
+void __time_critical_func(scanline_planar256_vga)(const ScanlineFrame *f, uint32_t line,
+                                                  uint32_t *out, const uint16_t *pal_even,
+                                                  const uint16_t *pal_odd, uint32_t blank) {
+    int32_t src_line = planar256_src_line(f, line);
+    if (src_line < 0) {
+        fill32(out, blank, SCANLINE_VGA_WIDTH / 4);
+        return;
+    }
+    const uint32_t *src32 =
+        (const uint32_t *)(f->vram + planar256_address(f, line, src_line) * 4);
+    render_256_vga(src32, out, (src_line & 1) ? pal_odd : pal_even);
+}
+
+// CGA data is in odd/even mode: even bytes in plane 0, odd bytes in plane 1,
+// VGA address = ((cga_addr & ~1) << 1) | (cga_addr & 1)
+void __time_critical_func(scanline_cga4_vga)(const ScanlineFrame *f, uint32_t line,
+                                             uint32_t *out, const uint8_t *pal,
+                                             uint32_t blank) {
+    int32_t addr = cga_address(f, line);
+    if (addr < 0) {
+        fill32(out, blank, SCANLINE_VGA_WIDTH / 4);
+        return;
+    }
+    // 80 bytes = 320 pixels, 2 bits each MSB first, doubled to 640
+    for (uint32_t cga_addr = addr; cga_addr < (uint32_t)addr + 80; cga_addr++) {
+        uint8_t byte = f->vram[((cga_addr & ~1u) << 1) | (cga_addr & 1)];
+        uint32_t p0 = pal[(byte >> 6) & 3];
+        uint32_t p1 = pal[(byte >> 4) & 3];
+        uint32_t p2 = pal[(byte >> 2) & 3];
+        uint32_t p3 = pal[byte & 3];
+        *out++ = p0 | (p0 << 8) | (p1 << 16) | (p1 << 24);
+        *out++ = p2 | (p2 << 8) | (p3 << 16) | (p3 << 24);
+    }
+}
+
+// CGA 2-colour data is in plane 0 only, one screen byte per VGA address
+void __time_critical_func(scanline_cga2_vga)(const ScanlineFrame *f, uint32_t line,
+                                             uint32_t *out, uint8_t bg, uint8_t fg,
+                                             uint32_t blank) {
+    int32_t addr = cga_address(f, line);
+    if (addr < 0) {
+        fill32(out, blank, SCANLINE_VGA_WIDTH / 4);
+        return;
+    }
+    const uint8_t *src = f->vram + addr * 4;
+    // 80 bytes = 640 pixels, 1 bit each MSB first, native width
+    for (int i = 0; i < 80; i++) {
+        uint8_t byte = src[i * 4];
+        uint32_t p0 = (byte & 0x80) ? fg : bg;
+        uint32_t p1 = (byte & 0x40) ? fg : bg;
+        uint32_t p2 = (byte & 0x20) ? fg : bg;
+        uint32_t p3 = (byte & 0x10) ? fg : bg;
+        uint32_t p4 = (byte & 0x08) ? fg : bg;
+        uint32_t p5 = (byte & 0x04) ? fg : bg;
+        uint32_t p6 = (byte & 0x02) ? fg : bg;
+        uint32_t p7 = (byte & 0x01) ? fg : bg;
+        *out++ = p0 | (p1 << 8) | (p2 << 16) | (p3 << 24);
+        *out++ = p4 | (p5 << 8) | (p6 << 16) | (p7 << 24);
+    }
+}
+
+void __time_critical_func(scanline_ega_vga)(const ScanlineFrame *f, uint32_t line,
+                                            uint32_t *out, const uint8_t *pal,
+                                            uint32_t blank) {
+    int32_t src_line = ega_src_line(f, line);
+    if (src_line < 0) {
+        fill32(out, blank, SCANLINE_VGA_WIDTH / 4);
+        return;
+    }
+    const uint32_t *src32 = (const uint32_t *)(f->vram + ega_address(f, src_line) * 4);
+    int panning = f->panning;
+    int words = ega_words(f);
+
+    if (f->width <= 320) {
+        // 320-wide: double each pixel, 8 pixels -> 4 output words
+        for (int i = 0; i < words; i++) {
+            uint32_t eight_pixels = ega_fetch8(src32, i, panning);
+            uint32_t c0 = pal[eight_pixels >> 28];
+            uint32_t c1 = pal[(eight_pixels >> 24) & 0xF];
+            uint32_t c2 = pal[(eight_pixels >> 20) & 0xF];
+            uint32_t c3 = pal[(eight_pixels >> 16) & 0xF];
+            uint32_t c4 = pal[(eight_pixels >> 12) & 0xF];
+            uint32_t c5 = pal[(eight_pixels >> 8) & 0xF];
+            uint32_t c6 = pal[(eight_pixels >> 4) & 0xF];
+            uint32_t c7 = pal[eight_pixels & 0xF];
+            *out++ = c0 | (c0 << 8) | (c1 << 16) | (c1 << 24);
+            *out++ = c2 | (c2 << 8) | (c3 << 16) | (c3 << 24);
+            *out++ = c4 | (c4 << 8) | (c5 << 16) | (c5 << 24);
+            *out++ = c6 | (c6 << 8) | (c7 << 16) | (c7 << 24);
+        }
+    } else {
+        for (int i = 0; i < words; i++) {
+            uint32_t eight_pixels = ega_fetch8(src32, i, panning);
+            uint32_t c0 = pal[eight_pixels >> 28];
+            uint32_t c1 = pal[(eight_pixels >> 24) & 0xF];
+            uint32_t c2 = pal[(eight_pixels >> 20) & 0xF];
+            uint32_t c3 = pal[(eight_pixels >> 16) & 0xF];
+            uint32_t c4 = pal[(eight_pixels >> 12) & 0xF];
+            uint32_t c5 = pal[(eight_pixels >> 8) & 0xF];
+            uint32_t c6 = pal[(eight_pixels >> 4) & 0xF];
+            uint32_t c7 = pal[eight_pixels & 0xF];
+            *out++ = c0 | (c1 << 8) | (c2 << 16) | (c3 << 24);
+            *out++ = c4 | (c5 << 8) | (c6 << 16) | (c7 << 24);
+        }
+    }
+}
+
+// ============================================================================
+// HDMI output
+// ============================================================================
+
+// Keep data bytes clear of the encoder's sync codes
+static inline uint8_t hdmi_data(uint8_t c) {
+    return c > SCANLINE_HDMI_MAX_INDEX ? SCANLINE_HDMI_MAX_INDEX : c;
+}
+
+// Pixel-pair bytes per attribute, indexed by two glyph bits (bit 0 = left
+// pixel, in the high nibble); blink is not rendered, so bit 7 is dropped
+static uint8_t text_pairs_hdmi[128][4];
+
+static void text_pairs_init(void) {
+    for (int attr = 0; attr < 128; attr++) {
+        uint8_t fg = attr & 0x0F;
+        uint8_t bg = (attr >> 4) & 0x07;
+        for (int b = 0; b < 4; b++)
+            text_pairs_hdmi[attr][b] = hdmi_data((((b & 1) ? fg : bg) << 4) |
+                                                 ((b & 2) ? fg : bg));
+    }
+}
+
+void __time_critical_func(scanline_text_hdmi)(const ScanlineFrame *f, uint32_t line,
+                                              uint8_t *out) {
+    uint32_t char_row = line >> 4;
+    uint32_t glyph_line = line & 15;
+    if (char_row >= 25)
+        return;
+
+    text_decode_row(f, char_row, glyph_line);
+    int cursor_col = text_cursor_col(f, char_row, glyph_line);
+    int cols = text_cache.cols;
+
+    if (cols != 40) {
+        for (int col = 0; col < cols; col++) {
+            uint32_t glyph = text_glyph(col, glyph_line, cursor_col);
+            const uint8_t *p = text_pairs_hdmi[text_cache.attr[col] & 0x7F];
+            *out++ = p[glyph & 3];
+            *out++ = p[(glyph >> 2) & 3];
+            *out++ = p[(glyph >> 4) & 3];
+            *out++ = p[(glyph >> 6) & 3];
+        }
+    } else {
+        for (int col = 0; col < cols; col++) {
+            uint32_t glyph = text_glyph(col, glyph_line, cursor_col);
+            const uint8_t *p = text_pairs_hdmi[text_cache.attr[col] & 0x7F];
+            for (int b = 0; b < 8; b++)
+                *out++ = p[(glyph >> b) & 1 ? 3 : 0];
+        }
+    }
+}
+
+static inline void copy_256_hdmi(const uint8_t *src, uint8_t *out) {
+    for (int i = 0; i < SCANLINE_HDMI_WIDTH; ++i)
+        out[i] = hdmi_data(src[i]);
+}
+
+void __time_critical_func(scanline_chain4_hdmi)(const ScanlineFrame *f, uint32_t line,
+                                                uint8_t *out) {
+    int32_t src_line = chain4_src_line(f, line);
+    if (src_line < 0) {
+        fill32((uint32_t *)out, 0, SCANLINE_HDMI_WIDTH / 4);
+        return;
+    }
+    copy_256_hdmi(f->vram + (chain4_address(f, src_line) << 2), out);
+}
+
+void __time_critical_func(scanline_planar256_hdmi)(const ScanlineFrame *f, uint32_t line,
+                                                   uint8_t *out) {
+    int32_t src_line = planar256_src_line(f, line);
+    if (src_line < 0) {
+        fill32((uint32_t *)out, 0, SCANLINE_HDMI_WIDTH / 4);
+        return;
+    }
+    copy_256_hdmi(f->vram + (planar256_address(f, line, src_line) << 2), out);
+}
+
+void __time_critical_func(scanline_cga4_hdmi)(const ScanlineFrame *f, uint32_t line,
+                                              uint8_t *out) {
+    int32_t addr = cga_address(f, line);
+    if (addr < 0) {
+        fill32((uint32_t *)out, 0, SCANLINE_HDMI_WIDTH / 4);
+        return;
+    }
+    for (uint32_t cga_addr = addr; cga_addr < (uint32_t)addr + 80; cga_addr++) {
+        uint8_t byte = f->vram[((cga_addr & ~1u) << 1) | (cga_addr & 1)];
+        *out++ = (byte >> 6) & 3;
+        *out++ = (byte >> 4) & 3;
+        *out++ = (byte >> 2) & 3;
+        *out++ = byte & 3;
+    }
+}
+
+void __time_critical_func(scanline_cga2_hdmi)(const ScanlineFrame *f, uint32_t line,
+                                              uint8_t *out) {
+    int32_t addr = cga_address(f, line);
+    if (addr < 0) {
+        fill32((uint32_t *)out, 0, SCANLINE_HDMI_WIDTH / 4);
+        return;
+    }
+    const uint8_t *src = f->vram + addr * 4;
+    // pixel pairs in bits 1..0, the left one in bit 1
+    for (int i = 0; i < 80; i++) {
+        uint8_t byte = src[i * 4];
+        *out++ = byte >> 6;
+        *out++ = (byte >> 4) & 3;
+        *out++ = (byte >> 2) & 3;
+        *out++ = byte & 3;
+    }
+}
+
+static inline uint32_t ega_pair(uint8_t ab) {
+    return ((uint32_t)(ab & 15) << 8) | (uint32_t)(ab >> 4);
+}
+
+// One byte per source pixel; 320-wide modes only
+void __time_critical_func(scanline_ega320_hdmi)(const ScanlineFrame *f, uint32_t line,
+                                                uint8_t *out) {
+    uint32_t *out32 = (uint32_t *)out;
+    int32_t src_line = ega_src_line(f, line);
+    if (src_line < 0) {
+        fill32(out32, 0, SCANLINE_HDMI_WIDTH / 4);
+        return;
+    }
+    const uint32_t *src32 = (const uint32_t *)(f->vram + (ega_address(f, src_line) << 2));
+    int panning = f->panning;
+    int words = ega_words(f);
+
+    for (int i = 0; i < words; ++i) {
+        uint32_t eight_pixels = ega_fetch8(src32, i, panning);
+        *out32++ = ega_pair(eight_pixels >> 24) | (ega_pair(eight_pixels >> 16) << 16);
+        *out32++ = ega_pair(eight_pixels >> 8) | (ega_pair(eight_pixels) << 16);
+    }
+}
+
+// Two pixels per byte, the left one in the high nibble
+void __time_critical_func(scanline_ega640_hdmi)(const ScanlineFrame *f, uint32_t line,
+                                                uint8_t *out) {
+    int32_t src_line = ega_src_line(f, line);
+    if (src_line < 0) {
+        fill32((uint32_t *)out, 0, SCANLINE_HDMI_WIDTH / 4);
+        return;
+    }
+    const uint32_t *src32 = (const uint32_t *)(f->vram + (ega_address(f, src_line) << 2));
+    int panning = f->panning;
+    int words = ega_words(f);
+
+    for (int i = 0; i < words; i++) {
+        uint32_t eight_pixels = ega_fetch8(src32, i, panning);
+        *out++ = hdmi_data(eight_pixels >> 24);
+        *out++ = hdmi_data(eight_pixels >> 16);
+        *out++ = hdmi_data(eight_pixels >> 8);
+        *out++ = hdmi_data(eight_pixels);
+    }
+}
@@ -0,0 +1,96 @@
+/**
+ * frank-386 - i386 PC Emulator for RP2350
+ *
+ * Scanline renderers shared by the VGA and HDMI drivers. These are the pure
+ * pixel-conversion parts of the per-line DMA interrupt: they read emulator
+ * VRAM (packed planes, 4 bytes per address) and write one output line, with
+ * no hardware access, so the same code also builds for the host, where it
+ * is benchmarked and checked against vga.c's software refresh.
+ *
+ * Copyright (c) 2026 Mikhail Matveev <xtreme@rh1.tech>
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef SCANLINE_H
+#define SCANLINE_H
+
+#include <stdint.h>
+
+#include "vga.h"
+
+/// Active picture width of the VGA output, in pixels (one byte each)
+#define SCANLINE_VGA_WIDTH 640
+/// HDMI output bytes per line (each byte is a pixel pair or a doubled pixel)
+#define SCANLINE_HDMI_WIDTH 320
+/// Highest byte the HDMI encoder treats as data; 252..255 are its sync codes
+#define SCANLINE_HDMI_MAX_INDEX 251
+
+/**
+ * Display state latched for one frame. The drivers fill this from what the
+ * emulator reported at the last vblank; line numbers passed to the
+ * renderers count from the top of the active area.
+ */
+typedef struct {
+    const uint8_t *vram;        ///< emulator VRAM, 4 bytes per address
+    uint32_t start;             ///< CRTC start address
+    int line_compare;           ///< split-screen line, -1 = off
+    int panning;                ///< pixel panning, 0-7
+    int width;                  ///< graphics mode width in pixels
+    int height;                 ///< graphics mode height in source lines
+    int line_offset;            ///< CRTC offset (CR13), in words
+    int active_lines;           ///< output lines in the active area (400 or 480)
+    int text_cols;              ///< visible text columns, 40 or 80
+    int text_stride;            ///< text row stride, in cells
+    int cursor_on;              ///< cursor visible in this blink phase
+    int cursor_x, cursor_y;
+    int cursor_start, cursor_end;
+    VGAState *vga;              ///< font source; NULL uses the built-in 8x16 font
+} ScanlineFrame;
+
+/// Fill the plane-spreading and text attribute tables used by the renderers
+void scanline_init(void);
+
+/*
+ * VGA output: 640 bytes per line, one per pixel, in the DAC encoding the
+ * caller's palette tables hold. 'out' points at the first active pixel.
+ * Lines past the source picture are filled with 'blank' (four pixels).
+ */
+
+/// Text; pal holds 4 pixel pairs per attribute (attr & 0x7f), low byte left
+void scanline_text_vga(const ScanlineFrame *f, uint32_t line, uint16_t *out,
+                       const uint16_t *pal);
+/// 256-colour chain-4 (mode 13h); pal_even/pal_odd are the dither phases
+void scanline_chain4_vga(const ScanlineFrame *f, uint32_t line, uint32_t *out,
+                         const uint16_t *pal_even, const uint16_t *pal_odd,
+                         uint32_t blank);
+/// 256-colour unchained (mode X)
+void scanline_planar256_vga(const ScanlineFrame *f, uint32_t line, uint32_t *out,
+                            const uint16_t *pal_even, const uint16_t *pal_odd,
+                            uint32_t blank);
+/// CGA 320x200 in 4 colours
+void scanline_cga4_vga(const ScanlineFrame *f, uint32_t line, uint32_t *out,
+                       const uint8_t *pal, uint32_t blank);
+/// CGA 640x200 in 2 colours
+void scanline_cga2_vga(const ScanlineFrame *f, uint32_t line, uint32_t *out,
+                       uint8_t bg, uint8_t fg, uint32_t blank);
+/// EGA/VGA planar 16 colours; 320-wide modes are doubled
+void scanline_ega_vga(const ScanlineFrame *f, uint32_t line, uint32_t *out,
+                      const uint8_t *pal, uint32_t blank);
+
+/*
+ * HDMI output: 320 bytes per line of palette indices for the TMDS encoder,
+ * which doubles every byte. Text and 640-wide EGA pack two pixels per byte
+ * (left pixel in the high nibble), CGA 2-colour packs two pixels in bits
+ * 1..0, and everything else is one source pixel per byte. Lines past the
+ * source picture are zeroed.
+ */
+
+void scanline_text_hdmi(const ScanlineFrame *f, uint32_t line, uint8_t *out);
+void scanline_chain4_hdmi(const ScanlineFrame *f, uint32_t line, uint8_t *out);
+void scanline_planar256_hdmi(const ScanlineFrame *f, uint32_t line, uint8_t *out);
+void scanline_cga4_hdmi(const ScanlineFrame *f, uint32_t line, uint8_t *out);
+void scanline_cga2_hdmi(const ScanlineFrame *f, uint32_t line, uint8_t *out);
+void scanline_ega320_hdmi(const ScanlineFrame *f, uint32_t line, uint8_t *out);
+void scanline_ega640_hdmi(const ScanlineFrame *f, uint32_t line, uint8_t *out);
+
+#endif /* SCANLINE_H */
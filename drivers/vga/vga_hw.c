@@ -12,7 +12,7 @@
 
 #include "vga_hw.h"
 #include "vga_osd.h"
-#include "font8x16.h"
+#include "scanline.h"
 #include "debug.h"
 #include "board_config.h"
 
@@ -29,7 +29,6 @@
 #include "hardware/timer.h"
 #include "hardware/vreg.h"
 #include "pico/time.h"
-#include <arm_acle.h>
 #include "../../drivers/psram/psram_init.h"
 
 bool SELECT_VGA = false;
@@ -276,425 +275,24 @@ static void init_palettes(void) {
 // DMA Interrupt Handler - Renders each scanline
 // ============================================================================
 
-// Render VGA 256-color planar (Mode X: 320x200x256, unchained)
-// VRAM layout in our emulator: packed planes in dwords.
-// Each dword holds 4 bytes: plane0..plane3, and those bytes are pixels x%4.
-static void __time_critical_func(render_gfx_line_vga_planar256)(uint32_t line, uint32_t *output_buffer) {
-    uint32_t *out32 = (uint32_t *)((uint8_t *)output_buffer + SHIFT_PICTURE);
-
-    int active_lines = active_end - active_start;
-    uint32_t src_line = (gfx_height * 2 <= active_lines) ? (line >> 1) : line;
-
-    if (src_line >= (uint32_t)gfx_height) {
-        uint32_t blank = TMPL_LINE | (TMPL_LINE << 8) | (TMPL_LINE << 16) | (TMPL_LINE << 24);
-        for (int i = 0; i < 160; i++) out32[i] = blank;
-        return;
-    }
-
-    // CRTC Offset (CR13) in words -> dword stride
-    uint32_t stride = (gfx_line_offset > 0) ? ((uint32_t)gfx_line_offset * 2u) : 80u;
-
-    uint32_t base;
-    // frame_line_compare is in display-line units (same as `line` parameter).
-    // Compare against `line` (not src_line) to get the right split point.
-    if (frame_line_compare >= 0 && (int)line >= frame_line_compare) {
-        uint32_t lc_src = (gfx_height * 2 <= active_lines) ? (uint32_t)frame_line_compare >> 1
-                                                           : (uint32_t)frame_line_compare;
-        base = (src_line - lc_src) * stride;
-    } else {
-        base = frame_vram_offset + src_line * stride;
-    }
-    base &= 0xFFFF;
-
-    // base is in dwords; gfx_buffer is bytes, so byte offset = base * 4
-    const uint32_t *src32 = (const uint32_t *)(gfx_buffer + base * 4);
-    // Select dither phase per scanline
-    uint16_t *active_palette = (src_line & 1) ? palette_a : palette_b;
-    // 320 pixels -> 80 dwords -> 160 output dwords (640px doubled)
-    for (int i = 0; i < 80; i++) {
-        uint32_t pixels = src32[i];
-        uint16_t p0 = active_palette[pixels & 0xFF];
-        uint16_t p1 = active_palette[(pixels >> 8) & 0xFF];
-        uint16_t p2 = active_palette[(pixels >> 16) & 0xFF];
-        uint16_t p3 = active_palette[(pixels >> 24) & 0xFF];
-        *out32++ = (uint32_t)p0 | ((uint32_t)p1 << 16);
-        *out32++ = (uint32_t)p2 | ((uint32_t)p3 << 16);
-    }
-}
-
-// Render graphics line directly from SRAM framebuffer (for IRQ use)
-// Uses dithered 16-bit palette for ~2197 perceived colors
-static void __time_critical_func(render_gfx_line_from_sram)(uint32_t line, uint32_t *output_buffer) {
-    uint32_t *out32 = (uint32_t *)((uint8_t *)output_buffer + SHIFT_PICTURE);
-
-    // Determine source line based on graphics height
-    // If height > 200 (e.g. 400 in Mode X), map 1:1
-    // If height <= 200 (e.g. 320x200), double lines
-    uint32_t src_line;
-    if (gfx_height > 200) {
-        src_line = line;
-    } else {
-        src_line = line / 2;
-    }
-
-    if (src_line >= gfx_height && gfx_height > 0) {
-        // Blank line below visible area
-        for (int i = 0; i < 160; i++) {
-            *out32++ = (TMPL_LINE) | (TMPL_LINE << 8) | (TMPL_LINE << 16) | (TMPL_LINE << 24);
-        }
-    } else if (src_line >= 200 && gfx_height <= 0) {
-         // Fallback if gfx_height not set
-        for (int i = 0; i < 160; i++) {
-            *out32++ = (TMPL_LINE) | (TMPL_LINE << 8) | (TMPL_LINE << 16) | (TMPL_LINE << 24);
-        }
-    } else {
-        // Read from VRAM (stable during active video)
-        // Stride comes from CRTC Offset (CR13) which is in words for VGA.
-        // We use 32-bit words for fetch, so convert words->dwords.
-        uint32_t stride = (gfx_line_offset > 0) ? ((uint32_t)gfx_line_offset * 2u) : 80u;
-        uint32_t offset;
-        if (frame_line_compare >= 0 && src_line >= (uint32_t)frame_line_compare) {
-            offset = (src_line - frame_line_compare) * stride;
-        } else {
-            offset = frame_vram_offset + src_line * stride;
-        }
-
-        offset &= 0xFFFF;
-
-        // offset is in dwords; gfx_buffer is bytes, so byte offset = offset * 4
-        const uint32_t *src32 = (const uint32_t *)(gfx_buffer + offset * 4);
-        // Select dither phase per scanline
-        uint16_t *active_palette = (src_line & 1) ? palette_a : palette_b;
-        // 320 pixels -> 80 dwords
-        for (int i = 0; i < 80; i++) {
-            uint32_t pixels = src32[i];
-            uint16_t p0 = active_palette[pixels & 0xFF];
-            uint16_t p1 = active_palette[(pixels >> 8) & 0xFF];
-            uint16_t p2 = active_palette[(pixels >> 16) & 0xFF];
-            uint16_t p3 = active_palette[(pixels >> 24) & 0xFF];
-            *out32++ = (uint32_t)p0 | ((uint32_t)p1 << 16);
-            *out32++ = (uint32_t)p2 | ((uint32_t)p3 << 16);
-        }
-    }
-}
-
-// Render CGA 4-color graphics line (320x200, 2 bits per pixel, interleaved)
-// VGA stores CGA data in odd/even mode with interleaved planes
-static void __time_critical_func(render_gfx_line_cga)(uint32_t line, uint32_t *output_buffer) {
-    uint32_t *out32 = (uint32_t *)((uint8_t *)output_buffer + SHIFT_PICTURE);
-
-    // CGA 320x200 mode (doubled to 640x400)
-    uint32_t src_line = line / 2;
-    if (src_line >= 200) {
-        // Blank line
-        for (int i = 0; i < 160; i++) {
-            *out32++ = (TMPL_LINE) | (TMPL_LINE << 8) | (TMPL_LINE << 16) | (TMPL_LINE << 24);
-        }
-    } else {
-        // CGA interleaved scanlines:
-        // Even lines (0,2,4,...) at offset 0x0000
-        // Odd lines (1,3,5,...) at offset 0x2000
-        uint32_t cga_bank = (src_line & 1) ? 0x2000 : 0x0000;
-        uint32_t cga_row = src_line >> 1;  // Which row within bank (0-99)
-        uint32_t cga_line_offset;
-        if (frame_line_compare >= 0 && src_line >= (uint32_t)frame_line_compare) {
-            cga_line_offset = cga_bank + (src_line - frame_line_compare) * 80;
-        } else {
-            cga_line_offset = frame_vram_offset + cga_bank + cga_row * 80;
-        }
-        cga_line_offset &= 0xFFFF;
-
-        const uint8_t *src = gfx_buffer;
-
-        // In CGA/odd-even mode, data is stored linearly in planes 0 and 1
-        // Even bytes go to plane 0, odd bytes go to plane 1
-        // VGA address = ((cga_addr & ~1) << 1) | (cga_addr & 1)
-        // This spreads byte pairs across 4-byte boundaries
-
-        // 80 bytes per CGA scanline = 320 pixels, doubled to 640
-        for (int i = 0; i < 80; i++) {
-            uint32_t cga_addr = cga_line_offset + i;
-            uint32_t vga_addr = ((cga_addr & ~1) << 1) | (cga_addr & 1);
-            uint8_t byte = src[vga_addr];
-
-            // Extract 4 pixels (2 bits each), MSB first
-            uint8_t p0 = cga_palette[(byte >> 6) & 3];
-            uint8_t p1 = cga_palette[(byte >> 4) & 3];
-            uint8_t p2 = cga_palette[(byte >> 2) & 3];
-            uint8_t p3 = cga_palette[byte & 3];
-
-            // Double each pixel horizontally (4 pixels -> 8 output pixels)
-            *out32++ = (p0) | (p0 << 8) | (p1 << 16) | (p1 << 24);
-            *out32++ = (p2) | (p2 << 8) | (p3 << 16) | (p3 << 24);
-        }
-    }
-}
-
-// Render CGA 2-color graphics line (640x200, 1 bit per pixel, interleaved)
-// Mode 6: 640x200 monochrome CGA mode
-// Memory layout: planar (4 bytes per screen byte), plane 0 only contains data
-// Row interleaving: even rows at bank 0, odd rows at bank 1 (0x2000 offset)
-static void __time_critical_func(render_gfx_line_cga2)(uint32_t line, uint32_t *output_buffer) {
-    uint32_t *out32 = (uint32_t *)((uint8_t *)output_buffer + SHIFT_PICTURE);
-
-    // CGA 640x200 mode (doubled to 640x400)
-    uint32_t src_line = line / 2;
-    if (src_line >= 200) {
-        // Blank line
-        for (int i = 0; i < 160; i++) {
-            *out32++ = (TMPL_LINE) | (TMPL_LINE << 8) | (TMPL_LINE << 16) | (TMPL_LINE << 24);
-        }
-    } else {
-        // CGA interleaved scanlines:
-        // Even lines (0,2,4,...) at offset 0x0000
-        // Odd lines (1,3,5,...) at offset 0x2000 (which is 0x800 words)
-        // Each "byte" of screen data is stored at 4-byte boundaries (planar layout)
-        uint32_t bank_offset = (src_line & 1) ? 0x2000 : 0x0000;
-        uint32_t row_in_bank = src_line >> 1;  // Which row within bank (0-99)
-        // Base address for this scanline (in bytes): bank + row * 80 bytes/row
-        // In planar layout: multiply by 4 to get actual byte offset
-        uint32_t offset;
-        if (frame_line_compare >= 0 && src_line >= (uint32_t)frame_line_compare) {
-            offset = bank_offset + (src_line - frame_line_compare) * 80;
-        } else {
-            offset = frame_vram_offset + bank_offset + row_in_bank * 80;
-        }
-        offset &= 0xFFFF;
-        uint32_t base_addr = offset * 4;
-        const uint8_t *src = gfx_buffer;
-
-        // CGA 2-color palette: 0 = black, 1 = white (or foreground color)
-        uint8_t bg = cga_palette[0];  // Background (black)
-        uint8_t fg = cga_palette[3];  // Foreground (white)
-
-        // 80 bytes per CGA scanline = 640 pixels (1 bit per pixel)
-        // Data is in plane 0 (every 4th byte in planar layout)
-        for (int i = 0; i < 80; i++) {
-            // In planar layout, plane 0 is at offset 0, 4, 8, 12, ...
-            uint8_t byte = src[base_addr + i * 4];
-
-            // Extract 8 pixels (1 bit each), MSB first
-            // Output directly (no horizontal doubling since 640 is native width)
-            uint8_t p0 = (byte & 0x80) ? fg : bg;
-            uint8_t p1 = (byte & 0x40) ? fg : bg;
-            uint8_t p2 = (byte & 0x20) ? fg : bg;
-            uint8_t p3 = (byte & 0x10) ? fg : bg;
-            uint8_t p4 = (byte & 0x08) ? fg : bg;
-            uint8_t p5 = (byte & 0x04) ? fg : bg;
-            uint8_t p6 = (byte & 0x02) ? fg : bg;
-            uint8_t p7 = (byte & 0x01) ? fg : bg;
-
-            // 8 pixels = 8 bytes = 2 x uint32_t (no doubling)
-            *out32++ = (p0) | (p1 << 8) | (p2 << 16) | (p3 << 24);
-            *out32++ = (p4) | (p5 << 8) | (p6 << 16) | (p7 << 24);
-        }
-    }
-}
-
-uint32_t __scratch_y("spread8_lut") spread8_lut[256];
-// Spread 8 bits of a byte into positions 0,4,8,...28
-static inline uint32_t spread8(uint32_t plane) {
-    plane = (plane | (plane << 12)) & 0x000F000Fu;
-    plane = (plane | (plane <<  6)) & 0x03030303u;
-    plane = (plane | (plane <<  3)) & 0x11111111u;
-    return plane;
-}
-
-// Merge 4 plane bytes [P3|P2|P1|P0] into 8 nibbles (pixel color indices).
-static inline uint32_t ega_pack8_from_planes(const uint32_t ega_planes) {
-    const uint32_t pixel1 = spread8_lut[ega_planes        & 0xFFu];
-    const uint32_t pixel2 = spread8_lut[(ega_planes >> 8) & 0xFFu];
-    const uint32_t pixel3 = spread8_lut[(ega_planes >> 16) & 0xFFu];
-    const uint32_t pixel4 = spread8_lut[ega_planes >> 24];
-
-    return pixel1 | pixel2 << 1 | pixel3 << 2 | pixel4 << 3;
-}
-
-// Render EGA planar 16-color graphics line
-// Supports both 320x200 (doubled) and 640x350 (native) modes
-// Reads from SRAM buffer (copied from PSRAM during main loop)
-static void __time_critical_func(render_gfx_line_ega)(uint32_t line, uint32_t *output_buffer) {
-    uint32_t *out32 = (uint32_t *)((uint8_t *)output_buffer + SHIFT_PICTURE);
-
-    // Determine if we need pixel doubling (for 320-wide modes)
-    int double_pixels = (gfx_width <= 320);
-
-    // Determine source line with appropriate scaling
-    // 400 display lines -> gfx_height source lines
-    // gfx_height is the actual number of unique scanlines in VRAM
-    uint32_t src_line;
-    int height = gfx_height > 0 ? gfx_height : 200;
-
-    // Calculate vertical scale factor: how many display lines per source line
-    // For 400 display lines and 200 source lines: scale = 2 (double each line)
-    // For 400 display lines and 100 source lines: scale = 4 (quadruple each line)
-    // For 400 display lines and 350 source lines: scale ≈ 1.14
-    if (height <= 100) {
-        // Very low res (e.g., 640x100 doubled twice): each source line shows 4x
-        src_line = line >> 2;
-    } else if (height <= 200) {
-        // 200-line mode: double vertically (400/2 = 200)
-        src_line = line >> 1;
-    } else if (height <= 350) {
-        // 350-line mode: map active display lines to 350 source lines
-        // Scale: src = line * 350 / 400 = line * 7 / 8
-        int ega_active_lines = active_end - active_start;
-        src_line = (line * height) / ega_active_lines;
-    } else {
-        // 400-line mode: 1:1 mapping
-        src_line = line;
-    }
-
-    // Check if source line is beyond the actual height
-    if (src_line >= (uint32_t)height) {
-        // Blank line - fast fill
-        uint32_t blank = TMPL_LINE | (TMPL_LINE << 8) | (TMPL_LINE << 16) | (TMPL_LINE << 24);
-        for (int i = 0; i < 160; i++) {
-            out32[i] = blank;
-        }
-        return;
-    }
-    uint32_t stride = gfx_line_offset > 0 ? (gfx_line_offset * 2) : (gfx_width / 8);
-
-    uint32_t offset;
-    if (frame_line_compare >= 0 && src_line >= (uint32_t)frame_line_compare) {
-        offset = (src_line - frame_line_compare) * stride;
-    } else {
-        offset = frame_vram_offset + src_line * stride;
-    }
-
-    offset &= 0xFFFF;
-
-    const uint32_t *src32 = (const uint32_t *)(gfx_buffer + offset * 4);
-    int panning = frame_pixel_panning;
-    int shift = panning * 4;
-
-    // Loop over display width
-    int words_to_render = gfx_width / 8;
-    if (words_to_render > 80) words_to_render = 80; // Cap at 640px
-
-    if (double_pixels) {
-        // 320-wide mode: double each pixel horizontally
-        for (int i = 0; i < words_to_render; i++) {
-            uint32_t ega_planes = src32[i];
-            uint32_t eight_pixels = ega_pack8_from_planes(ega_planes);
-
-            if (panning > 0) {
-                uint32_t next_planes = src32[i+1];
-                uint32_t next_eight = ega_pack8_from_planes(next_planes);
-                eight_pixels = (eight_pixels << shift) | (next_eight >> (32 - shift));
-            }
-
-            // Lookup and double each pixel
-            uint8_t c0 = ega_palette[eight_pixels >> 28];
-            uint8_t c1 = ega_palette[(eight_pixels >> 24) & 0xF];
-            uint8_t c2 = ega_palette[(eight_pixels >> 20) & 0xF];
-            uint8_t c3 = ega_palette[(eight_pixels >> 16) & 0xF];
-            uint8_t c4 = ega_palette[(eight_pixels >> 12) & 0xF];
-            uint8_t c5 = ega_palette[(eight_pixels >> 8) & 0xF];
-            uint8_t c6 = ega_palette[(eight_pixels >> 4) & 0xF];
-            uint8_t c7 = ega_palette[eight_pixels & 0xF];
-
-            // 4 x 32-bit writes = 16 bytes (8 doubled pixels)
-            *out32++ = c0 | (c0 << 8) | (c1 << 16) | (c1 << 24);
-            *out32++ = c2 | (c2 << 8) | (c3 << 16) | (c3 << 24);
-            *out32++ = c4 | (c4 << 8) | (c5 << 16) | (c5 << 24);
-            *out32++ = c6 | (c6 << 8) | (c7 << 16) | (c7 << 24);
-        }
-    } else {
-        // 640-wide mode: no horizontal doubling
-        for (int i = 0; i < words_to_render; i++) {
-            uint32_t ega_planes = src32[i];
-            uint32_t eight_pixels = ega_pack8_from_planes(ega_planes);
-
-            if (panning > 0) {
-                uint32_t next_planes = src32[i+1];
-                uint32_t next_eight = ega_pack8_from_planes(next_planes);
-                eight_pixels = (eight_pixels << shift) | (next_eight >> (32 - shift));
-            }
-
-            // Lookup each pixel (no doubling)
-            uint8_t c0 = ega_palette[eight_pixels >> 28];
-            uint8_t c1 = ega_palette[(eight_pixels >> 24) & 0xF];
-            uint8_t c2 = ega_palette[(eight_pixels >> 20) & 0xF];
-            uint8_t c3 = ega_palette[(eight_pixels >> 16) & 0xF];
-            uint8_t c4 = ega_palette[(eight_pixels >> 12) & 0xF];
-            uint8_t c5 = ega_palette[(eight_pixels >> 8) & 0xF];
-            uint8_t c6 = ega_palette[(eight_pixels >> 4) & 0xF];
-            uint8_t c7 = ega_palette[eight_pixels & 0xF];
-
-            // 2 x 32-bit writes = 8 bytes (8 pixels, no doubling)
-            *out32++ = c0 | (c1 << 8) | (c2 << 16) | (c3 << 24);
-            *out32++ = c4 | (c5 << 8) | (c6 << 16) | (c7 << 24);
-        }
-    }
-}
-
-// 80 cols: one uint16 = 2 pixels (left in low byte, right in high byte)
-// 40 cols: need true 2x horizontal scaling per pixel: A B -> A A B B
-static inline void __time_critical_func(out16_2x_per_pixel)(uint16_t **pp, uint16_t v) {
-    uint16_t *p = *pp;
-    uint8_t a = (uint8_t)(v & 0xFF);
-    uint8_t b = (uint8_t)(v >> 8);
-    *p++ = (uint16_t)a | ((uint16_t)a << 8);  // A A
-    *p++ = (uint16_t)b | ((uint16_t)b << 8);  // B B
-    *pp = p;
-}
-
-// Helper function to render a single text line
-static void __time_critical_func(render_text_line)(uint32_t line, uint32_t *output_buffer) {
-    uint16_t *out16 = (uint16_t *)((uint8_t *)output_buffer + SHIFT_PICTURE);
-
-    uint32_t char_row = line >> 4;
-    uint32_t glyph_line = line & 15;
-
-    int cols = text_cols;
-    int double_h = (cols == 40);  // 40 columns => 2x horizontal scaling
-
-    if (char_row < 25) {
-        // Use snapped start address for the frame (prevents mid-frame tearing).
-        const uint32_t *base = (const uint32_t *)(gfx_buffer + ((uint32_t)frame_vram_offset << 2));
-        const uint32_t *text_row = base + (char_row * (uint32_t)text_stride_cells);
-
-        for (int col = 0; col < cols; col++) {
-            uint16_t cell = text_row[col];
-            uint8_t ch   = (uint8_t)(cell & 0xFF);
-            uint8_t attr = (uint8_t)(cell >> 8);
-            /* Use font from VGA plane 2 (supports loaded fonts via SR3).
-             * Stride between rows is 4 bytes (interleaved planes).
-             * Fall back to built-in font8x16 if vga_state is unavailable. */
-            register uint32_t glyph;
-            const uint8_t *fp = vga_get_font_ptr(vga_state, ch, (attr >> 3) & 1);
-            if (fp) {
-                glyph = __rbit(fp[glyph_line * 4]) >> 24;
-            } else {
-                glyph = font_8x16[ch * 16 + glyph_line];
-            }
-            uint16_t *pal = &txt_palette_fast[(attr & 0x7F) * 4];
-
-            if (cursor_blink_state && col == cursor_x &&
-                char_row == (uint32_t)cursor_y &&
-                glyph_line >= (uint32_t)cursor_start &&
-                glyph_line <= (uint32_t)cursor_end) {
-                glyph = 0xFF;
-            }
-
-            // 8px glyph -> 4x uint16 (каждый uint16 = 2 пикселя)
-            uint16_t v;
-            if (!double_h) {
-                v = pal[glyph & 3];           *out16++ = v;
-                v = pal[(glyph >> 2) & 3];    *out16++ = v;
-                v = pal[(glyph >> 4) & 3];    *out16++ = v;
-                v = pal[(glyph >> 6) & 3];    *out16++ = v;
-            } else {
-                // true per-pixel doubling: (A,B) -> (A,A,B,B)
-                v = pal[glyph & 3];           out16_2x_per_pixel(&out16, v);
-                v = pal[(glyph >> 2) & 3];    out16_2x_per_pixel(&out16, v);
-                v = pal[(glyph >> 4) & 3];    out16_2x_per_pixel(&out16, v);
-                v = pal[(glyph >> 6) & 3];    out16_2x_per_pixel(&out16, v);
-            }
-        }
-    }
+// Snapshot of the frame state for the shared scanline renderers
+void __time_critical_func(vga_hw_scanline_frame)(ScanlineFrame *f) {
+    f->vram = gfx_buffer;
+    f->start = frame_vram_offset;
+    f->line_compare = frame_line_compare;
+    f->panning = frame_pixel_panning;
+    f->width = gfx_width;
+    f->height = gfx_height;
+    f->line_offset = gfx_line_offset;
+    f->active_lines = active_end - active_start;
+    f->text_cols = text_cols;
+    f->text_stride = text_stride_cells;
+    f->cursor_on = cursor_blink_state;
+    f->cursor_x = cursor_x;
+    f->cursor_y = cursor_y;
+    f->cursor_start = cursor_start;
+    f->cursor_end = cursor_end;
+    f->vga = vga_state;
 }
 
 void __time_critical_func(pre_render_line)(void) {
@@ -745,28 +343,30 @@ static void __time_critical_func(render_line)(uint32_t line, uint32_t *output_bu
         osd_render_line_vga(line, output_buffer);
         return;
     }
-    if (current_mode == 1) {
-        // Text mode now rendered from linear framebuffer
-        render_text_line(line, output_buffer);
-        return;
-    }
-    if (current_mode == 2) {
-        // Graphics mode - choose renderer based on submode
-        if (gfx_submode == 1) {
+    if (current_mode == 1 || current_mode == 2) {
+        ScanlineFrame f;
+        vga_hw_scanline_frame(&f);
+        uint32_t *out32 = (uint32_t *)((uint8_t *)output_buffer + SHIFT_PICTURE);
+        uint32_t blank = TMPL_LINE | (TMPL_LINE << 8) | (TMPL_LINE << 16) | (TMPL_LINE << 24);
+
+        if (current_mode == 1) {
+            // Text mode now rendered from linear framebuffer
+            scanline_text_vga(&f, line, (uint16_t *)out32, txt_palette_fast);
+        } else if (gfx_submode == 1) {
             // CGA 4-color
-            render_gfx_line_cga(line, output_buffer);
+            scanline_cga4_vga(&f, line, out32, cga_palette, blank);
         } else if (gfx_submode == 2 || gfx_submode == 6) {
             // EGA planar 16-color
-            render_gfx_line_ega(line, output_buffer);
+            scanline_ega_vga(&f, line, out32, ega_palette, blank);
         } else if (gfx_submode == 4) {
             // CGA 2-color (640x200 monochrome)
-            render_gfx_line_cga2(line, output_buffer);
+            scanline_cga2_vga(&f, line, out32, cga_palette[0], cga_palette[3], blank);
         } else if (gfx_submode == 5) {
             // VGA 256-color planar (Mode X)
-            render_gfx_line_vga_planar256(line, output_buffer);
+            scanline_planar256_vga(&f, line, out32, palette_b, palette_a, blank);
         } else {
             // VGA 256-color (mode 13h) - default
-            render_gfx_line_from_sram(line, output_buffer);
+            scanline_chain4_vga(&f, line, out32, palette_b, palette_a, blank);
         }
         return;
     }
@@ -1082,9 +682,7 @@ void vga_hw_reclock(void) {
 }
 
 void vga_hw_init(void) {
-    for(uint32_t i = 0; i < 256; ++i) {
-        spread8_lut[i] = spread8(i);
-    }
+    scanline_init();
     #ifdef FORCE_HDMI
         SELECT_VGA = false;
     #else
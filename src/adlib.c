@@ -28,6 +28,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include "adlib.h"
+#include "mixer.h"
 #include "emu8950/emu8950.h"
 
 /* __dmb() is a CMSIS intrinsic; pico.h should pull it in transitively,
@@ -41,17 +42,24 @@
 #define ADLIB_DESC "Yamaha YM3812 (OPL2)"
 
 /*
- * Double-buffer:
- *   buf[2][ADLIB_BATCH_SIZE] — two batches.
- *   ready[2]  — Core 0 sets ready[i]=1 after filling buf[i],
- *               Core 1 sets ready[i]=0 after consuming buf[i].
- *   play_buf  — which buffer Core 1 is currently reading (0 or 1).
- *   read_pos  — sample index within buf[play_buf].
+ * Register-write queue:
+ *   queue[]   — OPL register writes with their get_uticks() time stamp.
+ *   head      — Core 0: next free slot, advanced after the slot is written.
+ *   tail      — Core 1: next write to apply.
  *
- * Core 0 fills whichever buffer is NOT ready (i.e. already consumed).
- * Core 1 reads from play_buf; when exhausted, switches to the other one
- * if it's ready, otherwise returns silence.
- * Each ready[i] is written by one core at a time — no contention.
+ * The port handler on Core 0 only records writes; Core 1 owns the OPL and
+ * synthesises each mixer block in pieces, applying every queued write at
+ * the sample its time stamp falls on. Single producer, single consumer.
+ *
+ * Backlog, when Core 1 stalls long enough for the queue to fill:
+ *   backlog[] — the last value written to each register since it filled.
+ *   dirty[]   — Core 0 sets after writing backlog[], Core 1 clears.
+ *   seq       — Core 0: backlog writes so far; done — Core 1: seq applied.
+ *
+ * Writes go to the backlog until Core 1 has drained the queue and applied
+ * every backlog write, and only then to the queue again. The backlog loses
+ * the timing and repeats within it, but never a write's final value, so a
+ * key-off is not lost.
  */
 
 struct AdlibState {
@@ -60,14 +68,43 @@ struct AdlibState {
     uint8_t  adlibstatus;
     OPL     *opl;
 
-    int32_t  buf[2][ADLIB_BATCH_SIZE];
-    volatile uint8_t ready[2];  /* 1 = filled by Core 0, not yet consumed */
-    uint8_t  play_buf;          /* Core 1: which buf is being played */
-    uint32_t read_pos;          /* Core 1: next sample index in play_buf */
+    struct {
+        uint32_t t;
+        uint8_t  reg, val;
+    } queue[ADLIB_QUEUE];
+    volatile uint32_t head;
+    volatile uint32_t tail;
+
+    uint8_t  backlog[256];
+    volatile uint8_t dirty[256];
+    volatile uint32_t seq;
+    volatile uint32_t done;
+    int      in_backlog;        /* Core 0 */
 
-    uint32_t underrun_count;
+    int32_t  buf[ADLIB_BATCH_SIZE]; /* Core 1: OPL output before mixing */
 };
 
+static void adlib_queue_write(AdlibState *s, uint8_t reg, uint8_t val)
+{
+    uint32_t head = s->head;
+    if (s->in_backlog && s->done == s->seq)
+        s->in_backlog = 0;
+    if (s->in_backlog || head - s->tail >= ADLIB_QUEUE) {
+        s->in_backlog = 1;
+        s->backlog[reg] = val;
+        __dmb();
+        s->dirty[reg] = 1;
+        __dmb();
+        s->seq++;
+        return;
+    }
+    s->queue[head % ADLIB_QUEUE].t = get_uticks();
+    s->queue[head % ADLIB_QUEUE].reg = reg;
+    s->queue[head % ADLIB_QUEUE].val = val;
+    __dmb();
+    s->head = head + 1;
+}
+
 void adlib_write(void *opaque, uint32_t nport, uint32_t val)
 {
     AdlibState *s = opaque;
@@ -83,7 +120,7 @@ void adlib_write(void *opaque, uint32_t nport, uint32_t val)
                     s->adlibregmem[4] = 0;
                 }
             }
-            OPL_writeReg(s->opl, s->adlib_register, val);
+            adlib_queue_write(s, s->adlib_register, val);
     }
 }
 
@@ -110,8 +147,6 @@ AdlibState *adlib_new()
     AdlibState *s = malloc(sizeof(AdlibState));
     memset(s, 0, sizeof(AdlibState));
     s->freq     = SOUND_FREQUENCY;
-    s->play_buf = 0;
-    s->read_pos = 0;
     s->opl = OPL_new(3579552, s->freq);
     if (!s->opl) {
         return NULL;
@@ -119,48 +154,63 @@ AdlibState *adlib_new()
     return s;
 }
 
-// call it 44100 times per sec from timer on core1 (ISR, so should be fast)
-int16_t __not_in_flash_func(adlib_getsample)(AdlibState *s) {
-    if (!s->opl) return 0;
-
-    if (!s->ready[s->play_buf]) {
-        s->underrun_count++;
-        return 0;
+/* Add n samples of the OPL output at its current register state */
+static void __not_in_flash_func(adlib_synth)(AdlibState *s, int32_t *buf, int n)
+{
+    while (n > 0) {
+        int k = n < ADLIB_BATCH_SIZE ? n : ADLIB_BATCH_SIZE;
+        OPL_calc_buffer_linear(s->opl, s->buf, k);
+        for (int i = 0; i < k; i++)
+            buf[i] += (int16_t)s->buf[i];
+        buf += k;
+        n -= k;
     }
+}
 
-    int16_t sample = (int16_t)s->buf[s->play_buf][s->read_pos++];
-
-    if (s->read_pos >= ADLIB_BATCH_SIZE) {
-        /* Mark this buffer as consumed, switch to the other one. */
-        s->ready[s->play_buf] = 0;
-        s->play_buf ^= 1;
-        s->read_pos = 0;
+/* Core 1, with the queue drained: write the registers changed in the
+ * backlog, in register order, then report up to which write */
+static void __not_in_flash_func(adlib_apply_backlog)(AdlibState *s, uint32_t seq)
+{
+    for (int reg = 0; reg < 256; reg++) {
+        if (!s->dirty[reg])
+            continue;
+        s->dirty[reg] = 0;
+        __dmb();
+        OPL_writeReg(s->opl, reg, s->backlog[reg]);
     }
-
-    return sample;
+    __dmb();
+    s->done = seq;
 }
 
-// call it from main cycle on core0
-void __not_in_flash_func(adlib_core0)(AdlibState *s) {
+// call it from the audio mixer on core1 with one block at a time
+void __not_in_flash_func(adlib_render)(AdlibState *s, int32_t *buf, int n, uint32_t now)
+{
     if (!s->opl) return;
 
-    /* Fill buf[0] first, then buf[1], alternating.
-     * Fill whichever buffer is free (not ready). Prefer the one
-     * Core 1 is about to play (play_buf) if it's empty, otherwise
-     * fill the other one as look-ahead. */
-    for (int i = 0; i < 2; i++) {
-        uint8_t fill_buf = (s->play_buf + i) & 1;
-        if (s->ready[fill_buf]) continue;  /* already full */
-
-        OPL_calc_buffer_linear(s->opl, s->buf[fill_buf], ADLIB_BATCH_SIZE);
+    uint32_t tail = s->tail;
+    int i = 0;
+    for (;;) {
+        /* seq before head: a backlog started after this head was read
+         * must wait for the queue entries in front of it */
+        uint32_t seq = s->seq;
         __dmb();
-        s->ready[fill_buf] = 1;
-        return;  /* fill one buffer per call */
+        if (tail == s->head) {
+            if (seq != s->done)
+                adlib_apply_backlog(s, seq);
+            break;
+        }
+        __dmb();
+        int at = mixer_frame_at(now, s->queue[tail % ADLIB_QUEUE].t, n);
+        if (at < 0)
+            break;
+        if (at > i) {
+            adlib_synth(s, buf + i, at - i);
+            i = at;
+        }
+        OPL_writeReg(s->opl, s->queue[tail % ADLIB_QUEUE].reg,
+                     s->queue[tail % ADLIB_QUEUE].val);
+        tail++;
     }
-}
-
-uint32_t adlib_underruns(AdlibState *s) {
-    uint32_t u = s->underrun_count;
-    s->underrun_count = 0;
-    return u;
+    s->tail = tail;
+    adlib_synth(s, buf + i, n - i);
 }
@@ -6,15 +6,15 @@
 #define FLOAT float
 
 #define ADLIB_BATCH_SIZE 64
+#define ADLIB_QUEUE 512     // register writes between two mixer blocks
 
 typedef struct AdlibState AdlibState;
 
 void adlib_write(void *opaque, uint32_t nport, uint32_t val);
 uint32_t adlib_read(void *opaque, uint32_t nport);
 AdlibState *adlib_new();
-// call it 44100 times per sec from timer on core1 (ISR, so should be fast)
-int16_t adlib_getsample(AdlibState *s);
-// call it from main cycle on core0
-void adlib_core0(AdlibState *s);
+// add n samples ending at get_uticks() time 'now' to buf, applying the
+// register writes queued by adlib_write; called from the audio mixer on core1
+void adlib_render(AdlibState *s, int32_t *buf, int n, uint32_t now);
 
 #endif /* ADLIB_H */
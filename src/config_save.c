@@ -39,6 +39,7 @@ static int cfg_flash_freq = FLASH_MAX_FREQ_MHZ;
 static int cfg_volume = 15;
 static int cfg_voltage = -1;  /* -1 = auto (by cpu_freq) */
 static int cfg_mouse_invert_y = 0;
+static int cfg_midi_voices = 16;
 static bool cfg_hw_changed = false;
 
 extern PC *pc;
@@ -96,6 +97,7 @@ void config_set_pcspeaker(int enabled) {
 int config_get_adlib(void) { return cfg_adlib; }
 void config_set_adlib(int enabled) {
     pc->adlib_enabled = enabled;
+    pc_update_io_map(pc);
     if (cfg_adlib != enabled) {
         cfg_adlib = enabled;
         cfg_changed = true;
@@ -105,6 +107,7 @@ void config_set_adlib(int enabled) {
 int config_get_soundblaster(void) { return cfg_soundblaster; }
 void config_set_soundblaster(int enabled) {
     pc->sb16_enabled = enabled;
+    pc_update_io_map(pc);
     if (cfg_soundblaster != enabled) {
         cfg_soundblaster = enabled;
         cfg_changed = true;
@@ -114,6 +117,7 @@ void config_set_soundblaster(int enabled) {
 int config_get_tandy(void) { return cfg_tandy; }
 void config_set_tandy(int enabled) {
     pc->tandy_enabled = enabled;
+    pc_update_io_map(pc);
     if (cfg_tandy != enabled) {
         cfg_tandy = enabled;
         cfg_changed = true;
@@ -123,6 +127,7 @@ void config_set_tandy(int enabled) {
 int config_get_covox(void) { return cfg_covox; }
 void config_set_covox(int enabled) {
     pc->covox_enabled = enabled;
+    pc_update_io_map(pc);
     if (cfg_covox != enabled) {
         cfg_covox = enabled;
         cfg_changed = true;
@@ -132,6 +137,7 @@ void config_set_covox(int enabled) {
 int config_get_mpu401(void) { return cfg_mpu401; }
 void config_set_mpu401(int enabled) {
     pc->mpu401_enabled = enabled;
+    pc_update_io_map(pc);
     if (cfg_mpu401 != enabled) {
         cfg_mpu401 = enabled;
         cfg_changed = true;
@@ -141,6 +147,7 @@ void config_set_mpu401(int enabled) {
 int config_get_dss(void) { return cfg_dss; }
 void config_set_dss(int enabled) {
     pc->dss_enabled = enabled;
+    pc_update_io_map(pc);
     if (cfg_dss != enabled) {
         cfg_dss = enabled;
         cfg_changed = true;
@@ -214,6 +221,15 @@ void config_set_mouse_invert_y(int enabled) {
     }
 }
 
+int config_get_midi_voices(void) { return cfg_midi_voices; }
+void config_set_midi_voices(int voices) {
+    midi_set_polyphony(voices);
+    if (cfg_midi_voices != voices) {
+        cfg_midi_voices = voices;
+        cfg_changed = true;
+    }
+}
+
 bool config_hw_changed(void) { return cfg_hw_changed; }
 bool config_has_changes(void) { return cfg_changed; }
 void config_clear_changes(void) { cfg_changed = false; cfg_hw_changed = false; }
@@ -315,6 +331,8 @@ bool config_save_all(void) {
     write_line(&fp, line);
     snprintf(line, sizeof(line), "mouse_invert_y=%d\n", cfg_mouse_invert_y);
     write_line(&fp, line);
+    snprintf(line, sizeof(line), "midi_voices=%d\n", cfg_midi_voices);
+    write_line(&fp, line);
 
     f_close(&fp);
     cfg_changed = false;
@@ -365,6 +383,8 @@ int parse_frank_386_ini(void* user, const char* section,
         cfg_voltage = atoi(value);
     } else if (strcmp(name, "mouse_invert_y") == 0) {
         cfg_mouse_invert_y = atoi(value);
+    } else if (strcmp(name, "midi_voices") == 0) {
+        cfg_midi_voices = atoi(value);
     }
 
     return 1;  // Success
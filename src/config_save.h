@@ -74,6 +74,8 @@ int config_get_voltage(void);
 void config_set_voltage(int v);
 int config_get_mouse_invert_y(void);
 void config_set_mouse_invert_y(int enabled);
+int config_get_midi_voices(void);
+void config_set_midi_voices(int voices);
 
 // Check if hardware settings changed (requires reboot)
 bool config_hw_changed(void);
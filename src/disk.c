@@ -80,6 +80,9 @@ void disk_set_fdc_mediachange_callback(void (*cb)(int drive)) { disk_fdc_mediach
 static void (*disk_cdrom_change_cb)(int drive, const char *filename) = NULL;
 void disk_set_cdrom_change_callback(void (*cb)(int drive, const char *filename)) { disk_cdrom_change_cb = cb; }
 
+static void (*disk_hdd_eject_cb)(int drive) = NULL;
+void disk_set_hdd_eject_callback(void (*cb)(int drive)) { disk_hdd_eject_cb = cb; }
+
 /* Установить FDPT (Fixed Disk Parameter Table) и INT 41h/46h векторы.
  * Вызывается при каждом INT 13h для HDD — перезаписывает то что мог
  * поставить SeaBIOS во время boot.
@@ -165,6 +168,8 @@ void ejectdisk(uint8_t drivenum, bool is_fdd) {
     }
     if (drivenum < 4 && ata[drivenum].name) {
         /* HDD eject (e.g. from GUI for HDD drives) */
+        if (disk_hdd_eject_cb)
+            disk_hdd_eject_cb(drivenum);
         f_close(&ata[drivenum].fil);
         free(ata[drivenum].name);
         ata[drivenum].name = 0;
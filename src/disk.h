@@ -24,6 +24,9 @@ void disk_set_fdc_mediachange_callback(void (*cb)(int drive));
 /* Callback: called when a CD-ROM (drive 4) is inserted or ejected.
    Used by the IDE emulator to signal UNIT_ATTENTION. */
 void disk_set_cdrom_change_callback(void (*cb)(int drive, const char *filename, int was_present));
+/* Callback: called before an HDD image (ata[] index) is closed.
+   Used by the IDE emulator to write back its cache. */
+void disk_set_hdd_eject_callback(void (*cb)(int drive));
 
 struct VGAState;
 void disk_set_vga(struct VGAState *vga);
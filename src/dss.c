@@ -5,6 +5,7 @@
 #define INLINE inline
 
 #define FIFO_BUFFER_SIZE 16
+#define DSS_RATE 7000
 
 static uint8_t fifo_buffer[FIFO_BUFFER_SIZE] = { 0 };
 static uint8_t fifo_head = 0;  // Write position
@@ -12,15 +13,24 @@ static uint8_t fifo_tail = 0;  // Read position
 static uint8_t fifo_count = 0; // Number of elements
 static uint8_t dss_data;
 
-int16_t __not_in_flash_func(dss_sample)() {
-    static uint8_t held = 0;
-    if (fifo_count == 0) {
-        return held;
+// The FIFO drains at 7 kHz; step through it on the output sample clock
+void __not_in_flash_func(dss_render)(int32_t *buf, int n) {
+    static uint32_t phase = 0;
+    static int16_t level = 0;
+    for (int i = 0; i < n; i++) {
+        phase += DSS_RATE;
+        if (phase >= SOUND_FREQUENCY) {
+            phase -= SOUND_FREQUENCY;
+            if (fifo_count == 0) {
+                level = 0;
+            } else {
+                level = ((int16_t)fifo_buffer[fifo_tail] - 128) << 8;
+                fifo_tail = (fifo_tail + 1) & (FIFO_BUFFER_SIZE - 1);
+                --fifo_count;
+            }
+        }
+        buf[i] += level;
     }
-    held = fifo_buffer[fifo_tail];
-    fifo_tail = (fifo_tail + 1) & (FIFO_BUFFER_SIZE - 1);
-    --fifo_count;
-    return ((int16_t)held - 128) << 8;
 }
 
 static INLINE void fifo_push_byte(uint8_t value) {
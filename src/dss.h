@@ -2,5 +2,5 @@
 
 void dss_out(const uint16_t portnum, const uint8_t value);
 uint8_t dss_in(const uint16_t portnum);
-// 7 kHz fn
-int16_t dss_sample();
\ No newline at end of file
+// add n output-rate samples of the 7 kHz FIFO to buf
+void dss_render(int32_t *buf, int n);
\ No newline at end of file
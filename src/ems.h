@@ -2,9 +2,9 @@
 /*
  * EMS (Lo-tech 2MB EMS board) shared access helpers.
  *
- * ems.c.inl is #included directly into i386.c so its symbols are local to
- * that translation unit.  This header re-exposes the same constants and a
- * small set of inline helpers for use in other TUs (disk handler, i8257 DMA).
+ * The CPU reaches the page frame through the MMIO region pc.c maps over
+ * it.  This header holds the constants and a small set of inline helpers
+ * for that and for the other TUs (disk handler, i8257 DMA).
  *
  * Include this header wherever you need to read/write guest memory that may
  * fall in the EMS window and you cannot go through the normal pload/pstore
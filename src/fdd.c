@@ -1001,6 +1001,11 @@ void __not_in_flash_func(fdc_tick)(FDCState *s)
     }
 }
 
+int fdc_irq_pending(FDCState *s)
+{
+    return s->irq_pending;
+}
+
 /* ------------------------------------------------------------------ */
 /*  Constructor / destructor                                            */
 /* ------------------------------------------------------------------ */
@@ -46,5 +46,6 @@ void fdc_media_changed(FDCState *s, int drive);
 
 /* Periodic service – call from pc_step() once per emulated ms */
 void fdc_tick(FDCState *s);
+int  fdc_irq_pending(FDCState *s);
 
 #endif /* FDC_H */
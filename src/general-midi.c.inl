@@ -1,6 +1,7 @@
 #pragma GCC optimize("Ofast")
 #pragma once
 #include "general-midi.h"
+#include "mixer.h"
 
 // #define DEBUG_MIDI
 
@@ -12,6 +13,8 @@
 
 #define MAX_MIDI_VOICES 32
 #define MIDI_CHANNELS 16
+#define MIDI_DEFAULT_POLYPHONY 16
+#define DRUM_LENGTH 4096 // samples; every drum envelope has reached zero by then
 
 typedef struct midi_voice_s {
     uint8_t channel;
@@ -21,9 +24,13 @@ typedef struct midi_voice_s {
     uint8_t decay_shift;
     uint8_t sustain_level;
     uint8_t attack_target;   // >0 = attack phase, target velocity
+    uint8_t released;        // note-off seen, decaying to silence
 
     int32_t frequency_m100;
     uint16_t sample_position;
+    uint32_t phase;          // sine phase, full turn = 2^32
+    uint32_t phase_step;
+    uint32_t started;        // note-on serial, for stealing the oldest voice
 } midi_voice_t;
 
 typedef struct midi_channel_s {
@@ -51,6 +58,9 @@ static midi_channel_t midi_channels[MIDI_CHANNELS] = {
 static uint32_t active_voice_bitmask = 0;
 // Bitmask for sustained channels
 static uint32_t channels_sustain_bitmask = 0;
+// Voices allowed to sound at once; further notes steal one
+static int midi_polyphony = MIDI_DEFAULT_POLYPHONY;
+static uint32_t midi_note_serial = 0;
 
 // Best seeds for different percussion characteristics
 static uint32_t noise_seed = 0x7EC80000; // Best overall for drums
@@ -83,13 +93,22 @@ static INLINE int32_t calc_pitch_bend(const int bend) {
 
 #define SIN_STEP (SOUND_FREQUENCY * 100 / 4096)
 
-static INLINE int32_t sine_lookup(const uint32_t angle) {
-    const uint16_t index = (angle / SIN_STEP) & 4095; // TODO: Should it be & 4095 or % 4096???
+// index: 0..4095 for one period, from the quarter-wave table
+static INLINE int32_t sine_at(const uint32_t index) {
     return index < 2048
                ? sin_m128[index < 1024 ? index : 2047 - index]
                : -sin_m128[index < 3072 ? index - 2048 : 4095 - index];
 }
 
+static INLINE int32_t sine_lookup(const uint32_t angle) {
+    return sine_at((angle / SIN_STEP) & 4095);
+}
+
+// Per-sample phase increment for a frequency in Hz x 100
+static INLINE uint32_t midi_phase_step(const int32_t frequency_m100) {
+    return (uint32_t) (((uint64_t) frequency_m100 << 32) / (SOUND_FREQUENCY * 100));
+}
+
 static INLINE int16_t generate_noise() {
     // Linear feedback shift register for white noise
     noise_seed = (noise_seed >> 1) ^ (-(noise_seed & 1) & 0xD0000001);
@@ -268,11 +287,13 @@ static INLINE int16_t generate_drum_sample(const midi_voice_t *voice, const uint
     return sample >> 2; // Scale down to prevent clipping
 }
 
-// Modified midi_sample function
-int16_t __not_in_flash_func(midi_sample)(void) {
-    if (__builtin_expect(!active_voice_bitmask, 0)) return 0;
+// Render a block voice by voice: each voice's state stays in registers for
+// the whole block instead of being reloaded for every output sample
+void __not_in_flash_func(midi_render)(int32_t *buf, const int n) {
+    if (__builtin_expect(!active_voice_bitmask, 0)) return;
 
-    int32_t sample = 0;
+    int32_t mix[MIXER_BLOCK];
+    memset(mix, 0, n * sizeof(int32_t));
     uint32_t active_voices = active_voice_bitmask;
 
     do {
@@ -281,15 +302,25 @@ int16_t __not_in_flash_func(midi_sample)(void) {
         active_voices ^= voice_bit;
 
         midi_voice_t *__restrict voice = &midi_voices[voice_index];
-        const uint16_t sample_position = voice->sample_position++;
 
         // Check if this is a drum channel (channel 9)
         if (voice->channel == 9) {
-            sample += generate_drum_sample(voice, sample_position);
-        } else {
-            // Melodic synthesis with exponential envelope
+            for (int i = 0; i < n; i++)
+                mix[i] += generate_drum_sample(voice, voice->sample_position++);
+            if (voice->sample_position >= DRUM_LENGTH)
+                active_voice_bitmask &= ~voice_bit;
+            continue;
+        }
+
+        // Melodic synthesis with exponential envelope. The envelope steps
+        // every 256 samples (~172 Hz), so the block is cut at those points
+        // and each run in between is a plain sine accumulate.
+        uint32_t sample_position = voice->sample_position;
+        uint32_t phase = voice->phase;
+        const uint32_t phase_step = voice->phase_step;
+        int i = 0;
 
-            // Envelope update every 256 samples (~172 Hz update rate)
+        while (i < n) {
             if (__builtin_expect((sample_position & 255) == 0 && sample_position > 0, 0)) {
                 if (voice->attack_target) {
                     // Attack phase: rise toward target
@@ -307,18 +338,68 @@ int16_t __not_in_flash_func(midi_sample)(void) {
                         voice->velocity -= ((voice->velocity - target) >> voice->decay_shift) | 1;
                         if (voice->velocity <= 1 && target == 0) {
                             active_voice_bitmask &= ~voice_bit;
-                            continue;
+                            break;
                         }
                     }
                 }
             }
 
-            const int32_t sine_val = sine_lookup(__fast_mul(voice->frequency_m100, sample_position));
-            sample += __fast_mul(voice->velocity, sine_val);
+            int run = 256 - (sample_position & 255);
+            if (run > n - i) run = n - i;
+            const int32_t velocity = voice->velocity;
+            for (const int end = i + run; i < end; i++) {
+                mix[i] += __fast_mul(velocity, sine_at(phase >> 20));
+                phase += phase_step;
+            }
+            sample_position = (uint16_t) (sample_position + run);
         }
+        voice->sample_position = sample_position;
+        voice->phase = phase;
     } while (active_voices);
 
-    return sample >> 2;
+    for (int i = 0; i < n; i++)
+        buf[i] += (int16_t)(mix[i] >> 2);
+}
+
+void midi_set_polyphony(int voices) {
+    if (voices < 1) voices = 1;
+    if (voices > MAX_MIDI_VOICES) voices = MAX_MIDI_VOICES;
+    midi_polyphony = voices;
+}
+
+// How loud a voice is, or is about to be: a voice in its attack counts at
+// the level it is rising to. Drums never lower their velocity, so their
+// level is taken from their age; every drum envelope is down to zero by
+// DRUM_LENGTH.
+static INLINE uint32_t voice_level(const midi_voice_t *voice) {
+    if (voice->channel == 9) {
+        const uint32_t age = voice->sample_position < DRUM_LENGTH ? voice->sample_position : DRUM_LENGTH;
+        return voice->velocity * (DRUM_LENGTH - age) / DRUM_LENGTH;
+    }
+    return voice->attack_target ? voice->attack_target : voice->velocity;
+}
+
+// Pick the voice to give up for a new note: released voices go first, then
+// the quietest, and the oldest among equally quiet ones.
+static INLINE uint32_t steal_voice(void) {
+    uint32_t voices = active_voice_bitmask;
+    uint32_t victim = __builtin_ctz(voices);
+    uint32_t victim_score = UINT32_MAX;
+
+    while (voices) {
+        const uint32_t vs = __builtin_ctz(voices);
+        voices &= ~(1U << vs);
+
+        const midi_voice_t *voice = &midi_voices[vs];
+        const uint32_t score = (voice->released ? 0 : 256) + voice_level(voice);
+        if (score < victim_score ||
+            (score == victim_score && (int32_t) (voice->started - midi_voices[victim].started) < 0)) {
+            victim = vs;
+            victim_score = score;
+        }
+    }
+    CLEAR_ACTIVE_VOICE(victim);
+    return victim;
 }
 
 // Optimized pitch bend calculation with lookup table or approximation
@@ -347,45 +428,49 @@ static INLINE void parse_midi(const midi_command_t *message) {
                     }
                 }
 
-                // Find free voice slot using bit operations
-                const uint32_t free_voices = ~active_voice_bitmask;
-                if (__builtin_expect(free_voices != 0, 1)) {
-                    const uint32_t voice_slot = __builtin_ctz(free_voices);
-                    if (voice_slot < MAX_MIDI_VOICES) {
-                        midi_voice_t *__restrict voice = &midi_voices[voice_slot];
-
-                        // Initialize voice data
-                        voice->sample_position = 0;
-                        voice->channel = channel;
-                        voice->note = message->note;
-                        voice->velocity_base = message->velocity;
-
-                        // Apply pitch bend and volume in one go
-                        voice->frequency_m100 = apply_pitch(
-                            note_frequencies_m_100[message->note],
-                            midi_channels[channel].pitch
-                        );
-
-                        const uint8_t ch_volume = midi_channels[channel].volume;
-                        voice->velocity = (ch_volume * message->velocity) >> 7;
-
-                        // Set envelope from GM program table
-                        const gm_envelope_t *env = &gm_envelopes[midi_channels[channel].program];
-                        voice->sustain_level = env->sustain_level;
-                        if (env->attack_shift) {
-                            // Slow attack: start from zero, rise to target
-                            voice->attack_target = voice->velocity;
-                            voice->velocity = 0;
-                            voice->decay_shift = env->attack_shift;
-                        } else {
-                            // Instant attack
-                            voice->attack_target = 0;
-                            voice->decay_shift = env->decay_shift;
-                        }
+                // Find a free voice slot, or steal one once the polyphony
+                // budget is used up
+                const uint32_t voice_slot = __builtin_popcount(active_voice_bitmask) >= midi_polyphony
+                                            ? steal_voice()
+                                            : __builtin_ctz(~active_voice_bitmask);
+                {
+                    midi_voice_t *__restrict voice = &midi_voices[voice_slot];
 
-                        SET_ACTIVE_VOICE(voice_slot);
-                        break;
+                    // Initialize voice data
+                    voice->sample_position = 0;
+                    voice->phase = 0;
+                    voice->started = midi_note_serial++;
+                    voice->channel = channel;
+                    voice->note = message->note;
+                    voice->velocity_base = message->velocity;
+                    voice->released = 0;
+
+                    // Apply pitch bend and volume in one go
+                    voice->frequency_m100 = apply_pitch(
+                        note_frequencies_m_100[message->note],
+                        midi_channels[channel].pitch
+                    );
+                    voice->phase_step = midi_phase_step(voice->frequency_m100);
+
+                    const uint8_t ch_volume = midi_channels[channel].volume;
+                    voice->velocity = (ch_volume * message->velocity) >> 7;
+
+                    // Set envelope from GM program table
+                    const gm_envelope_t *env = &gm_envelopes[midi_channels[channel].program];
+                    voice->sustain_level = env->sustain_level;
+                    if (env->attack_shift) {
+                        // Slow attack: start from zero, rise to target
+                        voice->attack_target = voice->velocity;
+                        voice->velocity = 0;
+                        voice->decay_shift = env->attack_shift;
+                    } else {
+                        // Instant attack
+                        voice->attack_target = 0;
+                        voice->decay_shift = env->decay_shift;
                     }
+
+                    SET_ACTIVE_VOICE(voice_slot);
+                    break;
                 }
             } // else do note off
         case 0x8: // Note OFF
@@ -408,6 +493,7 @@ static INLINE void parse_midi(const midi_command_t *message) {
                             voice->attack_target = 0;
                             voice->sustain_level = 0;
                             voice->decay_shift = 2;
+                            voice->released = 1;
                         }
                         break;
                     }
@@ -449,6 +535,7 @@ static INLINE void parse_midi(const midi_command_t *message) {
                                     midi_voices[voice_slot].attack_target = 0;
                                     midi_voices[voice_slot].sustain_level = 0;
                                     midi_voices[voice_slot].decay_shift = 2;
+                                    midi_voices[voice_slot].released = 1;
                                 }
                             }
                     }
@@ -496,6 +583,7 @@ static INLINE void parse_midi(const midi_command_t *message) {
                 if (midi_voices[voice_slot].channel == channel) {
                     midi_voices[voice_slot].frequency_m100 = apply_pitch(
                         note_frequencies_m_100[midi_voices[voice_slot].note], cents);
+                    midi_voices[voice_slot].phase_step = midi_phase_step(midi_voices[voice_slot].frequency_m100);
                 }
             break;
         }
@@ -0,0 +1,290 @@
+/**
+ * frank-386 - i386 PC Emulator for RP2350
+ *
+ * Host check of the CPU's REP string kernels. Random REP MOVS, STOS, LODS,
+ * SCAS and CMPS instructions run on two CPUs with identical memory: one
+ * executes the REP instruction, where whole page chunks go through the
+ * phys_mem kernels; the other executes the same instruction without the
+ * prefix once per element, with the count and the REPE/REPNE termination
+ * done here, which is the architectural definition of REP. Registers,
+ * flags and memory must match after every instruction.
+ *
+ * The cases cover byte, word and dword elements, 16- and 32-bit
+ * addressing (including the 64K offset wrap), both directions, overlapping
+ * MOVS and segment overrides. Linear memory is paged onto shuffled
+ * physical pages, some of which are ROM or unmapped, so chunks end at page
+ * boundaries and mix with the element-wise paths.
+ *
+ * Copyright (c) 2026 Mikhail Matveev <xtreme@rh1.tech>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "i386.h"
+
+#define MEM_SIZE (4 * 1024 * 1024)
+#define CODE_ADDR 0x100
+#define PDIR_ADDR 0x1000
+#define PTAB_ADDR 0x2000
+/// Linear and physical range the string operations work in
+#define DATA_BASE 0x100000
+#define DATA_END 0x3ff000
+
+#define FLAGS_MASK 0x8d5    ///< OF SF ZF AF PF CF
+#define DF 0x400
+
+enum { OP_MOVS, OP_STOS, OP_LODS, OP_SCAS, OP_CMPS, N_OPS };
+static const char *const op_names[N_OPS] = { "movs", "stos", "lods", "scas", "cmps" };
+static const uint8_t op_byte[N_OPS] = { 0xa4, 0xaa, 0xac, 0xae, 0xa6 };
+
+typedef struct {
+    int op;
+    int size;           ///< element size in bytes
+    int adsz16;
+    int rep;            ///< 0xf3 or 0xf2
+    int seg;            ///< source segment override prefix, 0 if none
+    int down;           ///< DF set
+    uint32_t flags;     ///< arithmetic flags before the instruction
+    uint32_t eax, ecx, esi, edi;
+    uint32_t ds_base, es_base, fs_base;
+} Case;
+
+static char *mem[2];
+static CPUI386 *cpu[2];
+static uint32_t rng = 0x2545f491;
+/// Byte the data range is mostly filled with, and the one sprinkled in
+static uint8_t fill_run, fill_mark;
+
+static uint32_t rnd(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+//=============================================================================
+// CPU Setup
+//=============================================================================
+
+/* Flat 32-bit protected mode with paging: the first megabyte is identity
+ * mapped, the data range onto a shuffled set of its own pages */
+static void setup_memory(char *m, const uint32_t *frame) {
+    uint32_t *pdir = (uint32_t *)(m + PDIR_ADDR);
+    uint32_t *ptab = (uint32_t *)(m + PTAB_ADDR);
+    memset(m, 0, MEM_SIZE);
+    pdir[0] = PTAB_ADDR | 7;
+    for (uint32_t pg = 0; pg < 1024; pg++)
+        ptab[pg] = ((pg << 12) >= DATA_BASE && (pg << 12) < DATA_END ?
+                    frame[pg] << 12 : pg << 12) | 7;
+}
+
+static CPUI386 *setup_cpu(char *m) {
+    CPUI386 *c = cpui386_new(4, m, MEM_SIZE, NULL);
+    cpui386_reset_pm(c, CODE_ADDR);
+    /* one page of each kind that is not plain RAM */
+    cpui386_set_mem_type(c, 0x200000, 4096, PMEM_ROM);
+    cpui386_set_mem_type(c, 0x281000, 4096, PMEM_UNMAPPED);
+    c->cr3 = PDIR_ADDR;
+    c->cr0 |= 0x80000000;
+    return c;
+}
+
+static void load_case(CPUI386 *c, const Case *t) {
+    cpui386_set_gpr(c, 0, t->eax);
+    cpui386_set_gpr(c, 1, t->ecx);
+    cpui386_set_gpr(c, 6, t->esi);
+    cpui386_set_gpr(c, 7, t->edi);
+    c->seg[3].base = t->ds_base;    /* DS */
+    c->seg[0].base = t->es_base;    /* ES */
+    c->seg[4].base = t->fs_base;    /* FS */
+    c->seg[4].sel = c->seg[3].sel;
+    c->seg[4].limit = c->seg[3].limit;
+    cpu_setflags(c, t->flags | (t->down ? DF : 0),
+                 (FLAGS_MASK & ~t->flags) | (t->down ? 0 : DF));
+}
+
+/* Run the instruction at CODE_ADDR once */
+static void exec(CPUI386 *c, const uint8_t *code, int len) {
+    memcpy(cpu_get_phys_mem(c) + CODE_ADDR, code, len);
+    cpu_invalidate_code(c, CODE_ADDR, len);
+    c->ip = c->next_ip = CODE_ADDR;
+    cpui386_step(c, 1);
+}
+
+//=============================================================================
+// Random Cases
+//=============================================================================
+
+/* An offset that often sits just before or after a page or 64K boundary */
+static uint32_t rnd_offset(uint32_t span) {
+    uint32_t off = rnd() % span;
+    switch (rnd() % 4) {
+    case 0: return (off & ~0xfffu) + 4096 - 1 - rnd() % 8;
+    case 1: return (off & ~0xfffu) + rnd() % 8;
+    default: return off;
+    }
+}
+
+static void make_case(Case *t) {
+    t->op = rnd() % N_OPS;
+    t->size = 1 << (rnd() % 3);
+    t->adsz16 = rnd() % 2;
+    t->rep = rnd() % 2 ? 0xf3 : 0xf2;
+    t->seg = rnd() % 4 == 0 ? (rnd() % 2 ? 0x26 : 0x64) : 0;
+    t->down = rnd() % 3 == 0;
+    t->flags = rnd() & FLAGS_MASK;
+    /* an accumulator that matches the filled data or the marks */
+    switch (rnd() % 3) {
+    case 0: t->eax = fill_run * 0x01010101u; break;
+    case 1: t->eax = fill_mark * 0x01010101u; break;
+    default: t->eax = rnd(); break;
+    }
+
+    uint32_t count = rnd() % 4 == 0 ? rnd() % 8 : rnd() % 3000;
+    uint32_t span = count * t->size + 32;
+    if (t->adsz16) {
+        /* offsets anywhere in 64K, so runs may wrap; segment bases are not
+         * page aligned and keep the whole segment inside the data range */
+        t->ds_base = DATA_BASE + rnd() % (DATA_END - DATA_BASE - 0x10000);
+        t->es_base = rnd() % 4 == 0 ? t->ds_base :
+                     DATA_BASE + rnd() % (DATA_END - DATA_BASE - 0x10000);
+        t->fs_base = DATA_BASE + rnd() % (DATA_END - DATA_BASE - 0x10000);
+        t->ecx = (rnd() & 0xffff0000) | count;
+        t->esi = (rnd() & 0xffff0000) | (rnd() % 4 == 0 ? 0xffff - rnd() % 16 :
+                                        rnd_offset(0x10000));
+        t->edi = (rnd() & 0xffff0000) | rnd_offset(0x10000);
+    } else {
+        t->ds_base = t->es_base = t->fs_base = 0;
+        uint32_t lo = DATA_BASE + span, hi = DATA_END - span;
+        t->ecx = count;
+        t->esi = lo + rnd_offset(hi - lo);
+        /* close to the source so that MOVS overlaps in both directions */
+        t->edi = rnd() % 3 == 0 ? t->esi + (int32_t)(rnd() % 33) - 16 :
+                 lo + rnd_offset(hi - lo);
+    }
+}
+
+/* Fill the physical data range so that REPE and REPNE scans end at
+ * varying points: long runs of one byte with sparse marks */
+static void fill_data(void) {
+    uint32_t rate = 16 + rnd() % 4000;
+    fill_run = rnd();
+    fill_mark = rnd();
+    for (uint32_t a = DATA_BASE; a < DATA_END; a++) {
+        uint8_t v = fill_run;
+        if (rnd() % rate == 0)
+            v = rnd() % 2 ? fill_mark : rnd();
+        mem[0][a] = mem[1][a] = v;
+    }
+    cpu_invalidate_code(cpu[0], DATA_BASE, DATA_END - DATA_BASE);
+    cpu_invalidate_code(cpu[1], DATA_BASE, DATA_END - DATA_BASE);
+}
+
+//=============================================================================
+// Check
+//=============================================================================
+
+static int encode(const Case *t, int rep, uint8_t *code) {
+    int n = 0;
+    if (t->adsz16)
+        code[n++] = 0x67;
+    if (t->size == 2)
+        code[n++] = 0x66;
+    if (t->seg)
+        code[n++] = t->seg;
+    if (rep)
+        code[n++] = t->rep;
+    code[n++] = op_byte[t->op] | (t->size > 1);
+    return n;
+}
+
+/* REP by definition: one element per step until the count runs out or
+ * a comparison ends a REPE/REPNE scan */
+static void run_reference(CPUI386 *c, const Case *t) {
+    uint8_t code[8];
+    int len = encode(t, 0, code);
+    uint32_t mask = t->adsz16 ? 0xffff : 0xffffffff;
+    for (;;) {
+        uint32_t ecx = c->gprx[1].r32;
+        if (!(ecx & mask))
+            break;
+        exec(c, code, len);
+        cpui386_set_gpr(c, 1, (ecx & ~mask) | ((ecx - 1) & mask));
+        if (t->op == OP_SCAS || t->op == OP_CMPS) {
+            int zf = (cpu_getflags(c) >> 6) & 1;
+            if (zf != (t->rep == 0xf3))
+                break;
+        }
+    }
+}
+
+static int check_case(int n, const Case *t) {
+    uint8_t code[8];
+    int len = encode(t, 1, code);
+
+    load_case(cpu[0], t);
+    load_case(cpu[1], t);
+    exec(cpu[0], code, len);
+    run_reference(cpu[1], t);
+
+    int bad = -1;
+    for (int r = 0; r < 8; r++)
+        if (cpu[0]->gprx[r].r32 != cpu[1]->gprx[r].r32)
+            bad = r;
+    uint32_t f0 = cpu_getflags(cpu[0]) & (FLAGS_MASK | DF);
+    uint32_t f1 = cpu_getflags(cpu[1]) & (FLAGS_MASK | DF);
+    int mem_bad = memcmp(mem[0] + DATA_BASE, mem[1] + DATA_BASE, DATA_END - DATA_BASE);
+    if (bad < 0 && f0 == f1 && !mem_bad)
+        return 0;
+
+    printf("case %d: rep%s %s%d a%d%s%s ecx=%08x esi=%08x edi=%08x eax=%08x"
+           " ds=%06x es=%06x\n", n, t->rep == 0xf3 ? "e" : "ne", op_names[t->op],
+           t->size * 8, t->adsz16 ? 16 : 32, t->down ? " std" : "",
+           t->seg == 0x26 ? " es:" : t->seg == 0x64 ? " fs:" : "",
+           t->ecx, t->esi, t->edi, t->eax, t->ds_base, t->es_base);
+    if (bad >= 0)
+        printf("  reg %d: %08x, reference %08x\n", bad,
+               cpu[0]->gprx[bad].r32, cpu[1]->gprx[bad].r32);
+    if (f0 != f1)
+        printf("  flags %03x, reference %03x\n", f0, f1);
+    if (mem_bad)
+        printf("  memory differs\n");
+    return 1;
+}
+
+//=============================================================================
+// Main
+//=============================================================================
+
+int main(int argc, char **argv) {
+    int cases = argc > 1 ? atoi(argv[1]) : 3000;
+    static uint32_t frame[1024];
+
+    for (uint32_t pg = 0; pg < 1024; pg++)
+        frame[pg] = pg;
+    for (uint32_t pg = (DATA_END >> 12) - 1; pg > (DATA_BASE >> 12); pg--) {
+        uint32_t k = (DATA_BASE >> 12) + rnd() % (pg - (DATA_BASE >> 12) + 1);
+        uint32_t f = frame[pg];
+        frame[pg] = frame[k];
+        frame[k] = f;
+    }
+    for (int i = 0; i < 2; i++) {
+        mem[i] = malloc(MEM_SIZE);
+        setup_memory(mem[i], frame);
+        cpu[i] = setup_cpu(mem[i]);
+    }
+
+    int failed = 0, n;
+    for (n = 0; n < cases && failed < 10; n++) {
+        Case t;
+        if (n % 16 == 0)
+            fill_data();
+        make_case(&t);
+        failed += check_case(n, &t);
+    }
+    printf("%d cases, %d failed\n", n, failed);
+    return failed != 0;
+}
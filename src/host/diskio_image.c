@@ -0,0 +1,100 @@
+/**
+ * frank-386 - i386 PC Emulator for RP2350
+ *
+ * Host FatFS low-level disk I/O: drive 0 is backed by an SD card image
+ * file (raw FAT volume or MBR-partitioned card dump) instead of SPI.
+ *
+ * Copyright (c) 2026 Mikhail Matveev <xtreme@rh1.tech>
+ * SPDX-License-Identifier: MIT
+ */
+
+#define _FILE_OFFSET_BITS 64
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ff.h"
+#include "diskio.h"
+#include "diskio_image.h"
+
+#define SECTOR_SIZE 512
+
+static int image_fd = -1;
+static const char *image_path = NULL;
+static DSTATUS image_stat = STA_NOINIT;
+
+void diskio_image_set_path(const char *path) {
+    image_path = path;
+}
+
+DSTATUS disk_initialize(BYTE pdrv) {
+    if (pdrv) return STA_NOINIT;
+    if (image_fd >= 0) return image_stat;
+    if (!image_path) return STA_NOINIT | STA_NODISK;
+
+    image_stat = 0;
+    image_fd = open(image_path, O_RDWR);
+    if (image_fd < 0) {
+        image_fd = open(image_path, O_RDONLY);
+        image_stat = STA_PROTECT;
+    }
+    if (image_fd < 0) {
+        fprintf(stderr, "diskio: cannot open image %s\n", image_path);
+        image_stat = STA_NOINIT | STA_NODISK;
+    }
+    return image_stat;
+}
+
+DSTATUS disk_status(BYTE pdrv) {
+    if (pdrv) return STA_NOINIT;
+    return image_stat;
+}
+
+DRESULT disk_read(BYTE pdrv, BYTE *buff, LBA_t sector, UINT count) {
+    if (pdrv || !count) return RES_PARERR;
+    if (image_stat & STA_NOINIT) return RES_NOTRDY;
+
+    size_t len = (size_t)count * SECTOR_SIZE;
+    ssize_t r = pread(image_fd, buff, len, (off_t)sector * SECTOR_SIZE);
+    if (r < 0) return RES_ERROR;
+    /* Reads past the end of a truncated image return zeros */
+    for (size_t i = (size_t)r; i < len; i++)
+        buff[i] = 0;
+    return RES_OK;
+}
+
+DRESULT disk_write(BYTE pdrv, const BYTE *buff, LBA_t sector, UINT count) {
+    if (pdrv || !count) return RES_PARERR;
+    if (image_stat & STA_NOINIT) return RES_NOTRDY;
+    if (image_stat & STA_PROTECT) return RES_WRPRT;
+
+    size_t len = (size_t)count * SECTOR_SIZE;
+    ssize_t r = pwrite(image_fd, buff, len, (off_t)sector * SECTOR_SIZE);
+    return r == (ssize_t)len ? RES_OK : RES_ERROR;
+}
+
+DRESULT disk_ioctl(BYTE pdrv, BYTE cmd, void *buff) {
+    if (pdrv) return RES_PARERR;
+    if (image_stat & STA_NOINIT) return RES_NOTRDY;
+
+    switch (cmd) {
+    case CTRL_SYNC:
+        return fsync(image_fd) == 0 || (image_stat & STA_PROTECT) ? RES_OK : RES_ERROR;
+    case GET_SECTOR_COUNT: {
+        struct stat st;
+        if (fstat(image_fd, &st) != 0) return RES_ERROR;
+        *(LBA_t *)buff = (LBA_t)(st.st_size / SECTOR_SIZE);
+        return RES_OK;
+    }
+    case GET_SECTOR_SIZE:
+        *(WORD *)buff = SECTOR_SIZE;
+        return RES_OK;
+    case GET_BLOCK_SIZE:
+        *(DWORD *)buff = 1;
+        return RES_OK;
+    default:
+        return RES_PARERR;
+    }
+}
@@ -0,0 +1,20 @@
+/**
+ * frank-386 - i386 PC Emulator for RP2350
+ *
+ * Host FatFS disk I/O over an SD card image file.
+ *
+ * Copyright (c) 2026 Mikhail Matveev <xtreme@rh1.tech>
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef _DISKIO_IMAGE_H_
+#define _DISKIO_IMAGE_H_
+
+/**
+ * Select the image file backing FatFS drive 0.
+ * Must be called before f_mount(). The image is opened read-write,
+ * falling back to read-only (write-protected volume).
+ */
+void diskio_image_set_path(const char *path);
+
+#endif /* _DISKIO_IMAGE_H_ */
@@ -0,0 +1,20 @@
+/**
+ * frank-386 - i386 PC Emulator for RP2350
+ *
+ * Host build shim for drivers/audio/audio.h. The host runner is headless
+ * and has no audio output.
+ *
+ * Copyright (c) 2026 Mikhail Matveev <xtreme@rh1.tech>
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef _HOST_AUDIO_H_
+#define _HOST_AUDIO_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+static inline void audio_set_enabled(bool enabled) { (void)enabled; }
+static inline void audio_set_volume(uint8_t volume) { (void)volume; }
+
+#endif /* _HOST_AUDIO_H_ */
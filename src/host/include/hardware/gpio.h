@@ -0,0 +1,21 @@
+/**
+ * frank-386 - i386 PC Emulator for RP2350
+ *
+ * Host build shim for <hardware/gpio.h>: GPIO writes (activity LED) are
+ * ignored.
+ *
+ * Copyright (c) 2026 Mikhail Matveev <xtreme@rh1.tech>
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef _HOST_HARDWARE_GPIO_H_
+#define _HOST_HARDWARE_GPIO_H_
+
+#include <stdbool.h>
+
+static inline void gpio_put(unsigned int gpio, bool value) {
+    (void)gpio;
+    (void)value;
+}
+
+#endif /* _HOST_HARDWARE_GPIO_H_ */
@@ -0,0 +1,21 @@
+/**
+ * frank-386 - i386 PC Emulator for RP2350
+ *
+ * Host build shim for <hardware/structs/sysinfo.h> (pulled in by
+ * board_config.h). get_psram_pin() is never called on the host.
+ *
+ * Copyright (c) 2026 Mikhail Matveev <xtreme@rh1.tech>
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef _HOST_HARDWARE_STRUCTS_SYSINFO_H_
+#define _HOST_HARDWARE_STRUCTS_SYSINFO_H_
+
+#include <stdint.h>
+
+typedef volatile const uint32_t io_ro_32;
+
+#define SYSINFO_BASE 0
+#define SYSINFO_PACKAGE_SEL_OFFSET 0
+
+#endif /* _HOST_HARDWARE_STRUCTS_SYSINFO_H_ */
@@ -0,0 +1,27 @@
+/**
+ * frank-386 - i386 PC Emulator for RP2350
+ *
+ * Host build shim for <hardware/timer.h>: microsecond timebase on top of
+ * CLOCK_MONOTONIC.
+ *
+ * Copyright (c) 2026 Mikhail Matveev <xtreme@rh1.tech>
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef _HOST_HARDWARE_TIMER_H_
+#define _HOST_HARDWARE_TIMER_H_
+
+#include <stdint.h>
+#include <time.h>
+
+static inline uint64_t time_us_64(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+static inline uint32_t time_us_32(void) {
+    return (uint32_t)time_us_64();
+}
+
+#endif /* _HOST_HARDWARE_TIMER_H_ */
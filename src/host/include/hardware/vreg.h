@@ -0,0 +1,19 @@
+/**
+ * frank-386 - i386 PC Emulator for RP2350
+ *
+ * Host build shim for <hardware/vreg.h> (pulled in by board_config.h).
+ *
+ * Copyright (c) 2026 Mikhail Matveev <xtreme@rh1.tech>
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef _HOST_HARDWARE_VREG_H_
+#define _HOST_HARDWARE_VREG_H_
+
+enum vreg_voltage {
+    VREG_VOLTAGE_1_50,
+    VREG_VOLTAGE_1_60,
+    VREG_VOLTAGE_1_65,
+};
+
+#endif /* _HOST_HARDWARE_VREG_H_ */
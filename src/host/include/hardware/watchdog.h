@@ -0,0 +1,24 @@
+/**
+ * frank-386 - i386 PC Emulator for RP2350
+ *
+ * Host build shim for <hardware/watchdog.h>: a watchdog reboot ends the
+ * host process.
+ *
+ * Copyright (c) 2026 Mikhail Matveev <xtreme@rh1.tech>
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef _HOST_HARDWARE_WATCHDOG_H_
+#define _HOST_HARDWARE_WATCHDOG_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+static inline void watchdog_reboot(uint32_t pc, uint32_t sp, uint32_t delay_ms) {
+    (void)pc;
+    (void)sp;
+    (void)delay_ms;
+    exit(0);
+}
+
+#endif /* _HOST_HARDWARE_WATCHDOG_H_ */
@@ -0,0 +1,33 @@
+/**
+ * frank-386 - i386 PC Emulator for RP2350
+ *
+ * Host build shim for <pico.h>: maps the Pico SDK section and intrinsic
+ * macros used by the emulator core onto plain C so the core compiles
+ * unchanged on a POSIX host.
+ *
+ * Copyright (c) 2026 Mikhail Matveev <xtreme@rh1.tech>
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef _HOST_PICO_H_
+#define _HOST_PICO_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef unsigned int uint;
+
+/* This header stands in for the SDK's pico_platform library */
+#define LIB_PICO_PLATFORM 1
+
+#define __not_in_flash(group)
+#define __not_in_flash_func(func_name) func_name
+#define __time_critical_func(func_name) func_name
+#define __scratch_x(group)
+#define __scratch_y(group)
+
+#define __dmb() __sync_synchronize()
+#define __fast_mul(a, b) ((a) * (b))
+
+#endif /* _HOST_PICO_H_ */
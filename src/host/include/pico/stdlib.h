@@ -0,0 +1,17 @@
+/**
+ * frank-386 - i386 PC Emulator for RP2350
+ *
+ * Host build shim for <pico/stdlib.h>.
+ *
+ * Copyright (c) 2026 Mikhail Matveev <xtreme@rh1.tech>
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef _HOST_PICO_STDLIB_H_
+#define _HOST_PICO_STDLIB_H_
+
+#include "pico.h"
+#include "hardware/timer.h"
+#include "hardware/gpio.h"
+
+#endif /* _HOST_PICO_STDLIB_H_ */
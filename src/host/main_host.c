@@ -0,0 +1,351 @@
+/**
+ * frank-386 - i386 PC Emulator for RP2350
+ *
+ * Headless host runner. Boots the emulator core from an SD card image
+ * (the same 386/ layout the firmware reads) and, in --bench mode, reports
+ * guest instruction throughput, time to the DOS prompt and the wall time
+ * spent in each pc_step subsystem.
+ *
+ * Copyright (c) 2026 Mikhail Matveev <xtreme@rh1.tech>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pc.h"
+#include "ide.h"
+#include "ff.h"
+#include "ini.h"
+#include "config_save.h"
+#include "diskio_image.h"
+#include "vclock.h"
+
+//=============================================================================
+// Global State
+//=============================================================================
+
+PC *pc = NULL;
+static PCConfig config;
+static FATFS fatfs;
+static uint8_t *framebuffer = NULL;
+
+static struct {
+    const char *image;
+    const char *config;
+    int bench;
+    int screen;
+    int keep_running;
+    double seconds;
+    long long instructions;
+    int clock_mhz;          ///< -1: as configured
+    int catchup;
+    int idle_poll;
+} opts = {
+    .config = "config.ini",
+    .seconds = 60.0,
+    .clock_mhz = -1,
+};
+
+static long frames = 0;
+
+//=============================================================================
+// Platform Callbacks
+//=============================================================================
+
+static void host_redraw(void *opaque, int x, int y, int w, int h) {
+    (void)opaque;
+    (void)x;
+    (void)y;
+    (void)w;
+    (void)h;
+    frames++;
+}
+
+static void host_poll(void *opaque) {
+    (void)opaque;
+}
+
+//=============================================================================
+// Configuration Loading
+//=============================================================================
+
+static void load_default_config(void) {
+    memset(&config, 0, sizeof(config));
+    config.mem_size = EMU_MEM_SIZE_MB * 1024 * 1024;
+    config.vga_mem_size = 256 * 1024;
+    config.cpu_gen = EMU_CPU_GEN;
+    // Software renderer needs room for 9-dot 80x25 text (720x400)
+    config.width = 720;
+    config.height = 480;
+    config.bios = "bios.bin";
+    config.vga_bios = "vgabios.bin";
+    config.redirector = 1;
+}
+
+static int load_config(const char *filename) {
+    FIL fp;
+    UINT bytes_read;
+    char path[256];
+    snprintf(path, sizeof(path), "386/%s", filename);
+
+    if (f_open(&fp, path, FA_READ) != FR_OK) {
+        fprintf(stderr, "Config file not found: %s\n", path);
+        return -1;
+    }
+    FSIZE_t size = f_size(&fp);
+    char *content = malloc(size + 1);
+    if (!content || f_read(&fp, content, size, &bytes_read) != FR_OK) {
+        f_close(&fp);
+        free(content);
+        return -1;
+    }
+    f_close(&fp);
+    content[bytes_read] = '\0';
+
+    int ret = ini_parse_string(content, parse_conf_ini, &config);
+    ini_parse_string(content, parse_frank_386_ini, NULL);
+    free(content);
+    return ret;
+}
+
+//=============================================================================
+// Text Screen Inspection
+//=============================================================================
+
+#define TEXT_MAX_COLS 132
+
+/* Text mode stores each character cell in planes 0/1 of a 4-byte slot:
+ * vga_mem[cell * 4] is the character, vga_mem[cell * 4 + 1] the attribute. */
+static int text_cell(int cell) {
+    uint32_t off = (uint32_t)(vga_get_start_addr(pc->vga) + cell) * 4;
+    if (off >= (uint32_t)pc->vga_mem_size)
+        return ' ';
+    return (uint8_t)pc->vga_mem[off];
+}
+
+static bool screen_has_dos_prompt(void) {
+    if (vga_get_mode(pc->vga) != 1)
+        return false;
+    int cells = vga_get_text_cols(pc->vga) * 50;
+    for (int i = 0; i + 2 < cells; i++) {
+        if (text_cell(i) == ':' && text_cell(i + 1) == '\\' && text_cell(i + 2) == '>')
+            return true;
+    }
+    return false;
+}
+
+static void dump_screen(void) {
+    if (vga_get_mode(pc->vga) != 1) {
+        printf("(screen is not in text mode)\n");
+        return;
+    }
+    int cols = vga_get_text_cols(pc->vga);
+    for (int row = 0; row < 25; row++) {
+        char line[TEXT_MAX_COLS + 1];
+        int len = 0;
+        for (int col = 0; col < cols && col < TEXT_MAX_COLS; col++) {
+            int ch = text_cell(row * cols + col);
+            line[len++] = (ch >= 0x20 && ch < 0x7f) ? ch : ' ';
+        }
+        while (len > 0 && line[len - 1] == ' ')
+            len--;
+        line[len] = '\0';
+        printf("%s\n", line);
+    }
+}
+
+//=============================================================================
+// Benchmark Report
+//=============================================================================
+
+static void print_report(double wall_s, double emu_s, long long instructions,
+                         double prompt_s, long long prompt_instructions) {
+    printf("\n=== frank386-host benchmark ===\n");
+    printf("image:               %s\n", opts.image);
+    printf("cpu:                 %d86, %ld KB RAM\n",
+           config.cpu_gen, config.mem_size / 1024);
+    if (vclock.cpu)
+        printf("clock:               %u MHz instruction count%s\n",
+               (unsigned)vclock.ipus, vclock.catchup ? ", catch-up" : "");
+    else
+        printf("clock:               host\n");
+    printf("wall time:           %.3f s\n", wall_s);
+    printf("emulated time:       %.3f s\n", emu_s);
+    printf("guest instructions:  %lld\n", instructions);
+    printf("guest MIPS:          %.2f\n",
+           wall_s > 0 ? instructions / wall_s / 1e6 : 0.0);
+    if (prompt_s >= 0)
+        printf("DOS prompt after:    %.3f s (%lld instructions)\n",
+               prompt_s, prompt_instructions);
+    else
+        printf("DOS prompt after:    not reached\n");
+    printf("vga refreshes:       %ld\n", frames);
+
+    struct i386_tlb_stats tlb;
+    cpui386_get_tlb_stats(pc->cpu, &tlb);
+    printf("dtlb hits/misses:    %lu / %lu\n", tlb.dtlb_hits, tlb.dtlb_misses);
+    printf("itlb hits/misses:    %lu / %lu\n", tlb.itlb_hits, tlb.itlb_misses);
+    printf("tlb flushes:         %lu\n", tlb.flushes);
+
+    for (int i = 0; i < 4; i++) {
+        struct ide_wcache_stats wc;
+        ide_get_wcache_stats(i < 2 ? pc->ide : pc->ide2, i & 1, &wc);
+        if (!wc.capacity)
+            continue;
+        printf("hdd%d write cache:    %d/%d dirty, %lu flushes, "
+               "%lu sectors in %lu runs, flush %u us (max %u us)\n",
+               i, wc.dirty, wc.capacity, wc.flushes, wc.sectors, wc.runs,
+               (unsigned)wc.last_flush_us, (unsigned)wc.max_flush_us);
+    }
+
+    uint64_t total = 0;
+    for (int i = 0; i < PC_STAT_COUNT; i++)
+        total += pc_step_stats_ns[i];
+    printf("pc_step time by subsystem:\n");
+    for (int i = 0; i < PC_STAT_COUNT; i++) {
+        printf("  %-8s %10.3f ms  %5.1f%%\n", pc_step_stats_names[i],
+               pc_step_stats_ns[i] / 1e6,
+               total ? 100.0 * pc_step_stats_ns[i] / total : 0.0);
+    }
+}
+
+//=============================================================================
+// Main
+//=============================================================================
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [options] <sdcard.img>\n"
+            "  --bench             print a benchmark report on exit;\n"
+            "                      stops at the DOS prompt unless --keep-running\n"
+            "  --config FILE       config file inside 386/ (default config.ini)\n"
+            "  --seconds N         stop after N seconds of wall time (default 60)\n"
+            "  --instructions N    stop after N guest instructions\n"
+            "  --keep-running      do not stop at the DOS prompt\n"
+            "  --clock-mhz N       emulated time from the instruction count at\n"
+            "                      N MHz (0 = host clock; default from config)\n"
+            "  --catch-up          with --clock-mhz, never fall behind the host\n"
+            "  --idle-poll         treat port polling loops as idle, like HLT\n"
+            "  --screen            print the text screen on exit\n",
+            argv0);
+}
+
+int main(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        const char *a = argv[i];
+        if (!strcmp(a, "--bench")) {
+            opts.bench = 1;
+        } else if (!strcmp(a, "--screen")) {
+            opts.screen = 1;
+        } else if (!strcmp(a, "--keep-running")) {
+            opts.keep_running = 1;
+        } else if (!strcmp(a, "--catch-up")) {
+            opts.catchup = 1;
+        } else if (!strcmp(a, "--idle-poll")) {
+            opts.idle_poll = 1;
+        } else if (!strcmp(a, "--clock-mhz") && i + 1 < argc) {
+            opts.clock_mhz = atoi(argv[++i]);
+        } else if (!strcmp(a, "--config") && i + 1 < argc) {
+            opts.config = argv[++i];
+        } else if (!strcmp(a, "--seconds") && i + 1 < argc) {
+            opts.seconds = atof(argv[++i]);
+        } else if (!strcmp(a, "--instructions") && i + 1 < argc) {
+            opts.instructions = atoll(argv[++i]);
+        } else if (a[0] != '-' && !opts.image) {
+            opts.image = a;
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (!opts.image) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    diskio_image_set_path(opts.image);
+    FRESULT res = f_mount(&fatfs, "", 1);
+    if (res != FR_OK) {
+        fprintf(stderr, "Cannot mount %s (error %d)\n", opts.image, res);
+        return 1;
+    }
+
+    load_default_config();
+    if (load_config(opts.config) != 0)
+        fprintf(stderr, "Using default configuration\n");
+    if (opts.clock_mhz >= 0)
+        config.clock_mhz = opts.clock_mhz;
+    if (opts.catchup)
+        config.clock_catchup = 1;
+    if (opts.idle_poll)
+        config.idle_poll = 1;
+
+    framebuffer = calloc((size_t)config.width * config.height, BPP / 8);
+    pc = pc_new(host_redraw, host_poll, NULL, framebuffer, &config);
+    if (!pc) {
+        fprintf(stderr, "Failed to create PC instance\n");
+        return 1;
+    }
+    pc->pcspk_enabled = config_get_pcspeaker();
+    pc->adlib_enabled = config_get_adlib();
+    pc->sb16_enabled = config_get_soundblaster();
+    pc->tandy_enabled = config_get_tandy();
+    pc->covox_enabled = config_get_covox();
+    pc->mpu401_enabled = config_get_mpu401();
+    midi_set_polyphony(config_get_midi_voices());
+    pc->dss_enabled = config_get_dss();
+    pc->mouse_enabled = config_get_mouse() || config_get_nes_mouse();
+    load_bios_and_reset(pc);
+
+    uint64_t start = get_nticks();
+    uint64_t deadline = start + (uint64_t)(opts.seconds * 1e9);
+    /* the microsecond clock wraps after 71 minutes: add it up in steps */
+    uint32_t emu_last = emu_uticks();
+    uint64_t emu_us = 0;
+    double prompt_s = -1;
+    long long prompt_instructions = 0;
+
+    for (unsigned iter = 0; ; iter++) {
+        pc_step(pc);
+
+        if (pc->reset_request) {
+            pc->reset_request = 0;
+            load_bios_and_reset(pc);
+        }
+        if (pc->shutdown_state)
+            break;
+        if (iter % 16)
+            continue;
+
+        uint32_t emu_now = emu_uticks();
+        emu_us += (uint32_t)(emu_now - emu_last);
+        emu_last = emu_now;
+        long long instructions = cpui386_get_cycle(pc->cpu);
+        uint64_t now = get_nticks();
+        if (prompt_s < 0 && screen_has_dos_prompt()) {
+            prompt_s = (now - start) / 1e9;
+            prompt_instructions = instructions;
+            if (opts.bench && !opts.keep_running)
+                break;
+        }
+        if (now >= deadline)
+            break;
+        if (opts.instructions && instructions >= opts.instructions)
+            break;
+    }
+
+    double wall_s = (get_nticks() - start) / 1e9;
+    emu_us += (uint32_t)(emu_uticks() - emu_last);
+    double emu_s = emu_us / 1e6;
+    long long instructions = cpui386_get_cycle(pc->cpu);
+    if (opts.screen)
+        dump_screen();
+    if (opts.bench)
+        print_report(wall_s, emu_s, instructions, prompt_s, prompt_instructions);
+
+    pc_flush_disks(pc);
+    f_unmount("");
+    return 0;
+}
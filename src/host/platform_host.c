@@ -0,0 +1,72 @@
+/**
+ * frank-386 - i386 PC Emulator for RP2350
+ *
+ * Host Platform Layer - POSIX implementation of the platform HAL that
+ * main.c, platform_rp2350.c and the video driver provide on the device.
+ *
+ * Copyright (c) 2026 Mikhail Matveev <xtreme@rh1.tech>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "pc.h"
+#include "ff.h"
+
+// VGA planar memory; vga_hw.c owns this buffer on the device.
+uint8_t gfx_buffer[256ul << 10] __attribute__((aligned(4)));
+
+/**
+ * Get microsecond timestamp.
+ */
+uint32_t get_uticks(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000000u + ts.tv_nsec / 1000u);
+}
+
+/**
+ * Get nanosecond timestamp (pc_step subsystem accounting).
+ */
+uint64_t get_nticks(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/**
+ * Allocate memory.
+ */
+void *pcmalloc(long size) {
+    return malloc(size);
+}
+
+/**
+ * Load ROM file from the SD card image to memory.
+ */
+int load_rom(void *phys_mem, const char *file, uword addr, int backward) {
+    FIL fp;
+    UINT bytes_read;
+    char path[256];
+    snprintf(path, sizeof(path), "386/%s", file);
+
+    FRESULT res = f_open(&fp, path, FA_READ);
+    if (res != FR_OK) {
+        fprintf(stderr, "Failed to open ROM: %s (error %d)\n", path, res);
+        return -1;
+    }
+
+    FSIZE_t size = f_size(&fp);
+    uint8_t *dest = (uint8_t *)phys_mem + (backward ? addr - size : addr);
+    res = f_read(&fp, dest, size, &bytes_read);
+    f_close(&fp);
+    if (res != FR_OK || bytes_read != size) {
+        fprintf(stderr, "Failed to read ROM: %s (error %d, read %u of %lu)\n",
+                path, res, bytes_read, (unsigned long)size);
+        return -1;
+    }
+    return (int)size;
+}
@@ -0,0 +1,767 @@
+/**
+ * frank-386 - i386 PC Emulator for RP2350
+ *
+ * Host check and benchmark for the scanline renderers the VGA and HDMI
+ * drivers run in their per-line DMA interrupt. Each test mode programs the
+ * emulated VGA with the BIOS register set for that mode, fills VRAM with a
+ * fixed pseudo-random pattern and renders one frame with both vga.c's
+ * software refresh and the scanline renderers:
+ *
+ *  - the VGA renderers, given identity palette tables, must produce the
+ *    same picture as vga.c once their palette indices are resolved through
+ *    the emulated DAC;
+ *  - the HDMI renderers must produce the same indices as the VGA ones,
+ *    packed the way the HDMI encoder expects;
+ *  - in graphics modes, an incremental refresh after a few CPU writes must
+ *    redraw only some lines and still match a full refresh.
+ *
+ * The "writes" check runs random register changes and 8/16/32-bit and
+ * string writes through vga.c and through a per-byte reference of the
+ * write modes, odd/even, chain 4 and the memory map windows, and compares
+ * the two copies of VRAM.
+ *
+ * With --bench it also reports the time per scanline of every renderer and
+ * the time of vga.c's refresh, for a full and for an unchanged frame.
+ *
+ * Copyright (c) 2026 Mikhail Matveev <xtreme@rh1.tech>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "vga.h"
+#include "vclock.h"
+#include "scanline.h"
+
+#define VRAM_SIZE (256 * 1024)
+#define FB_WIDTH 720
+#define FB_HEIGHT 480
+
+//=============================================================================
+// Test Modes
+//=============================================================================
+
+enum { FILL_TEXT, FILL_PLANES, FILL_PLANE0 };
+enum { PAL_16, PAL_256 };
+/// How an HDMI output byte is built from two VGA output pixels
+enum { PACK_NIBBLES, PACK_DOUBLED, PACK_BITS };
+
+typedef struct {
+    const char *name;
+    uint8_t misc;
+    uint8_t seq[4];             ///< SR1..SR4
+    uint8_t crtc[25];
+    uint8_t attr[20];
+    uint8_t grdc[9];
+    int fill;
+    int palette;
+    int ref_width, ref_height;  ///< picture size vga.c draws
+    int pack;
+} TestMode;
+
+#define TEXT_ATTR \
+    { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x14, 0x07, \
+      0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0x3e, 0x3f, 0x0c, 0x00, 0x0f, 0x08 }
+#define TEXT_GRDC { 0x00, 0x00, 0x00, 0x00, 0x00, 0x10, 0x0e, 0x0f, 0xff }
+#define EGA_ATTR \
+    { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, \
+      0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x01, 0x00, 0x0f, 0x00 }
+#define VGA256_ATTR \
+    { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, \
+      0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x41, 0x00, 0x0f, 0x00 }
+
+/* Register sets of the standard BIOS modes; text runs with 8-dot cells and
+ * the cursor off, like the hardware renderers */
+static const TestMode modes[] = {
+    { "text80", 0x67, { 0x00, 0x03, 0x00, 0x02 },
+      { 0x5f, 0x4f, 0x50, 0x82, 0x55, 0x81, 0xbf, 0x1f, 0x00, 0x4f, 0x2d, 0x0e,
+        0x00, 0x00, 0x00, 0x00, 0x9c, 0x8e, 0x8f, 0x28, 0x1f, 0x96, 0xb9, 0xa3, 0xff },
+      TEXT_ATTR, TEXT_GRDC, FILL_TEXT, PAL_16, 640, 400, PACK_NIBBLES },
+    { "text40", 0x67, { 0x08, 0x03, 0x00, 0x02 },
+      { 0x2d, 0x27, 0x28, 0x90, 0x2b, 0xa0, 0xbf, 0x1f, 0x00, 0x4f, 0x2d, 0x0e,
+        0x00, 0x00, 0x00, 0x00, 0x9c, 0x8e, 0x8f, 0x14, 0x1f, 0x96, 0xb9, 0xa3, 0xff },
+      TEXT_ATTR, TEXT_GRDC, FILL_TEXT, PAL_16, 320, 400, PACK_NIBBLES },
+    { "cga4", 0x63, { 0x09, 0x03, 0x00, 0x02 },
+      { 0x2d, 0x27, 0x28, 0x90, 0x2b, 0x80, 0xbf, 0x1f, 0x00, 0xc1, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x9c, 0x8e, 0x8f, 0x14, 0x00, 0x96, 0xb9, 0xa2, 0xff },
+      { 0x00, 0x13, 0x15, 0x17, 0x02, 0x04, 0x06, 0x07,
+        0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x01, 0x00, 0x03, 0x00 },
+      { 0x00, 0x00, 0x00, 0x00, 0x00, 0x30, 0x0f, 0x0f, 0xff },
+      FILL_PLANES, PAL_16, 640, 400, PACK_DOUBLED },
+    { "cga2", 0x63, { 0x01, 0x01, 0x00, 0x06 },
+      { 0x5f, 0x4f, 0x50, 0x82, 0x54, 0x80, 0xbf, 0x1f, 0x00, 0xc1, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x9c, 0x8e, 0x8f, 0x28, 0x00, 0x96, 0xb9, 0xc2, 0xff },
+      { 0x00, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17,
+        0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x01, 0x00, 0x01, 0x00 },
+      { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0d, 0x0f, 0xff },
+      FILL_PLANE0, PAL_16, 640, 400, PACK_BITS },
+    { "ega320", 0x63, { 0x09, 0x0f, 0x00, 0x06 },
+      { 0x2d, 0x27, 0x28, 0x90, 0x2b, 0x80, 0xbf, 0x1f, 0x00, 0xc0, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x9c, 0x8e, 0x8f, 0x14, 0x00, 0x96, 0xb9, 0xe3, 0xff },
+      EGA_ATTR, { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x05, 0x0f, 0xff },
+      FILL_PLANES, PAL_16, 640, 400, PACK_DOUBLED },
+    { "ega640", 0xe3, { 0x01, 0x0f, 0x00, 0x06 },
+      { 0x5f, 0x4f, 0x50, 0x82, 0x54, 0x80, 0x0b, 0x3e, 0x00, 0x40, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x59, 0xea, 0x8c, 0xdf, 0x28, 0x00, 0xe7, 0x04, 0xe3, 0xff },
+      { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x14, 0x07,
+        0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0x3e, 0x3f, 0x01, 0x00, 0x0f, 0x00 },
+      { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x05, 0x0f, 0xff },
+      FILL_PLANES, PAL_16, 640, 480, PACK_NIBBLES },
+    { "vga256", 0x63, { 0x01, 0x0f, 0x00, 0x0e },
+      { 0x5f, 0x4f, 0x50, 0x82, 0x54, 0x80, 0xbf, 0x1f, 0x00, 0x41, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x9c, 0x8e, 0x8f, 0x28, 0x40, 0x96, 0xb9, 0xa3, 0xff },
+      VGA256_ATTR, { 0x00, 0x00, 0x00, 0x00, 0x00, 0x40, 0x05, 0x0f, 0xff },
+      FILL_PLANES, PAL_256, 640, 400, PACK_DOUBLED },
+    /* mode 13h unchained: chain-4 off, byte addressing */
+    { "modex", 0x63, { 0x01, 0x0f, 0x00, 0x06 },
+      { 0x5f, 0x4f, 0x50, 0x82, 0x54, 0x80, 0xbf, 0x1f, 0x00, 0x41, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x9c, 0x8e, 0x8f, 0x28, 0x00, 0x96, 0xb9, 0xe3, 0xff },
+      VGA256_ATTR, { 0x00, 0x00, 0x00, 0x00, 0x00, 0x40, 0x05, 0x0f, 0xff },
+      FILL_PLANES, PAL_256, 640, 400, PACK_DOUBLED },
+};
+
+#define N_MODES ((int)(sizeof(modes) / sizeof(modes[0])))
+
+//=============================================================================
+// Emulated VGA Setup
+//=============================================================================
+
+static char *vram;
+static uint8_t *font_vram;      ///< VRAM as vga_init left it, font in plane 2
+static uint8_t *fb;
+static VGAState *vga;
+
+/* vga.c paces retrace and the cursor blink from the emulated clock; with
+ * no CPU attached that is the host clock */
+VClock vclock;
+
+uint32_t vclock_read(void) {
+    return get_uticks();
+}
+
+uint32_t get_uticks(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000000u + ts.tv_nsec / 1000);
+}
+
+static int redrawn_lines;
+
+static void redraw(void *opaque, int x, int y, int w, int h) {
+    (void)opaque;
+    (void)x;
+    (void)y;
+    (void)w;
+    redrawn_lines += h;
+}
+
+static uint32_t rng_state;
+
+static uint32_t rng(void) {
+    rng_state = rng_state * 1103515245u + 12345u;
+    return rng_state >> 8;
+}
+
+static void set_mode(const TestMode *m) {
+    vga_ioport_write(vga, 0x3c2, m->misc);
+    for (int i = 0; i < 4; i++) {
+        vga_ioport_write(vga, 0x3c4, i + 1);
+        vga_ioport_write(vga, 0x3c5, m->seq[i]);
+    }
+    // CR11 bit 7 write-protects CR0-7
+    vga_ioport_write(vga, 0x3d4, 0x11);
+    vga_ioport_write(vga, 0x3d5, 0x00);
+    for (int i = 0; i < 25; i++) {
+        vga_ioport_write(vga, 0x3d4, i);
+        vga_ioport_write(vga, 0x3d5, m->crtc[i]);
+    }
+    for (int i = 0; i < 9; i++) {
+        vga_ioport_write(vga, 0x3ce, i);
+        vga_ioport_write(vga, 0x3cf, m->grdc[i]);
+    }
+    vga_ioport_read(vga, 0x3da);    // reset the attribute flip-flop
+    for (int i = 0; i < 20; i++) {
+        vga_ioport_write(vga, 0x3c0, i);
+        vga_ioport_write(vga, 0x3c0, m->attr[i]);
+    }
+    vga_ioport_write(vga, 0x3c0, 0x20);
+
+    // a DAC palette with distinct entries, so that any index mix-up shows
+    vga_ioport_write(vga, 0x3c8, 0);
+    for (int i = 0; i < 256; i++) {
+        vga_ioport_write(vga, 0x3c9, i & 0x3f);
+        vga_ioport_write(vga, 0x3c9, (i >> 2) ^ 0x15);
+        vga_ioport_write(vga, 0x3c9, (i * 7 + (i >> 6)) & 0x3f);
+    }
+}
+
+static void fill_vram(const TestMode *m) {
+    rng_state = 0x386;
+    for (int i = 0; i < VRAM_SIZE / 4; i++) {
+        uint8_t *p = (uint8_t *)vram + i * 4;
+        switch (m->fill) {
+        case FILL_TEXT:
+            // attribute bit 7 (blink) is left out, the renderers only take
+            // 3 bits of background
+            p[0] = rng();
+            p[1] = rng() & 0x7f;
+            p[2] = font_vram[i * 4 + 2];
+            p[3] = font_vram[i * 4 + 3];
+            break;
+        case FILL_PLANE0:
+            p[0] = rng();
+            p[1] = p[2] = p[3] = 0;
+            break;
+        default:
+            p[0] = rng();
+            p[1] = rng();
+            p[2] = rng();
+            p[3] = rng();
+            break;
+        }
+    }
+}
+
+/* The same frame state the drivers latch at vblank */
+static void latch_frame(ScanlineFrame *f, int *submode) {
+    int w = 0, h = 0;
+    memset(f, 0, sizeof(*f));
+    f->vram = (const uint8_t *)vram;
+    f->start = vga_get_start_addr(vga);
+    int lc = vga_get_line_compare(vga);
+    f->line_compare = (lc > 0 && lc < 480) ? lc : -1;
+    f->panning = vga_get_panning(vga);
+    f->text_cols = vga_get_text_cols(vga);
+    f->text_stride = vga_get_line_offset(vga) * 2;
+    f->vga = vga;
+
+    *submode = 0;
+    if (vga_get_mode(vga) == 2) {
+        *submode = vga_get_graphics_mode(vga, &w, &h);
+        if (*submode == 2 && w <= 320)
+            *submode = 6;
+        int line_offset = vga_get_line_offset(vga);
+        f->width = w;
+        f->height = h;
+        f->line_offset = line_offset > 0 ? line_offset : w / 8;
+    }
+    f->active_lines = (h > 400 || (*submode == 5 && h > 200)) ? 480 : 400;
+}
+
+//=============================================================================
+// Renderers Under Test
+//=============================================================================
+
+static uint16_t text_pal[128 * 4];
+static uint16_t pal256[256];
+static uint8_t pal16[16];
+
+/* Identity tables: every output byte is the palette index itself */
+static void init_tables(void) {
+    for (int a = 0; a < 128; a++) {
+        int fg = a & 15, bg = (a >> 4) & 7;
+        for (int b = 0; b < 4; b++)
+            text_pal[a * 4 + b] = ((b & 1) ? fg : bg) | (((b & 2) ? fg : bg) << 8);
+    }
+    for (int i = 0; i < 256; i++)
+        pal256[i] = i | (i << 8);
+    for (int i = 0; i < 16; i++)
+        pal16[i] = i;
+}
+
+static void render_vga(const ScanlineFrame *f, int submode, uint32_t line, uint8_t *out) {
+    uint32_t *out32 = (uint32_t *)out;
+    if (vga_get_mode(vga) == 1) {
+        scanline_text_vga(f, line, (uint16_t *)out32, text_pal);
+        return;
+    }
+    switch (submode) {
+    case 1: scanline_cga4_vga(f, line, out32, pal16, 0); break;
+    case 2:
+    case 6: scanline_ega_vga(f, line, out32, pal16, 0); break;
+    case 4: scanline_cga2_vga(f, line, out32, 0, 1, 0); break;
+    case 5: scanline_planar256_vga(f, line, out32, pal256, pal256, 0); break;
+    default: scanline_chain4_vga(f, line, out32, pal256, pal256, 0); break;
+    }
+}
+
+static void render_hdmi(const ScanlineFrame *f, int submode, uint32_t line, uint8_t *out) {
+    if (vga_get_mode(vga) == 1) {
+        scanline_text_hdmi(f, line, out);
+        return;
+    }
+    switch (submode) {
+    case 1: scanline_cga4_hdmi(f, line, out); break;
+    case 2: scanline_ega640_hdmi(f, line, out); break;
+    case 6: scanline_ega320_hdmi(f, line, out); break;
+    case 4: scanline_cga2_hdmi(f, line, out); break;
+    case 5: scanline_planar256_hdmi(f, line, out); break;
+    default: scanline_chain4_hdmi(f, line, out); break;
+    }
+}
+
+//=============================================================================
+// Golden Check
+//=============================================================================
+
+static inline int c6_to_8(int v) {
+    v &= 0x3f;
+    return (v << 2) | ((v & 1) << 1) | (v & 1);
+}
+
+static uint32_t rgb(const uint8_t *p) {
+    return (c6_to_8(p[0]) << 16) | (c6_to_8(p[1]) << 8) | c6_to_8(p[2]);
+}
+
+static uint8_t hdmi_expected(const TestMode *m, const uint8_t *vga_line, int j) {
+    uint8_t l = vga_line[2 * j], r = vga_line[2 * j + 1];
+    int v;
+    switch (m->pack) {
+    case PACK_NIBBLES: v = (l << 4) | r; break;
+    case PACK_BITS: v = (l << 1) | r; break;
+    default: v = l; break;
+    }
+    return v > SCANLINE_HDMI_MAX_INDEX ? SCANLINE_HDMI_MAX_INDEX : v;
+}
+
+static int check_mode(const TestMode *m) {
+    ScanlineFrame f;
+    int submode;
+
+    memset(fb, 0, FB_WIDTH * FB_HEIGHT * 4);
+    set_mode(m);
+    fill_vram(m);
+    vga_refresh(vga, redraw, NULL, 1);
+    latch_frame(&f, &submode);
+
+    uint32_t colors[256];
+    if (m->palette == PAL_16) {
+        uint8_t p16[48];
+        vga_get_palette16(vga, p16);
+        for (int i = 0; i < 16; i++)
+            colors[i] = rgb(p16 + i * 3);
+    } else {
+        const uint8_t *dac = vga_get_palette(vga);
+        for (int i = 0; i < 256; i++)
+            colors[i] = rgb(dac + i * 3);
+    }
+
+    int ox = (FB_WIDTH - m->ref_width) / 2;
+    int oy = (FB_HEIGHT - m->ref_height) / 2;
+    int vga_errors = 0, hdmi_errors = 0;
+    for (int y = 0; y < f.active_lines; y++) {
+        uint8_t line[SCANLINE_VGA_WIDTH];
+        uint8_t hdmi[SCANLINE_HDMI_WIDTH];
+        render_vga(&f, submode, y, line);
+        render_hdmi(&f, submode, y, hdmi);
+
+        int ry = oy + y * m->ref_height / f.active_lines;
+        for (int x = 0; x < SCANLINE_VGA_WIDTH; x++) {
+            int rx = ox + x * m->ref_width / SCANLINE_VGA_WIDTH;
+            const uint8_t *p = fb + (ry * FB_WIDTH + rx) * 4;
+            uint32_t ref = p[0] | (p[1] << 8) | (p[2] << 16);
+            if (colors[line[x]] != ref && vga_errors++ < 5)
+                printf("%s: vga line %d x %d: index %d = %06x, refresh has %06x\n",
+                       m->name, y, x, line[x], colors[line[x]], ref);
+        }
+        for (int j = 0; j < SCANLINE_HDMI_WIDTH; j++) {
+            uint8_t want = hdmi_expected(m, line, j);
+            if (hdmi[j] != want && hdmi_errors++ < 5)
+                printf("%s: hdmi line %d byte %d: %02x, expected %02x\n",
+                       m->name, y, j, hdmi[j], want);
+        }
+    }
+    printf("%-8s %s (%d x %d lines, vga %d / hdmi %d mismatches)\n", m->name,
+           vga_errors || hdmi_errors ? "FAIL" : "ok", SCANLINE_VGA_WIDTH,
+           f.active_lines, vga_errors, hdmi_errors);
+    return vga_errors || hdmi_errors;
+}
+
+/* Run right after check_mode's full refresh: writes go through
+ * vga_mem_write, so they have to mark VRAM dirty for the refresh to see them */
+static int check_dirty(const TestMode *m) {
+    static const uint32_t windows[4] = { 0xa0000, 0xa0000, 0xb0000, 0xb8000 };
+    static uint8_t incremental[FB_WIDTH * FB_HEIGHT * 4];
+    uint32_t base = windows[(m->grdc[6] >> 2) & 3];
+
+    redrawn_lines = 0;
+    vga_refresh(vga, redraw, NULL, 0);
+    int clean_lines = redrawn_lines;
+
+    // a few bytes near the top, so that most of the picture stays clean
+    for (int i = 0; i < 8; i++)
+        vga_mem_write(vga, base + rng() % 0x400, rng());
+    redrawn_lines = 0;
+    vga_refresh(vga, redraw, NULL, 0);
+    int dirty_lines = redrawn_lines;
+    memcpy(incremental, fb, sizeof(incremental));
+    vga_refresh(vga, redraw, NULL, 1);
+
+    int same = !memcmp(incremental, fb, sizeof(incremental));
+    int ok = same && clean_lines == 0 && dirty_lines > 0 &&
+             dirty_lines < m->ref_height;
+    printf("%-8s dirty %s (clean refresh %d lines, after writes %d lines%s)\n",
+           m->name, ok ? "ok" : "FAIL", clean_lines, dirty_lines,
+           same ? "" : ", picture differs from a full refresh");
+    return !ok;
+}
+
+//=============================================================================
+// Write Engine Check
+//=============================================================================
+
+/* vga.c's CPU write path, as it was before the write state was
+ * precomputed: decoded byte by byte from the registers on every access.
+ * It works on its own copy of VRAM, with the latch vga_mem_read left. */
+static uint8_t *ref_vram;
+
+static uint32_t plane_bytes(int mask) {
+    uint32_t v = 0;
+    for (int p = 0; p < 4; p++)
+        if (mask & (1 << p))
+            v |= 0xffu << (p * 8);
+    return v;
+}
+
+/* CPU address to VRAM offset through the GR6 memory map; 0 if unmapped */
+static int ref_map(uint32_t *addr) {
+    uint32_t a = *addr & 0x1ffff;
+    switch ((vga->gr[6] >> 2) & 3) {
+    case 0:
+        break;
+    case 1:
+        if (a >= 0x10000)
+            return 0;
+        a += vga->bank_offset;
+        break;
+    case 2:
+        a -= 0x10000;
+        if (a >= 0x8000)
+            return 0;
+        break;
+    default:
+        a -= 0x18000;
+        if (a >= 0x8000)
+            return 0;
+        break;
+    }
+    *addr = a;
+    return 1;
+}
+
+static void ref_write(uint32_t addr, uint8_t val8) {
+    uint32_t val = val8, bit_mask = 0;
+    if (!ref_map(&addr))
+        return;
+
+    if (vga->sr[4] & 0x08) {
+        if (vga->sr[2] & (1 << (addr & 3)))
+            ref_vram[addr] = val;
+        return;
+    }
+    if (vga->gr[5] & 0x10) {
+        int plane = (vga->gr[4] & 2) | (addr & 1);
+        if (vga->sr[2] & (1 << plane)) {
+            addr = ((addr & ~1) << 1) | plane;
+            if (addr < VRAM_SIZE)
+                ref_vram[addr] = val;
+        }
+        return;
+    }
+
+    int rotate = vga->gr[3] & 7;
+    switch (vga->gr[5] & 3) {
+    case 0:
+        val = ((val >> rotate) | (val << (8 - rotate))) & 0xff;
+        val *= 0x01010101u;
+        val = (val & ~plane_bytes(vga->gr[1])) |
+              (plane_bytes(vga->gr[0]) & plane_bytes(vga->gr[1]));
+        bit_mask = vga->gr[8];
+        break;
+    case 1:
+        val = vga->latch;
+        goto write;
+    case 2:
+        val = plane_bytes(val & 0x0f);
+        bit_mask = vga->gr[8];
+        break;
+    case 3:
+        val = (val >> rotate) | (val << (8 - rotate));
+        bit_mask = vga->gr[8] & val;
+        val = plane_bytes(vga->gr[0]);
+        break;
+    }
+    switch (vga->gr[3] >> 3) {
+    case 1: val &= vga->latch; break;
+    case 2: val |= vga->latch; break;
+    case 3: val ^= vga->latch; break;
+    }
+    bit_mask = (bit_mask & 0xff) * 0x01010101u;
+    val = (val & bit_mask) | (vga->latch & ~bit_mask);
+
+write:
+    if (addr * 4 >= VRAM_SIZE)
+        return;
+    uint32_t mask = plane_bytes(vga->sr[2]), old;
+    memcpy(&old, ref_vram + addr * 4, 4);
+    val = (old & ~mask) | (val & mask);
+    memcpy(ref_vram + addr * 4, &val, 4);
+}
+
+/* 16/32-bit writes: chain 4 stores the whole value if the first byte's
+ * plane is enabled, every other mode splits it into bytes */
+static void ref_write_n(uint32_t addr, uint32_t val, int len) {
+    uint32_t a = addr;
+    if (!(vga->sr[4] & 0x08)) {
+        for (int i = 0; i < len; i++)
+            ref_write(addr + i, val >> (i * 8));
+        return;
+    }
+    if (ref_map(&a) && (vga->sr[2] & (1 << (a & 3))))
+        memcpy(ref_vram + a, &val, len);
+}
+
+/* The string path takes chain 4 runs whole; otherwise the CPU falls back
+ * to byte writes */
+static void ref_write_string(uint32_t addr, const uint8_t *buf, int len) {
+    uint32_t a = addr;
+    if ((vga->sr[4] & 0x08) && ref_map(&a) && (vga->sr[2] & (1 << (a & 3)))) {
+        memcpy(ref_vram + a, buf, len);
+        return;
+    }
+    for (int i = 0; i < len; i++)
+        ref_write(addr + i, buf[i]);
+}
+
+/* Mostly random, often at the edges of the 64K and 32K windows so that
+ * 16/32-bit accesses straddle them */
+static uint32_t write_addr(void) {
+    static const uint32_t edges[] = { 0x00000, 0x08000, 0x10000, 0x18000, 0x20000 };
+    if (rng() % 4)
+        return 0xa0000 + rng() % 0x20000;
+    return 0xa0000 + ((edges[rng() % 5] - 4 + rng() % 8) & 0x1ffff);
+}
+
+static int check_writes(int ops) {
+    static const char *const op_names[] = {
+        "gr", "sr", "read", "write8", "write16", "write32", "string", "fill"
+    };
+    uint8_t buf[64];
+    int op = 0, n;
+
+    rng_state = 0x25;
+    for (int i = 0; i < VRAM_SIZE; i++)
+        vram[i] = rng();
+    memcpy(ref_vram, vram, VRAM_SIZE);
+
+    for (n = 0; n < ops; n++) {
+        uint32_t addr = write_addr(), val = rng() ^ (rng() << 16);
+        switch (rng() % 16) {
+        case 0: case 1: case 2: {
+            // write modes, rotate/function, set/reset, bit mask, odd/even,
+            // read map and memory map
+            static const uint8_t regs[] = { 0, 1, 3, 4, 5, 5, 6, 8 };
+            int r = regs[rng() % sizeof(regs)];
+            int k = rng() % 3;
+            vga_ioport_write(vga, 0x3ce, r);
+            vga_ioport_write(vga, 0x3cf, k == 0 ? 0 : k == 1 ? 0xff : rng());
+            op = 0;
+            break;
+        }
+        case 3: {
+            // plane mask and chain 4
+            int r = rng() % 2 ? 2 : 4;
+            int k = rng() % 3;
+            vga_ioport_write(vga, 0x3c4, r);
+            vga_ioport_write(vga, 0x3c5, k == 0 ? (r == 4 ? 0x06 : 0x0f) : rng());
+            op = 1;
+            break;
+        }
+        case 4:
+            vga_mem_read(vga, addr);
+            op = 2;
+            break;
+        case 5: case 6: case 7:
+            vga_mem_write(vga, addr, val);
+            ref_write(addr, val);
+            op = 3;
+            break;
+        case 8: case 9:
+            vga_mem_write16(vga, addr, val);
+            ref_write_n(addr, val, 2);
+            op = 4;
+            break;
+        case 10: case 11:
+            vga_mem_write32(vga, addr, val);
+            ref_write_n(addr, val, 4);
+            op = 5;
+            break;
+        case 12: case 13: {
+            int len = 1 + rng() % sizeof(buf);
+            for (int i = 0; i < len; i++)
+                buf[i] = rng();
+            if (!vga_mem_write_string(vga, addr, buf, len))
+                for (int i = 0; i < len; i++)
+                    vga_mem_write(vga, addr + i, buf[i]);
+            ref_write_string(addr, buf, len);
+            op = 6;
+            break;
+        }
+        default: {
+            // REP STOS: the CPU falls back to one store per element
+            int size = 1 << rng() % 3, count = 1 + rng() % 32;
+            if (!vga_mem_fill(vga, addr, val, size, count)) {
+                for (int i = 0; i < count; i++) {
+                    uint32_t a = addr + i * size;
+                    if (size == 1)
+                        vga_mem_write(vga, a, val);
+                    else if (size == 2)
+                        vga_mem_write16(vga, a, val);
+                    else
+                        vga_mem_write32(vga, a, val);
+                }
+            }
+            for (int i = 0; i < count; i++) {
+                if (size == 1)
+                    ref_write(addr + i, val);
+                else
+                    ref_write_n(addr + i * size, val, size);
+            }
+            op = 7;
+            break;
+        }
+        }
+        if (((n & 63) == 63 || n == ops - 1) && memcmp(vram, ref_vram, VRAM_SIZE))
+            break;
+    }
+
+    int ok = n == ops;
+    if (ok)
+        printf("writes   ok (%d operations)\n", ops);
+    else
+        printf("writes   FAIL (VRAM differs after operations %d-%d, last %s,"
+               " GR3 %02x GR5 %02x GR6 %02x SR2 %02x SR4 %02x)\n",
+               n & ~63, n, op_names[op], vga->gr[3], vga->gr[5], vga->gr[6],
+               vga->sr[2], vga->sr[4]);
+    return !ok;
+}
+
+//=============================================================================
+// Benchmark
+//=============================================================================
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static void bench_mode(const TestMode *m, int frames) {
+    ScanlineFrame f;
+    int submode;
+    static uint8_t out[SCANLINE_VGA_WIDTH];
+
+    set_mode(m);
+    fill_vram(m);
+    latch_frame(&f, &submode);
+
+    uint64_t t0 = now_ns();
+    for (int n = 0; n < frames; n++)
+        for (int y = 0; y < f.active_lines; y++)
+            render_vga(&f, submode, y, out);
+    uint64_t t1 = now_ns();
+    for (int n = 0; n < frames; n++)
+        for (int y = 0; y < f.active_lines; y++)
+            render_hdmi(&f, submode, y, out);
+    uint64_t t2 = now_ns();
+
+    // vga.c's software refresh of the whole frame, and of an unchanged one
+    for (int n = 0; n < frames; n++)
+        vga_refresh(vga, redraw, NULL, 1);
+    uint64_t t3 = now_ns();
+    for (int n = 0; n < frames; n++)
+        vga_refresh(vga, redraw, NULL, 0);
+    uint64_t t4 = now_ns();
+
+    double lines = (double)frames * f.active_lines;
+    printf("%-8s %10.1f %10.1f %11.1f %11.1f\n", m->name,
+           (t1 - t0) / lines, (t2 - t1) / lines,
+           (t3 - t2) / 1e3 / frames, (t4 - t3) / 1e3 / frames);
+}
+
+//=============================================================================
+// Main
+//=============================================================================
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [options] [mode...]\n"
+            "  --bench             report ns per scanline, and us per software\n"
+            "                      refresh, instead of checking\n"
+            "  --frames N          frames rendered per mode with --bench (default 200)\n"
+            "modes:",
+            argv0);
+    for (int i = 0; i < N_MODES; i++)
+        fprintf(stderr, " %s", modes[i].name);
+    fprintf(stderr, "\n"
+            "writes: check the CPU write path against a per-byte reference\n");
+}
+
+int main(int argc, char **argv) {
+    int bench = 0;
+    int frames = 200;
+    int selected[N_MODES] = { 0 };
+    int writes = 0;
+    int any = 0;
+
+    for (int i = 1; i < argc; i++) {
+        const char *a = argv[i];
+        int k;
+        if (!strcmp(a, "--bench")) {
+            bench = 1;
+        } else if (!strcmp(a, "--frames") && i + 1 < argc) {
+            frames = atoi(argv[++i]);
+        } else if (!strcmp(a, "writes")) {
+            writes = any = 1;
+        } else {
+            for (k = 0; k < N_MODES && strcmp(a, modes[k].name); k++)
+                ;
+            if (k == N_MODES) {
+                usage(argv[0]);
+                return 2;
+            }
+            selected[k] = any = 1;
+        }
+    }
+
+    vram = calloc(VRAM_SIZE, 1);
+    fb = calloc(FB_WIDTH * FB_HEIGHT, 4);
+    vga = vga_init(vram, VRAM_SIZE, fb, FB_WIDTH, FB_HEIGHT);
+    vga_set_force_8dm(vga, 1);
+    font_vram = malloc(VRAM_SIZE);
+    memcpy(font_vram, vram, VRAM_SIZE);
+    ref_vram = malloc(VRAM_SIZE);
+    scanline_init();
+    init_tables();
+
+    if (bench)
+        printf("mode     vga ns/line hdmi ns/line refresh us clean us\n");
+    int failed = 0;
+    for (int i = 0; i < N_MODES; i++) {
+        if (any && !selected[i])
+            continue;
+        if (bench)
+            bench_mode(&modes[i], frames);
+        else {
+            failed |= check_mode(&modes[i]);
+            if (modes[i].fill != FILL_TEXT)
+                failed |= check_dirty(&modes[i]);
+        }
+    }
+    if (!bench && (writes || !any))
+        failed |= check_writes(200000);
+    return failed;
+}
@@ -55,6 +55,77 @@ void dolog(const char *fmt, ...)
 #define dolog(...) (void)0
 #endif
 
+#ifdef I386_PROFILE
+/* Execution profile, dumped and cleared periodically from pc_step().
+ * op[] is counted at every dispatch, so the prefix bytes in it are
+ * prefix frequencies. EIPs are sampled every PROF_SAMPLE_PERIOD
+ * instructions into a small open-addressed hash of linear addresses. */
+#define PROF_SAMPLE_PERIOD 64
+#define PROF_HOT_SIZE 512
+static struct {
+	u32 op[256];
+	u32 op0f[256];
+	u32 exc[32];
+	u32 irq;
+	u32 halt;
+	u32 samples;
+	u32 samples_evicted;
+	u32 dcache_hit;
+	u32 dcache_fill;
+	uword hot_eip[PROF_HOT_SIZE];
+	u32 hot_hits[PROF_HOT_SIZE];
+} prof;
+
+/* When all 8 probe slots are taken, the coldest one is handed to the
+ * new EIP with its count plus one (space-saving), so a hot address that
+ * shows up late still climbs into the table. The inherited counts are
+ * reported as evicted. */
+static void prof_sample(uword eip)
+{
+	unsigned h = (eip * 2654435761u) >> 23;
+	unsigned victim = h % PROF_HOT_SIZE;
+	prof.samples++;
+	for (int n = 0; n < 8; n++, h++) {
+		h %= PROF_HOT_SIZE;
+		if (prof.hot_hits[h] == 0)
+			prof.hot_eip[h] = eip;
+		if (prof.hot_eip[h] == eip) {
+			prof.hot_hits[h]++;
+			return;
+		}
+		if (prof.hot_hits[h] < prof.hot_hits[victim])
+			victim = h;
+	}
+	prof.samples_evicted += prof.hot_hits[victim];
+	prof.hot_eip[victim] = eip;
+	prof.hot_hits[victim]++;
+}
+
+/* Decoded-cache hits skip the prefix loop; count what it would have seen */
+static void prof_decoded(int b1, bool pfx66, bool pfx67, int rep, int seg)
+{
+	static const u8 seg_prefix[6] = { 0x26, 0x2e, 0x36, 0x3e, 0x64, 0x65 };
+	prof.dcache_hit++;
+	if (pfx66)
+		prof.op[0x66]++;
+	if (pfx67)
+		prof.op[0x67]++;
+	if (rep)
+		prof.op[rep == 1 ? 0xf3 : 0xf2]++;
+	if (seg >= 0)
+		prof.op[seg_prefix[seg]]++;
+	prof.op[b1]++;
+}
+
+#define PROF(stmt) do { stmt; } while (0)
+#define PROF_SAMPLE() \
+	if ((cpu->cycle & (PROF_SAMPLE_PERIOD - 1)) == 0) \
+		prof_sample(cpu->seg[SEG_CS].base + cpu->ip)
+#else
+#define PROF(stmt) (void)0
+#define PROF_SAMPLE() (void)0
+#endif
+
 #define likely(x) __builtin_expect(!!(x), 1)
 #define unlikely(x) __builtin_expect(!!(x), 0)
 #define wordmask ((uword) ((sword) -1))
@@ -446,11 +517,30 @@ static inline int get_IOPL(CPUI386 *cpu)
 /* MMU */
 #define CR0_PG (1<<31)
 #define CR0_WP (0x10000)
+#define CR4_PGE (1<<7)
+/*
+ * The data TLB is tlb_size entries split into sets of I386_DTLB_WAYS; the
+ * instruction TLB only refills ifetch, so it can be much smaller. Sizes and
+ * ways must be powers of two, ways 1, 2 or 4.
+ */
+#ifndef tlb_size
 #ifdef BUILD_ESP32
 #define tlb_size 256
 #else
 #define tlb_size 512
 #endif
+#endif
+#ifndef I386_DTLB_WAYS
+#define I386_DTLB_WAYS 4
+#endif
+#ifndef I386_ITLB_SIZE
+#define I386_ITLB_SIZE 32
+#endif
+#ifndef I386_ITLB_WAYS
+#define I386_ITLB_WAYS 2
+#endif
+#define DTLB_SETS (tlb_size / I386_DTLB_WAYS)
+#define ITLB_SETS (I386_ITLB_SIZE / I386_ITLB_WAYS)
 typedef struct {
 	enum {
 		ADDR_OK1,
@@ -458,14 +548,91 @@ typedef struct {
 	} res;
 	uword addr1;
 	uword addr2;
+	int pmem;	/* PMEM_* type of the page holding addr1 */
+	int pmem2;	/* and of the page holding addr2 (ADDR_OK2) */
 } OptAddr;
 
+/* Type of the physical page holding addr */
+static inline int pmem_type(CPUI386 *cpu, uword addr)
+{
+	if (likely((addr >> 12) < cpu->pmem.npages))
+		return cpu->pmem.page[addr >> 12];
+	for (int i = 0; i < I386_MMIO_MAX; i++) {
+		if (addr - cpu->pmem.mmio[i].base < cpu->pmem.mmio[i].size)
+			return PMEM_MMIO + i;
+	}
+	return PMEM_UNMAPPED;
+}
+
 static void tlb_clear(CPUI386 *cpu)
 {
 	for (int i = 0; i < tlb_size; i++) {
-		cpu->tlb.tab[i].lpgno = -1;
+		cpu->tlb.d.tab[i].lpgno = -1;
+	}
+	for (int i = 0; i < I386_ITLB_SIZE; i++) {
+		cpu->tlb.i.tab[i].lpgno = -1;
+	}
+	cpu->ifetch.laddr = -1;
+	cpu->tlb.flushes++;
+}
+
+/* CR3 load: drop everything but global pages */
+static void tlb_flush_nonglobal(CPUI386 *cpu)
+{
+	if (!(cpu->cr4 & CR4_PGE)) {
+		tlb_clear(cpu);
+		return;
+	}
+	for (int i = 0; i < tlb_size; i++) {
+		if (!cpu->tlb.d.tab[i].global)
+			cpu->tlb.d.tab[i].lpgno = -1;
+	}
+	for (int i = 0; i < I386_ITLB_SIZE; i++) {
+		if (!cpu->tlb.i.tab[i].global)
+			cpu->tlb.i.tab[i].lpgno = -1;
 	}
 	cpu->ifetch.laddr = -1;
+	cpu->tlb.flushes++;
+}
+
+static void tlb_side_invalidate(struct tlb_side *t, int sets, int ways, uword lpgno)
+{
+	struct tlb_entry *ent = &(t->tab[(lpgno & (sets - 1)) * ways]);
+	for (int w = 0; w < ways; w++) {
+		if (ent[w].lpgno == lpgno)
+			ent[w].lpgno = -1;
+	}
+}
+
+/* INVLPG: drop one page, global or not */
+static void tlb_invalidate(CPUI386 *cpu, uword laddr)
+{
+	uword lpgno = laddr >> 12;
+	tlb_side_invalidate(&(cpu->tlb.d), DTLB_SETS, I386_DTLB_WAYS, lpgno);
+	tlb_side_invalidate(&(cpu->tlb.i), ITLB_SETS, I386_ITLB_WAYS, lpgno);
+	if ((cpu->ifetch.laddr >> 12) == lpgno)
+		cpu->ifetch.laddr = -1;
+}
+
+/*
+ * Tree pseudo-LRU: with 4 ways bit 0 picks the half holding the victim and
+ * bits 1/2 the way within the left/right half; with 2 ways bit 0 is the victim.
+ */
+static inline void plru_touch(u8 *p, int ways, int w)
+{
+	if (ways == 2)
+		*p = w ^ 1;
+	else if (ways == 4)
+		*p = w < 2 ? 1 | (w == 0) << 1 | (*p & 4) : (*p & 2) | (w == 2) << 2;
+}
+
+static inline int plru_victim(u8 p, int ways)
+{
+	if (ways == 2)
+		return p & 1;
+	if (ways == 4)
+		return !(p & 1) ? (p >> 1) & 1 : 2 + ((p >> 2) & 1);
+	return 0;
 }
 
 static int pte_lookup[2][4][2][2] = { //[wp != 0][(pte >> 1) & 3][cpl > 0][rwm > 1]
@@ -508,24 +675,47 @@ static bool IRAM_ATTR tlb_refill(CPUI386 *cpu, struct tlb_entry *ent, uword lpgn
 	pte = pte & ((pde & 7) | 0xfffffff8);
 	ent->pte_lookup = pte_lookup[!!(cpu->cr0 & CR0_WP)][(pte >> 1) & 3];
 	ent->ppte = &(mem[base_addr2 + j * 4]);
+	ent->global = (cpu->cr4 & CR4_PGE) && (pte & (1 << 8));
+	ent->pmem = pmem_type(cpu, pte & ~0xfff);
 	return true;
 }
 
-static bool IRAM_ATTR translate_lpgno(CPUI386 *cpu, int rwm, uword lpgno, uword laddr, int cpl, uword *paddr)
+/*
+ * Entry for lpgno in one side of the TLB. On a miss the pseudo-LRU victim
+ * of the set is refilled from the page tables; NULL if the page is absent.
+ */
+static inline struct tlb_entry *tlb_get(CPUI386 *cpu, struct tlb_side *t, int sets, int ways, uword lpgno)
 {
-	struct tlb_entry *ent = &(cpu->tlb.tab[lpgno % tlb_size]);
-	if (ent->lpgno != lpgno) {
-		if (!tlb_refill(cpu, ent, lpgno)) {
-			cpu->cr2 = laddr;
-			cpu->excno = EX_PF;
-			cpu->excerr = 0;
-			if (rwm & 2)
-				cpu->excerr |= 2;
-			if (cpl)
-				cpu->excerr |= 4;
-			return false;
+	int set = lpgno & (sets - 1);
+	struct tlb_entry *ent = &(t->tab[set * ways]);
+	for (int w = 0; w < ways; w++) {
+		if (ent[w].lpgno == lpgno) {
+			plru_touch(&(t->plru[set]), ways, w);
+			t->hits++;
+			return &ent[w];
 		}
 	}
+	int w = plru_victim(t->plru[set], ways);
+	t->misses++;
+	if (!tlb_refill(cpu, &ent[w], lpgno))
+		return NULL;
+	plru_touch(&(t->plru[set]), ways, w);
+	return &ent[w];
+}
+
+static bool IRAM_ATTR translate_lpgno(CPUI386 *cpu, int rwm, uword lpgno, uword laddr, int cpl, uword *paddr, int *pmem)
+{
+	struct tlb_entry *ent = tlb_get(cpu, &(cpu->tlb.d), DTLB_SETS, I386_DTLB_WAYS, lpgno);
+	if (!ent) {
+		cpu->cr2 = laddr;
+		cpu->excno = EX_PF;
+		cpu->excerr = 0;
+		if (rwm & 2)
+			cpu->excerr |= 2;
+		if (cpl)
+			cpu->excerr |= 4;
+		return false;
+	}
 	if (ent->pte_lookup[cpl > 0][rwm > 1]) {
 		cpu->cr2 = laddr;
 		cpu->excno = EX_PF;
@@ -538,6 +728,7 @@ static bool IRAM_ATTR translate_lpgno(CPUI386 *cpu, int rwm, uword lpgno, uword
 		return false;
 	}
 	*paddr = ent->xaddr ^ laddr;
+	*pmem = ent->pmem;
 	if (rwm & 2) {
 		*(ent->ppte) |= 1 << 6; // dirty
 //		pstore8(cpu, ent->ppte,
@@ -551,18 +742,19 @@ static bool IRAM_ATTR translate_laddr(CPUI386 *cpu, OptAddr *res, int rwm, uword
 	if (cpu->cr0 & CR0_PG) {
 		uword lpgno = laddr >> 12;
 		uword paddr;
-		TRY(translate_lpgno(cpu, rwm, lpgno, laddr, cpl, &paddr));
+		TRY(translate_lpgno(cpu, rwm, lpgno, laddr, cpl, &paddr, &res->pmem));
 		res->res = ADDR_OK1;
 		res->addr1 = paddr;
 		if ((laddr & 0xfff) > 0x1000 - size) {
 			lpgno++;
-			TRY(translate_lpgno(cpu, rwm, lpgno, lpgno << 12, cpl, &paddr));
+			TRY(translate_lpgno(cpu, rwm, lpgno, lpgno << 12, cpl, &paddr, &res->pmem2));
 			res->res = ADDR_OK2;
 			res->addr2 = paddr;
 		}
 	} else {
 		res->res = ADDR_OK1;
 		res->addr1 = laddr;
+		res->pmem = pmem_type(cpu, laddr);
 	}
 	return true;
 }
@@ -602,16 +794,14 @@ static bool IRAM_ATTR translate8r(CPUI386 *cpu, OptAddr *res, int seg, uword add
 
 	if (cpu->cr0 & CR0_PG) {
 		uword lpgno = laddr >> 12;
-		struct tlb_entry *ent = &(cpu->tlb.tab[lpgno % tlb_size]);
-		if (ent->lpgno != lpgno) {
-			if (!tlb_refill(cpu, ent, lpgno)) {
-				cpu->cr2 = laddr;
-				cpu->excno = EX_PF;
-				cpu->excerr = 0;
-				if (cpu->cpl)
-					cpu->excerr |= 4;
-				return false;
-			}
+		struct tlb_entry *ent = tlb_get(cpu, &(cpu->tlb.i), ITLB_SETS, I386_ITLB_WAYS, lpgno);
+		if (!ent) {
+			cpu->cr2 = laddr;
+			cpu->excno = EX_PF;
+			cpu->excerr = 0;
+			if (cpu->cpl)
+				cpu->excerr |= 4;
+			return false;
 		}
 		if (ent->pte_lookup[cpu->cpl > 0][0]) {
 			cpu->cr2 = laddr;
@@ -624,9 +814,11 @@ static bool IRAM_ATTR translate8r(CPUI386 *cpu, OptAddr *res, int seg, uword add
 		}
 		res->res = ADDR_OK1;
 		res->addr1 = ent->xaddr ^ laddr;
+		res->pmem = ent->pmem;
 	} else {
 		res->res = ADDR_OK1;
 		res->addr1 = laddr;
+		res->pmem = pmem_type(cpu, laddr);
 	}
 
 	return true;
@@ -647,29 +839,218 @@ static inline bool translate32(CPUI386 *cpu, OptAddr *res, int rwm, int seg, uwo
 	return translate(cpu, res, rwm, seg, addr, 4, cpu->cpl);
 }
 
-static inline bool in_iomem(uword addr)
+/*
+ * Decoded instruction cache: prefixes, opcode, modrm and effective address
+ * form of instructions in RAM, looked up by physical address so that hot
+ * loops skip the prefix loop and modsib. Entries are filled lazily while
+ * an instruction decodes the slow way. Each physical page has a generation
+ * which is odd while the cache may hold entries of that page; a store to
+ * such a page bumps it, killing all of the page's entries at once.
+ */
+#ifndef I386_DCACHE_SIZE
+#ifdef RP2350_BUILD
+#define I386_DCACHE_SIZE 1024
+#else
+#define I386_DCACHE_SIZE 8192
+#endif
+#endif
+
+/* RAM is far below 2 GB, so the top tag bit can hold the CS size */
+#define DC_TAG_CODE16 0x80000000u
+
+enum {
+	DC_OPSZ16 = 0x02,
+	DC_ADSZ16 = 0x04,
+	DC_REP_SHIFT = 3,	/* 2 bits */
+	DC_OP = 0x20,		/* b1/oplen/prefix state valid */
+	DC_MODRM = 0x40,
+	DC_EA = 0x80,
+};
+#define DC_NOREG 8
+#define DC_SS 0x10
+
+static inline void dcache_write(CPUI386 *cpu, uword addr, int size)
 {
-	return (addr >= 0xa0000 && addr < 0xc0000) || addr >= 0xe0000000;
+	u32 *gen = cpu->dcache.gen;
+	if (gen) {
+		u32 *g = &gen[addr >> 12];
+		if (unlikely(*g & 1))
+			(*g)++;
+		g = &gen[(addr + size - 1) >> 12];
+		if (unlikely(*g & 1))
+			(*g)++;
+	}
 }
 
-static u8 IRAM_ATTR load8(CPUI386 *cpu, OptAddr *res)
+void cpu_invalidate_code(CPUI386 *cpu, uword addr, uword len)
 {
-	uword addr = res->addr1;
-	if (in_iomem(addr) && cpu->cb.iomem_read8)
-		return cpu->cb.iomem_read8(cpu->cb.iomem, addr);
-	if (unlikely(addr >= cpu->phys_mem_size)) {
-		return 0;
+	if (!cpu->dcache.gen || !len)
+		return;
+	uword first = addr >> 12;
+	uword last = (addr + len - 1) >> 12;
+	for (uword p = first; p <= last && p < cpu->dcache.npages; p++) {
+		if (cpu->dcache.gen[p] & 1)
+			cpu->dcache.gen[p]++;
 	}
-	return pload8(cpu, addr);
 }
 
-static u16 IRAM_ATTR load16(CPUI386 *cpu, OptAddr *res)
+static void dcache_flush(CPUI386 *cpu)
+{
+	if (!cpu->dcache.tab)
+		return;
+	for (int i = 0; i < I386_DCACHE_SIZE; i++)
+		cpu->dcache.tab[i].tag = -1;
+}
+
+/*
+ * Entry for the instruction at cpu->ip, or NULL when it is not cacheable.
+ * Only instructions that lie entirely within the RAM page currently mapped
+ * by ifetch are cached, so the lookup needs no translation of its own.
+ */
+static inline struct dcache_entry *dcache_lookup(CPUI386 *cpu, bool code16)
+{
+	uword laddr = cpu->seg[SEG_CS].base + cpu->ip;
+	if ((laddr ^ cpu->ifetch.laddr) > 4096 - 15 || !cpu->ifetch.dcache)
+		return NULL;
+	uword paddr = cpu->ifetch.xaddr ^ laddr;
+	uword tag = paddr | (code16 ? DC_TAG_CODE16 : 0);
+	struct dcache_entry *dc = &cpu->dcache.tab[(paddr ^ (paddr >> 12)) & (I386_DCACHE_SIZE - 1)];
+	u32 *g = &cpu->dcache.gen[paddr >> 12];
+	if (likely(dc->tag == tag && dc->gen == *g))
+		return dc;
+	if (!(*g & 1))
+		(*g)++;
+	PROF(prof.dcache_fill++);
+	dc->tag = tag;
+	dc->gen = *g;
+	dc->flags = 0;
+	return dc;
+}
+
+/*
+ * Device and unmapped pages. RAM and ROM pages take the inline path in
+ * load/store; everything else lands here with the page type the TLB (or
+ * pmem_type() without paging) resolved for addr.
+ */
+#define MMIO_REGION(pmem) (&cpu->pmem.mmio[(pmem) - PMEM_MMIO])
+
+static u8 mmio_read8(CPUI386 *cpu, int pmem, uword addr)
 {
-	if (in_iomem(res->addr1) && cpu->cb.iomem_read16)
-		return cpu->cb.iomem_read16(cpu->cb.iomem, res->addr1);
-	if (unlikely(res->addr1 >= cpu->phys_mem_size)) {
+	if (pmem < PMEM_MMIO)
 		return 0;
+	return MMIO_REGION(pmem)->ops->read8(MMIO_REGION(pmem)->opaque,
+					     addr - MMIO_REGION(pmem)->base);
+}
+
+static u16 mmio_read16(CPUI386 *cpu, int pmem, uword addr)
+{
+	if (pmem < PMEM_MMIO)
+		return 0;
+	return MMIO_REGION(pmem)->ops->read16(MMIO_REGION(pmem)->opaque,
+					      addr - MMIO_REGION(pmem)->base);
+}
+
+static u32 mmio_read32(CPUI386 *cpu, int pmem, uword addr)
+{
+	if (pmem < PMEM_MMIO)
+		return 0;
+	return MMIO_REGION(pmem)->ops->read32(MMIO_REGION(pmem)->opaque,
+					      addr - MMIO_REGION(pmem)->base);
+}
+
+static void mmio_write8(CPUI386 *cpu, int pmem, uword addr, u8 val)
+{
+	if (pmem < PMEM_MMIO)
+		return;
+	MMIO_REGION(pmem)->ops->write8(MMIO_REGION(pmem)->opaque,
+				       addr - MMIO_REGION(pmem)->base, val);
+}
+
+static void mmio_write16(CPUI386 *cpu, int pmem, uword addr, u16 val)
+{
+	if (pmem < PMEM_MMIO)
+		return;
+	MMIO_REGION(pmem)->ops->write16(MMIO_REGION(pmem)->opaque,
+					addr - MMIO_REGION(pmem)->base, val);
+}
+
+static void mmio_write32(CPUI386 *cpu, int pmem, uword addr, u32 val)
+{
+	if (pmem < PMEM_MMIO)
+		return;
+	MMIO_REGION(pmem)->ops->write32(MMIO_REGION(pmem)->opaque,
+					addr - MMIO_REGION(pmem)->base, val);
+}
+
+/* Copy len bytes from RAM at src into a device page in one call */
+static bool mmio_write_string(CPUI386 *cpu, int pmem, uword addr, uword src, int len)
+{
+	if (pmem < PMEM_MMIO || !MMIO_REGION(pmem)->ops->write_string)
+		return false;
+	return MMIO_REGION(pmem)->ops->write_string(MMIO_REGION(pmem)->opaque,
+						    addr - MMIO_REGION(pmem)->base,
+						    cpu->phys_mem + src, len);
+}
+
+static bool mmio_fill(CPUI386 *cpu, int pmem, uword addr, u32 val, int size, int count)
+{
+	if (pmem < PMEM_MMIO || !MMIO_REGION(pmem)->ops->fill)
+		return false;
+	return MMIO_REGION(pmem)->ops->fill(MMIO_REGION(pmem)->opaque,
+					    addr - MMIO_REGION(pmem)->base,
+					    val, size, count);
+}
+
+static u8 IRAM_ATTR load8(CPUI386 *cpu, OptAddr *res)
+{
+	if (unlikely(res->pmem > PMEM_ROM))
+		return mmio_read8(cpu, res->pmem, res->addr1);
+	return pload8(cpu, res->addr1);
+}
+
+/*
+ * Accesses split across two pages whose types differ, or where one side
+ * is a device, go byte by byte so each byte reaches its own page.
+ */
+static bool split_bytewise(OptAddr *res)
+{
+	return res->pmem != res->pmem2 || res->pmem > PMEM_ROM;
+}
+
+static u32 load_split(CPUI386 *cpu, OptAddr *res, int size)
+{
+	int n1 = 0x1000 - (res->addr1 & 0xfff);
+	u32 val = 0;
+	for (int i = 0; i < size; i++) {
+		int pmem = i < n1 ? res->pmem : res->pmem2;
+		uword addr = i < n1 ? res->addr1 + i : res->addr2 + (i - n1);
+		u8 b = pmem > PMEM_ROM ? mmio_read8(cpu, pmem, addr) : pload8(cpu, addr);
+		val |= (u32) b << (i * 8);
+	}
+	return val;
+}
+
+static void store_split(CPUI386 *cpu, OptAddr *res, int size, u32 val)
+{
+	int n1 = 0x1000 - (res->addr1 & 0xfff);
+	for (int i = 0; i < size; i++, val >>= 8) {
+		int pmem = i < n1 ? res->pmem : res->pmem2;
+		uword addr = i < n1 ? res->addr1 + i : res->addr2 + (i - n1);
+		if (pmem != PMEM_RAM) {
+			mmio_write8(cpu, pmem, addr, val);
+			continue;
+		}
+		cpu_invalidate_code(cpu, addr, 1);
+		pstore8(cpu, addr, val);
 	}
+}
+
+static u16 IRAM_ATTR load16(CPUI386 *cpu, OptAddr *res)
+{
+	if (unlikely(res->res == ADDR_OK2 && split_bytewise(res)))
+		return load_split(cpu, res, 2);
+	if (unlikely(res->pmem > PMEM_ROM))
+		return mmio_read16(cpu, res->pmem, res->addr1);
 	if (likely(res->res == ADDR_OK1))
 		return pload16(cpu, res->addr1);
 	else
@@ -678,11 +1059,10 @@ static u16 IRAM_ATTR load16(CPUI386 *cpu, OptAddr *res)
 
 static u32 IRAM_ATTR load32(CPUI386 *cpu, OptAddr *res)
 {
-	if (in_iomem(res->addr1) && cpu->cb.iomem_read32)
-		return cpu->cb.iomem_read32(cpu->cb.iomem, res->addr1);
-	if (unlikely(res->addr1 >= cpu->phys_mem_size)) {
-		return 0;
-	}
+	if (unlikely(res->res == ADDR_OK2 && split_bytewise(res)))
+		return load_split(cpu, res, 4);
+	if (unlikely(res->pmem > PMEM_ROM))
+		return mmio_read32(cpu, res->pmem, res->addr1);
 	if (likely(res->res == ADDR_OK1)) {
 		return pload32(cpu, res->addr1);
 	} else {
@@ -703,28 +1083,30 @@ static u32 IRAM_ATTR load32(CPUI386 *cpu, OptAddr *res)
 static void IRAM_ATTR store8(CPUI386 *cpu, OptAddr *res, u8 val)
 {
 	uword addr = res->addr1;
-	if (in_iomem(addr) && cpu->cb.iomem_write8) {
-		cpu->cb.iomem_write8(cpu->cb.iomem, addr, val);
-		return;
-	}
-	if (unlikely(addr >= cpu->phys_mem_size)) {
+	if (unlikely(res->pmem != PMEM_RAM)) {
+		mmio_write8(cpu, res->pmem, addr, val);
 		return;
 	}
+	dcache_write(cpu, addr, 1);
 	pstore8(cpu, addr, val);
 }
 
 static void IRAM_ATTR store16(CPUI386 *cpu, OptAddr *res, u16 val)
 {
-	if (in_iomem(res->addr1) && cpu->cb.iomem_write16) {
-		cpu->cb.iomem_write16(cpu->cb.iomem, res->addr1, val);
+	if (unlikely(res->res == ADDR_OK2 && split_bytewise(res))) {
+		store_split(cpu, res, 2, val);
 		return;
 	}
-	if (unlikely(res->addr1 >= cpu->phys_mem_size)) {
+	if (unlikely(res->pmem != PMEM_RAM)) {
+		mmio_write16(cpu, res->pmem, res->addr1, val);
 		return;
 	}
 	if (likely(res->res == ADDR_OK1)) {
+		dcache_write(cpu, res->addr1, 2);
 		pstore16(cpu, res->addr1, val);
 	} else {
+		cpu_invalidate_code(cpu, res->addr1, 1);
+		cpu_invalidate_code(cpu, res->addr2, 1);
 		pstore8(cpu, res->addr1, val);
 		pstore8(cpu, res->addr2, val >> 8);
 	}
@@ -732,16 +1114,20 @@ static void IRAM_ATTR store16(CPUI386 *cpu, OptAddr *res, u16 val)
 
 static void IRAM_ATTR store32(CPUI386 *cpu, OptAddr *res, u32 val)
 {
-	if (in_iomem(res->addr1) && cpu->cb.iomem_write32) {
-		cpu->cb.iomem_write32(cpu->cb.iomem, res->addr1, val);
+	if (unlikely(res->res == ADDR_OK2 && split_bytewise(res))) {
+		store_split(cpu, res, 4, val);
 		return;
 	}
-	if (unlikely(res->addr1 >= cpu->phys_mem_size)) {
+	if (unlikely(res->pmem != PMEM_RAM)) {
+		mmio_write32(cpu, res->pmem, res->addr1, val);
 		return;
 	}
 	if (likely(res->res == ADDR_OK1)) {
+		dcache_write(cpu, res->addr1, 4);
 		pstore32(cpu, res->addr1, val);
 	} else {
+		cpu_invalidate_code(cpu, res->addr1, 1);
+		cpu_invalidate_code(cpu, res->addr2, 3);
 		switch(res->addr1 & 0xf) {
 		case 0xf:
 			pstore8(cpu, res->addr1, val);
@@ -792,8 +1178,14 @@ static bool IRAM_ATTR peek8(CPUI386 *cpu, u8 *val)
 	OptAddr res;
 	TRY(translate8r(cpu, &res, SEG_CS, cpu->next_ip));
 	*val = load8(cpu, &res);
+	if (res.pmem > PMEM_ROM) {
+		/* code in device memory is fetched through load8 every time */
+		cpu->ifetch.laddr = -1;
+		return true;
+	}
 	cpu->ifetch.laddr = laddr & (~4095ul);
 	cpu->ifetch.xaddr = res.addr1 ^ laddr;
+	cpu->ifetch.dcache = cpu->dcache.tab != NULL;
 	return true;
 }
 
@@ -911,10 +1303,108 @@ static inline bool modsib16(CPUI386 *cpu, int mod, int rm, uword *addr, int *seg
 	return true;
 }
 
-static bool IRAM_ATTR modsib(CPUI386 *cpu, int adsz16, int mod, int rm, uword *addr, int *seg)
+/* Decode the addressing form into a dcache entry; modsib16/32 in table form */
+static bool dcache_decode_ea(CPUI386 *cpu, struct dcache_entry *dc, int adsz16, int mod, int rm)
 {
-	if (adsz16) return modsib16(cpu, mod, rm, addr, seg);
-	else return modsib32(cpu, mod, rm, addr, seg);
+	static const u8 base16[8] = { 3, 3, 5 | DC_SS, 5 | DC_SS, 6, 7, 5 | DC_SS, 3 };
+	static const u8 index16[8] = { 6, 7, 6, 7, DC_NOREG, DC_NOREG, DC_NOREG, DC_NOREG };
+	uword start = cpu->next_ip;
+	dc->disp = 0;
+	dc->index = DC_NOREG;
+	if (adsz16) {
+		if (rm == 6 && mod == 0) {
+			u16 imm16;
+			TRY(fetch16(cpu, &imm16));
+			dc->disp = imm16;
+			dc->base = DC_NOREG;
+		} else {
+			dc->base = base16[rm];
+			dc->index = index16[rm];
+		}
+		if (mod == 1) {
+			u8 imm8;
+			TRY(fetch8(cpu, &imm8));
+			dc->disp = (s8) imm8;
+		} else if (mod == 2) {
+			u16 imm16;
+			TRY(fetch16(cpu, &imm16));
+			dc->disp = imm16;
+		}
+	} else {
+		if (rm == 4) {
+			u8 sib;
+			TRY(fetch8(cpu, &sib));
+			int b = sib & 7;
+			if (b == 5 && mod == 0) {
+				TRY(fetch32(cpu, &dc->disp));
+				dc->base = DC_NOREG;
+			} else {
+				dc->base = b | ((b == 4 || b == 5) ? DC_SS : 0);
+			}
+			int i = (sib >> 3) & 7;
+			if (i != 4)
+				dc->index = i | ((sib >> 6) << 4);
+		} else if (rm == 5 && mod == 0) {
+			TRY(fetch32(cpu, &dc->disp));
+			dc->base = DC_NOREG;
+		} else {
+			dc->base = rm | (rm == 5 ? DC_SS : 0);
+		}
+		if (mod == 1) {
+			u8 imm8;
+			TRY(fetch8(cpu, &imm8));
+			dc->disp = (s8) imm8;
+		} else if (mod == 2) {
+			u32 imm32;
+			TRY(fetch32(cpu, &imm32));
+			dc->disp = imm32;
+		}
+	}
+	dc->ealen = cpu->next_ip - start;
+	dc->flags |= DC_EA;
+	return true;
+}
+
+static bool IRAM_ATTR modsib(CPUI386 *cpu, struct dcache_entry *dc, int adsz16, int mod, int rm, uword *addr, int *seg)
+{
+	if (!dc) {
+		if (adsz16) return modsib16(cpu, mod, rm, addr, seg);
+		else return modsib32(cpu, mod, rm, addr, seg);
+	}
+	if (likely(dc->flags & DC_EA))
+		cpu->next_ip += dc->ealen;
+	else
+		TRY(dcache_decode_ea(cpu, dc, adsz16, mod, rm));
+	uword a = dc->disp;
+	if ((dc->base & 15) != DC_NOREG)
+		a += REGi(dc->base & 15);
+	if ((dc->index & 15) != DC_NOREG)
+		a += REGi(dc->index & 15) << (dc->index >> 4);
+	*addr = adsz16 ? (a & 0xffff) : a;
+	if (*seg == -1)
+		*seg = (dc->base & DC_SS) ? SEG_SS : SEG_DS;
+	return true;
+}
+
+static inline bool peek_modrm(CPUI386 *cpu, struct dcache_entry *dc, u8 *modrm)
+{
+	if (dc && (dc->flags & DC_MODRM)) {
+		*modrm = dc->modrm;
+		return true;
+	}
+	TRY(peek8(cpu, modrm));
+	if (dc) {
+		dc->modrm = *modrm;
+		dc->flags |= DC_MODRM;
+	}
+	return true;
+}
+
+static inline bool fetch_modrm(CPUI386 *cpu, struct dcache_entry *dc, u8 *modrm)
+{
+	TRY(peek_modrm(cpu, dc, modrm));
+	cpu->next_ip++;
+	return true;
 }
 
 static bool read_desc(CPUI386 *cpu, int sel, uword *w1, uword *w2)
@@ -1049,13 +1539,13 @@ static inline void clear_segs(CPUI386 *cpu)
 #define _(rwm, inst) inst()
 
 #define E_helper(BIT, SUFFIX, rwm, INST) \
-	TRY(fetch8(cpu, &modrm)); \
+	TRY(fetch_modrm(cpu, dc, &modrm)); \
 	int mod = modrm >> 6; \
 	int rm = modrm & 7; \
 	if (mod == 3) { \
 		INST ## SUFFIX(rm, lreg ## BIT, sreg ## BIT) \
 	} else { \
-		TRY(modsib(cpu, adsz16, mod, rm, &addr, &curr_seg)); \
+		TRY(modsib(cpu, dc, adsz16, mod, rm, &addr, &curr_seg)); \
 		TRY(translate ## BIT(cpu, &meml, rwm, curr_seg, addr)); \
 		INST ## SUFFIX(&meml, laddr ## BIT, saddr ## BIT) \
 	}
@@ -1064,7 +1554,7 @@ static inline void clear_segs(CPUI386 *cpu)
 #define Ev(...) if (opsz16) { E_helper(16, w, __VA_ARGS__) } else { E_helper(32, d, __VA_ARGS__) }
 
 #define EG_helper(PM, BT, BIT, SUFFIX, rwm, INST) \
-	TRY(fetch8(cpu, &modrm)); \
+	TRY(fetch_modrm(cpu, dc, &modrm)); \
 	int reg = (modrm >> 3) & 7; \
 	int mod = modrm >> 6; \
 	int rm = modrm & 7; \
@@ -1072,7 +1562,7 @@ static inline void clear_segs(CPUI386 *cpu)
 	if (mod == 3) { \
 		INST ## SUFFIX(rm, reg, lreg ## BIT, sreg ## BIT, lreg ## BIT, sreg ## BIT) \
 	} else { \
-		TRY(modsib(cpu, adsz16, mod, rm, &addr, &curr_seg)); \
+		TRY(modsib(cpu, dc, adsz16, mod, rm, &addr, &curr_seg)); \
 		if (BT) addr += lreg ## BIT(reg) / BIT * (BIT / 8); \
 		TRY(translate ## BIT(cpu, &meml, rwm, curr_seg, addr)); \
 		INST ## SUFFIX(&meml, reg, laddr ## BIT, saddr ## BIT, lreg ## BIT, sreg ## BIT) \
@@ -1085,7 +1575,7 @@ static inline void clear_segs(CPUI386 *cpu)
 #define BTEvGv(...) if (opsz16) { EG_helper(false, true, 16, w, __VA_ARGS__) } else { EG_helper(false, true, 32, d, __VA_ARGS__) }
 
 #define EGIb_helper(BIT, SUFFIX, rwm, INST) \
-	TRY(fetch8(cpu, &modrm)); \
+	TRY(fetch_modrm(cpu, dc, &modrm)); \
 	int reg = (modrm >> 3) & 7; \
 	int mod = modrm >> 6; \
 	int rm = modrm & 7; \
@@ -1094,7 +1584,7 @@ static inline void clear_segs(CPUI386 *cpu)
 		TRY(fetch8(cpu, &imm8)); \
 		INST ## SUFFIX(rm, reg, imm8, lreg ## BIT, sreg ## BIT, lreg ## BIT, sreg ## BIT, limm, 0) \
 	} else { \
-		TRY(modsib(cpu, adsz16, mod, rm, &addr, &curr_seg)); \
+		TRY(modsib(cpu, dc, adsz16, mod, rm, &addr, &curr_seg)); \
 		TRY(fetch8(cpu, &imm8)); \
 		TRY(translate ## BIT(cpu, &meml, rwm, curr_seg, addr)); \
 		INST ## SUFFIX(&meml, reg, imm8, laddr ## BIT, saddr ## BIT, lreg ## BIT, sreg ## BIT, limm, 0) \
@@ -1103,14 +1593,14 @@ static inline void clear_segs(CPUI386 *cpu)
 #define EvGvIb(...) if (opsz16) { EGIb_helper(16, w, __VA_ARGS__) } else { EGIb_helper(32, d, __VA_ARGS__) }
 
 #define EGCL_helper(BIT, SUFFIX, rwm, INST) \
-	TRY(fetch8(cpu, &modrm)); \
+	TRY(fetch_modrm(cpu, dc, &modrm)); \
 	int reg = (modrm >> 3) & 7; \
 	int mod = modrm >> 6; \
 	int rm = modrm & 7; \
 	if (mod == 3) { \
 		INST ## SUFFIX(rm, reg, 1, lreg ## BIT, sreg ## BIT, lreg ## BIT, sreg ## BIT, lreg8, sreg8) \
 	} else { \
-		TRY(modsib(cpu, adsz16, mod, rm, &addr, &curr_seg)); \
+		TRY(modsib(cpu, dc, adsz16, mod, rm, &addr, &curr_seg)); \
 		TRY(translate ## BIT(cpu, &meml, rwm, curr_seg, addr)); \
 		INST ## SUFFIX(&meml, reg, 1, laddr ## BIT, saddr ## BIT, lreg ## BIT, sreg ## BIT, lreg8, sreg8) \
 	}
@@ -1118,7 +1608,7 @@ static inline void clear_segs(CPUI386 *cpu)
 #define EvGvCL(...) if (opsz16) { EGCL_helper(16, w, __VA_ARGS__) } else { EGCL_helper(32, d, __VA_ARGS__) }
 
 #define EI_helper(BIT, SUFFIX, rwm, INST) \
-	TRY(fetch8(cpu, &modrm)); \
+	TRY(fetch_modrm(cpu, dc, &modrm)); \
 	int mod = modrm >> 6; \
 	int rm = modrm & 7; \
 	u ## BIT imm ## BIT; \
@@ -1126,7 +1616,7 @@ static inline void clear_segs(CPUI386 *cpu)
 		TRY(fetch ## BIT(cpu, &imm ## BIT)); \
 		INST ## SUFFIX(rm, imm ## BIT, lreg ## BIT, sreg ## BIT, limm, 0) \
 	} else { \
-		TRY(modsib(cpu, adsz16, mod, rm, &addr, &curr_seg)); \
+		TRY(modsib(cpu, dc, adsz16, mod, rm, &addr, &curr_seg)); \
 		TRY(fetch ## BIT(cpu, &imm ## BIT)); \
 		TRY(translate ## BIT(cpu, &meml, rwm, curr_seg, addr)); \
 		INST ## SUFFIX(&meml, imm ## BIT, laddr ## BIT, saddr ## BIT, limm, 0) \
@@ -1136,7 +1626,7 @@ static inline void clear_segs(CPUI386 *cpu)
 #define EvIv(...) if (opsz16) { EI_helper(16, w, __VA_ARGS__) } else { EI_helper(32, d, __VA_ARGS__) }
 
 #define EIb_helper(BT, BIT, SUFFIX, rwm, INST) \
-	TRY(fetch8(cpu, &modrm)); \
+	TRY(fetch_modrm(cpu, dc, &modrm)); \
 	int mod = modrm >> 6; \
 	int rm = modrm & 7; \
 	u8 imm8; \
@@ -1146,7 +1636,7 @@ static inline void clear_segs(CPUI386 *cpu)
 		imm ## BIT = (s ## BIT) ((s8) imm8); \
 		INST ## SUFFIX(rm, imm ## BIT, lreg ## BIT, sreg ## BIT, limm, 0) \
 	} else { \
-		TRY(modsib(cpu, adsz16, mod, rm, &addr, &curr_seg)); \
+		TRY(modsib(cpu, dc, adsz16, mod, rm, &addr, &curr_seg)); \
 		TRY(fetch8(cpu, &imm8)); \
 		imm ## BIT = (s ## BIT) ((s8) imm8); \
 		if (BT) addr += imm ## BIT / BIT * (BIT / 8); \
@@ -1158,13 +1648,13 @@ static inline void clear_segs(CPUI386 *cpu)
 #define BTEvIb(...) if (opsz16) { EIb_helper(true, 16, w, __VA_ARGS__) } else { EIb_helper(true, 32, d, __VA_ARGS__) }
 
 #define E1_helper(BIT, SUFFIX, rwm, INST) \
-	TRY(fetch8(cpu, &modrm)); \
+	TRY(fetch_modrm(cpu, dc, &modrm)); \
 	int mod = modrm >> 6; \
 	int rm = modrm & 7; \
 	if (mod == 3) { \
 		INST ## SUFFIX(rm, 1, lreg ## BIT, sreg ## BIT, limm, 0) \
 	} else { \
-		TRY(modsib(cpu, adsz16, mod, rm, &addr, &curr_seg)); \
+		TRY(modsib(cpu, dc, adsz16, mod, rm, &addr, &curr_seg)); \
 		TRY(translate ## BIT(cpu, &meml, rwm, curr_seg, addr)); \
 		INST ## SUFFIX(&meml, 1, laddr ## BIT, saddr ## BIT, limm, 0) \
 	}
@@ -1173,13 +1663,13 @@ static inline void clear_segs(CPUI386 *cpu)
 #define Ev1(...) if (opsz16) { E1_helper(16, w, __VA_ARGS__) } else { E1_helper(32, d, __VA_ARGS__) }
 
 #define ECL_helper(BIT, SUFFIX, rwm, INST) \
-	TRY(fetch8(cpu, &modrm)); \
+	TRY(fetch_modrm(cpu, dc, &modrm)); \
 	int mod = modrm >> 6; \
 	int rm = modrm & 7; \
 	if (mod == 3) { \
 		INST ## SUFFIX(rm, 1, lreg ## BIT, sreg ## BIT, lreg8, sreg8) \
 	} else { \
-		TRY(modsib(cpu, adsz16, mod, rm, &addr, &curr_seg)); \
+		TRY(modsib(cpu, dc, adsz16, mod, rm, &addr, &curr_seg)); \
 		TRY(translate ## BIT(cpu, &meml, rwm, curr_seg, addr)); \
 		INST ## SUFFIX(&meml, 1, laddr ## BIT, saddr ## BIT, lreg8, sreg8) \
 	}
@@ -1188,14 +1678,14 @@ static inline void clear_segs(CPUI386 *cpu)
 #define EvCL(...) if (opsz16) { ECL_helper(16, w, __VA_ARGS__) } else { ECL_helper(32, d, __VA_ARGS__) }
 
 #define GE_helper(BIT, SUFFIX, rwm, INST) \
-	TRY(fetch8(cpu, &modrm)); \
+	TRY(fetch_modrm(cpu, dc, &modrm)); \
 	int reg = (modrm >> 3) & 7; \
 	int mod = modrm >> 6; \
 	int rm = modrm & 7; \
 	if (mod == 3) { \
 		INST ## SUFFIX(reg, rm, lreg ## BIT, sreg ## BIT, lreg ## BIT, sreg ## BIT) \
 	} else { \
-		TRY(modsib(cpu, adsz16, mod, rm, &addr, &curr_seg)); \
+		TRY(modsib(cpu, dc, adsz16, mod, rm, &addr, &curr_seg)); \
 		TRY(translate ## BIT(cpu, &meml, rwm, curr_seg, addr)); \
 		INST ## SUFFIX(reg, &meml, lreg ## BIT, sreg ## BIT, laddr ## BIT, saddr ## BIT) \
 	}
@@ -1204,39 +1694,39 @@ static inline void clear_segs(CPUI386 *cpu)
 #define GvEv(...) if (opsz16) { GE_helper(16, w, __VA_ARGS__) } else { GE_helper(32, d, __VA_ARGS__) }
 
 #define GvM_helper(BIT, SUFFIX, rwm, INST) \
-	TRY(fetch8(cpu, &modrm)); \
+	TRY(fetch_modrm(cpu, dc, &modrm)); \
 	int reg = (modrm >> 3) & 7; \
 	int mod = modrm >> 6; \
 	int rm = modrm & 7; \
 	if (mod == 3) { \
 		INST ## SUFFIX(reg, rm, lreg ## BIT, sreg ## BIT, lreg ## BIT, sreg ## BIT) \
 	} else { \
-		TRY(modsib(cpu, adsz16, mod, rm, &addr, &curr_seg)); \
+		TRY(modsib(cpu, dc, adsz16, mod, rm, &addr, &curr_seg)); \
 		INST ## SUFFIX(reg, addr, lreg ## BIT, sreg ## BIT, limm, 0) \
 	}
 #define GvM(...) if (opsz16) { GvM_helper(16, w, __VA_ARGS__) } else { GvM_helper(32, d, __VA_ARGS__) }
 
 #define GvMp_helper(BIT, SUFFIX, rwm, INST) \
-	TRY(fetch8(cpu, &modrm)); \
+	TRY(fetch_modrm(cpu, dc, &modrm)); \
 	int reg = (modrm >> 3) & 7; \
 	int mod = modrm >> 6; \
 	int rm = modrm & 7; \
 	if (mod == 3) THROW0(EX_UD); \
 	else { \
-		TRY(modsib(cpu, adsz16, mod, rm, &addr, &curr_seg)); \
+		TRY(modsib(cpu, dc, adsz16, mod, rm, &addr, &curr_seg)); \
 		INST ## SUFFIX(reg, addr, lreg ## BIT, sreg ## BIT, limm, 0) \
 	}
 #define GvMp(...) if (opsz16) { GvMp_helper(16, w, __VA_ARGS__) } else { GvMp_helper(32, d, __VA_ARGS__) }
 
 #define GE_helper2(BIT, SUFFIX, BIT2, SUFFIX2, rwm, INST) \
-	TRY(fetch8(cpu, &modrm)); \
+	TRY(fetch_modrm(cpu, dc, &modrm)); \
 	int reg = (modrm >> 3) & 7; \
 	int mod = modrm >> 6; \
 	int rm = modrm & 7; \
 	if (mod == 3) { \
 		INST ## SUFFIX ## SUFFIX2(reg, rm, lreg ## BIT, sreg ## BIT, lreg ## BIT2, sreg ## BIT2) \
 	} else { \
-		TRY(modsib(cpu, adsz16, mod, rm, &addr, &curr_seg)); \
+		TRY(modsib(cpu, dc, adsz16, mod, rm, &addr, &curr_seg)); \
 		TRY(translate ## BIT2(cpu, &meml, rwm, curr_seg, addr)); \
 		INST ## SUFFIX ## SUFFIX2(reg, &meml, lreg ## BIT, sreg ## BIT, laddr ## BIT2, saddr ## BIT2) \
 	}
@@ -1245,7 +1735,7 @@ static inline void clear_segs(CPUI386 *cpu)
 #define GvEw(...) if (opsz16) { GE_helper2(16, w, 16, w, __VA_ARGS__) } else { GE_helper2(32, d, 16, w, __VA_ARGS__) }
 
 #define GEI_helperI2(BIT, SUFFIX, BIT2, SUFFIX2, rwm, INST) \
-	TRY(fetch8(cpu, &modrm)); \
+	TRY(fetch_modrm(cpu, dc, &modrm)); \
 	int reg = (modrm >> 3) & 7; \
 	int mod = modrm >> 6; \
 	int rm = modrm & 7; \
@@ -1254,7 +1744,7 @@ static inline void clear_segs(CPUI386 *cpu)
 		TRY(fetch ## BIT2(cpu, &imm ## BIT2)); \
 		INST ## SUFFIX ## I ## SUFFIX2(reg, rm, imm ## BIT2, lreg ## BIT, sreg ## BIT, lreg ## BIT, sreg ## BIT) \
 	} else { \
-		TRY(modsib(cpu, adsz16, mod, rm, &addr, &curr_seg)); \
+		TRY(modsib(cpu, dc, adsz16, mod, rm, &addr, &curr_seg)); \
 		u ## BIT2 imm ## BIT2; \
 		TRY(fetch ## BIT2(cpu, &imm ## BIT2)); \
 		TRY(translate ## BIT(cpu, &meml, rwm, curr_seg, addr)); \
@@ -1462,7 +1952,7 @@ static inline void clear_segs(CPUI386 *cpu)
 	INST(addr, seg)
 
 #define Ep(rwm, INST) \
-	TRY(fetch8(cpu, &modrm)); \
+	TRY(fetch_modrm(cpu, dc, &modrm)); \
 	int mod = modrm >> 6; \
 	int rm = modrm & 7; \
 	if (mod == 3) THROW0(EX_UD); \
@@ -1470,7 +1960,7 @@ static inline void clear_segs(CPUI386 *cpu)
 		u16 seg; \
 		u32 off; \
 		OptAddr moff, mseg; \
-		TRY(modsib(cpu, adsz16, mod, rm, &addr, &curr_seg)); \
+		TRY(modsib(cpu, dc, adsz16, mod, rm, &addr, &curr_seg)); \
 		if (opsz16) { \
 			TRY(translate16(cpu, &moff, rwm, curr_seg, addr)); \
 			TRY(translate16(cpu, &mseg, rwm, curr_seg, addr + 2)); \
@@ -1486,17 +1976,17 @@ static inline void clear_segs(CPUI386 *cpu)
 	}
 
 #define Ms(rwm, INST) \
-	TRY(fetch8(cpu, &modrm)); \
+	TRY(fetch_modrm(cpu, dc, &modrm)); \
 	int mod = modrm >> 6; \
 	int rm = modrm & 7; \
 	if (mod == 3) THROW0(EX_UD); \
 	else { \
-		TRY(modsib(cpu, adsz16, mod, rm, &addr, &curr_seg)); \
+		TRY(modsib(cpu, dc, adsz16, mod, rm, &addr, &curr_seg)); \
 		INST(addr) \
 	}
 
 #define Ew(rwm, INST) \
-	TRY(fetch8(cpu, &modrm)); \
+	TRY(fetch_modrm(cpu, dc, &modrm)); \
 	int mod = modrm >> 6; \
 	int rm = modrm & 7; \
 	if (mod == 3) { \
@@ -1506,13 +1996,13 @@ static inline void clear_segs(CPUI386 *cpu)
 			INST(rm, lreg32, sreg32) \
 		} \
 	} else { \
-		TRY(modsib(cpu, adsz16, mod, rm, &addr, &curr_seg)); \
+		TRY(modsib(cpu, dc, adsz16, mod, rm, &addr, &curr_seg)); \
 		TRY(translate16(cpu, &meml, rwm, curr_seg, addr)); \
 		INST(&meml, laddr16, saddr16) \
 	}
 
 #define EwSw(rwm, INST) \
-	TRY(fetch8(cpu, &modrm)); \
+	TRY(fetch_modrm(cpu, dc, &modrm)); \
 	int reg = (modrm >> 3) & 7; \
 	int mod = modrm >> 6; \
 	int rm = modrm & 7; \
@@ -1523,20 +2013,20 @@ static inline void clear_segs(CPUI386 *cpu)
 			INST(rm, reg, lreg32, sreg32, lseg, 0) \
 		} \
 	} else { \
-		TRY(modsib(cpu, adsz16, mod, rm, &addr, &curr_seg)); \
+		TRY(modsib(cpu, dc, adsz16, mod, rm, &addr, &curr_seg)); \
 		TRY(translate16(cpu, &meml, rwm, curr_seg, addr)); \
 		INST(&meml, reg, laddr16, saddr16, lseg, 0) \
 	}
 
 #define SwEw(rwm, INST) \
-	TRY(fetch8(cpu, &modrm)); \
+	TRY(fetch_modrm(cpu, dc, &modrm)); \
 	int reg = (modrm >> 3) & 7; \
 	int mod = modrm >> 6; \
 	int rm = modrm & 7; \
 	if (mod == 3) { \
 		INST(reg, rm, lseg, 0, lreg16, sreg16) \
 	} else { \
-		TRY(modsib(cpu, adsz16, mod, rm, &addr, &curr_seg)); \
+		TRY(modsib(cpu, dc, adsz16, mod, rm, &addr, &curr_seg)); \
 		TRY(translate16(cpu, &meml, rwm, curr_seg, addr)); \
 		INST(reg, &meml,lseg, 0, laddr16, saddr16) \
 	}
@@ -2094,7 +2584,7 @@ static inline void clear_segs(CPUI386 *cpu)
 
 #define MOVFC() \
 	if (cpu->cpl != 0) THROW(EX_GP, 0); \
-	TRY(fetch8(cpu, &modrm)); \
+	TRY(fetch_modrm(cpu, dc, &modrm)); \
 	int reg = (modrm >> 3) & 7; \
 	int rm = modrm & 7; \
 	if (reg == 0) { \
@@ -2104,12 +2594,12 @@ static inline void clear_segs(CPUI386 *cpu)
 	} else if (reg == 3) { \
 		sreg32(rm, cpu->cr3); \
 	} else if (reg == 4) { \
-		sreg32(rm, 0); \
+		sreg32(rm, cpu->cr4); \
 	} else THROW0(EX_UD);
 
 #define MOVTC() \
 	if (cpu->cpl != 0) THROW(EX_GP, 0); \
-	TRY(fetch8(cpu, &modrm)); \
+	TRY(fetch_modrm(cpu, dc, &modrm)); \
 	int reg = (modrm >> 3) & 7; \
 	int rm = modrm & 7; \
 	if (reg == 0) { \
@@ -2122,8 +2612,12 @@ static inline void clear_segs(CPUI386 *cpu)
 		cpu->cr2 = lreg32(rm); \
 	} else if (reg == 3) { \
 		cpu->cr3 = lreg32(rm); \
-		tlb_clear(cpu); \
+		tlb_flush_nonglobal(cpu); \
 	} else if (reg == 4) { \
+		u32 new_cr4 = cpu->gen >= 5 ? lreg32(rm) & CR4_PGE : 0; \
+		if ((new_cr4 ^ cpu->cr4) & CR4_PGE) \
+			tlb_clear(cpu); \
+		cpu->cr4 = new_cr4; \
 	} else THROW0(EX_UD);
 
 #define INT3() \
@@ -2148,7 +2642,18 @@ static bool call_isr(CPUI386 *cpu, int no, bool pusherr, int ext);
 	if (!call_isr(cpu, li(i), false, 0)) { \
 		cpu->ip = oldip; \
 		return false; \
-	}
+	} \
+	if (unlikely(cpu->poll.repeats) && li(i) == 0x16 && \
+	    poll_check_kbd(cpu, oldip)) \
+		return true;
+
+/*
+ * An interrupt may have become deliverable (IF set, or an I/O access made
+ * the PIC raise one): make this the last instruction of cpu_exec1, so that
+ * cpui386_step delivers it and carries on with the rest of the burst.
+ */
+#define IRQ_WINDOW() \
+	if (unlikely(cpu->intr) && (cpu->flags & IF)) stepcount = 1;
 
 #define IRET() \
 	if ((cpu->cr0 & 1) && (!(cpu->flags & VM) || get_IOPL(cpu) < 3)) { \
@@ -2190,7 +2695,7 @@ static bool call_isr(CPUI386 *cpu, int no, bool pusherr, int ext);
 			cpu->next_ip = newip; \
 		} \
 	} \
-	if (cpu->intr && (cpu->flags & IF)) return true;
+	IRQ_WINDOW()
 
 #define RETFARw(i, li, _) \
 	if ((cpu->cr0 & 1) && !(cpu->flags & VM)) { \
@@ -2314,7 +2819,7 @@ static bool call_isr(CPUI386 *cpu, int no, bool pusherr, int ext);
 
 #define POP_helper(BIT) \
 	OptAddr meml1; \
-	TRY(fetch8(cpu, &modrm)); \
+	TRY(fetch_modrm(cpu, dc, &modrm)); \
 	int mod = modrm >> 6; \
 	int rm = modrm & 7; \
 	uword sp = lreg32(4); \
@@ -2324,7 +2829,7 @@ static bool call_isr(CPUI386 *cpu, int no, bool pusherr, int ext);
 	if (mod == 3) { \
 		sreg ## BIT(rm, src); \
 	} else { \
-		if (!modsib(cpu, adsz16, mod, rm, &addr, &curr_seg) || \
+		if (!modsib(cpu, dc, adsz16, mod, rm, &addr, &curr_seg) || \
 		    !translate ## BIT(cpu, &meml, 2, curr_seg, addr)) { \
 			set_sp(sp, sp_mask); \
 			return false; \
@@ -2378,7 +2883,7 @@ static bool call_isr(CPUI386 *cpu, int no, bool pusherr, int ext);
 	cpu->flags &= EFLAGS_MASK; \
 	cpu->flags |= 0x2; \
 	cpu->cc.mask = 0; \
-	if (cpu->intr && (cpu->flags & IF)) return true;
+	IRQ_WINDOW()
 
 #define PUSHSeg(seg) \
 	if (opsz16) { \
@@ -2462,6 +2967,103 @@ static bool call_isr(CPUI386 *cpu, int no, bool pusherr, int ext);
 #define POPA() if (opsz16) { POPA_helper(16, 2) } else { POPA_helper(32, 4) }
 
 // string operations
+
+/*
+ * Elements of a REP string op, at most cx, that stay within the page of
+ * addr and, with 16-bit addressing, do not wrap the offset off. Zero if
+ * the first element already straddles the offset wrap.
+ */
+static inline uword rep_chunk(uword addr, uword off, bool adsz16, uword cx, int size, int dir)
+{
+	uword n = dir > 0 ? (4096 - (addr & 4095)) / size : 1 + (addr & 4095) / size;
+	if (adsz16) {
+		uword n16 = dir > 0 ? (0x10000 - off) / size : 1 + off / size;
+		if (n16 < n)
+			n = n16;
+	}
+	return n < cx ? n : cx;
+}
+
+/* The page holding a->addr1 is plain RAM that may be accessed through phys_mem */
+static inline bool ram_page(const OptAddr *a)
+{
+	return a->pmem == PMEM_RAM;
+}
+
+static inline u32 pload_n(CPUI386 *cpu, uword addr, int size)
+{
+	switch (size) {
+	case 1: return pload8(cpu, addr);
+	case 2: return pload16(cpu, addr);
+	default: return pload32(cpu, addr);
+	}
+}
+
+/*
+ * REP MOVS of count elements between RAM pages. Returns false if the
+ * ranges overlap so that element-wise copying (which replicates a
+ * pattern) differs from memmove; the caller then copies element-wise.
+ */
+static inline bool rep_movs_ram(CPUI386 *cpu, uword s, uword d, uword count, int size, int dir)
+{
+	uword len = count * size;
+	if (dir < 0) {
+		s -= len - size;
+		d -= len - size;
+	}
+	if (dir > 0 ? d > s && d < s + len : d < s && d + len > s)
+		return false;
+	cpu_invalidate_code(cpu, d, len);
+	memmove(cpu->phys_mem + d, cpu->phys_mem + s, len);
+	return true;
+}
+
+static inline void rep_stos_ram(CPUI386 *cpu, uword d, u32 val, uword count, int size, int dir)
+{
+	uword len = count * size;
+	if (dir < 0)
+		d -= len - size;
+	cpu_invalidate_code(cpu, d, len);
+	if (size == 1) {
+		memset(cpu->phys_mem + d, val, len);
+		return;
+	}
+	for (uword i = 0; i < len; i += size) {
+		if (size == 2)
+			pstore16(cpu, d + i, val);
+		else
+			pstore32(cpu, d + i, val);
+	}
+}
+
+/*
+ * REPE/REPNE SCAS (s unused, val is the accumulator) or CMPS over count
+ * elements of RAM. Returns the number of elements consumed, including the
+ * one that ended the scan.
+ */
+static inline uword rep_cmp_ram(CPUI386 *cpu, bool scas, uword s, u32 val, uword d,
+				uword count, int size, int dir, bool stop_eq)
+{
+	if (scas && size == 1 && dir > 0) {
+		u8 *p = cpu->phys_mem + d;
+		if (stop_eq) {
+			u8 *q = memchr(p, val & 0xff, count);
+			return q ? q - p + 1 : count;
+		}
+		for (uword i = 0; i < count; i++)
+			if (p[i] != (u8) val)
+				return i + 1;
+		return count;
+	}
+	for (uword i = 0; i < count; i++) {
+		if (!scas)
+			val = pload_n(cpu, s + i * dir, size);
+		if ((val == pload_n(cpu, d + i * dir, size)) == stop_eq)
+			return i + 1;
+	}
+	return count;
+}
+
 #define stdi(BIT, ABIT) \
 	TRY(translate ## BIT(cpu, &meml, 2, SEG_ES, lreg ## ABIT(7))); \
 	saddr ## BIT(&meml, ax); \
@@ -2502,7 +3104,9 @@ static bool call_isr(CPUI386 *cpu, int no, bool pusherr, int ext);
 	uword cx = lreg ## ABIT(1); \
 	while (cx) { \
 		TRY(translate ## BIT(cpu, &memld, 2, SEG_ES, lreg ## ABIT(7))); \
-		if (memld.addr1 % (BIT / 8)) { \
+		uword count = rep_chunk(memld.addr1, lreg ## ABIT(7), ABIT == 16, \
+					cx, BIT / 8, dir); \
+		if (memld.addr1 % (BIT / 8) || !count) { \
 			/* slow path */ \
 			while (lreg ## ABIT(1)) { \
 				stdi(BIT, ABIT) \
@@ -2510,15 +3114,14 @@ static bool call_isr(CPUI386 *cpu, int no, bool pusherr, int ext);
 			} \
 			break; \
 		} \
-		uword count = cx; \
-		int countd; \
-		if (dir > 0) countd = (4096 - (memld.addr1 & 4095)) / (BIT / 8); \
-		else countd = 1 + (memld.addr1 & 4095) / (BIT / 8); \
-		if (countd < count) \
-			count = countd; \
-		for (uword i = 0; i <= count - 1; i++) { \
-			saddr ## BIT(&memld, ax); \
-			memld.addr1 += dir; \
+		if (ram_page(&memld)) { \
+			rep_stos_ram(cpu, memld.addr1, ax, count, BIT / 8, dir); \
+		} else if (!(dir > 0 && mmio_fill(cpu, memld.pmem, memld.addr1, \
+						 ax, BIT / 8, count))) { \
+			for (uword i = 0; i <= count - 1; i++) { \
+				saddr ## BIT(&memld, ax); \
+				memld.addr1 += dir; \
+			} \
 		} \
 		sreg ## ABIT(7, lreg ## ABIT(7) + count * dir); \
 		sreg ## ABIT(1, cx - count); \
@@ -2535,6 +3138,27 @@ static bool call_isr(CPUI386 *cpu, int no, bool pusherr, int ext);
 		if (adsz16) { STOS_helper2(BIT, 16) } else { STOS_helper2(BIT, 32) } \
 	}
 
+/* only the last element of a RAM chunk is observable */
+#define LODS_helper2(BIT, ABIT) \
+	OptAddr memls; \
+	uword cx = lreg ## ABIT(1); \
+	while (cx) { \
+		TRY(translate ## BIT(cpu, &memls, 1, curr_seg, lreg ## ABIT(6))); \
+		uword count = rep_chunk(memls.addr1, lreg ## ABIT(6), ABIT == 16, \
+					cx, BIT / 8, dir); \
+		if (memls.addr1 % (BIT / 8) || !count || !ram_page(&memls)) { \
+			ldsi(BIT, ABIT) \
+			sreg ## BIT(0, ax); \
+			sreg ## ABIT(1, cx - 1); \
+			cx = lreg ## ABIT(1); \
+			continue; \
+		} \
+		sreg ## BIT(0, pload ## BIT(cpu, memls.addr1 + (count - 1) * dir)); \
+		sreg ## ABIT(6, lreg ## ABIT(6) + count * dir); \
+		sreg ## ABIT(1, cx - count); \
+		cx = lreg ## ABIT(1); \
+	}
+
 #define LODS_helper(BIT) \
 	if (curr_seg == -1) curr_seg = SEG_DS; \
 	xdir ## BIT \
@@ -2543,19 +3167,38 @@ static bool call_isr(CPUI386 *cpu, int no, bool pusherr, int ext);
 		if (adsz16) { ldsi(BIT, 16) } else { ldsi(BIT, 32) } \
 		sreg ## BIT(0, ax); \
 	} else { \
-		if (adsz16) { \
-			while (lreg16(1)) { \
-				ldsi(BIT, 16) \
-				sreg ## BIT(0, ax); \
-				sreg16(1, lreg16(1) - 1); \
-			} \
+		if (adsz16) { LODS_helper2(BIT, 16) } else { LODS_helper2(BIT, 32) } \
+	}
+
+/* flags come from the last compared pair, ax0 - ax */
+#define REP_CMP_FLAGS(BIT) \
+	cpu->cc.src1 = sext ## BIT(ax0); \
+	cpu->cc.src2 = sext ## BIT(ax); \
+	cpu->cc.dst = sext ## BIT(cpu->cc.src1 - cpu->cc.src2); \
+	cpu->cc.op = CC_SUB; \
+	cpu->cc.mask = CF | PF | AF | ZF | SF | OF; \
+	bool zf = get_ZF(cpu); \
+	if ((zf && rep == 2) || (!zf && rep == 1)) break;
+
+#define SCAS_helper2(BIT, ABIT) \
+	OptAddr memld; \
+	uword cx = lreg ## ABIT(1); \
+	while (cx) { \
+		TRY(translate ## BIT(cpu, &memld, 1, SEG_ES, lreg ## ABIT(7))); \
+		uword count = rep_chunk(memld.addr1, lreg ## ABIT(7), ABIT == 16, \
+					cx, BIT / 8, dir); \
+		if (memld.addr1 % (BIT / 8) || !count || !ram_page(&memld)) { \
+			lddi(BIT, ABIT) \
+			sreg ## ABIT(1, cx - 1); \
 		} else { \
-			while (lreg32(1)) { \
-				ldsi(BIT, 32) \
-				sreg ## BIT(0, ax); \
-				sreg32(1, lreg32(1) - 1); \
-			} \
+			uword n = rep_cmp_ram(cpu, true, 0, ax0, memld.addr1, \
+					      count, BIT / 8, dir, rep == 2); \
+			ax = pload ## BIT(cpu, memld.addr1 + (n - 1) * dir); \
+			sreg ## ABIT(7, lreg ## ABIT(7) + n * dir); \
+			sreg ## ABIT(1, cx - n); \
 		} \
+		cx = lreg ## ABIT(1); \
+		REP_CMP_FLAGS(BIT) \
 	}
 
 #define SCAS_helper(BIT) \
@@ -2571,31 +3214,7 @@ static bool call_isr(CPUI386 *cpu, int no, bool pusherr, int ext);
 		cpu->cc.op = CC_SUB; \
 		cpu->cc.mask = CF | PF | AF | ZF | SF | OF; \
 	} else { \
-		if (adsz16) { \
-			while (lreg16(1)) { \
-				lddi(BIT, 16) \
-				sreg16(1, lreg16(1) - 1); \
-				cpu->cc.src1 = sext ## BIT(ax0); \
-				cpu->cc.src2 = sext ## BIT(ax); \
-				cpu->cc.dst = sext ## BIT(cpu->cc.src1 - cpu->cc.src2); \
-				cpu->cc.op = CC_SUB; \
-				cpu->cc.mask = CF | PF | AF | ZF | SF | OF; \
-				bool zf = get_ZF(cpu); \
-				if ((zf && rep == 2) || (!zf && rep == 1)) break; \
-			} \
-		} else { \
-			while (lreg32(1)) { \
-				lddi(BIT, 32) \
-				sreg32(1, lreg32(1) - 1); \
-				cpu->cc.src1 = sext ## BIT(ax0); \
-				cpu->cc.src2 = sext ## BIT(ax); \
-				cpu->cc.dst = sext ## BIT(cpu->cc.src1 - cpu->cc.src2); \
-				cpu->cc.op = CC_SUB; \
-				cpu->cc.mask = CF | PF | AF | ZF | SF | OF; \
-				bool zf = get_ZF(cpu); \
-				if ((zf && rep == 2) || (!zf && rep == 1)) break; \
-			} \
-		} \
+		if (adsz16) { SCAS_helper2(BIT, 16) } else { SCAS_helper2(BIT, 32) } \
 	}
 
 #define MOVS_helper2(BIT, ABIT) \
@@ -2604,7 +3223,11 @@ static bool call_isr(CPUI386 *cpu, int no, bool pusherr, int ext);
 	while (cx) { \
 		TRY(translate ## BIT(cpu, &memls, 1, curr_seg, lreg ## ABIT(6))); \
 		TRY(translate ## BIT(cpu, &memld, 2, SEG_ES, lreg ## ABIT(7))); \
-		if (memls.addr1 % (BIT / 8) || memld.addr1 % (BIT / 8)) { \
+		uword count = rep_chunk(memls.addr1, lreg ## ABIT(6), ABIT == 16, \
+					cx, BIT / 8, dir); \
+		count = rep_chunk(memld.addr1, lreg ## ABIT(7), ABIT == 16, \
+				  count, BIT / 8, dir); \
+		if (memls.addr1 % (BIT / 8) || memld.addr1 % (BIT / 8) || !count) { \
 			/* slow path */ \
 			while (lreg ## ABIT(1)) { \
 				ldsistdi(BIT, ABIT) \
@@ -2612,26 +3235,9 @@ static bool call_isr(CPUI386 *cpu, int no, bool pusherr, int ext);
 			} \
 			break; \
 		} \
-		uword count = cx; \
-		int counts, countd; \
-		if (dir > 0) { \
-			counts = (4096 - (memls.addr1 & 4095)) / (BIT / 8); \
-			countd = (4096 - (memld.addr1 & 4095)) / (BIT / 8); \
-		} else { \
-			counts = 1 + (memls.addr1 & 4095) / (BIT / 8); \
-			countd = 1 + (memld.addr1 & 4095) / (BIT / 8); \
-		} \
-		if (counts < count) \
-			count = counts; \
-		if (countd < count) \
-			count = countd; \
-		if (cpu->cb.iomem_write_string && in_iomem(memld.addr1) && \
-		    dir > 0  && in_iomem(memld.addr1 + count - 1) && \
-		    (memls.addr1 | 4095) < cpu->phys_mem_size && \
-		    !in_iomem(memls.addr1) && !in_iomem(memls.addr1 | 4095)) { \
-			if (cpu->cb.iomem_write_string( \
-				    cpu->cb.iomem, memld.addr1, \
-				    cpu->phys_mem + memls.addr1, count * dir)) { \
+		if (memld.pmem >= PMEM_MMIO && dir > 0 && ram_page(&memls)) { \
+			if (mmio_write_string(cpu, memld.pmem, memld.addr1, \
+					      memls.addr1, count * dir)) { \
 				sreg ## ABIT(6, lreg ## ABIT(6) + count * dir); \
 				sreg ## ABIT(7, lreg ## ABIT(7) + count * dir); \
 				sreg ## ABIT(1, cx - count); \
@@ -2639,10 +3245,13 @@ static bool call_isr(CPUI386 *cpu, int no, bool pusherr, int ext);
 				continue; \
 			} \
 		} \
-		for (uword i = 0; i <= count - 1; i++) { \
-			store ## BIT(cpu, &memld, load ## BIT(cpu, &memls)); \
-			memld.addr1 += dir; \
-			memls.addr1 += dir; \
+		if (!ram_page(&memls) || !ram_page(&memld) || \
+		    !rep_movs_ram(cpu, memls.addr1, memld.addr1, count, BIT / 8, dir)) { \
+			for (uword i = 0; i <= count - 1; i++) { \
+				store ## BIT(cpu, &memld, load ## BIT(cpu, &memls)); \
+				memld.addr1 += dir; \
+				memls.addr1 += dir; \
+			} \
 		} \
 		sreg ## ABIT(6, lreg ## ABIT(6) + count * dir); \
 		sreg ## ABIT(7, lreg ## ABIT(7) + count * dir); \
@@ -2660,6 +3269,33 @@ static bool call_isr(CPUI386 *cpu, int no, bool pusherr, int ext);
 		if (adsz16) { MOVS_helper2(BIT, 16) } else { MOVS_helper2(BIT, 32) } \
 	}
 
+#define CMPS_helper2(BIT, ABIT) \
+	OptAddr memls, memld; \
+	uword cx = lreg ## ABIT(1); \
+	while (cx) { \
+		TRY(translate ## BIT(cpu, &memls, 1, curr_seg, lreg ## ABIT(6))); \
+		TRY(translate ## BIT(cpu, &memld, 1, SEG_ES, lreg ## ABIT(7))); \
+		uword count = rep_chunk(memls.addr1, lreg ## ABIT(6), ABIT == 16, \
+					cx, BIT / 8, dir); \
+		count = rep_chunk(memld.addr1, lreg ## ABIT(7), ABIT == 16, \
+				  count, BIT / 8, dir); \
+		if (memls.addr1 % (BIT / 8) || memld.addr1 % (BIT / 8) || !count || \
+		    !ram_page(&memls) || !ram_page(&memld)) { \
+			ldsilddi(BIT, ABIT) \
+			sreg ## ABIT(1, cx - 1); \
+		} else { \
+			uword n = rep_cmp_ram(cpu, false, memls.addr1, 0, memld.addr1, \
+					      count, BIT / 8, dir, rep == 2); \
+			ax0 = pload ## BIT(cpu, memls.addr1 + (n - 1) * dir); \
+			ax = pload ## BIT(cpu, memld.addr1 + (n - 1) * dir); \
+			sreg ## ABIT(6, lreg ## ABIT(6) + n * dir); \
+			sreg ## ABIT(7, lreg ## ABIT(7) + n * dir); \
+			sreg ## ABIT(1, cx - n); \
+		} \
+		cx = lreg ## ABIT(1); \
+		REP_CMP_FLAGS(BIT) \
+	}
+
 #define CMPS_helper(BIT) \
 	if (curr_seg == -1) curr_seg = SEG_DS; \
 	xdir ## BIT \
@@ -2672,31 +3308,7 @@ static bool call_isr(CPUI386 *cpu, int no, bool pusherr, int ext);
 		cpu->cc.op = CC_SUB; \
 		cpu->cc.mask = CF | PF | AF | ZF | SF | OF; \
 	} else { \
-		if (adsz16) { \
-			while (lreg16(1)) { \
-				ldsilddi(BIT, 16) \
-				sreg16(1, lreg16(1) - 1); \
-				cpu->cc.src1 = sext ## BIT(ax0); \
-				cpu->cc.src2 = sext ## BIT(ax); \
-				cpu->cc.dst = sext ## BIT(cpu->cc.src1 - cpu->cc.src2); \
-				cpu->cc.op = CC_SUB; \
-				cpu->cc.mask = CF | PF | AF | ZF | SF | OF; \
-				bool zf = get_ZF(cpu); \
-				if ((zf && rep == 2) || (!zf && rep == 1)) break; \
-			} \
-		} else { \
-			while (lreg32(1)) { \
-				ldsilddi(BIT, 32) \
-				sreg32(1, lreg32(1) - 1); \
-				cpu->cc.src1 = sext ## BIT(ax0); \
-				cpu->cc.src2 = sext ## BIT(ax); \
-				cpu->cc.dst = sext ## BIT(cpu->cc.src1 - cpu->cc.src2); \
-				cpu->cc.op = CC_SUB; \
-				cpu->cc.mask = CF | PF | AF | ZF | SF | OF; \
-				bool zf = get_ZF(cpu); \
-				if ((zf && rep == 2) || (!zf && rep == 1)) break; \
-			} \
-		} \
+		if (adsz16) { CMPS_helper2(BIT, 16) } else { CMPS_helper2(BIT, 32) } \
 	}
 
 #define STOSb() STOS_helper(8)
@@ -2721,28 +3333,22 @@ static bool call_isr(CPUI386 *cpu, int no, bool pusherr, int ext);
 	uword cx = lreg ## ABIT(1); \
 	while (cx) { \
 		TRY(translate ## BIT(cpu, &memld, 2, SEG_ES, lreg ## ABIT(7))); \
-		if (memld.addr1 % (BIT / 8)) { \
-			/* slow path */ \
-			while (lreg ## ABIT(1)) { \
-				indxstdi(BIT, ABIT) \
-				sreg ## ABIT(1, lreg ## ABIT(1) - 1); \
-			} \
-			break; \
+		uword count = rep_chunk(memld.addr1, lreg ## ABIT(7), ABIT == 16, \
+					cx, BIT / 8, dir); \
+		if (!count) { \
+			/* element straddles a page or the offset wrap */ \
+			indxstdi(BIT, ABIT) \
+			sreg ## ABIT(1, cx - 1); \
+			cx = lreg ## ABIT(1); \
+			continue; \
 		} \
-		uword count = cx; \
-		int countd; \
-		if (dir > 0) countd = (4096 - (memld.addr1 & 4095)) / (BIT / 8); \
-		else countd = 1 + (memld.addr1 & 4095) / (BIT / 8); \
-		if (countd < count) \
-			count = countd; \
-		if (cpu->cb.io_read_string && dir > 0 && \
-		    (memld.addr1 | 4095) < cpu->phys_mem_size && \
-		    !in_iomem(memld.addr1) && !in_iomem(memld.addr1 | 4095)) { \
+		if (cpu->cb.io_read_string && dir > 0 && ram_page(&memld)) { \
 			int count1 = cpu->cb.io_read_string( \
 				cpu->cb.io, lreg16(2), \
 				cpu->phys_mem + memld.addr1, dir, count); \
 			if (count1 > 0) { \
 				count = count1; \
+				cpu_invalidate_code(cpu, memld.addr1, count * dir); \
 				sreg ## ABIT(7, lreg ## ABIT(7) + count * dir); \
 				sreg ## ABIT(1, cx - count); \
 				cx = lreg ## ABIT(1); \
@@ -2768,7 +3374,8 @@ static bool call_isr(CPUI386 *cpu, int no, bool pusherr, int ext);
 	} else { \
 		if (rep != 1 && rep != 2) THROW0(EX_UD); \
 		if (adsz16) { INS_helper2(BIT, 16) } else { INS_helper2(BIT, 32) } \
-	}
+	} \
+	IRQ_WINDOW()
 
 #define INSb() INS_helper(8)
 #define INS() if (opsz16) { INS_helper(16) } else { INS_helper(32) }
@@ -2784,23 +3391,16 @@ static bool call_isr(CPUI386 *cpu, int no, bool pusherr, int ext);
 	uword cx = lreg ## ABIT(1); \
 	while (cx) { \
 		TRY(translate ## BIT(cpu, &memls, 1, curr_seg, lreg ## ABIT(6))); \
-		if (memls.addr1 % (BIT / 8)) { \
-			/* slow path */ \
-			while (lreg ## ABIT(1)) { \
-				ldsioutdx(BIT, ABIT) \
-				sreg ## ABIT(1, lreg ## ABIT(1) - 1); \
-			} \
-			break; \
+		uword count = rep_chunk(memls.addr1, lreg ## ABIT(6), ABIT == 16, \
+					cx, BIT / 8, dir); \
+		if (!count) { \
+			/* element straddles a page or the offset wrap */ \
+			ldsioutdx(BIT, ABIT) \
+			sreg ## ABIT(1, cx - 1); \
+			cx = lreg ## ABIT(1); \
+			continue; \
 		} \
-		uword count = cx; \
-		int counts; \
-		if (dir > 0) counts = (4096 - (memls.addr1 & 4095)) / (BIT / 8); \
-		else counts = 1 + (memls.addr1 & 4095) / (BIT / 8); \
-		if (counts < count) \
-			count = counts; \
-		if (cpu->cb.io_write_string && dir > 0 && \
-		    (memls.addr1 | 4095) < cpu->phys_mem_size && \
-		    !in_iomem(memls.addr1) && !in_iomem(memls.addr1 | 4095)) { \
+		if (cpu->cb.io_write_string && dir > 0 && ram_page(&memls)) { \
 			int count1 = cpu->cb.io_write_string( \
 				cpu->cb.io, lreg16(2), \
 				cpu->phys_mem + memls.addr1, dir, count); \
@@ -2836,7 +3436,8 @@ static bool call_isr(CPUI386 *cpu, int no, bool pusherr, int ext);
 		} else { \
 			OUTS_helper2(BIT, 32) \
 		} \
-	}
+	} \
+	IRQ_WINDOW()
 
 #define OUTSb() OUTS_helper(8)
 #define OUTS() if (opsz16) { OUTS_helper(16) } else { OUTS_helper(32) }
@@ -3167,21 +3768,21 @@ static bool __not_in_flash_func(enter_helper)(
 	sa(a, cpu->seg[SEG_TR].sel);
 
 #define MOVFD() \
-	TRY(fetch8(cpu, &modrm)); \
+	TRY(fetch_modrm(cpu, dc, &modrm)); \
 	int reg = (modrm >> 3) & 7; \
 	int rm = modrm & 7; \
 	sreg32(rm, cpu->dr[reg]);
 
 #define MOVTD() \
-	TRY(fetch8(cpu, &modrm)); \
+	TRY(fetch_modrm(cpu, dc, &modrm)); \
 	int reg = (modrm >> 3) & 7; \
 	int rm = modrm & 7; \
 	cpu->dr[reg] = lreg32(rm);
 
 #define MOVFT() \
-	TRY(fetch8(cpu, &modrm));
+	TRY(fetch_modrm(cpu, dc, &modrm));
 #define MOVTT() \
-	TRY(fetch8(cpu, &modrm));
+	TRY(fetch_modrm(cpu, dc, &modrm));
 
 #define SMSW(addr, laddr, saddr) \
 	saddr(addr, cpu->cr0 & 0xffff);
@@ -3246,35 +3847,92 @@ static bool check_ioperm(CPUI386 *cpu, int port, int bit)
 	return true;
 }
 
+/*
+ * Polling loop detection: a read at the same EIP that keeps seeing the
+ * same value from the same source, each time within a few instructions of
+ * the previous one, is a loop waiting on a device. Once it has gone round
+ * poll.repeats times the step ends, so that the caller can skip ahead to
+ * the next device event instead of spinning. Sources are I/O ports and
+ * the BIOS keyboard buffer.
+ */
+#define POLL_LOOP_MAX 16	/* instructions per round of an IN loop */
+#define POLL_INT_LOOP_MAX 1024	/* ...and of a loop around INT 16h */
+#define POLL_KBD 0x10000	/* poll.port of INT 16h polls */
+
+static bool poll_check(CPUI386 *cpu, uword ip, int port, u32 val, long window)
+{
+	bool same = ip == cpu->poll.ip && port == cpu->poll.port &&
+		val == cpu->poll.val && cpu->cycle - cpu->poll.cycle <= window;
+	cpu->poll.cycle = cpu->cycle;
+	if (!same) {
+		cpu->poll.ip = ip;
+		cpu->poll.port = port;
+		cpu->poll.val = val;
+		cpu->poll.count = 0;
+		return false;
+	}
+	if (++cpu->poll.count < cpu->poll.repeats)
+		return false;
+	cpu->poll.count = 0;
+	cpu->poll.hit = true;
+	return true;
+}
+
+/*
+ * INT 16h AH=01h/11h with the BIOS keyboard buffer empty: how DOS prompts
+ * and most text-mode programs wait for a key.
+ */
+static bool poll_check_kbd(CPUI386 *cpu, uword ip)
+{
+	u8 ah = REGi(0) >> 8;
+	if ((ah != 0x01 && ah != 0x11) || ((cpu->cr0 & 1) && !(cpu->flags & VM)))
+		return false;
+	u16 head = pload16(cpu, 0x41a);
+	if (head != pload16(cpu, 0x41c)) {
+		cpu->poll.count = 0;
+		return false;
+	}
+	return poll_check(cpu, ip, POLL_KBD, head, POLL_INT_LOOP_MAX);
+}
+
+#define IN_helper(BIT, a, sa) \
+	TRY(check_ioperm(cpu, port, BIT)); \
+	u ## BIT val = cpu->cb.io_read ## BIT(cpu->cb.io, port); \
+	sa(a, val); \
+	IRQ_WINDOW() \
+	if (unlikely(cpu->poll.repeats) && \
+	    poll_check(cpu, cpu->ip, port, val, POLL_LOOP_MAX)) \
+		return true;
+
 #define INb(a, b, la, sa, lb, sb) \
 	int port = lb(b); \
-	TRY(check_ioperm(cpu, port, 8)); \
-	sa(a, cpu->cb.io_read8(cpu->cb.io, port));
+	IN_helper(8, a, sa)
 
 #define INw(a, b, la, sa, lb, sb) \
 	int port = lb(b); \
-	TRY(check_ioperm(cpu, port, 16)); \
-	sa(a, cpu->cb.io_read16(cpu->cb.io, port));
+	IN_helper(16, a, sa)
 
 #define INd(a, b, la, sa, lb, sb) \
 	int port = lb(b); \
-	TRY(check_ioperm(cpu, port, 32)); \
-	sa(a, cpu->cb.io_read32(cpu->cb.io, port));
+	IN_helper(32, a, sa)
 
 #define OUTb(a, b, la, sa, lb, sb) \
 	int port = la(a); \
 	TRY(check_ioperm(cpu, port, 8)); \
-	cpu->cb.io_write8(cpu->cb.io, port, lb(b));
+	cpu->cb.io_write8(cpu->cb.io, port, lb(b)); \
+	IRQ_WINDOW()
 
 #define OUTw(a, b, la, sa, lb, sb) \
 	int port = la(a); \
 	TRY(check_ioperm(cpu, port, 16)); \
-	cpu->cb.io_write16(cpu->cb.io, port, lb(b));
+	cpu->cb.io_write16(cpu->cb.io, port, lb(b)); \
+	IRQ_WINDOW()
 
 #define OUTd(a, b, la, sa, lb, sb) \
 	int port = la(a); \
 	TRY(check_ioperm(cpu, port, 32)); \
-	cpu->cb.io_write32(cpu->cb.io, port, lb(b));
+	cpu->cb.io_write32(cpu->cb.io, port, lb(b)); \
+	IRQ_WINDOW()
 
 #define CLTS() \
 	cpu->cr0 &= ~(1 << 3);
@@ -3282,13 +3940,13 @@ static bool check_ioperm(CPUI386 *cpu, int port, int bit)
 #define ESC() \
 	if (cpu->cr0 & 0xc) THROW0(EX_NM); \
 	else { \
-		TRY(fetch8(cpu, &modrm)); \
+		TRY(fetch_modrm(cpu, dc, &modrm)); \
 		int mod = modrm >> 6; \
 		int rm = modrm & 7; \
 		int op = b1 - 0xd8; \
 		int group = (modrm >> 3) & 7; \
 		if (mod != 3) { \
-			TRY(modsib(cpu, adsz16, mod, rm, &addr, &curr_seg)); \
+			TRY(modsib(cpu, dc, adsz16, mod, rm, &addr, &curr_seg)); \
 			if (cpu->fpu) { \
 				TRY(fpu_exec2(cpu->fpu, cpu, opsz16, op, group, curr_seg, addr)); \
 			} \
@@ -3592,7 +4250,9 @@ static bool verrw_helper(CPUI386 *cpu, int sel, int wr, int *zf)
 #define XADDw(...) XADD_helper(16, __VA_ARGS__)
 #define XADDd(...) XADD_helper(32, __VA_ARGS__)
 
-#define INVLPG(addr) tlb_clear(cpu);
+#define INVLPG(addr) \
+	if (cpu->cpl != 0) THROW(EX_GP, 0); \
+	tlb_invalidate(cpu, cpu->seg[curr_seg].base + addr);
 
 #define BSWAPw(a, la, sa) THROW0(EX_UD);
 
@@ -3635,6 +4295,7 @@ static bool verrw_helper(CPUI386 *cpu, int sel, int wr, int *zf)
 		REGi(2) = 0x100; \
 		REGi(1) = 0; \
 		if (cpu->fpu) REGi(2) |= 1; \
+		if (cpu->gen >= 5) REGi(2) |= 0x2000; \
 		if (cpu->gen > 5) REGi(2) |= 0x8820; \
 		if (cpu->gen > 5 && cpu->fpu) { \
 			REGi(2) |= CPUID_SIMD_FEATURE; \
@@ -3780,6 +4441,54 @@ static bool IRAM_ATTR_CPU_EXEC1 cpu_exec1(CPUI386 *cpu, int stepcount)
 #define CX(_1) f ## _1:
 #endif
 
+#ifdef I386_OPT2
+	static const void *pfxlabel[] __not_in_flash("pfxlabel") = {
+/* 0x00 */	&&f0x00, &&f0x01, &&f0x02, &&f0x03, &&f0x04, &&f0x05, &&f0x06, &&f0x07,
+/* 0x08 */	&&f0x08, &&f0x09, &&f0x0a, &&f0x0b, &&f0x0c, &&f0x0d, &&f0x0e, &&f0x0f,
+/* 0x10 */	&&f0x10, &&f0x11, &&f0x12, &&f0x13, &&f0x14, &&f0x15, &&f0x16, &&f0x17,
+/* 0x18 */	&&f0x18, &&f0x19, &&f0x1a, &&f0x1b, &&f0x1c, &&f0x1d, &&f0x1e, &&f0x1f,
+/* 0x20 */	&&f0x20, &&f0x21, &&f0x22, &&f0x23, &&f0x24, &&f0x25, &&pfx26, &&f0x27,
+/* 0x28 */	&&f0x28, &&f0x29, &&f0x2a, &&f0x2b, &&f0x2c, &&f0x2d, &&pfx2e, &&f0x2f,
+/* 0x30 */	&&f0x30, &&f0x31, &&f0x32, &&f0x33, &&f0x34, &&f0x35, &&pfx36, &&f0x37,
+/* 0x38 */	&&f0x38, &&f0x39, &&f0x3a, &&f0x3b, &&f0x3c, &&f0x3d, &&pfx3e, &&f0x3f,
+/* 0x40 */	&&f0x40, &&f0x41, &&f0x42, &&f0x43, &&f0x44, &&f0x45, &&f0x46, &&f0x47,
+/* 0x48 */	&&f0x48, &&f0x49, &&f0x4a, &&f0x4b, &&f0x4c, &&f0x4d, &&f0x4e, &&f0x4f,
+/* 0x50 */	&&f0x50, &&f0x51, &&f0x52, &&f0x53, &&f0x54, &&f0x55, &&f0x56, &&f0x57,
+/* 0x58 */	&&f0x58, &&f0x59, &&f0x5a, &&f0x5b, &&f0x5c, &&f0x5d, &&f0x5e, &&f0x5f,
+/* 0x60 */	&&f0x60, &&f0x61, &&f0x62, &&f0x63, &&pfx64, &&pfx65, &&pfx66, &&pfx67,
+/* 0x68 */	&&f0x68, &&f0x69, &&f0x6a, &&f0x6b, &&f0x6c, &&f0x6d, &&f0x6e, &&f0x6f,
+/* 0x70 */	&&f0x70, &&f0x71, &&f0x72, &&f0x73, &&f0x74, &&f0x75, &&f0x76, &&f0x77,
+/* 0x78 */	&&f0x78, &&f0x79, &&f0x7a, &&f0x7b, &&f0x7c, &&f0x7d, &&f0x7e, &&f0x7f,
+/* 0x80 */	&&f0x80, &&f0x81, &&f0x82, &&f0x83, &&f0x84, &&f0x85, &&f0x86, &&f0x87,
+/* 0x88 */	&&f0x88, &&f0x89, &&f0x8a, &&f0x8b, &&f0x8c, &&f0x8d, &&f0x8e, &&f0x8f,
+/* 0x90 */	&&f0x90, &&f0x91, &&f0x92, &&f0x93, &&f0x94, &&f0x95, &&f0x96, &&f0x97,
+/* 0x98 */	&&f0x98, &&f0x99, &&f0x9a, &&f0x9b, &&f0x9c, &&f0x9d, &&f0x9e, &&f0x9f,
+/* 0xa0 */	&&f0xa0, &&f0xa1, &&f0xa2, &&f0xa3, &&f0xa4, &&f0xa5, &&f0xa6, &&f0xa7,
+/* 0xa8 */	&&f0xa8, &&f0xa9, &&f0xaa, &&f0xab, &&f0xac, &&f0xad, &&f0xae, &&f0xaf,
+/* 0xb0 */	&&f0xb0, &&f0xb1, &&f0xb2, &&f0xb3, &&f0xb4, &&f0xb5, &&f0xb6, &&f0xb7,
+/* 0xb8 */	&&f0xb8, &&f0xb9, &&f0xba, &&f0xbb, &&f0xbc, &&f0xbd, &&f0xbe, &&f0xbf,
+/* 0xc0 */	&&f0xc0, &&f0xc1, &&f0xc2, &&f0xc3, &&f0xc4, &&f0xc5, &&f0xc6, &&f0xc7,
+/* 0xc8 */	&&f0xc8, &&f0xc9, &&f0xca, &&f0xcb, &&f0xcc, &&f0xcd, &&f0xce, &&f0xcf,
+/* 0xd0 */	&&f0xd0, &&f0xd1, &&f0xd2, &&f0xd3, &&f0xd4, &&f0xd5, &&f0xd6, &&f0xd7,
+/* 0xd8 */	&&f0xd8, &&f0xd9, &&f0xda, &&f0xdb, &&f0xdc, &&f0xdd, &&f0xde, &&f0xdf,
+/* 0xe0 */	&&f0xe0, &&f0xe1, &&f0xe2, &&f0xe3, &&f0xe4, &&f0xe5, &&f0xe6, &&f0xe7,
+/* 0xe8 */	&&f0xe8, &&f0xe9, &&f0xea, &&f0xeb, &&f0xec, &&f0xed, &&f0xee, &&f0xef,
+/* 0xf0 */	&&pfxf0, &&f0xf1, &&pfxf2, &&pfxf3, &&f0xf4, &&f0xf5, &&f0xf6, &&f0xf7,
+/* 0xf8 */	&&f0xf8, &&f0xf9, &&f0xfa, &&f0xfb, &&f0xfc, &&f0xfd, &&f0xfe, &&f0xff,
+	};
+#define DISPATCH() goto *pfxlabel[b1]
+#else
+#define DISPATCH() goto dispatch
+#endif
+#define DC_RECORD() \
+	if (dc) { \
+		dc->b1 = b1; \
+		dc->oplen = cpu->next_ip - cpu->ip; \
+		dc->seg = curr_seg; \
+		dc->flags = DC_OP | (rep << DC_REP_SHIFT) | \
+			(opsz16 ? DC_OPSZ16 : 0) | (adsz16 ? DC_ADSZ16 : 0); \
+	}
+
 	u8 b1;
 	u8 modrm;
 	OptAddr meml;
@@ -3790,11 +4499,35 @@ static bool IRAM_ATTR_CPU_EXEC1 cpu_exec1(CPUI386 *cpu, int stepcount)
 
 	if (code16) cpu->next_ip &= 0xffff;
 	cpu->ip = cpu->next_ip;
+	bool opsz16 = code16;
+	bool adsz16 = code16;
+	int rep = 0;
+	/*bool lock = false;*/
+	int curr_seg = -1;
+	struct dcache_entry *dc = dcache_lookup(cpu, code16);
+	if (dc && (dc->flags & DC_OP)) {
+		b1 = dc->b1;
+		cpu->next_ip = cpu->ip + dc->oplen;
+		opsz16 = dc->flags & DC_OPSZ16;
+		adsz16 = dc->flags & DC_ADSZ16;
+		rep = (dc->flags >> DC_REP_SHIFT) & 3;
+		curr_seg = dc->seg;
+#if DEBUG_CPU
+		opcode = b1;
+#endif
+		cpu->cycle++;
+		PROF_SAMPLE();
+		PROF(prof_decoded(b1, opsz16 != code16, adsz16 != code16, rep, curr_seg));
+		DISPATCH();
+	}
 	TRY(fetch8(cpu, &b1));
+	if (!dc)
+		dc = dcache_lookup(cpu, code16); /* ifetch may have moved to this page */
 #if DEBUG_CPU
 	opcode = b1;
 #endif
 	cpu->cycle++;
+	PROF_SAMPLE();
 
 #ifndef I386_OPT1
 	if (verbose) {
@@ -3802,15 +4535,11 @@ static bool IRAM_ATTR_CPU_EXEC1 cpu_exec1(CPUI386 *cpu, int stepcount)
 	}
 #endif
 	// prefix
-	bool opsz16 = code16;
-	bool adsz16 = code16;
-	int rep = 0;
-	/*bool lock = false;*/
-	int curr_seg = -1;
 #ifndef I386_OPT2
 	for (;;) {
 #define HANDLE_PREFIX(C, STMT) \
 		if (b1 == C) { \
+			PROF(prof.op[C]++); \
 			STMT; \
 			TRY(fetch8(cpu, &b1)); \
 			continue; \
@@ -3829,46 +4558,19 @@ static bool IRAM_ATTR_CPU_EXEC1 cpu_exec1(CPUI386 *cpu, int stepcount)
 #undef HANDLE_PREFIX
 		break;
 	}
+	PROF(prof.op[b1]++);
+	DC_RECORD();
+dispatch:
 #else
-	static const void *pfxlabel[] __not_in_flash("pfxlabel") = {
-/* 0x00 */	&&f0x00, &&f0x01, &&f0x02, &&f0x03, &&f0x04, &&f0x05, &&f0x06, &&f0x07,
-/* 0x08 */	&&f0x08, &&f0x09, &&f0x0a, &&f0x0b, &&f0x0c, &&f0x0d, &&f0x0e, &&f0x0f,
-/* 0x10 */	&&f0x10, &&f0x11, &&f0x12, &&f0x13, &&f0x14, &&f0x15, &&f0x16, &&f0x17,
-/* 0x18 */	&&f0x18, &&f0x19, &&f0x1a, &&f0x1b, &&f0x1c, &&f0x1d, &&f0x1e, &&f0x1f,
-/* 0x20 */	&&f0x20, &&f0x21, &&f0x22, &&f0x23, &&f0x24, &&f0x25, &&pfx26, &&f0x27,
-/* 0x28 */	&&f0x28, &&f0x29, &&f0x2a, &&f0x2b, &&f0x2c, &&f0x2d, &&pfx2e, &&f0x2f,
-/* 0x30 */	&&f0x30, &&f0x31, &&f0x32, &&f0x33, &&f0x34, &&f0x35, &&pfx36, &&f0x37,
-/* 0x38 */	&&f0x38, &&f0x39, &&f0x3a, &&f0x3b, &&f0x3c, &&f0x3d, &&pfx3e, &&f0x3f,
-/* 0x40 */	&&f0x40, &&f0x41, &&f0x42, &&f0x43, &&f0x44, &&f0x45, &&f0x46, &&f0x47,
-/* 0x48 */	&&f0x48, &&f0x49, &&f0x4a, &&f0x4b, &&f0x4c, &&f0x4d, &&f0x4e, &&f0x4f,
-/* 0x50 */	&&f0x50, &&f0x51, &&f0x52, &&f0x53, &&f0x54, &&f0x55, &&f0x56, &&f0x57,
-/* 0x58 */	&&f0x58, &&f0x59, &&f0x5a, &&f0x5b, &&f0x5c, &&f0x5d, &&f0x5e, &&f0x5f,
-/* 0x60 */	&&f0x60, &&f0x61, &&f0x62, &&f0x63, &&pfx64, &&pfx65, &&pfx66, &&pfx67,
-/* 0x68 */	&&f0x68, &&f0x69, &&f0x6a, &&f0x6b, &&f0x6c, &&f0x6d, &&f0x6e, &&f0x6f,
-/* 0x70 */	&&f0x70, &&f0x71, &&f0x72, &&f0x73, &&f0x74, &&f0x75, &&f0x76, &&f0x77,
-/* 0x78 */	&&f0x78, &&f0x79, &&f0x7a, &&f0x7b, &&f0x7c, &&f0x7d, &&f0x7e, &&f0x7f,
-/* 0x80 */	&&f0x80, &&f0x81, &&f0x82, &&f0x83, &&f0x84, &&f0x85, &&f0x86, &&f0x87,
-/* 0x88 */	&&f0x88, &&f0x89, &&f0x8a, &&f0x8b, &&f0x8c, &&f0x8d, &&f0x8e, &&f0x8f,
-/* 0x90 */	&&f0x90, &&f0x91, &&f0x92, &&f0x93, &&f0x94, &&f0x95, &&f0x96, &&f0x97,
-/* 0x98 */	&&f0x98, &&f0x99, &&f0x9a, &&f0x9b, &&f0x9c, &&f0x9d, &&f0x9e, &&f0x9f,
-/* 0xa0 */	&&f0xa0, &&f0xa1, &&f0xa2, &&f0xa3, &&f0xa4, &&f0xa5, &&f0xa6, &&f0xa7,
-/* 0xa8 */	&&f0xa8, &&f0xa9, &&f0xaa, &&f0xab, &&f0xac, &&f0xad, &&f0xae, &&f0xaf,
-/* 0xb0 */	&&f0xb0, &&f0xb1, &&f0xb2, &&f0xb3, &&f0xb4, &&f0xb5, &&f0xb6, &&f0xb7,
-/* 0xb8 */	&&f0xb8, &&f0xb9, &&f0xba, &&f0xbb, &&f0xbc, &&f0xbd, &&f0xbe, &&f0xbf,
-/* 0xc0 */	&&f0xc0, &&f0xc1, &&f0xc2, &&f0xc3, &&f0xc4, &&f0xc5, &&f0xc6, &&f0xc7,
-/* 0xc8 */	&&f0xc8, &&f0xc9, &&f0xca, &&f0xcb, &&f0xcc, &&f0xcd, &&f0xce, &&f0xcf,
-/* 0xd0 */	&&f0xd0, &&f0xd1, &&f0xd2, &&f0xd3, &&f0xd4, &&f0xd5, &&f0xd6, &&f0xd7,
-/* 0xd8 */	&&f0xd8, &&f0xd9, &&f0xda, &&f0xdb, &&f0xdc, &&f0xdd, &&f0xde, &&f0xdf,
-/* 0xe0 */	&&f0xe0, &&f0xe1, &&f0xe2, &&f0xe3, &&f0xe4, &&f0xe5, &&f0xe6, &&f0xe7,
-/* 0xe8 */	&&f0xe8, &&f0xe9, &&f0xea, &&f0xeb, &&f0xec, &&f0xed, &&f0xee, &&f0xef,
-/* 0xf0 */	&&pfxf0, &&f0xf1, &&pfxf2, &&pfxf3, &&f0xf4, &&f0xf5, &&f0xf6, &&f0xf7,
-/* 0xf8 */	&&f0xf8, &&f0xf9, &&f0xfa, &&f0xfb, &&f0xfc, &&f0xfd, &&f0xfe, &&f0xff,
-	};
+	PROF(prof.op[b1]++);
+	DC_RECORD();
 	goto *pfxlabel[b1];
 #define HANDLE_PREFIX(C, STMT) \
 		pfx ## C: { \
 			STMT; \
 			TRY(fetch8(cpu, &b1)); \
+			PROF(prof.op[b1]++); \
+			DC_RECORD(); \
 			goto *pfxlabel[b1]; \
 		}
 		HANDLE_PREFIX(26, curr_seg = SEG_ES)
@@ -3891,7 +4593,7 @@ static bool IRAM_ATTR_CPU_EXEC1 cpu_exec1(CPUI386 *cpu, int stepcount)
 
 #undef CX
 #define CX(_1) case _1:
-#define GRPBEG TRY(peek8(cpu, &modrm)); switch((modrm >> 3) & 7) {
+#define GRPBEG TRY(peek_modrm(cpu, dc, &modrm)); switch((modrm >> 3) & 7) {
 #define GRPCASE(_case, _rm, _rwm, _op) _case { _rm(_rwm, _op); ebreak; }
 #define GRPEND default: default_ud; } ebreak;
 
@@ -4001,6 +4703,7 @@ GRPEND
 
 	ecase(0x0f): { // two byte
 		TRY(fetch8(cpu, &b1));
+		PROF(prof.op0f[b1]++);
 		switch(b1) {
 #define I2(_case, _rm, _rwm, _op) _case { _rm(_rwm, _op); ebreak; }
 #include "i386ins.def"
@@ -4126,7 +4829,7 @@ static bool task_switch(CPUI386 *cpu, int tss, int sw_type)
 
 	TRY1(translate(cpu, &meml, 1, SEG_TR, 0x1c, 4, 0));
 	cpu->cr3 = load32(cpu, &meml);
-	tlb_clear(cpu);
+	tlb_flush_nonglobal(cpu);
 
 	return true;
 }
@@ -4904,44 +5607,59 @@ static bool pmret(CPUI386 *cpu, bool opsz16, int off, bool isiret)
 
 void cpui386_step(CPUI386 *cpu, int stepcount)
 {
-	if ((cpu->flags & IF) && cpu->intr) {
-		cpu->intr = false;
-		cpu->halt = false;
-		int no = cpu->cb.pic_read_irq(cpu->cb.pic);
-		cpu->ip = cpu->next_ip;
-		if (!call_isr(cpu, no, false, 1)) {
-			if (!call_isr(cpu, EX_DF, true, 1)) {
-				cpui386_reset(cpu);
-				return;
+	/* cpu_exec1 stops early when an interrupt becomes deliverable */
+	long end = cpu->cycle + stepcount;
+
+	/* the caller idles until the next device event, see cpui386_is_idle() */
+	cpu->poll.hit = false;
+	for (;;) {
+		if ((cpu->flags & IF) && cpu->intr) {
+			cpu->intr = false;
+			cpu->halt = false;
+			int no = cpu->cb.pic_read_irq(cpu->cb.pic);
+			PROF(prof.irq++);
+			cpu->ip = cpu->next_ip;
+			if (!call_isr(cpu, no, false, 1)) {
+				if (!call_isr(cpu, EX_DF, true, 1)) {
+					cpui386_reset(cpu);
+					return;
+				}
 			}
 		}
-	}
-
-	if (cpu->halt) {
-		usleep(1);
-		return;
-	}
 
-	if (!cpu_exec1(cpu, stepcount)) {
-		bool pusherr = false;
-		switch (cpu->excno) {
-		case EX_DF: case EX_TS: case EX_NP: case EX_SS: case EX_GP:
-		case EX_PF:
-			pusherr = true;
+		if (cpu->halt) {
+			PROF(prof.halt++);
+			return;
 		}
-		cpu->next_ip = cpu->ip;
 
-		if (cpu->excno == EX_DF) {
-			if (!call_isr(cpu, EX_DF, true, 1)) {
-				cpui386_reset(cpu);
-				return;
+		if (!cpu_exec1(cpu, stepcount)) {
+			bool pusherr = false;
+			PROF(prof.exc[cpu->excno & 31]++);
+			switch (cpu->excno) {
+			case EX_DF: case EX_TS: case EX_NP: case EX_SS: case EX_GP:
+			case EX_PF:
+				pusherr = true;
 			}
-		} else if (!call_isr(cpu, cpu->excno, pusherr, 1)) {
-			if (!call_isr(cpu, EX_DF, true, 1)) {
-				cpui386_reset(cpu);
-				return;
+			cpu->next_ip = cpu->ip;
+
+			if (cpu->excno == EX_DF) {
+				if (!call_isr(cpu, EX_DF, true, 1)) {
+					cpui386_reset(cpu);
+					return;
+				}
+			} else if (!call_isr(cpu, cpu->excno, pusherr, 1)) {
+				if (!call_isr(cpu, EX_DF, true, 1)) {
+					cpui386_reset(cpu);
+					return;
+				}
 			}
+			return;
 		}
+
+		stepcount = end - cpu->cycle;
+		if (stepcount <= 0 || !cpu->intr || !(cpu->flags & IF) ||
+		    cpu->poll.hit)
+			return;
 	}
 }
 
@@ -5014,11 +5732,14 @@ void cpui386_reset(CPUI386 *cpu)
 	cpu->cr0 = cpu->fpu ? 0x10 : 0;
 	cpu->cr2 = 0;
 	cpu->cr3 = 0;
+	cpu->cr4 = 0;
 	for (int i = 0; i < 8; i++)
 		cpu->dr[i] = 0;
 
 	cpu->cc.mask = 0;
 	tlb_clear(cpu);
+	/* ROMs and kernels were loaded behind the CPU's back */
+	dcache_flush(cpu);
 
 	cpu->sysenter.cs = 0;
 	cpu->sysenter.eip = 0;
@@ -5061,6 +5782,73 @@ long IRAM_ATTR cpui386_get_cycle(CPUI386 *cpu)
 	return cpu->cycle;
 }
 
+static void tlb_side_alloc(struct tlb_side *t, int sets, int ways)
+{
+	size_t tlb_bytes = sizeof(struct tlb_entry) * sets * ways;
+#ifdef BUILD_ESP32
+	extern void *pcmalloc(long size);
+	t->tab = malloc(tlb_bytes);
+	if (!t->tab)
+		t->tab = pcmalloc(tlb_bytes);
+#else
+	t->tab = malloc(tlb_bytes);
+#endif
+	t->plru = calloc(sets, 1);
+}
+
+/* Type of a page that nothing has been mapped over */
+static int pmem_default(CPUI386 *cpu, uword pg)
+{
+	return (pg << 12) < cpu->phys_mem_size ? PMEM_RAM : PMEM_UNMAPPED;
+}
+
+/* Set the type of the pages of [addr, addr + size) that the page table covers */
+static void pmem_fill(CPUI386 *cpu, uword addr, uword size, int type)
+{
+	if (!size)
+		return;
+	uword last = (addr + (size - 1)) >> 12;
+	for (uword pg = addr >> 12; pg <= last && pg < cpu->pmem.npages; pg++) {
+		/* only pages backed by phys_mem can be RAM or ROM */
+		if (type <= PMEM_ROM && pmem_default(cpu, pg) != PMEM_RAM)
+			cpu->pmem.page[pg] = PMEM_UNMAPPED;
+		else
+			cpu->pmem.page[pg] = type;
+	}
+}
+
+/*
+ * Mark physical pages RAM, ROM or unmapped. The TLB caches page types, so
+ * it is flushed along with the map.
+ */
+void cpui386_set_mem_type(CPUI386 *cpu, uword addr, uword size, int type)
+{
+	assert(type < PMEM_MMIO);
+	pmem_fill(cpu, addr, size, type);
+	tlb_clear(cpu);
+}
+
+/*
+ * Map device region 'region' (0 .. I386_MMIO_MAX - 1) at [addr, addr + size),
+ * replacing wherever it was mapped before; size 0 only unmaps it. Pages it
+ * leaves fall back to RAM or unmapped.
+ */
+void cpui386_map_mmio(CPUI386 *cpu, int region, uword addr, uword size,
+		      const CPU_MMIO *ops, void *opaque)
+{
+	assert(region >= 0 && region < I386_MMIO_MAX);
+	for (uword pg = 0; pg < cpu->pmem.npages; pg++) {
+		if (cpu->pmem.page[pg] == PMEM_MMIO + region)
+			cpu->pmem.page[pg] = pmem_default(cpu, pg);
+	}
+	cpu->pmem.mmio[region].base = addr;
+	cpu->pmem.mmio[region].size = size;
+	cpu->pmem.mmio[region].ops = ops;
+	cpu->pmem.mmio[region].opaque = opaque;
+	pmem_fill(cpu, addr, size, PMEM_MMIO + region);
+	tlb_clear(cpu);
+}
+
 CPUI386 *cpui386_new(int gen, char *phys_mem, long phys_mem_size, CPU_CB **cb)
 {
 	CPUI386 *cpu = malloc(sizeof(CPUI386));
@@ -5072,23 +5860,33 @@ CPUI386 *cpui386_new(int gen, char *phys_mem, long phys_mem_size, CPU_CB **cb)
 	}
 	cpu->gen = gen;
 
-	cpu->tlb.size = tlb_size;
-#ifdef BUILD_ESP32
-	{
-		extern void *pcmalloc(long size);
-		size_t tlb_bytes = sizeof(struct tlb_entry) * tlb_size;
-		cpu->tlb.tab = malloc(tlb_bytes);
-		if (!cpu->tlb.tab)
-			cpu->tlb.tab = pcmalloc(tlb_bytes);
-	}
-#else
-	cpu->tlb.tab = malloc(sizeof(struct tlb_entry) * tlb_size);
-#endif
+	tlb_side_alloc(&(cpu->tlb.d), DTLB_SETS, I386_DTLB_WAYS);
+	tlb_side_alloc(&(cpu->tlb.i), ITLB_SETS, I386_ITLB_WAYS);
+	cpui386_reset_tlb_stats(cpu);
 
 	cpu->phys_mem = (u8 *) phys_mem;
 	cpu->phys_mem_size = phys_mem_size;
 
+	/* RAM up to phys_mem_size, the rest of the first megabyte unmapped */
+	cpu->pmem.npages = ((phys_mem_size > 0x100000 ? phys_mem_size : 0x100000) + 4095) >> 12;
+	cpu->pmem.page = malloc(cpu->pmem.npages);
+	for (uword pg = 0; pg < cpu->pmem.npages; pg++)
+		cpu->pmem.page[pg] = pmem_default(cpu, pg);
+	memset(cpu->pmem.mmio, 0, sizeof(cpu->pmem.mmio));
+
+	/* the decoded cache is an optimization; run without it if short of RAM */
+	cpu->dcache.npages = (phys_mem_size >> 12) + 1;
+	cpu->dcache.tab = malloc(sizeof(struct dcache_entry) * I386_DCACHE_SIZE);
+	cpu->dcache.gen = calloc(cpu->dcache.npages, sizeof(u32));
+	if (!cpu->dcache.tab || !cpu->dcache.gen) {
+		free(cpu->dcache.tab);
+		free(cpu->dcache.gen);
+		cpu->dcache.tab = NULL;
+		cpu->dcache.gen = NULL;
+	}
+
 	cpu->cycle = 0;
+	memset(&(cpu->poll), 0, sizeof(cpu->poll));
 
 	cpu->intr = false;
 
@@ -5112,9 +5910,34 @@ void cpui386_delete(CPUI386 *cpu)
 {
 	if (cpu->fpu)
 		fpu_delete(cpu->fpu);
+	free(cpu->dcache.tab);
+	free(cpu->dcache.gen);
+	free(cpu->pmem.page);
+#ifndef BUILD_ESP32
+	free(cpu->tlb.d.tab);
+	free(cpu->tlb.i.tab);
+#endif
+	free(cpu->tlb.d.plru);
+	free(cpu->tlb.i.plru);
 	free(cpu);
 }
 
+void cpui386_get_tlb_stats(CPUI386 *cpu, struct i386_tlb_stats *stats)
+{
+	stats->dtlb_hits = cpu->tlb.d.hits;
+	stats->dtlb_misses = cpu->tlb.d.misses;
+	stats->itlb_hits = cpu->tlb.i.hits;
+	stats->itlb_misses = cpu->tlb.i.misses;
+	stats->flushes = cpu->tlb.flushes;
+}
+
+void cpui386_reset_tlb_stats(CPUI386 *cpu)
+{
+	cpu->tlb.d.hits = cpu->tlb.d.misses = 0;
+	cpu->tlb.i.hits = cpu->tlb.i.misses = 0;
+	cpu->tlb.flushes = 0;
+}
+
 #if !defined(_WIN32) && !defined(__wasm__)
 void cpui386_set_verbose() // for debugging
 {
@@ -5194,6 +6017,22 @@ int cpu_get_a20(CPUI386 *cpu)
 	return cpu->a20_mask >> 20 & 1;
 }
 
+/*
+ * Treat IN loops that see the same value repeats times in a row as idle
+ * (0 turns the detector off).
+ */
+void cpui386_set_poll_detect(CPUI386 *cpu, int repeats)
+{
+	cpu->poll.repeats = repeats > 0 ? repeats : 0;
+	cpu->poll.count = 0;
+}
+
+/* The last cpui386_step() ended halted or in a polling loop */
+bool cpui386_is_idle(CPUI386 *cpu)
+{
+	return cpu->halt || cpu->poll.hit;
+}
+
 void cpui386_get_state(CPUI386 *cpu, uint32_t *cs, uint32_t *ip, int *halt)
 {
 	*cs = cpu->seg[1].sel;  // SEG_CS = 1
@@ -5265,3 +6104,168 @@ void cpu_set_int2f_handler(CPUI386 *cpu, int2f_handler_t handler, void *opaque)
 	cpu->int2f_handler = handler;
 	cpu->int2f_opaque  = opaque;
 }
+
+#ifdef I386_PROFILE
+/* The profile goes to stdio and, on the device, is appended to a file on
+ * the SD card as well: with USB HID enabled there is no serial console. */
+#if defined(RP2350_BUILD) && !defined(I386_PROFILE_FILE)
+#define I386_PROFILE_FILE "386/profile.txt"
+#endif
+#include <stdarg.h>
+#ifdef I386_PROFILE_FILE
+#include "ff.h"
+static FIL prof_file;
+static bool prof_file_open;
+#endif
+
+static void prof_printf(const char *fmt, ...)
+{
+	char buf[128];
+	va_list ap;
+	va_start(ap, fmt);
+	int len = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	if (len < 0)
+		return;
+	if (len >= (int)sizeof(buf))
+		len = sizeof(buf) - 1;
+	fputs(buf, stdout);
+#ifdef I386_PROFILE_FILE
+	if (prof_file_open) {
+		UINT bw;
+		f_write(&prof_file, buf, len, &bw);
+	}
+#endif
+}
+
+static const char *const prof_exc_names[] = {
+	"#DE", "#DB", "NMI", "#BP", "#OF", "#BR", "#UD", "#NM",
+	"#DF", "INT9", "#TS", "#NP", "#SS", "#GP", "#PF",
+};
+
+static bool prof_is_prefix(int b)
+{
+	switch (b) {
+	case 0x26: case 0x2e: case 0x36: case 0x3e: case 0x64: case 0x65:
+	case 0x66: case 0x67: case 0xf0: case 0xf2: case 0xf3:
+		return true;
+	}
+	return false;
+}
+
+/* Pick the k largest non-zero counts, largest first. Tables are small
+ * and k is short, so a selection pass per row beats sorting a copy. */
+static int prof_top(const u32 *count, int n, int *idx, int k, bool (*skip)(int))
+{
+	int m = 0;
+	for (; m < k; m++) {
+		int best = -1;
+		for (int i = 0; i < n; i++) {
+			if (!count[i] || (skip && skip(i)))
+				continue;
+			bool taken = false;
+			for (int j = 0; j < m; j++)
+				if (idx[j] == i)
+					taken = true;
+			if (!taken && (best < 0 || count[i] > count[best]))
+				best = i;
+		}
+		if (best < 0)
+			break;
+		idx[m] = best;
+	}
+	return m;
+}
+
+static bool prof_not_prefix(int b)
+{
+	return !prof_is_prefix(b);
+}
+
+#define PROF_TOP_OPS 32
+#define PROF_TOP_HOT 24
+
+void i386_profile_dump(CPUI386 *cpu)
+{
+	int idx[PROF_TOP_OPS];
+	uint64_t total = 0, total0f = 0;
+	for (int i = 0; i < 256; i++) {
+		if (!prof_is_prefix(i))
+			total += prof.op[i];
+		total0f += prof.op0f[i];
+	}
+	if (!total)
+		return;
+
+#ifdef I386_PROFILE_FILE
+	prof_file_open = f_open(&prof_file, I386_PROFILE_FILE,
+				FA_WRITE | FA_OPEN_APPEND | FA_OPEN_ALWAYS) == FR_OK;
+#endif
+	prof_printf("\n=== i386 profile: %llu instructions ===\n",
+		    (unsigned long long) total);
+
+	prof_printf("opcode      count      %%\n");
+	int n = prof_top(prof.op, 256, idx, PROF_TOP_OPS, prof_is_prefix);
+	for (int i = 0; i < n; i++)
+		prof_printf("  %02x  %10lu  %5.2f\n", idx[i],
+			    (unsigned long) prof.op[idx[i]],
+			    100.0 * prof.op[idx[i]] / total);
+
+	if (total0f) {
+		prof_printf("0f opcode   count      %%\n");
+		n = prof_top(prof.op0f, 256, idx, PROF_TOP_OPS, NULL);
+		for (int i = 0; i < n; i++)
+			prof_printf("  0f %02x  %10lu  %5.2f\n", idx[i],
+				    (unsigned long) prof.op0f[idx[i]],
+				    100.0 * prof.op0f[idx[i]] / total);
+	}
+
+	prof_printf("prefix      count  per 100 insns\n");
+	n = prof_top(prof.op, 256, idx, PROF_TOP_OPS, prof_not_prefix);
+	for (int i = 0; i < n; i++)
+		prof_printf("  %02x  %10lu  %5.2f\n", idx[i],
+			    (unsigned long) prof.op[idx[i]],
+			    100.0 * prof.op[idx[i]] / total);
+
+	int hot[PROF_TOP_HOT];
+	n = prof_top(prof.hot_hits, PROF_HOT_SIZE, hot, PROF_TOP_HOT, NULL);
+	prof_printf("hot eip (1/%d sampled, %lu samples, %lu evicted)\n",
+		    PROF_SAMPLE_PERIOD, (unsigned long) prof.samples,
+		    (unsigned long) prof.samples_evicted);
+	for (int i = 0; i < n; i++)
+		prof_printf("  %08x  %8lu  %5.2f\n", (unsigned) prof.hot_eip[hot[i]],
+			    (unsigned long) prof.hot_hits[hot[i]],
+			    100.0 * prof.hot_hits[hot[i]] / prof.samples);
+
+	prof_printf("exceptions:");
+	for (int i = 0; i < 32; i++) {
+		if (!prof.exc[i])
+			continue;
+		if (i < (int)(sizeof(prof_exc_names) / sizeof(prof_exc_names[0])))
+			prof_printf(" %s=%lu", prof_exc_names[i], (unsigned long) prof.exc[i]);
+		else
+			prof_printf(" %d=%lu", i, (unsigned long) prof.exc[i]);
+	}
+	prof_printf("\nirqs: %lu  halts: %lu\n",
+		    (unsigned long) prof.irq, (unsigned long) prof.halt);
+	struct i386_tlb_stats tlb;
+	cpui386_get_tlb_stats(cpu, &tlb);
+	prof_printf("dtlb: %lu hits, %lu misses  itlb: %lu hits, %lu misses  flushes: %lu\n",
+		    tlb.dtlb_hits, tlb.dtlb_misses, tlb.itlb_hits, tlb.itlb_misses,
+		    tlb.flushes);
+	prof_printf("decoded cache: %lu hits, %lu fills\n",
+		    (unsigned long) prof.dcache_hit, (unsigned long) prof.dcache_fill);
+
+#ifdef I386_PROFILE_FILE
+	if (prof_file_open)
+		f_close(&prof_file);
+	prof_file_open = false;
+#endif
+}
+
+void i386_profile_reset(CPUI386 *cpu)
+{
+	memset(&prof, 0, sizeof(prof));
+	cpui386_reset_tlb_stats(cpu);
+}
+#endif
@@ -37,23 +37,77 @@ typedef struct {
 	void (*io_write32)(void *, int, u32);
 	int (*io_read_string)(void *, int, uint8_t *, int, int);
 	int (*io_write_string)(void *, int, uint8_t *, int, int);
-
-	void *iomem;
-	u8 (*iomem_read8)(void *, uword);
-	void (*iomem_write8)(void *, uword, u8);
-	u16 (*iomem_read16)(void *, uword);
-	void (*iomem_write16)(void *, uword, u16);
-	u32 (*iomem_read32)(void *, uword);
-	void (*iomem_write32)(void *, uword, u32);
-	bool (*iomem_write_string)(void *, uword, uint8_t *, int);
 } CPU_CB;
 
+/*
+ * Memory-mapped device, see cpui386_map_mmio(). Addresses passed to the
+ * handlers are offsets from the start of the region. write_string and
+ * fill may be NULL; they return false to fall back to element-wise stores.
+ * fill stores count elements of size bytes, all equal to val, upwards.
+ */
+typedef struct {
+	u8 (*read8)(void *, uword);
+	void (*write8)(void *, uword, u8);
+	u16 (*read16)(void *, uword);
+	void (*write16)(void *, uword, u16);
+	u32 (*read32)(void *, uword);
+	void (*write32)(void *, uword, u32);
+	bool (*write_string)(void *, uword, uint8_t *, int);
+	bool (*fill)(void *, uword, u32, int, int);
+} CPU_MMIO;
+
+/* Physical page types */
+enum {
+	PMEM_RAM,	/* phys_mem */
+	PMEM_ROM,	/* phys_mem, stores are dropped */
+	PMEM_UNMAPPED,	/* loads return 0, stores are dropped */
+	PMEM_MMIO,	/* PMEM_MMIO + n: device region n */
+};
+
+#ifndef I386_MMIO_MAX
+#define I386_MMIO_MAX 4
+#endif
+
 /* TLB entry structure */
 struct tlb_entry {
 	uword lpgno;
 	uword xaddr;
 	int (*pte_lookup)[2];
 	u8 *ppte;
+	bool global;	/* G bit with CR4.PGE: survives CR3 loads */
+	u8 pmem;	/* PMEM_* type of the physical page */
+};
+
+/* One side (instruction or data) of the set-associative TLB */
+struct tlb_side {
+	struct tlb_entry *tab;	/* sets * ways entries, grouped by set */
+	u8 *plru;		/* tree pseudo-LRU state per set */
+	unsigned long hits;
+	unsigned long misses;
+};
+
+/* TLB counters, see cpui386_get_tlb_stats() */
+struct i386_tlb_stats {
+	unsigned long dtlb_hits;
+	unsigned long dtlb_misses;
+	unsigned long itlb_hits;
+	unsigned long itlb_misses;
+	unsigned long flushes;
+};
+
+/* Decoded instruction cache entry, keyed by physical address */
+struct dcache_entry {
+	uword tag;	/* physical address | CS size */
+	u32 gen;	/* page generation the entry was decoded under */
+	uword disp;	/* effective address displacement */
+	u8 b1;		/* opcode byte after the prefixes */
+	u8 flags;
+	s8 seg;		/* segment override prefix, -1 if none */
+	u8 oplen;	/* prefix + opcode bytes */
+	u8 modrm;
+	u8 ealen;	/* SIB + displacement bytes */
+	u8 base;	/* base register | SS default */
+	u8 index;	/* index register | scale << 4 */
 };
 
 /*
@@ -78,6 +132,17 @@ struct CPUI386 {
 	uword sp_mask;
 	bool halt;
 
+	/* polling loop detector, see cpui386_set_poll_detect() */
+	struct {
+		int repeats;	/* rounds before a loop counts as idle, 0: off */
+		int count;
+		uword ip;
+		int port;
+		u32 val;
+		long cycle;
+		bool hit;	/* the last step ended in such a loop */
+	} poll;
+
 	FPU *fpu;
 
 	struct {
@@ -92,13 +157,14 @@ struct CPUI386 {
 		uword limit;
 	} idt, gdt;
 
-	uword cr0, cr2, cr3;
+	uword cr0, cr2, cr3, cr4;
 
 	uword dr[8];
 
 	struct {
 		unsigned long laddr;
 		uword xaddr;
+		bool dcache;	/* page can be cached in dcache */
 	} ifetch;
 
 	struct {
@@ -111,13 +177,35 @@ struct CPUI386 {
 	} cc;
 
 	struct {
-		int size;
-		struct tlb_entry *tab;
+		struct tlb_side d;	/* data accesses */
+		struct tlb_side i;	/* instruction fetch (ifetch refills) */
+		unsigned long flushes;
 	} tlb;
 
+	struct {
+		struct dcache_entry *tab;
+		u32 *gen;	/* per physical page, odd while entries may exist */
+		uword npages;
+	} dcache;
+
 	u8 *phys_mem;
 	long phys_mem_size;
 
+	/*
+	 * Physical memory map: a type per page up to the end of RAM or the
+	 * first megabyte, whichever is higher; device regions above that
+	 * (PCI BARs) are found by searching mmio[].
+	 */
+	struct {
+		u8 *page;
+		uword npages;
+		struct {
+			uword base, size;	/* size 0: slot unused */
+			const CPU_MMIO *ops;
+			void *opaque;
+		} mmio[I386_MMIO_MAX];
+	} pmem;
+
 	long cycle;
 
 	int excno;
@@ -150,6 +238,13 @@ void cpui386_raise_irq(CPUI386 *cpu);
 void cpui386_set_gpr(CPUI386 *cpu, int i, u32 val);
 long cpui386_get_cycle(CPUI386 *cpu);
 void cpui386_get_state(CPUI386 *cpu, uint32_t *cs, uint32_t *ip, int *halt);
+void cpui386_set_poll_detect(CPUI386 *cpu, int repeats);
+bool cpui386_is_idle(CPUI386 *cpu);
+void cpui386_get_tlb_stats(CPUI386 *cpu, struct i386_tlb_stats *stats);
+void cpui386_reset_tlb_stats(CPUI386 *cpu);
+void cpui386_set_mem_type(CPUI386 *cpu, uword addr, uword size, int type);
+void cpui386_map_mmio(CPUI386 *cpu, int region, uword addr, uword size,
+		      const CPU_MMIO *ops, void *opaque);
 
 bool cpu_load8(CPUI386 *cpu, int seg, uword addr, u8 *res);
 bool cpu_store8(CPUI386 *cpu, int seg, uword addr, u8 val);
@@ -203,6 +298,8 @@ int cpu_get_cf(CPUI386 *cpu);
 // Physical memory access
 u8 *cpu_get_phys_mem(CPUI386 *cpu);
 long cpu_get_phys_mem_size(CPUI386 *cpu);
+// Drop decoded instructions after writing guest memory behind the CPU's back
+void cpu_invalidate_code(CPUI386 *cpu, uword addr, uword len);
 // A20 gate control
 void cpu_set_a20(CPUI386 *cpu, int enabled);
 int cpu_get_a20(CPUI386 *cpu);
@@ -212,8 +309,8 @@ void cpu_set_int2f_handler(CPUI386 *cpu, int2f_handler_t handler, void *opaque);
 
 /* Profiling support (enable with -DI386_PROFILE) */
 #ifdef I386_PROFILE
-void i386_profile_dump(void);
-void i386_profile_reset(void);
+void i386_profile_dump(CPUI386 *cpu);
+void i386_profile_reset(CPUI386 *cpu);
 #endif
 
 #endif /* I386_H */
@@ -29,7 +29,7 @@
 #include <assert.h>
 #include <pico.h>
 
-uint32_t get_uticks();
+#include "vclock.h"
 static int after_eq(uint32_t a, uint32_t b)
 {
     return (a - b) < (1u << 31);
@@ -538,7 +538,7 @@ void ps2_put_keycode(PS2KbdState *s, int is_down, int keycode)
     if (keycode >= 0xe000) {
         ps2_queue(&s->common, keycode >> 8);
         s->delay = true;
-        s->delay_time = get_uticks() + 10000;
+        s->delay_time = emu_uticks() + 10000;
         s->delay_keycode = (keycode & 0xff) | ((!is_down) << 7);
     } else if (keycode >= INPUT_MAKE_KEY_MIN) {
         if (keycode > INPUT_MAKE_KEY_MAX)
@@ -553,7 +553,7 @@ void ps2_put_keycode(PS2KbdState *s, int is_down, int keycode)
            second keycode later, so that the guest software can read
            the same data again. */
         s->delay = true;
-        s->delay_time = get_uticks() + 1000;
+        s->delay_time = emu_uticks() + 1000;
         s->delay_keycode = keycode | ((!is_down) << 7);
     } else {
         ps2_queue(&s->common, keycode | ((!is_down) << 7));
@@ -565,7 +565,7 @@ void __not_in_flash_func(kbd_step)(void *opaque)
 {
     KBDState *s = opaque;
     PS2KbdState *kbd = s->kbd;
-    if (kbd->delay && after_eq(get_uticks(), kbd->delay_time)) {
+    if (kbd->delay && after_eq(emu_uticks(), kbd->delay_time)) {
         kbd->delay = false;
         ps2_queue(&(kbd->common), kbd->delay_keycode);
     }
@@ -577,6 +577,17 @@ void __not_in_flash_func(kbd_step)(void *opaque)
 #endif
 }
 
+/* next kbd_step: the pending E0-suffix delay, otherwise a 1 ms poll for
+ * input queued by the host (ps2_queue does not raise the irq itself) */
+uint32_t kbd_next_deadline(void *opaque, uint32_t now)
+{
+    KBDState *s = opaque;
+    PS2KbdState *kbd = s->kbd;
+    if (kbd->delay && !after_eq(kbd->delay_time, now + 1000))
+        return kbd->delay_time;
+    return now + 1000;
+}
+
 uint32_t ps2_read_data(void *opaque)
 {
     PS2State *s = (PS2State *)opaque;
@@ -27,6 +27,7 @@
 
 #include <stdio.h>
 #include "i8254.h"
+#include "vclock.h"
 #include <pico.h>
 //#define DEBUG_PIT
 
@@ -52,6 +53,8 @@ typedef struct PITChannelState {
 	uint32_t count_load_time;
 	uint32_t last_irq_count;
 	int irq;
+	PITNotifyFunc *notify;
+	void *notify_opaque;
 } PITChannelState;
 
 struct PITState {
@@ -60,13 +63,12 @@ struct PITState {
 	void (*set_irq)(void *pic, int irq, int level);
 };
 
-uint32_t get_uticks();
 static int pit_get_count(PITChannelState *s)
 {
 	uint32_t d;
 	int counter;
 
-	d = ((uint64_t) (get_uticks() - s->count_load_time)) * PIT_FREQ / 1000000;
+	d = ((uint64_t) (emu_uticks() - s->count_load_time)) * PIT_FREQ / 1000000;
 	switch(s->mode) {
 	case 0:
 	case 1:
@@ -121,7 +123,7 @@ static inline void pit_load_count(PITState *pit, PITChannelState *s, int val)
 {
 	if (val == 0)
 		val = 0x10000;
-	s->count_load_time = get_uticks();
+	s->count_load_time = emu_uticks();
 	s->last_irq_count = 0;
 	s->count = val;
 }
@@ -154,7 +156,7 @@ void i8254_ioport_write(PITState *pit, uint32_t addr, uint32_t val)
 					if (!(val & 0x10) && !s->status_latched) {
 						/* status latch */
 						/* XXX: add BCD and null count */
-						s->status = (pit_get_out1(s, get_uticks()) << 7) |
+						s->status = (pit_get_out1(s, emu_uticks()) << 7) |
 							(s->rw_mode << 4) |
 							(s->mode << 1) |
 							s->bcd;
@@ -175,6 +177,8 @@ void i8254_ioport_write(PITState *pit, uint32_t addr, uint32_t val)
 				s->mode = (val >> 1) & 7;
 				s->bcd = val & 1;
 				/* XXX: update irq timer ? */
+				if (s->notify)
+					s->notify(s->notify_opaque, PIT_MODE_SET);
 			}
 		}
 	} else {
@@ -196,6 +200,8 @@ void i8254_ioport_write(PITState *pit, uint32_t addr, uint32_t val)
 			s->write_state = RW_STATE_WORD0;
 			break;
 		}
+		if (s->notify && s->write_state != RW_STATE_WORD1)
+			s->notify(s->notify_opaque, PIT_COUNT_LOADED);
 	}
 }
 
@@ -268,7 +274,7 @@ static void pit_reset(void *opaque)
 
 void __not_in_flash_func(i8254_update_irq)(PITState *pit)
 {
-	uint32_t uticks = get_uticks();
+	uint32_t uticks = emu_uticks();
 	PITChannelState *s = pit->channels;
 	uint32_t d = ((uint64_t) (uticks - s->count_load_time)) * PIT_FREQ / 1000000;
 
@@ -299,6 +305,16 @@ void __not_in_flash_func(i8254_update_irq)(PITState *pit)
 	}
 }
 
+/* emulated time at which channel 0 next reaches terminal count */
+uint32_t i8254_next_deadline(PITState *pit)
+{
+	PITChannelState *s = pit->channels;
+	uint64_t ticks = (uint64_t)(s->last_irq_count + s->count) + 1;
+	/* first microsecond at which i8254_update_irq sees d > last + count */
+	return s->count_load_time +
+		(uint32_t)((ticks * 1000000 + PIT_FREQ - 1) / PIT_FREQ);
+}
+
 PITState *i8254_init(int irq, void *pic, void (*set_irq)(void *pic, int irq, int level))
 {
 	PITState *pit = malloc(sizeof(PITState));
@@ -314,7 +330,7 @@ PITState *i8254_init(int irq, void *pic, void (*set_irq)(void *pic, int irq, int
 int pit_get_out(PITState *pit, int channel)
 {
 	PITChannelState *s = &pit->channels[channel];
-	uint32_t uticks = get_uticks();
+	uint32_t uticks = emu_uticks();
 	return pit_get_out1(s, uticks);
 }
 
@@ -339,14 +355,14 @@ void pit_set_gate(PITState *pit, int channel, int val)
 	case 5:
 		if (s->gate < val) {
 			/* restart counting on rising edge */
-			s->count_load_time = get_uticks();
+			s->count_load_time = emu_uticks();
 		}
 		break;
 	case 2:
 	case 3:
 		if (s->gate < val) {
 			/* restart counting on rising edge */
-			s->count_load_time = get_uticks();
+			s->count_load_time = emu_uticks();
 		}
 		/* XXX: disable/enable counting */
 		break;
@@ -354,6 +370,12 @@ void pit_set_gate(PITState *pit, int channel, int val)
 	s->gate = val;
 }
 
+void i8254_set_notify(PITState *pit, int channel, PITNotifyFunc *fn, void *opaque)
+{
+	pit->channels[channel].notify = fn;
+	pit->channels[channel].notify_opaque = opaque;
+}
+
 int __not_in_flash_func(pit_get_initial_count)(PITState *pit, int channel)
 {
 	PITChannelState *s = &pit->channels[channel];
@@ -5,8 +5,13 @@
 #define PIT_FREQ 1193182
 
 typedef struct PITState PITState;
+
+enum { PIT_MODE_SET = 1, PIT_COUNT_LOADED = 2 };
+/* called after the guest writes a channel's control word or count */
+typedef void PITNotifyFunc(void *opaque, int what);
 PITState *i8254_init(int irq, void *pic, void (*set_irq)(void *pic, int irq, int level));
 void i8254_update_irq(PITState *pit);
+uint32_t i8254_next_deadline(PITState *pit);
 uint32_t i8254_ioport_read(PITState *pit, uint32_t addr1);
 void i8254_ioport_write(PITState *pit, uint32_t addr, uint32_t val);
 
@@ -15,5 +20,6 @@ int pit_get_gate(PITState *pit, int channel);
 int pit_get_initial_count(PITState *pit, int channel);
 int pit_get_mode(PITState *pit, int channel);
 void pit_set_gate(PITState *pit, int channel, int val);
+void i8254_set_notify(PITState *pit, int channel, PITNotifyFunc *fn, void *opaque);
 
 #endif /* I8254_H */
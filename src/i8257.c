@@ -474,6 +474,8 @@ int i8257_dma_write_memory(IsaDma *obj, int nchan, void *buf, int pos,
 #endif
                 s->phys_mem[a] = p[i];
         }
+        if (s->mem_written)
+            s->mem_written(s->mem_written_opaque, base, len);
         //cpu_physical_memory_write (addr - pos - len, buf, len);
         /* What about 16bit transfers? */
         for (int i = 0; i < len; i++) {
@@ -492,6 +494,8 @@ int i8257_dma_write_memory(IsaDma *obj, int nchan, void *buf, int pos,
 #endif
                 s->phys_mem[a] = p[i];
         }
+        if (s->mem_written)
+            s->mem_written(s->mem_written_opaque, base, len);
         //cpu_physical_memory_write (addr + pos, buf, len);
     }
 
@@ -712,3 +716,11 @@ I8257State *i8257_new(
 //    d->dma_bh = qemu_bh_new(i8257_dma_run, d);
     return d;
 }
+
+void i8257_set_mem_written_cb(I8257State *s,
+                              void (*cb)(void *opaque, uint32_t addr, int len),
+                              void *opaque)
+{
+    s->mem_written = cb;
+    s->mem_written_opaque = opaque;
+}
@@ -29,6 +29,9 @@ typedef struct I8257State {
     I8257Regs regs[4];
     char *phys_mem;
     long phys_mem_size;
+    /* called after a DMA transfer wrote guest memory */
+    void (*mem_written)(void *opaque, uint32_t addr, int len);
+    void *mem_written_opaque;
 //    MemoryRegion channel_io;
 //    MemoryRegion cont_io;
 
@@ -70,4 +73,7 @@ int i8257_dma_write_memory(IsaDma *obj, int nchan, void *buf, int pos,
 I8257State *i8257_new(
     char *phys_mem, long phys_mem_size,
     int base, int page_base, int pageh_base, int dshift);
+void i8257_set_mem_written_cb(I8257State *s,
+                              void (*cb)(void *opaque, uint32_t addr, int len),
+                              void *opaque);
 #endif
@@ -103,6 +103,18 @@ void atapi_tlog(const char *fmt, ...)
 #define IDE_CMD_RESET           0x04
 #define IDE_CMD_DISABLE_IRQ     0x02
 
+/* PIIX bus-master IDE registers (BAR4, 8 bytes per channel) */
+#define BM_CMD                  0
+#define BM_STATUS               2
+#define BM_PRD                  4
+#define BM_CMD_START            0x01
+#define BM_CMD_READ             0x08    /* direction: device to memory */
+#define BM_STATUS_ACTIVE        0x01
+#define BM_STATUS_ERROR         0x02
+#define BM_STATUS_INT           0x04
+#define BM_STATUS_DMA_CAP       0x60    /* drive 0/1 DMA capable, set by BIOS */
+#define BM_PRD_EOT              0x80000000
+
 /* ATA/ATAPI Commands pre T13 Spec */
 #define WIN_NOP				0x00
 /*
@@ -350,6 +362,32 @@ void atapi_tlog(const char *fmt, ...)
 /* Maximum size of ATAPI command packet or small reply (IDENTIFY etc.) */
 #define ATAPI_BUF_SIZE   512
 
+/* Read buffer: the current DRQ block (MAX_MULT_SECTORS sectors or one CD
+ * sector) plus the next one, fetched together by a single f_read */
+#define IDE_RBUF_SIZE    (2 * CD_SECTOR_SIZE)
+
+/*
+ * HDD write-back cache. Written sectors are kept in a heap buffer and
+ * reach the image file, followed by a single f_sync, when the cache fills
+ * up, the drive has been idle for IDE_WCACHE_IDLE_US, the oldest dirty
+ * sector is IDE_WCACHE_MAX_AGE_US old, on FLUSH CACHE, HDD eject and
+ * reset. PSRAM is taken whole by guest RAM and EMS, so the buffer lives
+ * in SRAM: IDE_WCACHE_SECTORS plus one DRQ block, about 18 KB per hard
+ * disk at the default. Smaller values trade throughput for durability;
+ * IDE_WCACHE_SECTORS 0 restores write-through with f_sync per batch.
+ * IDE_WCACHE_SECTORS must be a power of two.
+ */
+#ifndef IDE_WCACHE_SECTORS
+#define IDE_WCACHE_SECTORS    32
+#endif
+#ifndef IDE_WCACHE_IDLE_US
+#define IDE_WCACHE_IDLE_US    250000
+#endif
+#ifndef IDE_WCACHE_MAX_AGE_US
+#define IDE_WCACHE_MAX_AGE_US 2000000
+#endif
+#define IDE_WCACHE_HASH       (2 * IDE_WCACHE_SECTORS)
+
 typedef struct IDEState IDEState;
 typedef void EndTransferFunc(IDEState *);
 
@@ -382,11 +420,17 @@ struct IDEState {
     int      start_offset;  /* byte offset of data in file (for headered images) */
 
     /* active data transfer to/from CPU data port */
+    FSIZE_t  xfer_pos;          /* file offset of the next byte (file transfers) */
     int      xfer_left;         /* bytes remaining */
     int      xfer_sectors;      /* sectors in current batch (for accounting in done callback */
     int      xfer_is_write;     /* 1 = CPU is writing (HDD write / ATAPI packet) */
     EndTransferFunc *xfer_done; /* called when xfer_left reaches 0 */
 
+    /* READ/WRITE DMA issued, waiting for the bus master start bit */
+    int      dma_pending;
+    int      dma_is_write;
+    uint8_t  dma_mode;          /* SET FEATURES transfer mode (0x20|n MWDMA, 0x40|n UDMA) */
+
     /* CD-ROM streaming state (set by ide_atapi_cmd_read_pio) */
     int32_t  cd_lba;            /* next LBA to read */
     int32_t  cd_lba_end;        /* LBA past last sector */
@@ -397,6 +441,21 @@ struct IDEState {
     uint8_t  atapi_buf[ATAPI_BUF_SIZE];
     int      atapi_buf_len;     /* valid bytes in atapi_buf (reply mode) */
     int      atapi_buf_pos;     /* CPU read/write position in atapi_buf */
+
+    /* sector read buffer with read-ahead, see xfer_file_read() */
+    FSIZE_t  rbuf_pos;          /* file offset of rbuf[0] */
+    int      rbuf_len;          /* valid bytes, 0 = empty */
+    uint8_t  rbuf[IDE_RBUF_SIZE] __attribute__((aligned(4)));
+
+    /* write-back cache (HDD only, NULL = write-through), see wcache_store() */
+    uint8_t  *wc_data;          /* IDE_WCACHE_SECTORS slots + one DRQ block of staging */
+    uint32_t *wc_lba;           /* sector number held by each slot */
+    uint16_t *wc_hash;          /* open-addressed sector -> slot + 1, 0 = empty */
+    int      wc_count;          /* dirty slots in use */
+    uint32_t wc_first_us;       /* time of the oldest unflushed write */
+    uint32_t wc_last_us;        /* time of the latest write */
+    unsigned long wc_flushes, wc_runs, wc_sectors;
+    uint32_t wc_last_flush_us, wc_max_flush_us;
 };
 
 struct IDEIFState {
@@ -406,6 +465,17 @@ struct IDEIFState {
     IDEState *cur_drive;
     IDEState *drives[2];
     uint8_t  cmd;
+
+    /* bus-master DMA registers of this channel */
+    uint8_t  bm_cmd;
+    uint8_t  bm_status;
+    uint32_t bm_prd;            /* physical address of the PRD table */
+
+    /* guest RAM that bus-master DMA reads and writes */
+    uint8_t  *phys_mem;
+    uint32_t phys_mem_size;
+    void (*mem_written)(void *opaque, uint32_t addr, int len);
+    void *mem_written_opaque;
 };
 
 /* -------------------------------------------------------------------------
@@ -415,6 +485,7 @@ static void ide_atapi_cmd(IDEState *s);
 static void ide_sector_read(IDEState *s);
 static void ide_sector_write_flush(IDEState *s);
 static void ide_sector_read_next(IDEState *s);
+static void xfer_file_read(IDEState *s, uint8_t *dst, int len);
 
 /* -------------------------------------------------------------------------
  * helpers
@@ -580,7 +651,7 @@ static void ide_atapi_cmd_read_pio(IDEState *s, int lba, int nb_sectors, int sec
     atapi_tlog("[%d]  -> read_pio lba=%d n=%d ss=%d pos=%lu fp=%s\r\n",
         time_us_32(), lba, nb_sectors, sector_size,
         (unsigned long)pos, s->fp ? "ok" : "NULL");
-    f_lseek(s->fp, pos);
+    s->xfer_pos = pos;
 
     s->cd_lba        = lba;
     s->cd_lba_end    = lba + nb_sectors;
@@ -746,9 +817,10 @@ static void ide_identify(IDEState *s)
     padstr((char *)(tab+27), "TINY386 HARDDISK", 40);
     stw(tab+47, 0x8000 | MAX_MULT_SECTORS);
     stw(tab+48, 1);
-    stw(tab+49, 1<<9);
+    stw(tab+49, (1<<9) | (1<<8));       /* LBA, DMA */
     stw(tab+51, 0x200);
     stw(tab+52, 0x200);
+    stw(tab+53, (1<<1) | (1<<2));       /* words 64-70 and 88 valid */
     stw(tab+54, s->cylinders);
     stw(tab+55, s->heads);
     stw(tab+56, s->sectors);
@@ -758,12 +830,23 @@ static void ide_identify(IDEState *s)
     if (s->mult_sectors) stw(tab+59, 0x100 | s->mult_sectors);
     stw(tab+60, s->nb_sectors);
     stw(tab+61, s->nb_sectors >> 16);
-    stw(tab+80, (1<<1)|(1<<2));
-    stw(tab+82, 1<<14);
-    stw(tab+83, 1<<14);
+    /* MWDMA 0-2 and UDMA 0-2, with the mode selected by SET FEATURES */
+    int mw = (s->dma_mode & 0xf8) == 0x20 ? 1 << (s->dma_mode & 7) : 0;
+    int ud = (s->dma_mode & 0xf8) == 0x40 ? 1 << (s->dma_mode & 7) : 0;
+    stw(tab+63, 0x07 | (mw << 8));
+    stw(tab+64, 0x03);                  /* PIO 3-4 */
+    stw(tab+65, 120);
+    stw(tab+66, 120);
+    stw(tab+67, 120);
+    stw(tab+68, 120);
+    stw(tab+88, 0x07 | (ud << 8));
+    stw(tab+80, (1<<1)|(1<<2)|(1<<3)|(1<<4));
+    int wc = s->wc_data != NULL;
+    stw(tab+82, (1<<14) | (wc<<5));     /* write cache */
+    stw(tab+83, (1<<14) | (wc<<12));    /* FLUSH CACHE */
     stw(tab+84, 1<<14);
-    stw(tab+85, 1<<14);
-    stw(tab+86, 0);
+    stw(tab+85, (1<<14) | (wc<<5));
+    stw(tab+86, wc<<12);
     stw(tab+87, 1<<14);
 }
 
@@ -824,6 +907,119 @@ static void ide_set_sector(IDEState *s, int64_t sector_num)
 }
 
 /* Called when CPU finishes reading a batch; continue or done */
+/* -------------------------------------------------------------------------
+ * HDD write-back cache
+ * ---------------------------------------------------------------------- */
+static int wcache_find(IDEState *s, uint32_t lba)
+{
+    for (uint32_t h = lba & (IDE_WCACHE_HASH - 1); s->wc_hash[h];
+         h = (h + 1) & (IDE_WCACHE_HASH - 1)) {
+        int slot = s->wc_hash[h] - 1;
+        if (s->wc_lba[slot] == lba) return slot;
+    }
+    return -1;
+}
+
+/* Dirty data for the sector holding file offset pos, or NULL */
+static const uint8_t *wcache_lookup(IDEState *s, FSIZE_t pos)
+{
+    if (!s->wc_count || pos < (FSIZE_t)s->start_offset) return NULL;
+    int slot = wcache_find(s, (pos - s->start_offset) / SECTOR_SIZE);
+    return slot < 0 ? NULL : s->wc_data + slot * SECTOR_SIZE;
+}
+
+/*
+ * Write every dirty sector back to the image. Slots are ordered by sector
+ * number, contiguous runs are written with one f_lseek and f_writes of up
+ * to IDE_RBUF_SIZE bytes staged in rbuf, then the file is synced once.
+ */
+static void wcache_flush(IDEState *s)
+{
+    int n = s->wc_count;
+    if (!n) return;
+    uint32_t t0 = time_us_32();
+
+    /* insertion sort: guest writes arrive mostly in order */
+    uint16_t order[IDE_WCACHE_SECTORS];
+    for (int i = 0; i < n; i++) {
+        int j = i;
+        while (j > 0 && s->wc_lba[order[j - 1]] > s->wc_lba[i]) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = i;
+    }
+
+    for (int i = 0; i < n; ) {
+        int j = i + 1;
+        while (j < n && s->wc_lba[order[j]] == s->wc_lba[order[j - 1]] + 1) j++;
+        f_lseek(s->fp, (FSIZE_t)s->start_offset +
+                       (FSIZE_t)s->wc_lba[order[i]] * SECTOR_SIZE);
+        while (i < j) {
+            int m = j - i;
+            if (m > IDE_RBUF_SIZE / SECTOR_SIZE) m = IDE_RBUF_SIZE / SECTOR_SIZE;
+            for (int k = 0; k < m; k++)
+                memcpy(s->rbuf + k * SECTOR_SIZE,
+                       s->wc_data + order[i + k] * SECTOR_SIZE, SECTOR_SIZE);
+            UINT bw; f_write(s->fp, s->rbuf, m * SECTOR_SIZE, &bw);
+            i += m;
+        }
+        s->wc_runs++;
+    }
+    f_sync(s->fp);
+
+    s->rbuf_len = 0;    /* may predate the writes just made */
+    memset(s->wc_hash, 0, IDE_WCACHE_HASH * sizeof(*s->wc_hash));
+    s->wc_count = 0;
+    s->wc_flushes++;
+    s->wc_sectors += n;
+    s->wc_last_flush_us = time_us_32() - t0;
+    if (s->wc_last_flush_us > s->wc_max_flush_us)
+        s->wc_max_flush_us = s->wc_last_flush_us;
+}
+
+/* Staging area the CPU fills with the current DRQ block */
+static inline uint8_t *wcache_stage(IDEState *s)
+{
+    return s->wc_data + IDE_WCACHE_SECTORS * SECTOR_SIZE;
+}
+
+/* Copy n sectors starting at lba from src into the cache */
+static void wcache_store(IDEState *s, uint32_t lba, int n, const uint8_t *src)
+{
+    uint32_t now = time_us_32();
+    for (int i = 0; i < n; i++) {
+        int slot = wcache_find(s, lba + i);
+        if (slot < 0) {
+            if (s->wc_count == IDE_WCACHE_SECTORS) wcache_flush(s);
+            if (!s->wc_count) s->wc_first_us = now;
+            slot = s->wc_count++;
+            s->wc_lba[slot] = lba + i;
+            uint32_t h = (lba + i) & (IDE_WCACHE_HASH - 1);
+            while (s->wc_hash[h]) h = (h + 1) & (IDE_WCACHE_HASH - 1);
+            s->wc_hash[h] = slot + 1;
+        }
+        memcpy(s->wc_data + slot * SECTOR_SIZE, src + i * SECTOR_SIZE, SECTOR_SIZE);
+    }
+    s->wc_last_us = now;
+}
+
+static void wcache_init(IDEState *s)
+{
+    if (IDE_WCACHE_SECTORS == 0) return;
+    s->wc_data = malloc((IDE_WCACHE_SECTORS + MAX_MULT_SECTORS) * SECTOR_SIZE);
+    s->wc_lba  = malloc(IDE_WCACHE_SECTORS * sizeof(*s->wc_lba));
+    s->wc_hash = malloc(IDE_WCACHE_HASH * sizeof(*s->wc_hash));
+    if (!s->wc_data || !s->wc_lba || !s->wc_hash) {
+        free(s->wc_data);
+        free(s->wc_lba);
+        free(s->wc_hash);
+        s->wc_data = NULL;
+        return;
+    }
+    memset(s->wc_hash, 0, IDE_WCACHE_HASH * sizeof(*s->wc_hash));
+}
+
 static void ide_sector_read_next(IDEState *s)
 {
     int n = s->xfer_sectors;
@@ -844,9 +1040,7 @@ static void ide_sector_read(IDEState *s)
     int max = s->mult_sectors ? s->mult_sectors : 1;
     if (n > max) n = max;
 
-    FSIZE_t pos = (FSIZE_t)s->start_offset + (FSIZE_t)sector_num * SECTOR_SIZE;
-    f_lseek(s->fp, pos);
-
+    s->xfer_pos      = (FSIZE_t)s->start_offset + (FSIZE_t)sector_num * SECTOR_SIZE;
     s->xfer_sectors  = n;
     s->xfer_left     = n * SECTOR_SIZE;
     s->xfer_is_write = 0;
@@ -860,7 +1054,10 @@ static void ide_sector_write_flush(IDEState *s)
 {
     /* advance position by the batch we just received */
     int n = s->xfer_sectors;
-    f_sync(s->fp);
+    if (s->wc_data)
+        wcache_store(s, ide_get_sector(s), n, wcache_stage(s));
+    else
+        f_sync(s->fp);
     ide_set_sector(s, ide_get_sector(s) + n);
     s->nsector = (s->nsector - n) & 0xff;
 
@@ -889,8 +1086,11 @@ static void ide_sector_write(IDEState *s)
     int max = s->mult_sectors ? s->mult_sectors : 1;
     if (n > max) n = max;
 
-    FSIZE_t pos = (FSIZE_t)s->start_offset + (FSIZE_t)sector_num * SECTOR_SIZE;
-    f_lseek(s->fp, pos);
+    if (!s->wc_data) {
+        /* write-through: the data port writes straight to the file */
+        f_lseek(s->fp, (FSIZE_t)s->start_offset + (FSIZE_t)sector_num * SECTOR_SIZE);
+        s->rbuf_len = 0;    /* the write may cover buffered sectors */
+    }
 
     s->xfer_sectors  = n;
     s->xfer_left     = n * SECTOR_SIZE;
@@ -899,6 +1099,121 @@ static void ide_sector_write(IDEState *s)
     s->status        = READY_STAT | SEEK_STAT | DRQ_STAT;
 }
 
+/* -------------------------------------------------------------------------
+ * PIIX bus-master DMA
+ *
+ * The whole READ/WRITE DMA command runs as soon as both the command and the
+ * bus master start bit are in place: the PRD table is walked and sector
+ * data moves between the image (or the write-back cache) and phys_mem
+ * without going through the data port.
+ * ---------------------------------------------------------------------- */
+static uint32_t bm_ld32(IDEIFState *bm, uint32_t addr)
+{
+    if (bm->phys_mem_size < 4 || addr > bm->phys_mem_size - 4) return BM_PRD_EOT;
+    const uint8_t *p = bm->phys_mem + addr;
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void ide_dma_run(IDEState *s)
+{
+    IDEIFState *bm = s->ide_if;
+    int64_t sector_num = ide_get_sector(s);
+    int n = s->nsector ? s->nsector : 256;
+    uint32_t left = n * SECTOR_SIZE;
+    FSIZE_t pos = (FSIZE_t)s->start_offset + (FSIZE_t)sector_num * SECTOR_SIZE;
+    uint32_t lba = sector_num;
+    int part = 0;               /* bytes of a sector assembled in the stage */
+    uint32_t prd = bm->bm_prd & ~3;
+    int eot = 0;
+
+    s->dma_pending = 0;
+    if (!(bm->bm_cmd & BM_CMD_READ) != s->dma_is_write) {
+        /* bus master programmed for the other direction: nothing moves */
+        s->status = READY_STAT | ERR_STAT;
+        s->error  = ABRT_ERR;
+        bm->bm_status = (bm->bm_status & ~BM_STATUS_ACTIVE) |
+                        BM_STATUS_ERROR | BM_STATUS_INT;
+        ide_set_irq(s);
+        return;
+    }
+    if (!s->dma_is_write) {
+        s->xfer_pos = pos;
+    } else if (!s->wc_data) {
+        f_lseek(s->fp, pos);
+        s->rbuf_len = 0;
+    }
+
+    while (left && !eot) {
+        uint32_t addr = bm_ld32(bm, prd) & ~1;
+        uint32_t cnt  = bm_ld32(bm, prd + 4);
+        prd += 8;
+        eot = (cnt & BM_PRD_EOT) != 0;
+        cnt &= 0xfffe;
+        if (!cnt) cnt = 0x10000;
+        if (cnt > left) cnt = left;
+        if (addr >= bm->phys_mem_size || cnt > bm->phys_mem_size - addr)
+            break;
+        uint8_t *p = bm->phys_mem + addr;
+        left -= cnt;
+
+        if (!s->dma_is_write) {
+            xfer_file_read(s, p, cnt);
+            if (bm->mem_written)
+                bm->mem_written(bm->mem_written_opaque, addr, cnt);
+        } else if (!s->wc_data) {
+            UINT bw; f_write(s->fp, p, cnt, &bw);
+        } else {
+            /* PRD segments need not be sector aligned */
+            while (cnt) {
+                if (!part && cnt >= SECTOR_SIZE) {
+                    wcache_store(s, lba++, 1, p);
+                    p += SECTOR_SIZE;
+                    cnt -= SECTOR_SIZE;
+                    continue;
+                }
+                int m = SECTOR_SIZE - part;
+                if (m > (int)cnt) m = cnt;
+                memcpy(wcache_stage(s) + part, p, m);
+                part += m;
+                p += m;
+                cnt -= m;
+                if (part == SECTOR_SIZE) {
+                    wcache_store(s, lba++, 1, wcache_stage(s));
+                    part = 0;
+                }
+            }
+        }
+    }
+    if (s->dma_is_write && !s->wc_data)
+        f_sync(s->fp);
+
+    int done = n - (left + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    ide_set_sector(s, sector_num + done);
+    s->nsector = (s->nsector - done) & 0xff;
+    if (left) {
+        /* PRD table shorter than the transfer, or outside RAM */
+        s->status = READY_STAT | ERR_STAT;
+        s->error  = ABRT_ERR;
+        bm->bm_status |= BM_STATUS_ERROR;
+    } else {
+        s->status = READY_STAT | SEEK_STAT;
+    }
+    /* active stays set if the PRD table describes more than was moved */
+    if (eot || left)
+        bm->bm_status &= ~BM_STATUS_ACTIVE;
+    bm->bm_status |= BM_STATUS_INT;
+    ide_set_irq(s);
+}
+
+static void ide_dma_start(IDEState *s, int is_write)
+{
+    s->dma_pending  = 1;
+    s->dma_is_write = is_write;
+    s->status = READY_STAT | SEEK_STAT | DRQ_STAT;
+    if (s->ide_if->bm_cmd & BM_CMD_START)
+        ide_dma_run(s);
+}
+
 static void ide_identify_cb(IDEState *s)
 {
     ide_transfer_stop(s);
@@ -1233,6 +1548,7 @@ static void ide_atapi_cmd(IDEState *s)
  * ---------------------------------------------------------------------- */
 static void ide_exec_cmd(IDEState *s, int val)
 {
+    s->dma_pending = 0;
     switch (val) {
     case WIN_IDENTIFY:
         ide_identify(s);
@@ -1288,6 +1604,24 @@ static void ide_exec_cmd(IDEState *s, int val)
         ide_set_irq(s);
         break;
     case WIN_SETFEATURES:
+        /* 0x03: set transfer mode from the sector count register */
+        if (s->feature == 0x03 && ((s->nsector & 0xf8) == 0x20 ||
+                                   (s->nsector & 0xf8) == 0x40))
+            s->dma_mode = s->nsector;
+        s->status = READY_STAT | SEEK_STAT;
+        ide_set_irq(s);
+        break;
+    case WIN_READDMA:
+    case WIN_READDMA_ONCE:
+        ide_dma_start(s, 0);
+        break;
+    case WIN_WRITEDMA:
+    case WIN_WRITEDMA_ONCE:
+        ide_dma_start(s, 1);
+        break;
+    case WIN_FLUSH_CACHE:
+    case WIN_FLUSH_CACHE_EXT:
+        wcache_flush(s);
         s->status = READY_STAT | SEEK_STAT;
         ide_set_irq(s);
         break;
@@ -1458,15 +1792,75 @@ static inline int xfer_from_file(IDEState *s)
     return s->xfer_done == ide_sector_read_next;
 }
 
+/*
+ * Read len bytes at xfer_pos. Word and dword reads are served from rbuf,
+ * which a miss refills with IDE_RBUF_SIZE bytes: the rest of the current
+ * DRQ block and the block after it, so sequential reads cost one f_read
+ * per two blocks instead of one per word. Reads of a whole buffer or more
+ * (REP INSW straight into guest RAM) bypass it.
+ */
+static void xfer_file_read(IDEState *s, uint8_t *dst, int len)
+{
+    FSIZE_t pos = s->xfer_pos;
+    s->xfer_pos += len;
+    while (len > 0) {
+        const uint8_t *dirty = wcache_lookup(s, pos);
+        if (dirty) {
+            int off = (pos - s->start_offset) % SECTOR_SIZE;
+            int n = SECTOR_SIZE - off;
+            if (n > len) n = len;
+            memcpy(dst, dirty + off, n);
+            dst += n;
+            pos += n;
+            len -= n;
+            continue;
+        }
+        if (pos >= s->rbuf_pos && pos < s->rbuf_pos + s->rbuf_len) {
+            int n = s->rbuf_pos + s->rbuf_len - pos;
+            /* sectors cached as dirty after rbuf was filled are newer than
+             * it: stop at the sector end so the next one is looked up */
+            if (s->wc_count) {
+                int in = (pos - s->start_offset) % SECTOR_SIZE;
+                if (n > SECTOR_SIZE - in) n = SECTOR_SIZE - in;
+            }
+            if (n > len) n = len;
+            memcpy(dst, s->rbuf + (pos - s->rbuf_pos), n);
+            dst += n;
+            pos += n;
+            len -= n;
+            continue;
+        }
+        UINT br = 0;
+        f_lseek(s->fp, pos);
+        if (len >= IDE_RBUF_SIZE) {
+            f_read(s->fp, dst, len, &br);
+            /* patch in sectors still waiting in the write cache */
+            for (int off = 0; s->wc_count && off < len; ) {
+                const uint8_t *d = wcache_lookup(s, pos + off);
+                int in = (pos + off - s->start_offset) % SECTOR_SIZE;
+                int n = SECTOR_SIZE - in;
+                if (n > len - off) n = len - off;
+                if (d) memcpy(dst + off, d + in, n);
+                off += n;
+            }
+            return;
+        }
+        f_read(s->fp, s->rbuf, IDE_RBUF_SIZE, &br);
+        s->rbuf_pos = pos;
+        s->rbuf_len = br;
+        if (br == 0) return;    /* past the end of the image */
+    }
+}
+
 static uint16_t xfer_read16(IDEState *s)
 {
-    uint8_t buf[2]; UINT br;
+    uint8_t buf[2] = { 0, 0 };
     if (xfer_from_file(s)) {
-        f_read(s->fp, buf, 2, &br);
+        xfer_file_read(s, buf, 2);
         /* log first word of each sector (xfer_left is multiple of sector_size at start) */
         if (s->drive_kind == IDE_CD && s->xfer_left % s->cd_sector_size == s->cd_sector_size - 2)
-            atapi_tlog("[%d]  xfer16 lba=%d w0=%02x%02x br=%d\r\n",
-                time_us_32(), s->cd_lba, buf[0], buf[1], br);
+            atapi_tlog("[%d]  xfer16 lba=%d w0=%02x%02x\r\n",
+                time_us_32(), s->cd_lba, buf[0], buf[1]);
         return buf[0] | (buf[1] << 8);
     } else {
         if (s->atapi_buf_pos + 1 >= s->atapi_buf_len) return 0;
@@ -1478,9 +1872,9 @@ static uint16_t xfer_read16(IDEState *s)
 
 static uint32_t xfer_read32(IDEState *s)
 {
-    uint8_t buf[4]; UINT br;
+    uint8_t buf[4] = { 0, 0, 0, 0 };
     if (xfer_from_file(s)) {
-        f_read(s->fp, buf, 4, &br);
+        xfer_file_read(s, buf, 4);
         return buf[0] | (buf[1]<<8) | (buf[2]<<16) | (buf[3]<<24);
     } else {
         if (s->atapi_buf_pos + 3 >= s->atapi_buf_len) return 0;
@@ -1493,6 +1887,18 @@ static uint32_t xfer_read32(IDEState *s)
     }
 }
 
+/* Accept len bytes of HDD write data: staged for the write-back cache,
+ * or written through to the file */
+static void xfer_file_write(IDEState *s, const uint8_t *buf, int len)
+{
+    if (s->wc_data) {
+        memcpy(wcache_stage(s) + s->xfer_sectors * SECTOR_SIZE - s->xfer_left,
+               buf, len);
+    } else {
+        UINT bw; f_write(s->fp, buf, len, &bw);
+    }
+}
+
 static void xfer_advance(IDEState *s, int n)
 {
     s->xfer_left -= n;
@@ -1539,7 +1945,7 @@ void ide_data_writew(void *opaque, uint32_t val)
 
     if (s->drive_kind == IDE_HD) {
         uint8_t buf[2] = { val & 0xff, (val >> 8) & 0xff };
-        UINT bw; f_write(s->fp, buf, 2, &bw);
+        xfer_file_write(s, buf, 2);
     } else {
         /* ATAPI packet receive */
         s->atapi_buf[s->atapi_buf_pos++] = val & 0xff;
@@ -1566,7 +1972,7 @@ void ide_data_writel(void *opaque, uint32_t val)
 
     if (s->drive_kind == IDE_HD) {
         uint8_t buf[4] = { val, val>>8, val>>16, val>>24 };
-        UINT bw; f_write(s->fp, buf, 4, &bw);
+        xfer_file_write(s, buf, 4);
     } else {
         s->atapi_buf[s->atapi_buf_pos++] = val;
         s->atapi_buf[s->atapi_buf_pos++] = val >> 8;
@@ -1586,16 +1992,34 @@ uint32_t ide_data_readl(void *opaque)
     return v;
 }
 
+/*
+ * Bytes a string transfer may move in one go: the rest of the current DRQ
+ * block, and for CD reads no further than the end of the current sector so
+ * that xfer_advance() re-arms DRQ and advances cd_lba for every sector.
+ * The CPU calls again for the remainder.
+ */
+static int xfer_string_len(IDEState *s, int size, int count)
+{
+    int len = size * count;
+    if (len > s->xfer_left) len = s->xfer_left;
+    if (s->drive_kind == IDE_CD && !s->xfer_is_write && s->cd_sector_size > 0) {
+        int rest = s->xfer_left % s->cd_sector_size;
+        if (rest == 0) rest = s->cd_sector_size;
+        if (len > rest) len = rest;
+    }
+    return len - len % size;
+}
+
+/* REP OUTSW/OUTSD: the CPU hands over guest RAM directly */
 int ide_data_write_string(void *opaque, uint8_t *buf, int size, int count)
 {
     IDEIFState *s1 = opaque;
     IDEState *s = s1->cur_drive;
     if (!s || !s->xfer_is_write) return 0;
-    int len = size * count;
-    if (len > s->xfer_left) len = s->xfer_left;
-    len -= len % size;
+    int len = xfer_string_len(s, size, count);
+    if (len == 0) return 0;
     if (s->drive_kind == IDE_HD) {
-        UINT bw; f_write(s->fp, buf, len, &bw);
+        xfer_file_write(s, buf, len);
     } else {
         memcpy(s->atapi_buf + s->atapi_buf_pos, buf, len);
         s->atapi_buf_pos += len;
@@ -1604,16 +2028,16 @@ int ide_data_write_string(void *opaque, uint8_t *buf, int size, int count)
     return len / size;
 }
 
+/* REP INSW/INSD: sector data is read from the image straight into guest RAM */
 int ide_data_read_string(void *opaque, uint8_t *buf, int size, int count)
 {
     IDEIFState *s1 = opaque;
     IDEState *s = s1->cur_drive;
     if (!s || s->xfer_is_write) return 0;
-    int len = size * count;
-    if (len > s->xfer_left) len = s->xfer_left;
-    len -= len % size;
+    int len = xfer_string_len(s, size, count);
+    if (len == 0) return 0;
     if (xfer_from_file(s)) {
-        UINT br; f_read(s->fp, buf, len, &br);
+        xfer_file_read(s, buf, len);
     } else {
         memcpy(buf, s->atapi_buf + s->atapi_buf_pos, len);
         s->atapi_buf_pos += len;
@@ -1655,6 +2079,8 @@ static IDEState *ide_hddrive_init(IDEIFState *ide_if, FIL *f, int f_open,
     }
 
     s->mult_sectors = MAX_MULT_SECTORS;
+    s->dma_mode = 0x42;     /* UDMA 2 */
+    wcache_init(s);
     s->feature = s->error = s->nsector = 0;
     s->sector = s->lcyl = s->hcyl = 0;
     s->select = 0xa0;
@@ -1750,6 +2176,42 @@ int ide_attach_cd(IDEIFState *s, int drive)
     return s->drives[drive] ? 0 : -1;
 }
 
+/* Write back the cached sectors of both drives on this channel */
+void ide_flush(IDEIFState *s)
+{
+    if (!s) return;
+    for (int i = 0; i < 2; i++)
+        if (s->drives[i]) wcache_flush(s->drives[i]);
+}
+
+/* Periodic hook: flush a drive once it has gone idle or its oldest dirty
+ * sector has waited long enough */
+void ide_step(IDEIFState *s)
+{
+    for (int i = 0; i < 2; i++) {
+        IDEState *d = s->drives[i];
+        if (!d || !d->wc_count) continue;
+        uint32_t now = time_us_32();
+        if (now - d->wc_last_us >= IDE_WCACHE_IDLE_US ||
+            now - d->wc_first_us >= IDE_WCACHE_MAX_AGE_US)
+            wcache_flush(d);
+    }
+}
+
+void ide_get_wcache_stats(IDEIFState *s, int drive, struct ide_wcache_stats *st)
+{
+    IDEState *d = s ? s->drives[drive] : NULL;
+    memset(st, 0, sizeof(*st));
+    if (!d || !d->wc_data) return;
+    st->dirty         = d->wc_count;
+    st->capacity      = IDE_WCACHE_SECTORS;
+    st->flushes       = d->wc_flushes;
+    st->runs          = d->wc_runs;
+    st->sectors       = d->wc_sectors;
+    st->last_flush_us = d->wc_last_flush_us;
+    st->max_flush_us  = d->wc_max_flush_us;
+}
+
 int ide_has_drive(IDEIFState *s, int drive)
 {
     return s && drive >= 0 && drive < 2 && s->drives[drive] != NULL;
@@ -1766,6 +2228,7 @@ void ide_change_cd(IDEIFState *sif, int drive, FIL *f, int was_present)
     if (!s || s->drive_kind != IDE_CD) return;
 
     s->fp = f;
+    s->rbuf_len = 0;
 
     if (f) {
         atapi_tlog("  f_size=%lu nb_512=%ld cd_sec=%ld\r\n",
@@ -1797,11 +2260,68 @@ void ide_change_cd(IDEIFState *sif, int drive, FIL *f, int was_present)
     ide_set_irq(s);
 }
 
-PCIDevice *piix3_ide_init(PCIBus *pci_bus, int devfn)
+void ide_set_dma_mem(IDEIFState *s, uint8_t *phys_mem, uint32_t phys_mem_size,
+                     void (*cb)(void *opaque, uint32_t addr, int len),
+                     void *opaque)
+{
+    s->phys_mem           = phys_mem;
+    s->phys_mem_size      = phys_mem_size;
+    s->mem_written        = cb;
+    s->mem_written_opaque = opaque;
+}
+
+uint32_t ide_bmdma_read(IDEIFState *s, uint32_t offset, int size)
+{
+    uint32_t val = 0;
+    for (int i = 0; i < size; i++) {
+        uint32_t off = (offset + i) & 7;
+        uint8_t b = 0;
+        if (off == BM_CMD)
+            b = s->bm_cmd;
+        else if (off == BM_STATUS)
+            b = s->bm_status;
+        else if (off >= BM_PRD)
+            b = s->bm_prd >> ((off - BM_PRD) * 8);
+        val |= (uint32_t)b << (i * 8);
+    }
+    return val;
+}
+
+void ide_bmdma_write(IDEIFState *s, uint32_t offset, uint32_t val, int size)
+{
+    for (int i = 0; i < size; i++) {
+        uint32_t off = (offset + i) & 7;
+        uint8_t b = val >> (i * 8);
+        if (off == BM_CMD) {
+            if (!(b & BM_CMD_START)) {
+                s->bm_status &= ~BM_STATUS_ACTIVE;      /* stop/abort */
+                s->bm_cmd = b & BM_CMD_READ;
+            } else if (!(s->bm_cmd & BM_CMD_START)) {
+                s->bm_cmd = b & (BM_CMD_START | BM_CMD_READ);
+                s->bm_status |= BM_STATUS_ACTIVE;
+                if (s->cur_drive && s->cur_drive->dma_pending)
+                    ide_dma_run(s->cur_drive);
+            }
+        } else if (off == BM_STATUS) {
+            /* interrupt and error bits are write-1-to-clear */
+            s->bm_status = (s->bm_status & ~(b & (BM_STATUS_ERROR | BM_STATUS_INT)) &
+                            ~BM_STATUS_DMA_CAP) | (b & BM_STATUS_DMA_CAP);
+        } else if (off >= BM_PRD) {
+            int sh = (off - BM_PRD) * 8;
+            s->bm_prd = (s->bm_prd & ~(0xffu << sh)) | ((uint32_t)b << sh);
+        }
+    }
+}
+
+PCIDevice *piix3_ide_init(PCIBus *pci_bus, int devfn,
+                          void *opaque, PCIBarSetFunc *bm_bar_set)
 {
     PCIDevice *d;
     d = pci_register_device(pci_bus, "PIIX3 IDE", devfn, 0x8086, 0x7010, 0x00, 0x0101);
-    pci_device_set_config8(d, 0x09, 0x00);
+    pci_device_set_config8(d, 0x09, 0x80);          /* legacy ports, bus master */
+    pci_register_bar(d, 4, 16, PCI_ADDRESS_SPACE_IO, opaque, bm_bar_set);
+    pci_device_set_config16(d, 0x40, 0x8000);       /* IDETIM: channels decoded */
+    pci_device_set_config16(d, 0x42, 0x8000);
     return d;
 }
 
@@ -47,6 +47,23 @@ int ide_has_drive(IDEIFState *s, int drive);
 /* Hot-swap CD image: pass open FIL* on insert, NULL to eject */
 void ide_change_cd(IDEIFState *sif, int drive, FIL *f, int was_present);
 
+/* Write-back cache statistics of one HDD (all zero for CD-ROM or no drive) */
+struct ide_wcache_stats {
+    int dirty;                  /* sectors not yet written to the image */
+    int capacity;               /* cache size in sectors, 0 = write-through */
+    unsigned long flushes;      /* flushes, each ending with one f_sync */
+    unsigned long runs;         /* contiguous sector runs written */
+    unsigned long sectors;      /* sectors written back */
+    uint32_t last_flush_us, max_flush_us;
+};
+void ide_get_wcache_stats(IDEIFState *s, int drive, struct ide_wcache_stats *st);
+
+/* Write back dirty HDD sectors (before eject, reset or power-off) */
+void ide_flush(IDEIFState *s);
+
+/* Idle/age-based write-back, call periodically */
+void ide_step(IDEIFState *s);
+
 void     ide_data_writew(void *opaque, uint32_t val);
 uint32_t ide_data_readw(void *opaque);
 void     ide_data_writel(void *opaque, uint32_t val);
@@ -60,7 +77,19 @@ void     ide_cmd_write(void *opaque, uint32_t val);
 uint32_t ide_status_read(void *opaque);
 
 #include "pci.h"
-PCIDevice *piix3_ide_init(PCIBus *pci_bus, int devfn);
+/* PIIX IDE function; bm_bar_set is told where the guest maps the
+ * bus-master register block (BAR4, 16 ports: primary then secondary) */
+PCIDevice *piix3_ide_init(PCIBus *pci_bus, int devfn,
+                          void *opaque, PCIBarSetFunc *bm_bar_set);
+
+/* Bus-master registers of one channel, offset 0-7 inside its block */
+uint32_t ide_bmdma_read(IDEIFState *s, uint32_t offset, int size);
+void     ide_bmdma_write(IDEIFState *s, uint32_t offset, uint32_t val, int size);
+
+/* Guest RAM for bus-master DMA; cb is called after DMA wrote to it */
+void ide_set_dma_mem(IDEIFState *s, uint8_t *phys_mem, uint32_t phys_mem_size,
+                     void (*cb)(void *opaque, uint32_t addr, int len),
+                     void *opaque);
 
 void ide_fill_cmos(IDEIFState *s, void *cmos,
                    uint8_t (*set)(void *cmos, int addr, uint8_t val));
@@ -0,0 +1,125 @@
+/**
+ * frank-386 - i386 PC Emulator for RP2350
+ *
+ * Port I/O dispatch, see ioport.h.
+ *
+ * Copyright (c) 2026 Mikhail Matveev <xtreme@rh1.tech>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ioport.h"
+
+static const uint8_t unmapped_page[1 << IOPORT_PAGE_BITS];
+
+static uint8_t  none_read8(void *o, int port) { return 0xff; }
+static uint16_t none_read16(void *o, int port) { return 0; }
+static uint32_t none_read32(void *o, int port) { return 0; }
+static void     none_write8(void *o, int port, uint8_t val) { }
+static void     none_write16(void *o, int port, uint16_t val) { }
+static void     none_write32(void *o, int port, uint32_t val) { }
+static int      none_string(void *o, int port, uint8_t *buf,
+                            int size, int count) { return 0; }
+
+static void fill_slot(IOPortSlot *s, const IOPortOps *ops, void *opaque) {
+    static const IOPortOps none = { 0 };
+    if (!ops)
+        ops = &none;
+    s->owner = ops;
+    s->opaque = opaque;
+    s->ops.read8 = ops->read8 ? ops->read8 : none_read8;
+    s->ops.write8 = ops->write8 ? ops->write8 : none_write8;
+    s->ops.read16 = ops->read16 ? ops->read16 : none_read16;
+    s->ops.write16 = ops->write16 ? ops->write16 : none_write16;
+    s->ops.read32 = ops->read32 ? ops->read32 : none_read32;
+    s->ops.write32 = ops->write32 ? ops->write32 : none_write32;
+    s->ops.read_string = ops->read_string ? ops->read_string : none_string;
+    s->ops.write_string = ops->write_string ? ops->write_string : none_string;
+}
+
+void ioport_init(IOPortMap *m) {
+    for (int i = 0; i < IOPORT_PAGES; i++)
+        m->page[i] = (uint8_t *)unmapped_page;
+    fill_slot(&m->slot[0], NULL, NULL);
+    m->nslots = 1;
+}
+
+static int find_slot(IOPortMap *m, const IOPortOps *ops, void *opaque) {
+    for (int i = 1; i < m->nslots; i++) {
+        if (m->slot[i].owner == ops && m->slot[i].opaque == opaque)
+            return i;
+    }
+    return -1;
+}
+
+/* slots are never freed: devices re-registering after a settings change
+ * get their old slot back */
+static int get_slot(IOPortMap *m, const IOPortOps *ops, void *opaque) {
+    int i = find_slot(m, ops, opaque);
+    if (i >= 0)
+        return i;
+    if (m->nslots >= IOPORT_MAX_SLOTS)
+        return -1;
+    fill_slot(&m->slot[m->nslots], ops, opaque);
+    return m->nslots++;
+}
+
+enum { SET_ALL, SET_FREE, SET_OWNED };
+
+/* Set the ports of [start, start + len) that are inside the 64K space.
+ * SET_FREE only touches unmapped ports, SET_OWNED only those routed to
+ * slot `owner`. */
+static int set_range(IOPortMap *m, uint32_t start, uint32_t len,
+                     uint8_t idx, int mode, int owner) {
+    if (start > 0xffff)
+        return 0;
+    uint32_t end = len > 0x10000 - start ? 0x10000 : start + len;
+    for (uint32_t port = start; port < end; port++) {
+        uint8_t **page = &m->page[port >> IOPORT_PAGE_BITS];
+        uint8_t *cur = &(*page)[port & ((1 << IOPORT_PAGE_BITS) - 1)];
+        if ((mode == SET_FREE && *cur != 0) ||
+            (mode == SET_OWNED && *cur != owner))
+            continue;
+        if (*page == unmapped_page) {
+            if (idx == 0)
+                continue;
+            uint8_t *p = malloc(1 << IOPORT_PAGE_BITS);
+            if (!p)
+                return -1;
+            memset(p, 0, 1 << IOPORT_PAGE_BITS);
+            *page = p;
+            cur = &p[port & ((1 << IOPORT_PAGE_BITS) - 1)];
+        }
+        *cur = idx;
+    }
+    return 0;
+}
+
+int ioport_map(IOPortMap *m, uint32_t start, uint32_t len,
+               const IOPortOps *ops, void *opaque) {
+    int idx = get_slot(m, ops, opaque);
+    if (idx < 0)
+        return -1;
+    return set_range(m, start, len, idx, SET_ALL, 0);
+}
+
+int ioport_map_free(IOPortMap *m, uint32_t start, uint32_t len,
+                    const IOPortOps *ops, void *opaque) {
+    int idx = get_slot(m, ops, opaque);
+    if (idx < 0)
+        return -1;
+    return set_range(m, start, len, idx, SET_FREE, 0);
+}
+
+void ioport_unmap(IOPortMap *m, uint32_t start, uint32_t len) {
+    set_range(m, start, len, 0, SET_ALL, 0);
+}
+
+void ioport_unmap_owned(IOPortMap *m, uint32_t start, uint32_t len,
+                        const IOPortOps *ops, void *opaque) {
+    int idx = find_slot(m, ops, opaque);
+    if (idx > 0)
+        set_range(m, start, len, 0, SET_OWNED, idx);
+}
@@ -0,0 +1,88 @@
+/**
+ * frank-386 - i386 PC Emulator for RP2350
+ *
+ * Port I/O dispatch. The 64K port space is split into 256-port pages, each
+ * a byte array of handler indices, so an IN/OUT costs two loads and one
+ * indirect call. Pages nobody claimed share a single all-unmapped page.
+ * Handler slots are filled with defaults for the widths a device does not
+ * implement, so dispatch never tests for NULL.
+ *
+ * Copyright (c) 2026 Mikhail Matveev <xtreme@rh1.tech>
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef IOPORT_H
+#define IOPORT_H
+
+#include <stdint.h>
+
+#define IOPORT_PAGE_BITS  8
+#define IOPORT_PAGES      (0x10000 >> IOPORT_PAGE_BITS)
+#define IOPORT_MAX_SLOTS  64
+
+typedef uint8_t  IOPortRead8(void *opaque, int port);
+typedef uint16_t IOPortRead16(void *opaque, int port);
+typedef uint32_t IOPortRead32(void *opaque, int port);
+typedef void     IOPortWrite8(void *opaque, int port, uint8_t val);
+typedef void     IOPortWrite16(void *opaque, int port, uint16_t val);
+typedef void     IOPortWrite32(void *opaque, int port, uint32_t val);
+typedef int      IOPortString(void *opaque, int port, uint8_t *buf,
+                              int size, int count);
+
+/**
+ * A device's port handlers. Missing widths read as open bus (0xff for
+ * bytes, 0 for words and dwords, as the old switch did) and ignore writes;
+ * missing string handlers report no transfer so the CPU falls back to
+ * single accesses.
+ */
+typedef struct {
+    IOPortRead8   *read8;
+    IOPortWrite8  *write8;
+    IOPortRead16  *read16;
+    IOPortWrite16 *write16;
+    IOPortRead32  *read32;
+    IOPortWrite32 *write32;
+    IOPortString  *read_string;
+    IOPortString  *write_string;
+} IOPortOps;
+
+typedef struct {
+    IOPortOps ops;              ///< complete, defaults filled in
+    void *opaque;
+    const IOPortOps *owner;     ///< as registered, to share slots
+} IOPortSlot;
+
+typedef struct {
+    uint8_t *page[IOPORT_PAGES];
+    IOPortSlot slot[IOPORT_MAX_SLOTS];  ///< slot 0 = unmapped
+    int nslots;
+} IOPortMap;
+
+void ioport_init(IOPortMap *m);
+
+/**
+ * Route ports [start, start + len) to ops/opaque, replacing any handler.
+ * Ports above 0xFFFF are ignored. Returns -1 if the slot table is full or
+ * a page cannot be allocated, 0 otherwise.
+ */
+int ioport_map(IOPortMap *m, uint32_t start, uint32_t len,
+               const IOPortOps *ops, void *opaque);
+
+/// As ioport_map, but leave ports another device already handles alone
+int ioport_map_free(IOPortMap *m, uint32_t start, uint32_t len,
+                    const IOPortOps *ops, void *opaque);
+
+/// Return ports [start, start + len) to unmapped
+void ioport_unmap(IOPortMap *m, uint32_t start, uint32_t len);
+
+/// Return those ports of [start, start + len) routed to ops/opaque
+void ioport_unmap_owned(IOPortMap *m, uint32_t start, uint32_t len,
+                        const IOPortOps *ops, void *opaque);
+
+static inline IOPortSlot *ioport_find(IOPortMap *m, int port) {
+    port &= 0xffff;
+    return &m->slot[m->page[port >> IOPORT_PAGE_BITS]
+                           [port & ((1 << IOPORT_PAGE_BITS) - 1)]];
+}
+
+#endif /* IOPORT_H */
@@ -849,6 +849,7 @@ static bool init_emulator(void) {
     pc->tandy_enabled = config_get_tandy();
     pc->covox_enabled = config_get_covox();
     pc->mpu401_enabled = config_get_mpu401();
+    midi_set_polyphony(config_get_midi_voices());
     pc->dss_enabled = config_get_dss();
     pc->mouse_enabled = config_get_mouse() || config_get_nes_mouse();
     DBG_PRINT("  Audio: PC Speaker=%d, Adlib=%d, SB16=%d, MPU401=%d, Tandy=%d, Covox=%d, DSS=%d, Mouse=%d\n",
@@ -879,15 +880,12 @@ static bool init_emulator(void) {
     return true;
 }
 
-bool timer_callback(repeating_timer_t *rt);
 void vga_hw_process_deferred(void);
-static bool __not_in_flash_func(timer_callback0)(repeating_timer_t *rt) {
-    timer_callback(rt);
+static bool __not_in_flash_func(vga_deferred_tick)(repeating_timer_t *rt) {
     vga_hw_process_deferred();
     return true;
 }
-// to call DMA wait not from ISR for timer
-bool repeat_me_often(void);
+
 static void __not_in_flash_func(core1_entry)(void) {
 
     DBG_PRINT("[Core 1] Initializing video...\n");
@@ -909,11 +907,13 @@ static void __not_in_flash_func(core1_entry)(void) {
         sleep_ms(1);
         __dmb();
     }
-    static repeating_timer_t m_timer = { 0 };
-    int hz = 44100;
-	add_repeating_timer_us(-1000000 / hz, timer_callback0, pc, &m_timer);
+    audio_start();
+    // Frame updates interrupt the block render, which can take milliseconds,
+    // at the rate the old per-sample audio timer ran them
+    static repeating_timer_t vga_timer;
+    add_repeating_timer_us(-1000000 / SOUND_FREQUENCY, vga_deferred_tick, NULL, &vga_timer);
     while(1) {
-        repeat_me_often();
+        audio_pump(pc);
         sleep_us(1);
     }
     __unreachable();
@@ -1125,6 +1125,7 @@ int main(void) {
             settingsui_clear_restart();
             DBG_PRINT("Settings changed - triggering RP reset...\n");
             // Full hardware reset via watchdog
+            pc_flush_disks(pc);
             *(uint32_t*)(0x20000000 + (512ul << 10) - 32) = 0x1927fa52; // magic to fast reboot
             watchdog_reboot(0, 0, 0);
         }
@@ -1153,6 +1154,7 @@ int main(void) {
     }
 
     DBG_PRINT("\nEmulation stopped.\n");
+    pc_flush_disks(pc);
     *(uint32_t*)(0x20000000 + (512ul << 10) - 32) = 0x1927fa52; // magic to fast reboot
     watchdog_reboot(0, 0, 0);
     while (true);
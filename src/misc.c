@@ -1,4 +1,5 @@
 #include "misc.h"
+#include "vclock.h"
 #include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
@@ -126,6 +127,9 @@ struct CMOS {
 	int irq;
 	uint32_t irq_timeout;
 	uint32_t irq_period;
+	uint32_t timer;		/* CMOS_FREQ units, advanced from emu_uticks */
+	uint32_t timer_frac;
+	uint32_t timer_last;
 	void *pic;
 	void (*set_irq)(void *pic, int irq, int level);
 };
@@ -191,6 +195,7 @@ CMOS *cmos_init(long mem_size, int irq, void *pic, void (*set_irq)(void *pic, in
 	c->pic = pic;
 	c->set_irq = set_irq;
 
+	c->timer_last = emu_uticks();
 	cmos_update_time(c);
 	c->data[0x10] = 0x44;  /* floppy: A=1.44M(4), B=1.44M(4) */
 	c->data[10] = 0x26;
@@ -339,11 +344,13 @@ void u8250_update(U8250 *uart)
 
 static uint32_t cmos_get_timer(CMOS *s)
 {
-	struct timespec ts;
+	uint32_t now = emu_uticks();
+	uint64_t t = (uint64_t)(now - s->timer_last) * CMOS_FREQ + s->timer_frac;
 
-	clock_gettime(CLOCK_MONOTONIC, &ts);
-	return (uint32_t)ts.tv_sec * CMOS_FREQ +
-		((uint64_t)ts.tv_nsec * CMOS_FREQ / 1000000000);
+	s->timer_last = now;
+	s->timer += t / 1000000;
+	s->timer_frac = t % 1000000;
+	return s->timer;
 }
 
 static void cmos_update_timer(CMOS *s)
@@ -378,6 +385,17 @@ void __not_in_flash_func(cmos_update_irq)(CMOS *s)
 	}
 }
 
+/* emulated time (now = current value) of the next periodic irq */
+uint32_t cmos_next_deadline(CMOS *s, uint32_t now)
+{
+	if (!(s->data[RTC_REG_B] & REG_B_PIE))
+		return now + 1000000;
+	int32_t d = s->irq_timeout - cmos_get_timer(s);
+	if (d <= 0)
+		return now;
+	return now + (uint32_t)(((uint64_t)d * 1000000 + CMOS_FREQ - 1) / CMOS_FREQ);
+}
+
 uint8_t cmos_ioport_read(CMOS *cmos, int addr)
 {
 	if (addr == 0x70)
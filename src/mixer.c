@@ -0,0 +1,92 @@
+/**
+ * frank-386 - i386 PC Emulator for RP2350
+ *
+ * Block audio mixer. Mono devices (Tandy, MIDI, AdLib, DSS, Covox) are
+ * summed into the left accumulator, copied to the right one, and then the
+ * stereo Sound Blaster is added on top of both.
+ *
+ * Copyright (c) 2026 Mikhail Matveev <xtreme@rh1.tech>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <string.h>
+#include <pico.h>
+#ifdef RP2350_BUILD
+#include <hardware/sync.h>
+#endif
+
+#include "mixer.h"
+#include "dss.h"
+
+#define COVOX_QUEUE 256     ///< writes kept between two blocks, power of 2
+
+/*
+ * The Covox is a bare DAC: the guest writes samples straight to the port
+ * at its own rate. Core 0 time-stamps every write, and core 1 replays them
+ * at the matching frame of the block it renders. Single producer, single
+ * consumer; a full queue drops the newest write.
+ */
+static struct {
+    uint32_t t;
+    uint8_t val;
+} covox_ev[COVOX_QUEUE];
+static volatile uint32_t covox_head, covox_tail;
+static int32_t covox_level;
+
+void mixer_covox_write(uint8_t val) {
+    uint32_t head = covox_head;
+    if (head - covox_tail >= COVOX_QUEUE)
+        return;
+    covox_ev[head % COVOX_QUEUE].t = get_uticks();
+    covox_ev[head % COVOX_QUEUE].val = val;
+    __dmb();
+    covox_head = head + 1;
+}
+
+static void __not_in_flash_func(covox_render)(int32_t *buf, int n, uint32_t now,
+                                              int enabled) {
+    uint32_t tail = covox_tail;
+    int i = 0;
+
+    while (tail != covox_head) {
+        __dmb();
+        int at = mixer_frame_at(now, covox_ev[tail % COVOX_QUEUE].t, n);
+        if (at < 0)
+            break;
+        if (enabled) {
+            for (; i < at; i++)
+                buf[i] += covox_level;
+        }
+        uint8_t val = covox_ev[tail % COVOX_QUEUE].val;
+        covox_level = val ? ((int32_t)val - 127) << 8 : 0;
+        tail++;
+    }
+    covox_tail = tail;
+
+    if (enabled && covox_level) {
+        for (; i < n; i++)
+            buf[i] += covox_level;
+    }
+}
+
+void __not_in_flash_func(mixer_render)(PC *pc, MixerBlock *b, int n, uint32_t now) {
+    int32_t *mono = b->l;
+    memset(mono, 0, n * sizeof(int32_t));
+
+    memset(b->spk, 0, n * sizeof(int32_t));
+    pcspk_render(pc->pcspk, b->spk, n, now, pc->pcspk_enabled);
+
+    covox_render(mono, n, now, pc->covox_enabled);
+    if (pc->tandy_enabled)
+        sn76489_render(mono, n);
+    if (pc->mpu401_enabled)
+        midi_render(mono, n);
+    if (pc->adlib_enabled)
+        adlib_render(pc->adlib, mono, n, now);
+    if (pc->dss_enabled)
+        dss_render(mono, n);
+
+    memcpy(b->r, mono, n * sizeof(int32_t));
+    if (pc->sb16_enabled)
+        sb16_render(pc->sb16, b->l, b->r, n);
+}
@@ -0,0 +1,60 @@
+/**
+ * frank-386 - i386 PC Emulator for RP2350
+ *
+ * Block audio mixer. Each enabled sound device renders a whole block of
+ * samples into 32-bit accumulators, so the output driver sees one call per
+ * block instead of a call per device per sample, and can clip, scale and
+ * pack the block in a single pass.
+ *
+ * Copyright (c) 2026 Mikhail Matveev <xtreme@rh1.tech>
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef MIXER_H
+#define MIXER_H
+
+#include <stdint.h>
+
+#include "pc.h"
+
+#define MIXER_BLOCK 128     ///< frames per block, 2.9 ms at 44.1 kHz
+
+typedef struct {
+    int32_t l[MIXER_BLOCK];
+    int32_t r[MIXER_BLOCK];
+    int32_t spk[MIXER_BLOCK];   ///< PC speaker, +-PCSPK_AMPLITUDE / 2
+} MixerBlock;
+
+/// Frames per microsecond, Q16
+#define MIXER_FRAMES_PER_US ((uint32_t)(((uint64_t)SOUND_FREQUENCY << 16) / 1000000))
+
+/**
+ * Position, in frames Q16, within an n-frame block ending at 'now' at which
+ * a device event time-stamped 't' (both get_uticks()) takes effect, or -1
+ * if the event came after 'now' and belongs to the next block.
+ */
+static inline int32_t mixer_pos_at(uint32_t now, uint32_t t, int n) {
+    uint32_t age = now - t;
+    if ((int32_t)age < 0)
+        return -1;
+    int32_t pos = (n << 16) - (int32_t)(age * MIXER_FRAMES_PER_US);
+    return age >= (uint32_t)n * 1000000 / SOUND_FREQUENCY || pos < 0 ? 0 : pos;
+}
+
+/// Whole frame of mixer_pos_at
+static inline int mixer_frame_at(uint32_t now, uint32_t t, int n) {
+    int32_t pos = mixer_pos_at(now, t, n);
+    return pos < 0 ? -1 : pos >> 16;
+}
+
+/**
+ * Render n <= MIXER_BLOCK frames of every enabled device. 'now' is the
+ * get_uticks() time the block ends at; PC speaker, AdLib and Covox writes
+ * are placed within the block by their time stamps.
+ */
+void mixer_render(PC *pc, MixerBlock *b, int n, uint32_t now);
+
+/// Latch a Covox DAC write; called from the port handler on core 0
+void mixer_covox_write(uint8_t val);
+
+#endif /* MIXER_H */
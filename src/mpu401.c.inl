@@ -90,7 +90,8 @@ static INLINE void midi_send_sysex() {
     // Reset the SysEx state
     midi_insysex = 0;
 }
-int16_t midi_sample() { return 0; }
+void midi_render(int32_t *buf, int n) { }
+void midi_set_polyphony(int voices) { }
 
 
 #endif
@@ -143,6 +143,8 @@ static inline void write_block_to_ram(uint32_t address, const uint8_t* buffer, s
     for (size_t i = 0; i < size; i++) {
         write86(address + i, buffer[i]);
     }
+    // File data may be code the CPU has already decoded (program loads)
+    cpu_invalidate_code(_nr_cpu, address, size);
 }
 
 // Helper to get full path from guest path
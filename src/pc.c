@@ -2,6 +2,9 @@
 #include "ide.h"
 #include "dss.h"
 #include "misc.h"
+#include "vclock.h"
+#include "ems.h"
+#include "mixer.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -176,587 +179,997 @@ void debug_write(const char *fmt, ...) {
 #define debug_write(...) (void)0
 #endif
 
-static __always_inline u8 _pc_io_read(void *o, int addr)
+/* ---- Port I/O -------------------------------------------------------------
+ * Ports are routed through pc->io (see ioport.h); pc_map_ports installs the
+ * fixed devices and pc_update_io_map the ones the settings menu can switch
+ * off. The adapters translate the dispatch signature to each device's own.
+ * -------------------------------------------------------------------------*/
+
+/* the guest reprogrammed a device: let its event recompute the deadline */
+static inline void pc_kick(PC *pc, int ev)
+{
+	sched_kick(&pc->sched, ev, emu_uticks());
+}
+
+static uint8_t io_zero8(void *o, int port) { return 0; }
+static uint16_t io_ones16(void *o, int port) { return 0xffff; }
+
+static uint8_t io_pic_read(void *o, int port)
+{
+	return i8259_ioport_read(o, port);
+}
+
+static void io_pic_write(void *o, int port, uint8_t val)
+{
+	i8259_ioport_write(o, port, val);
+}
+
+static uint8_t io_serial_read(void *o, int port)
+{
+	return u8250_reg_read(o, port - 0x3f8);
+}
+
+static void io_serial_write(void *o, int port, uint8_t val)
+{
+	u8250_reg_write(o, port - 0x3f8, val);
+}
+
+static uint8_t io_pit_read(void *o, int port)
 {
 	PC *pc = o;
-	u8 val;
-
-	switch(addr) {
-	case 0x20: case 0x21: case 0xa0: case 0xa1:
-		val = i8259_ioport_read(pc->pic, addr);
-		return val;
-	case 0x3f8: case 0x3f9: case 0x3fa: case 0x3fb:
-	case 0x3fc: case 0x3fd: case 0x3fe: case 0x3ff:
-		val = 0xff;
-		if (pc->enable_serial)
-			val = u8250_reg_read(pc->serial, addr - 0x3f8);
-		return val;
-	case 0x2f8: case 0x2f9: case 0x2fa: case 0x2fb:
-	case 0x2fc: case 0x2fd: case 0x2fe: case 0x2ff:
-	case 0x2e8: case 0x2e9: case 0x2ea: case 0x2eb:
-	case 0x2ec: case 0x2ed: case 0x2ee: case 0x2ef:
-	case 0x3e8: case 0x3e9: case 0x3ea: case 0x3eb:
-	case 0x3ec: case 0x3ed: case 0x3ee: case 0x3ef:
-		return 0;
-	case 0x42:
-		/* read delay for PIT channel 2 */
-		/* certain guest code needs it to drive pc speaker properly */
+	/* read delay for PIT channel 2 */
+	/* certain guest code needs it to drive pc speaker properly */
+	if (port == 0x42)
 		usleep(0);
-		/* fall through */
-	case 0x40: case 0x41: case 0x43:
-		val = i8254_ioport_read(pc->pit, addr);
-		return val;
-	case 0x70: case 0x71:
-		val = cmos_ioport_read(pc->cmos, addr);
-		return val;
-	case 0x1f0: case 0x1f1: case 0x1f2: case 0x1f3:
-	case 0x1f4: case 0x1f5: case 0x1f6: case 0x1f7:
-		return ide_ioport_read(pc->ide, addr - 0x1f0);
-	case 0x170: case 0x171: case 0x172: case 0x173:
-	case 0x174: case 0x175: case 0x176: case 0x177:
-		return ide_ioport_read(pc->ide2, addr - 0x170);
-	case 0x3f6:
-		return ide_status_read(pc->ide);
-	case 0x376:
-		return ide_status_read(pc->ide2);
-	/* FDC ports 0x3F0-0x3F5, 0x3F7 (0x3F6 = IDE alt-status, handled above) */
-	case 0x3f0: case 0x3f1: case 0x3f2: case 0x3f3:
-	case 0x3f4: case 0x3f5:
-	case 0x3f7:
-		if (pc->fdc)
-			return fdc_ioport_read(pc->fdc, addr);
-		return 0xff;
-	case 0x3c0: case 0x3c1: case 0x3c2: case 0x3c3:
-	case 0x3c4: case 0x3c5: case 0x3c6: case 0x3c7:
-	case 0x3c8: case 0x3c9: case 0x3ca: case 0x3cb:
-	case 0x3cc: case 0x3cd: case 0x3ce: case 0x3cf:
-	case 0x3d0: case 0x3d1: case 0x3d2: case 0x3d3:
-	case 0x3d4: case 0x3d5: case 0x3d6: case 0x3d7:
-	case 0x3d8: case 0x3d9: case 0x3da: case 0x3db:
-	case 0x3dc: case 0x3dd: case 0x3de: case 0x3df:
-		val = vga_ioport_read(pc->vga, addr);
-		return val;
-	case 0x92:
-		return pc->port92;
-	case 0x60:
-		val = kbd_read_data(pc->i8042, addr);
-		return val;
-	case 0x64:
-		val = kbd_read_status(pc->i8042, addr);
-		return val;
-	case 0x61:
-		val = pcspk_ioport_read(pc->pcspk);
-		return val;
-	case 0x220: case 0x221: case 0x222: case 0x223:
-	case 0x228: case 0x229:
-	case 0x388: case 0x389: case 0x38a: case 0x38b:
-		if (pc->adlib_enabled)
-			return adlib_read(pc->adlib, addr);
-		return 0xFF;
-	case 0xcfc: case 0xcfd: case 0xcfe: case 0xcff:
-		val = i440fx_read_data(pc->i440fx, addr - 0xcfc, 0);
-		return val;
-	/* NE2000 networking removed */
-	case 0x300: case 0x301: case 0x302: case 0x303:
-	case 0x304: case 0x305: case 0x306: case 0x307:
-	case 0x308: case 0x309: case 0x30a: case 0x30b:
-	case 0x30c: case 0x30d: case 0x30e: case 0x30f:
-	case 0x310: case 0x31f:
-		return 0xff;
-	case 0x00: case 0x01: case 0x02: case 0x03:
-	case 0x04: case 0x05: case 0x06: case 0x07:
-		val = i8257_read_chan(pc->isa_dma, addr - 0x00, 1);
-		return val;
-	case 0xf1f4: {
-		/* emulink: single-byte read (BIOS probes this way too) */
-		uint32_t v32 = emulink_read32(pc);
-		return (u8)(v32 & 0xff);
-	}
-	case 0x08: case 0x09: case 0x0a: case 0x0b:
-	case 0x0c: case 0x0d: case 0x0e: case 0x0f:
-		val = i8257_read_cont(pc->isa_dma, addr - 0x08, 1);
-		return val;
-	case 0x81: case 0x82: case 0x83: case 0x87:
-		val = i8257_read_page(pc->isa_dma, addr - 0x80);
-		return val;
-	case 0x481: case 0x482: case 0x483: case 0x487:
-		val = i8257_read_pageh(pc->isa_dma, addr - 0x480);
-		return val;
-	case 0xc0: case 0xc1:
-		/* SN76489 is write-only; return 0xFF on read when Tandy active */
-		if (pc->tandy_enabled)
-			return 0xff;
-		val = i8257_read_chan(pc->isa_hdma, addr - 0xc0, 1);
-		return val;
-	case 0xc2: case 0xc4: case 0xc6:
-	case 0xc8: case 0xca: case 0xcc: case 0xce:
-		val = i8257_read_chan(pc->isa_hdma, addr - 0xc0, 1);
-		return val;
-	case 0xd0: case 0xd2: case 0xd4: case 0xd6:
-	case 0xd8: case 0xda: case 0xdc: case 0xde:
-		val = i8257_read_cont(pc->isa_hdma, addr - 0xd0, 1);
-		return val;
-	case 0x89: case 0x8a: case 0x8b: case 0x8f:
-		val = i8257_read_page(pc->isa_hdma, addr - 0x88);
-		return val;
-	case 0x489: case 0x48a: case 0x48b: case 0x48f:
-		val = i8257_read_pageh(pc->isa_hdma, addr - 0x488);
-		return val;
-	case 0x225:
-		if (pc->sb16_enabled) {
-			return sb16_mixer_read(pc->sb16, addr);
-		}
-		return 0xFF;
-	case 0x226: case 0x22a: case 0x22c: case 0x22d: case 0x22e: case 0x22f:
-		if (pc->sb16_enabled) {
-			return sb16_dsp_read(pc->sb16, addr);
-		}
-		return 0xFF;
-	case 0x201:
-		/* Gameport / Joystick - return "no joystick" state
-		 * Bits 7-4: buttons (1 = not pressed)
-		 * Bits 3-0: axes timeout (0 = timed out, no joystick)
-		 * Return 0xF0 to indicate axes have timed out (no joystick present) */
-		return 0xf0;
-	case 0x27A: // Covox Speech Thing
+	return i8254_ioport_read(pc->pit, port);
+}
+
+static void io_pit_write(void *o, int port, uint8_t val)
+{
+	PC *pc = o;
+	i8254_ioport_write(pc->pit, port, val);
+	pc_kick(pc, pc->ev_pit);
+}
+
+static uint8_t io_cmos_read(void *o, int port)
+{
+	PC *pc = o;
+	return cmos_ioport_read(pc->cmos, port);
+}
+
+static void io_cmos_write(void *o, int port, uint8_t val)
+{
+	PC *pc = o;
+	cmos_ioport_write(pc->cmos, port, val);
+	pc_kick(pc, pc->ev_cmos);
+}
+
+/* both IDE channels decode 8 aligned ports */
+static uint8_t io_ide_read(void *o, int port)
+{
+	return ide_ioport_read(o, port & 7);
+}
+
+static void io_ide_write(void *o, int port, uint8_t val)
+{
+	ide_ioport_write(o, port & 7, val);
+}
+
+static uint16_t io_ide_read16(void *o, int port)
+{
+	return ide_data_readw(o);
+}
+
+static void io_ide_write16(void *o, int port, uint16_t val)
+{
+	ide_data_writew(o, val);
+}
+
+static uint32_t io_ide_read32(void *o, int port)
+{
+	return ide_data_readl(o);
+}
+
+static void io_ide_write32(void *o, int port, uint32_t val)
+{
+	ide_data_writel(o, val);
+}
+
+static int io_ide_read_string(void *o, int port, uint8_t *buf, int size, int count)
+{
+	return ide_data_read_string(o, buf, size, count);
+}
+
+static int io_ide_write_string(void *o, int port, uint8_t *buf, int size, int count)
+{
+	return ide_data_write_string(o, buf, size, count);
+}
+
+static uint8_t io_ide_alt_read(void *o, int port)
+{
+	return ide_status_read(o);
+}
+
+static void io_ide_alt_write(void *o, int port, uint8_t val)
+{
+	ide_cmd_write(o, val);
+}
+
+/* PIIX bus-master IDE block: 8 ports per channel */
+static uint8_t io_bmdma_read(void *o, int port)
+{
+	return ide_bmdma_read(o, port & 7, 1);
+}
+
+static void io_bmdma_write(void *o, int port, uint8_t val)
+{
+	ide_bmdma_write(o, port & 7, val, 1);
+}
+
+static uint16_t io_bmdma_read16(void *o, int port)
+{
+	return ide_bmdma_read(o, port & 7, 2);
+}
+
+static void io_bmdma_write16(void *o, int port, uint16_t val)
+{
+	ide_bmdma_write(o, port & 7, val, 2);
+}
+
+static uint32_t io_bmdma_read32(void *o, int port)
+{
+	return ide_bmdma_read(o, port & 7, 4);
+}
+
+static void io_bmdma_write32(void *o, int port, uint32_t val)
+{
+	ide_bmdma_write(o, port & 7, val, 4);
+}
+
+static uint8_t io_fdc_read(void *o, int port)
+{
+	return fdc_ioport_read(o, port);
+}
+
+static void io_fdc_write(void *o, int port, uint8_t val)
+{
+	fdc_ioport_write(o, port, val);
+}
+
+static uint8_t io_vga_read(void *o, int port)
+{
+	PC *pc = o;
+	return vga_ioport_read(pc->vga, port);
+}
+
+static void io_vga_write(void *o, int port, uint8_t val)
+{
+	PC *pc = o;
+	vga_ioport_write(pc->vga, port, val);
+}
+
+static void io_vga_write16(void *o, int port, uint16_t val)
+{
+	PC *pc = o;
+	vga_ioport_write(pc->vga, port, val & 0xff);
+	vga_ioport_write(pc->vga, port + 1, (val >> 8) & 0xff);
+}
+
+/* 32-bit IN from 0x3cc: milliseconds since boot */
+static uint32_t io_vga_timer_read32(void *o, int port)
+{
+	PC *pc = o;
+	return (emu_uticks() - pc->boot_start_time) / 1000;
+}
+
+static uint16_t io_vbe_read16(void *o, int port)
+{
+	PC *pc = o;
+	return vbe_read(pc->vga, port - 0x1ce);
+}
+
+static void io_vbe_write16(void *o, int port, uint16_t val)
+{
+	PC *pc = o;
+	vbe_write(pc->vga, port - 0x1ce, val);
+}
+
+static uint8_t io_port92_read(void *o, int port)
+{
+	PC *pc = o;
+	return pc->port92;
+}
+
+static void io_port92_write(void *o, int port, uint8_t val)
+{
+	PC *pc = o;
+	pc->port92 = val;
+	cpu_set_a20(pc->cpu, (val >> 1) & 1);
+}
+
+static uint8_t io_kbd_data_read(void *o, int port)
+{
+	PC *pc = o;
+	return kbd_read_data(pc->i8042, port);
+}
+
+static void io_kbd_data_write(void *o, int port, uint8_t val)
+{
+	PC *pc = o;
+	kbd_write_data(pc->i8042, port, val);
+	pc_kick(pc, pc->ev_kbd);
+}
+
+static uint8_t io_kbd_status_read(void *o, int port)
+{
+	PC *pc = o;
+	return kbd_read_status(pc->i8042, port);
+}
+
+static void io_kbd_command_write(void *o, int port, uint8_t val)
+{
+	PC *pc = o;
+	kbd_write_command(pc->i8042, port, val);
+	pc_kick(pc, pc->ev_kbd);
+}
+
+static uint8_t io_pcspk_read(void *o, int port)
+{
+	return pcspk_ioport_read(o);
+}
+
+static void io_pcspk_write(void *o, int port, uint8_t val)
+{
+	pcspk_ioport_write(o, val);
+}
+
+static uint8_t io_adlib_read(void *o, int port)
+{
+	return adlib_read(o, port);
+}
+
+static uint16_t io_adlib_read16(void *o, int port)
+{
+	return adlib_read(o, port);
+}
+
+static void io_adlib_write(void *o, int port, uint8_t val)
+{
+	adlib_write(o, port, val);
+}
+
+static uint8_t io_sb16_mixer_read(void *o, int port)
+{
+	return sb16_mixer_read(o, port);
+}
+
+static void io_sb16_mixer_index_write(void *o, int port, uint8_t val)
+{
+	sb16_mixer_write_indexb(o, port, val);
+}
+
+static void io_sb16_mixer_data_write(void *o, int port, uint8_t val)
+{
+	sb16_mixer_write_datab(o, port, val);
+}
+
+static uint8_t io_sb16_dsp_read(void *o, int port)
+{
+	return sb16_dsp_read(o, port);
+}
+
+static void io_sb16_dsp_write(void *o, int port, uint8_t val)
+{
+	sb16_dsp_write(o, port, val);
+}
+
+static uint16_t io_pci_addr_read16(void *o, int port)
+{
+	return i440fx_read_addr(o, 0, 1);
+}
+
+static uint32_t io_pci_addr_read32(void *o, int port)
+{
+	return i440fx_read_addr(o, 0, 2);
+}
+
+static void io_pci_addr_write32(void *o, int port, uint32_t val)
+{
+	i440fx_write_addr(o, 0, val, 2);
+}
+
+static uint8_t io_pci_data_read(void *o, int port)
+{
+	return i440fx_read_data(o, port - 0xcfc, 0);
+}
+
+static void io_pci_data_write(void *o, int port, uint8_t val)
+{
+	i440fx_write_data(o, port - 0xcfc, val, 0);
+}
+
+static uint16_t io_pci_data_read16(void *o, int port)
+{
+	if (port & 1)
 		return 0;
-	// MPU-401
-	case 0x330:
-	case 0x331:
-		if (pc->mpu401_enabled)
-	        return mpu401_read(addr);
-		return 0xFF;
-	// Disney Sound Source
-	case 0x378:
-	case 0x379:
-		if (pc->dss_enabled)
-			return dss_in(addr);
-		return 0xFF;
-	/* LPT data ports (Covox): write-only DAC, reads return 0xFF */
-	case 0x278:
-		return 0xff;
-	/* LPT status ports: bit7=nBusy(1=ready), bits6..3=1 (idle/ready) */
-	case 0x279:
-		return 0xf8;
-	/* LPT control ports */
-	case 0x37a:
-		return 0x04;
-	default:
-		//fprintf(stderr, "in 0x%x <= 0x%x\n", addr, 0xff);
-		return 0xff;
+	return i440fx_read_data(o, port - 0xcfc, 1);
+}
+
+static void io_pci_data_write16(void *o, int port, uint16_t val)
+{
+	if (!(port & 1))
+		i440fx_write_data(o, port - 0xcfc, val, 1);
+}
+
+static uint32_t io_pci_data_read32(void *o, int port)
+{
+	if (port != 0xcfc)
+		return 0;
+	return i440fx_read_data(o, 0, 2);
+}
+
+static void io_pci_data_write32(void *o, int port, uint32_t val)
+{
+	if (port == 0xcfc)
+		i440fx_write_data(o, 0, val, 2);
+}
+
+/* both DMA controllers: channel registers at base + (port & 15) */
+static uint8_t io_dma_chan_read(void *o, int port)
+{
+	return i8257_read_chan(o, port & 0xf, 1);
+}
+
+static void io_dma_chan_write(void *o, int port, uint8_t val)
+{
+	i8257_write_chan(o, port & 0xf, val, 1);
+}
+
+static uint8_t io_dma_cont_read(void *o, int port)
+{
+	return i8257_read_cont(o, port & 7, 1);
+}
+
+static void io_dma_cont_write(void *o, int port, uint8_t val)
+{
+	i8257_write_cont(o, port & 7, val, 1);
+}
+
+static uint8_t io_hdma_cont_read(void *o, int port)
+{
+	return i8257_read_cont(o, port & 0xf, 1);
+}
+
+static void io_hdma_cont_write(void *o, int port, uint8_t val)
+{
+	i8257_write_cont(o, port & 0xf, val, 1);
+}
+
+static uint8_t io_dma_page_read(void *o, int port)
+{
+	return i8257_read_page(o, port & 7);
+}
+
+static void io_dma_page_write(void *o, int port, uint8_t val)
+{
+	i8257_write_page(o, port & 7, val);
+}
+
+static uint8_t io_dma_pageh_read(void *o, int port)
+{
+	return i8257_read_pageh(o, port & 7);
+}
+
+static void io_dma_pageh_write(void *o, int port, uint8_t val)
+{
+	i8257_write_pageh(o, port & 7, val);
+}
+
+static void io_tandy_write(void *o, int port, uint8_t val)
+{
+	sn76489_out(val);
+}
+
+static void io_covox_write(void *o, int port, uint8_t val)
+{
+	mixer_covox_write(val);
+}
+
+static uint8_t io_mpu401_read(void *o, int port)
+{
+	return mpu401_read(port);
+}
+
+static void io_mpu401_write(void *o, int port, uint8_t val)
+{
+	mpu401_write(port, val);
+}
+
+static uint8_t io_dss_read(void *o, int port)
+{
+	return dss_in(port);
+}
+
+static void io_dss_write(void *o, int port, uint8_t val)
+{
+	dss_out(port, val);
+}
+
+/* LPT status: bit7=nBusy(1=ready), bits6..3=1 (idle/ready) */
+static uint8_t io_lpt_status_read(void *o, int port) { return 0xf8; }
+static uint8_t io_lpt_control_read(void *o, int port) { return 0x04; }
+
+/* Gameport / Joystick - return "no joystick" state
+ * Bits 7-4: buttons (1 = not pressed)
+ * Bits 3-0: axes timeout (0 = timed out, no joystick) */
+static uint8_t io_joystick_read(void *o, int port) { return 0xf0; }
+
+static uint8_t io_emulink_read(void *o, int port)
+{
+	/* single-byte read (BIOS probes this way too) */
+	return emulink_read32(o) & 0xff;
+}
+
+static uint32_t io_emulink_status_read32(void *o, int port)
+{
+	return emulink_read32(o);
+}
+
+static void io_emulink_cmd_write32(void *o, int port, uint32_t val)
+{
+	emulink_cmd_write(o, val);
+}
+
+static void io_emulink_arg_write32(void *o, int port, uint32_t val)
+{
+	emulink_arg_write(o, val);
+}
+
+static int io_emulink_read_string(void *o, int port, uint8_t *buf, int size, int count)
+{
+	return emulink_data_read(o, buf, size, count);
+}
+
+static int io_emulink_write_string(void *o, int port, uint8_t *buf, int size, int count)
+{
+	return emulink_data_write(o, buf, size, count);
+}
+
+#if EMULATE_LTEMS
+uint8_t ems_pages[4] = {0};
+
+static void io_ems_write(void *o, int port, uint8_t val)
+{
+	ems_pages[port & 3] = val;
+}
+
+/* wider writes only reach the page registers up to 0x263; bytes past it
+ * went nowhere before the port map and still do */
+static void io_ems_write16(void *o, int port, uint16_t val)
+{
+	io_ems_write(o, port, val);
+	if ((port & 3) != 3)
+		io_ems_write(o, port + 1, val >> 8);
+}
+
+static void io_ems_write32(void *o, int port, uint32_t val)
+{
+	for (int i = 0; i < 4 - (port & 3); i++)
+		io_ems_write(o, port + i, val >> (8 * i));
+}
+#endif
+
+static void io_shutdown_write(void *o, int port, uint8_t val)
+{
+	PC *pc = o;
+	switch (val) {
+	case 'S': if (pc->shutdown_state == 0) pc->shutdown_state = 1; break;
+	case 'h': if (pc->shutdown_state == 1) pc->shutdown_state = 2; break;
+	case 'u': if (pc->shutdown_state == 2) pc->shutdown_state = 3; break;
+	case 't': if (pc->shutdown_state == 3) pc->shutdown_state = 4; break;
+	case 'd': if (pc->shutdown_state == 4) pc->shutdown_state = 5; break;
+	case 'o': if (pc->shutdown_state == 5) pc->shutdown_state = 6; break;
+	case 'w': if (pc->shutdown_state == 6) pc->shutdown_state = 7; break;
+	case 'n': if (pc->shutdown_state == 7) pc->shutdown_state = 8; break;
+	default : pc->shutdown_state = 0; break;
+	}
+}
+
+static const IOPortOps pic_ops = { .read8 = io_pic_read, .write8 = io_pic_write };
+static const IOPortOps serial_ops = { .read8 = io_serial_read, .write8 = io_serial_write };
+static const IOPortOps serial_off_ops = { .write8 = io_serial_write };
+static const IOPortOps zero_ops = { .read8 = io_zero8 };
+static const IOPortOps ones_ops = { .read16 = io_ones16 };
+static const IOPortOps pit_ops = { .read8 = io_pit_read, .write8 = io_pit_write };
+static const IOPortOps cmos_ops = { .read8 = io_cmos_read, .write8 = io_cmos_write };
+static const IOPortOps ide_ops = { .read8 = io_ide_read, .write8 = io_ide_write };
+static const IOPortOps ide_data_ops = {
+	.read8 = io_ide_read, .write8 = io_ide_write,
+	.read16 = io_ide_read16, .write16 = io_ide_write16,
+	.read32 = io_ide_read32, .write32 = io_ide_write32,
+	.read_string = io_ide_read_string, .write_string = io_ide_write_string,
+};
+static const IOPortOps ide_alt_ops = { .read8 = io_ide_alt_read, .write8 = io_ide_alt_write };
+static const IOPortOps bmdma_ops = {
+	.read8 = io_bmdma_read, .write8 = io_bmdma_write,
+	.read16 = io_bmdma_read16, .write16 = io_bmdma_write16,
+	.read32 = io_bmdma_read32, .write32 = io_bmdma_write32,
+};
+static const IOPortOps fdc_ops = { .read8 = io_fdc_read, .write8 = io_fdc_write };
+static const IOPortOps vga_ops = {
+	.read8 = io_vga_read, .write8 = io_vga_write, .write16 = io_vga_write16,
+};
+static const IOPortOps vga_timer_ops = {
+	.read8 = io_vga_read, .write8 = io_vga_write, .write16 = io_vga_write16,
+	.read32 = io_vga_timer_read32,
+};
+static const IOPortOps vbe_ops = { .read16 = io_vbe_read16, .write16 = io_vbe_write16 };
+static const IOPortOps port92_ops = { .read8 = io_port92_read, .write8 = io_port92_write };
+static const IOPortOps kbd_data_ops = { .read8 = io_kbd_data_read, .write8 = io_kbd_data_write };
+static const IOPortOps kbd_cmd_ops = { .read8 = io_kbd_status_read, .write8 = io_kbd_command_write };
+static const IOPortOps pcspk_ops = { .read8 = io_pcspk_read, .write8 = io_pcspk_write };
+static const IOPortOps adlib_ops = { .read8 = io_adlib_read, .write8 = io_adlib_write };
+static const IOPortOps adlib_220_ops = {
+	.read8 = io_adlib_read, .write8 = io_adlib_write, .read16 = io_adlib_read16,
+};
+static const IOPortOps sb16_mixer_index_ops = { .write8 = io_sb16_mixer_index_write };
+static const IOPortOps sb16_mixer_data_ops = {
+	.read8 = io_sb16_mixer_read, .write8 = io_sb16_mixer_data_write,
+};
+static const IOPortOps sb16_dsp_ops = { .read8 = io_sb16_dsp_read, .write8 = io_sb16_dsp_write };
+static const IOPortOps sb16_dsp_ro_ops = { .read8 = io_sb16_dsp_read };
+static const IOPortOps pci_addr_ops = {
+	.read16 = io_pci_addr_read16, .read32 = io_pci_addr_read32,
+	.write32 = io_pci_addr_write32,
+};
+static const IOPortOps pci_data_ops = {
+	.read8 = io_pci_data_read, .write8 = io_pci_data_write,
+	.read16 = io_pci_data_read16, .write16 = io_pci_data_write16,
+	.read32 = io_pci_data_read32, .write32 = io_pci_data_write32,
+};
+static const IOPortOps dma_chan_ops = { .read8 = io_dma_chan_read, .write8 = io_dma_chan_write };
+static const IOPortOps dma_cont_ops = { .read8 = io_dma_cont_read, .write8 = io_dma_cont_write };
+static const IOPortOps hdma_cont_ops = { .read8 = io_hdma_cont_read, .write8 = io_hdma_cont_write };
+static const IOPortOps dma_page_ops = { .read8 = io_dma_page_read, .write8 = io_dma_page_write };
+static const IOPortOps dma_pageh_ops = { .read8 = io_dma_pageh_read, .write8 = io_dma_pageh_write };
+/* SN76489 is write-only: 0xff on read */
+static const IOPortOps tandy_ops = { .write8 = io_tandy_write };
+static const IOPortOps covox_ops = { .write8 = io_covox_write };
+static const IOPortOps mpu401_ops = { .read8 = io_mpu401_read, .write8 = io_mpu401_write };
+static const IOPortOps dss_ops = { .read8 = io_dss_read, .write8 = io_dss_write };
+static const IOPortOps dss_status_ops = { .read8 = io_dss_read };
+static const IOPortOps lpt_status_ops = { .read8 = io_lpt_status_read };
+static const IOPortOps lpt_control_ops = { .read8 = io_lpt_control_read };
+static const IOPortOps lpt_control_dss_ops = {
+	.read8 = io_lpt_control_read, .write8 = io_dss_write,
+};
+static const IOPortOps joystick_ops = { .read8 = io_joystick_read };
+static const IOPortOps emulink_status_ops = {
+	.read32 = io_emulink_status_read32, .write32 = io_emulink_cmd_write32,
+};
+static const IOPortOps emulink_data_ops = {
+	.read8 = io_emulink_read, .write32 = io_emulink_arg_write32,
+	.read_string = io_emulink_read_string, .write_string = io_emulink_write_string,
+};
+#if EMULATE_LTEMS
+static const IOPortOps ems_ops = {
+	.write8 = io_ems_write, .write16 = io_ems_write16, .write32 = io_ems_write32,
+};
+#endif
+static const IOPortOps shutdown_ops = { .write8 = io_shutdown_write };
+
+/* Like the fallback dispatch the bus-master block used to have, it only
+ * gets the ports no other device decodes */
+static void pc_map_bmdma(PC *pc)
+{
+	uint32_t addr = pc->pci_ide_bm_addr;
+	if (!addr)
+		return;
+	/* 8 ports per channel, primary first */
+	ioport_map_free(&pc->io, addr, 8, &bmdma_ops, pc->ide);
+	ioport_map_free(&pc->io, addr + 8, 8, &bmdma_ops, pc->ide2);
+}
+
+/* devices that are always present */
+static void pc_map_ports(PC *pc)
+{
+	IOPortMap *m = &pc->io;
+	ioport_map(m, 0x20, 2, &pic_ops, pc->pic);
+	ioport_map(m, 0xa0, 2, &pic_ops, pc->pic);
+	ioport_map(m, 0x3f8, 8, pc->enable_serial ? &serial_ops : &serial_off_ops,
+		   pc->serial);
+	/* COM2-COM4 are not emulated */
+	ioport_map(m, 0x2f8, 8, &zero_ops, NULL);
+	ioport_map(m, 0x2e8, 8, &zero_ops, NULL);
+	ioport_map(m, 0x3e8, 8, &zero_ops, NULL);
+	ioport_map(m, 0x40, 4, &pit_ops, pc);
+	ioport_map(m, 0x70, 2, &cmos_ops, pc);
+	ioport_map(m, 0x1f0, 8, &ide_ops, pc->ide);
+	ioport_map(m, 0x1f0, 1, &ide_data_ops, pc->ide);
+	ioport_map(m, 0x3f6, 1, &ide_alt_ops, pc->ide);
+	ioport_map(m, 0x170, 8, &ide_ops, pc->ide2);
+	ioport_map(m, 0x170, 1, &ide_data_ops, pc->ide2);
+	ioport_map(m, 0x376, 1, &ide_alt_ops, pc->ide2);
+	/* FDC 0x3F0-0x3F5, 0x3F7 (0x3F6 = IDE alt-status) */
+	if (pc->fdc) {
+		ioport_map(m, 0x3f0, 6, &fdc_ops, pc->fdc);
+		ioport_map(m, 0x3f7, 1, &fdc_ops, pc->fdc);
+	}
+	ioport_map(m, 0x3c0, 0x20, &vga_ops, pc);
+	ioport_map(m, 0x3cc, 1, &vga_timer_ops, pc);
+	ioport_map(m, 0x1ce, 2, &vbe_ops, pc);
+	ioport_map(m, 0x92, 1, &port92_ops, pc);
+	ioport_map(m, 0x60, 1, &kbd_data_ops, pc);
+	ioport_map(m, 0x64, 1, &kbd_cmd_ops, pc);
+	ioport_map(m, 0x61, 1, &pcspk_ops, pc->pcspk);
+	ioport_map(m, 0xcf8, 1, &pci_addr_ops, pc->i440fx);
+	ioport_map(m, 0xcfc, 4, &pci_data_ops, pc->i440fx);
+	/* NE2000 networking removed: the data port floats high */
+	ioport_map(m, 0x310, 1, &ones_ops, NULL);
+
+	ioport_map(m, 0x00, 8, &dma_chan_ops, pc->isa_dma);
+	ioport_map(m, 0x08, 8, &dma_cont_ops, pc->isa_dma);
+	ioport_map(m, 0x81, 3, &dma_page_ops, pc->isa_dma);
+	ioport_map(m, 0x87, 1, &dma_page_ops, pc->isa_dma);
+	ioport_map(m, 0x481, 3, &dma_pageh_ops, pc->isa_dma);
+	ioport_map(m, 0x487, 1, &dma_pageh_ops, pc->isa_dma);
+	for (int i = 0; i < 8; i++) {
+		ioport_map(m, 0xc0 + 2 * i, 1, &dma_chan_ops, pc->isa_hdma);
+		ioport_map(m, 0xd0 + 2 * i, 1, &hdma_cont_ops, pc->isa_hdma);
+	}
+	ioport_map(m, 0x89, 3, &dma_page_ops, pc->isa_hdma);
+	ioport_map(m, 0x8f, 1, &dma_page_ops, pc->isa_hdma);
+	ioport_map(m, 0x489, 3, &dma_pageh_ops, pc->isa_hdma);
+	ioport_map(m, 0x48f, 1, &dma_pageh_ops, pc->isa_hdma);
+
+	ioport_map(m, 0x201, 1, &joystick_ops, NULL);
+	/* LPT2 status/control; the data port is the Covox DAC */
+	ioport_map(m, 0x279, 1, &lpt_status_ops, NULL);
+	ioport_map(m, 0x27a, 1, &zero_ops, NULL);
+	ioport_map(m, 0xf1f0, 1, &emulink_status_ops, pc);
+	ioport_map(m, 0xf1f4, 1, &emulink_data_ops, pc);
+#if EMULATE_LTEMS
+	ioport_map(m, 0x260, 4, &ems_ops, NULL);
+#endif
+	ioport_map(m, 0x8900, 1, &shutdown_ops, pc);
+	pc_update_io_map(pc);
+}
+
+/* devices the settings menu can enable and disable at run time */
+void pc_update_io_map(PC *pc)
+{
+	IOPortMap *m = &pc->io;
+
+	ioport_unmap(m, 0x220, 4);
+	ioport_unmap(m, 0x228, 2);
+	ioport_unmap(m, 0x388, 4);
+	if (pc->adlib_enabled) {
+		ioport_map(m, 0x220, 4, &adlib_ops, pc->adlib);
+		ioport_map(m, 0x220, 1, &adlib_220_ops, pc->adlib);
+		ioport_map(m, 0x228, 2, &adlib_ops, pc->adlib);
+		ioport_map(m, 0x388, 4, &adlib_ops, pc->adlib);
+	} else {
+		ioport_map(m, 0x220, 1, &ones_ops, NULL);
+	}
+
+	ioport_unmap(m, 0x224, 4);
+	ioport_unmap(m, 0x22a, 6);
+	if (pc->sb16_enabled) {
+		ioport_map(m, 0x224, 1, &sb16_mixer_index_ops, pc->sb16);
+		ioport_map(m, 0x225, 1, &sb16_mixer_data_ops, pc->sb16);
+		ioport_map(m, 0x226, 1, &sb16_dsp_ops, pc->sb16);
+		ioport_map(m, 0x22a, 1, &sb16_dsp_ro_ops, pc->sb16);
+		ioport_map(m, 0x22c, 1, &sb16_dsp_ops, pc->sb16);
+		ioport_map(m, 0x22d, 3, &sb16_dsp_ro_ops, pc->sb16);
+	}
+
+	/* 0xC0/0xC1: SN76489 data port when Tandy enabled, hdma ch0 otherwise.
+	 * 0x1E0: Tandy 1000 SX/TX/HX data port, 0x2C0: Tandy 1000 A/B mirror */
+	if (pc->tandy_enabled) {
+		ioport_map(m, 0xc0, 2, &tandy_ops, NULL);
+		ioport_map(m, 0x1e0, 1, &tandy_ops, NULL);
+		ioport_map(m, 0x2c0, 1, &tandy_ops, NULL);
+	} else {
+		ioport_map(m, 0xc0, 2, &dma_chan_ops, pc->isa_hdma);
+		ioport_unmap(m, 0x1e0, 1);
+		ioport_unmap(m, 0x2c0, 1);
+	}
+
+	/* Covox Speech Thing: parallel port DAC on LPT2 data */
+	if (pc->covox_enabled)
+		ioport_map(m, 0x278, 1, &covox_ops, NULL);
+	else
+		ioport_unmap(m, 0x278, 1);
+
+	if (pc->mpu401_enabled)
+		ioport_map(m, 0x330, 2, &mpu401_ops, NULL);
+	else
+		ioport_unmap(m, 0x330, 2);
+
+	/* Disney Sound Source on LPT1 */
+	if (pc->dss_enabled) {
+		ioport_map(m, 0x378, 1, &dss_ops, NULL);
+		ioport_map(m, 0x379, 1, &dss_status_ops, NULL);
+		ioport_map(m, 0x37a, 1, &lpt_control_dss_ops, NULL);
+	} else {
+		ioport_unmap(m, 0x378, 2);
+		ioport_map(m, 0x37a, 1, &lpt_control_ops, NULL);
+	}
+
+	/* ports just released may belong to the bus-master block */
+	pc_map_bmdma(pc);
+}
+
+static u8 pc_io_read(void *o, int addr)
+{
+	PC *pc = o;
+	IOPortSlot *s = ioport_find(&pc->io, addr);
+	u8 r = s->ops.read8(s->opaque, addr);
+	debug_write("R8: %ph <- %02Xh\n", addr, r);
+	return r;
+}
+
+static u16 pc_io_read16(void *o, int addr)
+{
+	PC *pc = o;
+	IOPortSlot *s = ioport_find(&pc->io, addr);
+	u16 r = s->ops.read16(s->opaque, addr);
+	debug_write("R16: %ph <- %04Xh\n", addr, r);
+	return r;
+}
+
+static u32 pc_io_read32(void *o, int addr)
+{
+	PC *pc = o;
+	IOPortSlot *s = ioport_find(&pc->io, addr);
+	u32 r = s->ops.read32(s->opaque, addr);
+	debug_write("R32: %ph <- %08Xh\n", addr, r);
+	return r;
+}
+
+static int pc_io_read_string(void *o, int addr, uint8_t *buf, int size, int count)
+{
+	debug_write("RS: %ph [%d / %d]\n", addr, size, count);
+	PC *pc = o;
+	IOPortSlot *s = ioport_find(&pc->io, addr);
+	return s->ops.read_string(s->opaque, addr, buf, size, count);
+}
+
+static void pc_io_write(void *o, int addr, u8 val)
+{
+	debug_write("W8: %ph -> %02Xh\n", addr, val);
+	PC *pc = o;
+	IOPortSlot *s = ioport_find(&pc->io, addr);
+	s->ops.write8(s->opaque, addr, val);
+}
+
+static void pc_io_write16(void *o, int addr, u16 val)
+{
+	debug_write("W16: %ph -> %04Xh\n", addr, val);
+	PC *pc = o;
+	IOPortSlot *s = ioport_find(&pc->io, addr);
+	s->ops.write16(s->opaque, addr, val);
+}
+
+static void pc_io_write32(void *o, int addr, u32 val)
+{
+	debug_write("W32: %ph -> %08Xh\n", addr, val);
+	PC *pc = o;
+	IOPortSlot *s = ioport_find(&pc->io, addr);
+	s->ops.write32(s->opaque, addr, val);
+}
+
+static int pc_io_write_string(void *o, int addr, uint8_t *buf, int size, int count)
+{
+	debug_write("WS: %ph [%d / %d]\n", addr, size, count);
+	PC *pc = o;
+	IOPortSlot *s = ioport_find(&pc->io, addr);
+	return s->ops.write_string(s->opaque, addr, buf, size, count);
+}
+
+void pc_vga_step(void *o)
+{
+	PC *pc = o;
+	int refresh = vga_step(pc->vga);
+	if (refresh) {
+		vga_refresh(pc->vga, pc->redraw, pc->redraw_data, 0);
 	}
 }
 
-static u8 pc_io_read(void *o, int addr) {
-	u8 r = _pc_io_read(o, addr);
-	debug_write("R8: %ph <- %02Xh\n", addr, r);
-	return r;
-}
+#ifdef PC_STEP_STATS
+uint64_t pc_step_stats_ns[PC_STAT_COUNT];
+const char *const pc_step_stats_names[PC_STAT_COUNT] = {
+	"vga", "timers", "serial", "kbd", "dma", "fdc", "ide",
+	"poll", "refresh", "cpu", "idle",
+};
+#define STAT_BEGIN() uint64_t stat_t = get_nticks()
+#define STAT_END(id) do { \
+		uint64_t stat_now = get_nticks(); \
+		pc_step_stats_ns[id] += stat_now - stat_t; \
+		stat_t = stat_now; \
+	} while (0)
+#define STAT_RESTART() stat_t = get_nticks()
+#else
+#define STAT_BEGIN() do {} while (0)
+#define STAT_END(id) do {} while (0)
+#define STAT_RESTART() do {} while (0)
+#endif
+
+/* CPU burst bounds, in instructions */
+#if defined(BUILD_ESP32)
+#define PC_BURST_MAX 512
+#elif defined(RP2350_BUILD)
+#define PC_BURST_MAX 4096
+#else
+#define PC_BURST_MAX 10240
+#endif
+#define PC_BURST_MIN (PC_BURST_MAX / 16)
+
+#define PC_SERIAL_PERIOD_US 1000
+#define PC_FDC_PERIOD_US    1000	/* fdc_tick counts emulated ms */
+#define PC_IDE_PERIOD_US    10000
+#define PC_IDLE_US          1000000	/* nothing to do until kicked */
+#define PC_POLL_REPEATS     64	/* IN loop rounds before the CPU counts as idle */
+/* longest idle sleep on the host clock, so input is still polled */
+#if defined(BUILD_ESP32) || defined(RP2350_BUILD)
+#define PC_SLEEP_MAX_US     100
+#else
+#define PC_SLEEP_MAX_US     1000
+#endif
 
-static __always_inline u16 _pc_io_read16(void *o, int addr)
+/*
+ * Device events. Each runs its device and returns the next time it has
+ * something to do; port writes that reprogram a device kick its event.
+ */
+static uint32_t ev_vga(void *o, uint32_t now)
 {
 	PC *pc = o;
-	u16 val;
-
-	switch(addr) {
-	case 0x1ce: case 0x1cf:
-		val = vbe_read(pc->vga, addr - 0x1ce);
-		return val;
-	/* IDE ports */
-	case 0x1f0:
-		return ide_data_readw(pc->ide);
-	case 0x170:
-		return ide_data_readw(pc->ide2);
-	case 0xcf8:
-		val = i440fx_read_addr(pc->i440fx, 0, 1);
-		return val;
-	case 0xcfc: case 0xcfe:
-		val = i440fx_read_data(pc->i440fx, addr - 0xcfc, 1);
-		return val;
-	/* NE2000 networking removed */
-	case 0x310:
-		return 0xffff;
-	case 0x220:
-		if (pc->adlib_enabled)
-			return adlib_read(pc->adlib, addr);
-		return 0xFFFF;
-	default:
-		return 0;
-	}
+	STAT_BEGIN();
+	if (vga_step(pc->vga))
+		pc->vga_refresh_due = 1;
+	STAT_END(PC_STAT_VGA);
+	return vga_next_deadline(pc->vga, now);
 }
 
-static u16 pc_io_read16(void *o, int addr) {
-	u16 r = _pc_io_read16(o, addr);
-	debug_write("R16: %ph <- %04Xh\n", addr, r);
-	return r;
+static uint32_t ev_pit(void *o, uint32_t now)
+{
+	PC *pc = o;
+	STAT_BEGIN();
+	i8254_update_irq(pc->pit);
+	STAT_END(PC_STAT_TIMERS);
+	return i8254_next_deadline(pc->pit);
 }
 
-static __always_inline u32 _pc_io_read32(void *o, int addr)
+static uint32_t ev_cmos(void *o, uint32_t now)
 {
 	PC *pc = o;
-	u32 val;
-	switch(addr) {
-	/* IDE ports */
-	case 0x1f0:
-		return ide_data_readl(pc->ide);
-	case 0x170:
-		return ide_data_readl(pc->ide2);
-	case 0x3cc:
-		return (get_uticks() - pc->boot_start_time) / 1000;
-	case 0xcf8:
-		val = i440fx_read_addr(pc->i440fx, 0, 2);
-		return val;
-	case 0xcfc:
-		val = i440fx_read_data(pc->i440fx, 0, 2);
-		return val;
-	/* Emulink FDD status port */
-	case 0xf1f0:
-		return emulink_read32(pc);
-	default:
-		return 0;
-	}
+	STAT_BEGIN();
+	cmos_update_irq(pc->cmos);
+	STAT_END(PC_STAT_TIMERS);
+	return cmos_next_deadline(pc->cmos, now);
 }
 
-static u32 pc_io_read32(void *o, int addr) {
-	u32 r = _pc_io_read32(o, addr);
-	debug_write("R32: %ph <- %08Xh\n", addr, r);
-	return r;
+static uint32_t ev_serial(void *o, uint32_t now)
+{
+	PC *pc = o;
+	STAT_BEGIN();
+	u8250_update(pc->serial);
+	STAT_END(PC_STAT_SERIAL);
+	return now + PC_SERIAL_PERIOD_US;
 }
 
-static int pc_io_read_string(void *o, int addr, uint8_t *buf, int size, int count)
+static uint32_t ev_kbd(void *o, uint32_t now)
 {
-	debug_write("RS: %ph [%d / %d]\n", addr, size, count);
 	PC *pc = o;
-	switch(addr) {
-	case 0x1f0:
-		return ide_data_read_string(pc->ide, buf, size, count);
-	case 0x170:
-		return ide_data_read_string(pc->ide2, buf, size, count);
-	case 0xf1f4:
-		return emulink_data_read(pc, buf, size, count);
-	}
-	return 0;
+	STAT_BEGIN();
+	kbd_step(pc->i8042);
+	STAT_END(PC_STAT_KBD);
+	return kbd_next_deadline(pc->i8042, now);
 }
 
-#if EMULATE_LTEMS
-uint8_t ems_pages[4] = {0};
-
-inline static void out_ems(const uint16_t port, const uint8_t data) {
-    ems_pages[port & 3] = data;
+static uint32_t ev_fdc(void *o, uint32_t now)
+{
+	PC *pc = o;
+	if (!pc->fdc)
+		return now + PC_IDLE_US;
+	STAT_BEGIN();
+	fdc_tick(pc->fdc);
+	STAT_END(PC_STAT_FDC);
+	return now + (fdc_irq_pending(pc->fdc) ? PC_FDC_PERIOD_US : PC_IDLE_US);
 }
-#endif
 
-static void pc_io_write(void *o, int addr, u8 val)
+static uint32_t ev_ide(void *o, uint32_t now)
 {
-	debug_write("W8: %ph -> %02Xh\n", addr, val);
 	PC *pc = o;
-	switch(addr) {
-	case 0x80: case 0xed:
-		/* used by linux, for io delay */
-		return;
-	case 0x20: case 0x21: case 0xa0: case 0xa1:
-		i8259_ioport_write(pc->pic, addr, val);
-		return;
-	case 0x3f8: case 0x3f9: case 0x3fa: case 0x3fb:
-	case 0x3fc: case 0x3fd: case 0x3fe: case 0x3ff:
-		u8250_reg_write(pc->serial, addr - 0x3f8, val);
-		return;
-#if EMULATE_LTEMS
-    case 0x260: case 0x261: case 0x262: case 0x263:
-		out_ems(addr, val);
-        return;
-#endif
-	case 0x2f8: case 0x2f9: case 0x2fa: case 0x2fb:
-	case 0x2fc: case 0x2fd: case 0x2fe: case 0x2ff:
-	case 0x2e8: case 0x2e9: case 0x2ea: case 0x2eb:
-	case 0x2ec: case 0x2ed: case 0x2ee: case 0x2ef:
-	case 0x3e8: case 0x3e9: case 0x3ea: case 0x3eb:
-	case 0x3ec: case 0x3ed: case 0x3ee: case 0x3ef:
-		return;
-	case 0x40: case 0x41: case 0x42: case 0x43:
-		i8254_ioport_write(pc->pit, addr, val);
-		return;
-	case 0x70: case 0x71:
-		cmos_ioport_write(pc->cmos, addr, val);
-		return;
-	/* IDE ports */
-	case 0x1f0: case 0x1f1: case 0x1f2: case 0x1f3:
-	case 0x1f4: case 0x1f5: case 0x1f6: case 0x1f7:
-		ide_ioport_write(pc->ide, addr - 0x1f0, val);
-		return;
-	case 0x170: case 0x171: case 0x172: case 0x173:
-	case 0x174: case 0x175: case 0x176: case 0x177:
-		ide_ioport_write(pc->ide2, addr - 0x170, val);
-		return;
-	case 0x3f6:
-		ide_cmd_write(pc->ide, val);
-		return;
-	case 0x376:
-		ide_cmd_write(pc->ide2, val);
-		return;
-	/* FDC ports 0x3F0-0x3F5, 0x3F7 */
-	case 0x3f0: case 0x3f1: case 0x3f2: case 0x3f3:
-	case 0x3f4: case 0x3f5:
-	case 0x3f7:
-		if (pc->fdc)
-			fdc_ioport_write(pc->fdc, addr, val);
-		return;
-	case 0x3c0: case 0x3c1: case 0x3c2: case 0x3c3:
-	case 0x3c4: case 0x3c5: case 0x3c6: case 0x3c7:
-	case 0x3c8: case 0x3c9: case 0x3ca: case 0x3cb:
-	case 0x3cc: case 0x3cd: case 0x3ce: case 0x3cf:
-	case 0x3d0: case 0x3d1: case 0x3d2: case 0x3d3:
-	case 0x3d4: case 0x3d5: case 0x3d6: case 0x3d7:
-	case 0x3d8: case 0x3d9: case 0x3da: case 0x3db:
-	case 0x3dc: case 0x3dd: case 0x3de: case 0x3df:
-		vga_ioport_write(pc->vga, addr, val);
-		return;
-	case 0x402:
-		return;
-	case 0x92:
-		pc->port92 = val;
-		cpu_set_a20(pc->cpu, (val >> 1) & 1);
-		return;
-	case 0x60:
-		kbd_write_data(pc->i8042, addr, val);
-		return;
-	case 0x64:
-		kbd_write_command(pc->i8042, addr, val);
-		return;
-	case 0x61:
-		pcspk_ioport_write(pc->pcspk, val);
-		return;
-	case 0x220: case 0x221: case 0x222: case 0x223:
-	case 0x228: case 0x229:
-	case 0x388: case 0x389: case 0x38a: case 0x38b:
-		if (pc->adlib_enabled)
-			adlib_write(pc->adlib, addr, val);
-		return;
-	case 0x8900:
-		switch (val) {
-		case 'S': if (pc->shutdown_state == 0) pc->shutdown_state = 1; break;
-		case 'h': if (pc->shutdown_state == 1) pc->shutdown_state = 2; break;
-		case 'u': if (pc->shutdown_state == 2) pc->shutdown_state = 3; break;
-		case 't': if (pc->shutdown_state == 3) pc->shutdown_state = 4; break;
-		case 'd': if (pc->shutdown_state == 4) pc->shutdown_state = 5; break;
-		case 'o': if (pc->shutdown_state == 5) pc->shutdown_state = 6; break;
-		case 'w': if (pc->shutdown_state == 6) pc->shutdown_state = 7; break;
-		case 'n': if (pc->shutdown_state == 7) pc->shutdown_state = 8; break;
-		default : pc->shutdown_state = 0; break;
-		}
-		return;
-	case 0xcfc: case 0xcfd: case 0xcfe: case 0xcff:
-		i440fx_write_data(pc->i440fx, addr - 0xcfc, val, 0);
-		return;
-	/* NE2000 networking removed */
-	case 0x300: case 0x301: case 0x302: case 0x303:
-	case 0x304: case 0x305: case 0x306: case 0x307:
-	case 0x308: case 0x309: case 0x30a: case 0x30b:
-	case 0x30c: case 0x30d: case 0x30e: case 0x30f:
-	case 0x310: case 0x31f:
-		return;
-	case 0x00: case 0x01: case 0x02: case 0x03:
-	case 0x04: case 0x05: case 0x06: case 0x07:
-		i8257_write_chan(pc->isa_dma, addr - 0x00, val, 1);
-		return;
-	case 0x08: case 0x09: case 0x0a: case 0x0b:
-	case 0x0c: case 0x0d: case 0x0e: case 0x0f:
-		i8257_write_cont(pc->isa_dma, addr - 0x08, val, 1);
-		return;
-	case 0x81: case 0x82: case 0x83: case 0x87:
-		i8257_write_page(pc->isa_dma, addr - 0x80, val);
-		return;
-	case 0x481: case 0x482: case 0x483: case 0x487:
-		i8257_write_pageh(pc->isa_dma, addr - 0x480, val);
-		return;
-	/* 0xC0/0xC1: SN76489 data port when Tandy enabled, hdma ch0 otherwise.
-	 * 0xC2-0xCE: always hdma (Tandy only occupied 0xC0). */
-	case 0xc0: case 0xc1:
-		if (pc->tandy_enabled)
-			sn76489_out(val);
-		else
-			i8257_write_chan(pc->isa_hdma, addr - 0xc0, val, 1);
-		return;
-	case 0xc2: case 0xc4: case 0xc6:
-	case 0xc8: case 0xca: case 0xcc: case 0xce:
-		i8257_write_chan(pc->isa_hdma, addr - 0xc0, val, 1);
-		return;
-	case 0xd0: case 0xd2: case 0xd4: case 0xd6:
-	case 0xd8: case 0xda: case 0xdc: case 0xde:
-		i8257_write_cont(pc->isa_hdma, addr - 0xd0, val, 1);
-		return;
-	case 0x89: case 0x8a: case 0x8b: case 0x8f:
-		i8257_write_page(pc->isa_hdma, addr - 0x88, val);
-		return;
-	case 0x489: case 0x48a: case 0x48b: case 0x48f:
-		i8257_write_pageh(pc->isa_hdma, addr - 0x488, val);
-		return;
-	case 0x224:
-		if (pc->sb16_enabled) {
-			sb16_mixer_write_indexb(pc->sb16, addr, val);
-		}
-		return;
-	case 0x225:
-		if (pc->sb16_enabled) {
-			sb16_mixer_write_datab(pc->sb16, addr, val);
-		}
-		return;
-	case 0x226: case 0x22c:
-		if (pc->sb16_enabled) {
-			sb16_dsp_write(pc->sb16, addr, val);
-		}
-		return;
-	/* Tandy 3-Voice Sound (SN76489) - additional alias ports.
-	 * Primary port 0xC0 is handled above.
-	 * 0x1E0: Tandy 1000 SX/TX/HX data port
-	 * 0x2C0: Tandy 1000 A/B mirror */
-	case 0x1E0: case 0x2C0:
-		if (pc->tandy_enabled)
-			sn76489_out(val);
-		return;
-	/* Covox Speech Thing (parallel port DAC)
-	 * 0x278 = LPT2 data. */
-	case 0x278:
-		if (pc->covox_enabled)
-			pc->covox_sample = val;
-		return;
-	// MPU-401
-	case 0x330:
-	case 0x331:
-		if (pc->mpu401_enabled)
-			mpu401_write(addr, val);
-		return;
-	// Disney Sound Source
-    case 0x378:
-    case 0x37A:
-		if (pc->dss_enabled)
-			dss_out(addr, val);
-		return;
-	/* LPT status/control ports are read-only - writes ignored */
-	case 0x379: case 0x279:
-	case 0x27a:
-		return;
-	default:
-///		fprintf(stderr, "out 0x%x => 0x%x\n", val, addr);
-		return;
-	}
+	STAT_BEGIN();
+	ide_step(pc->ide);
+	ide_step(pc->ide2);
+	STAT_END(PC_STAT_IDE);
+	return now + PC_IDE_PERIOD_US;
 }
 
-static void pc_io_write16(void *o, int addr, u16 val)
+static void pc_sched_init(PC *pc)
 {
-	debug_write("W16: %ph -> %04Xh\n", addr, val);
-	PC *pc = o;
-	switch(addr) {
-	/* IDE ports */
-	case 0x1f0:
-		ide_data_writew(pc->ide, val);
-		return;
-	case 0x170:
-		ide_data_writew(pc->ide2, val);
-		return;
-    case 0x260: case 0x261: case 0x262: case 0x263:
-		pc_io_write(o, addr, (uint8_t) val);
-		pc_io_write(o, addr + 1, val >> 8);
-        return;
-	case 0x3c0: case 0x3c1: case 0x3c2: case 0x3c3:
-	case 0x3c4: case 0x3c5: case 0x3c6: case 0x3c7:
-	case 0x3c8: case 0x3c9: case 0x3ca: case 0x3cb:
-	case 0x3cc: case 0x3cd: case 0x3ce: case 0x3cf:
-	case 0x3d0: case 0x3d1: case 0x3d2: case 0x3d3:
-	case 0x3d4: case 0x3d5: case 0x3d6: case 0x3d7:
-	case 0x3d8: case 0x3d9: case 0x3da: case 0x3db:
-	case 0x3dc: case 0x3dd: case 0x3de:
-		vga_ioport_write(pc->vga, addr, val & 0xff);
-		vga_ioport_write(pc->vga, addr + 1, (val >> 8) & 0xff);
-		return;
-	case 0x1ce: case 0x1cf:
-		vbe_write(pc->vga, addr - 0x1ce, val);
-		return;
-	case 0xcfc: case 0xcfe:
-		i440fx_write_data(pc->i440fx, addr - 0xcfc, val, 1);
-		return;
-	/* NE2000 networking removed */
-	case 0x310:
-		return;
-	default:
-///		fprintf(stderr, "outw 0x%x => 0x%x\n", val, addr);
-		return;
-	}
+	Scheduler *s = &pc->sched;
+	uint32_t now = emu_uticks();
+	sched_init(s, now);
+	pc->ev_vga = sched_add(s, ev_vga, pc, now);
+	pc->ev_pit = sched_add(s, ev_pit, pc, now);
+	pc->ev_cmos = sched_add(s, ev_cmos, pc, now);
+	pc->ev_serial = -1;
+	if (pc->enable_serial)
+		pc->ev_serial = sched_add(s, ev_serial, pc, now);
+	pc->ev_kbd = sched_add(s, ev_kbd, pc, now);
+	pc->ev_fdc = sched_add(s, ev_fdc, pc, now);
+	pc->ev_ide = sched_add(s, ev_ide, pc, now);
+	pc->vga_refresh_due = 0;
+	pc->burst_ipus = 16 << 8;
 }
 
-static void pc_io_write32(void *o, int addr, u32 val)
+#ifndef USEKVM
+/* Instructions that fit before the next deadline at the measured rate */
+static int pc_burst_steps(PC *pc, uint32_t now, uint32_t next)
 {
-	debug_write("W32: %ph -> %08Xh\n", addr, val);
-	PC *pc = o;
-	switch(addr) {
-	/* IDE ports */
-	case 0x1f0:
-		ide_data_writel(pc->ide, val);
-		return;
-	case 0x170:
-		ide_data_writel(pc->ide2, val);
-		return;
-	case 0xcf8:
-		i440fx_write_addr(pc->i440fx, 0, val, 2);
-		return;
-	case 0xcfc:
-		i440fx_write_data(pc->i440fx, 0, val, 2);
-		return;
-	/* Emulink FDD command/data ports */
-	case 0xf1f0:
-		emulink_cmd_write(pc, val);
-		return;
-	case 0xf1f4:
-		emulink_arg_write(pc, val);
-		return;
-    case 0x260: case 0x261: case 0x262: case 0x263:
-		pc_io_write16(o, addr, (uint16_t) val);
-		pc_io_write16(o, addr + 2, val >> 16);
-        return;
-	default:
-///		do_log(stderr, "outd 0x%x => 0x%x\n", val, addr);
-		return;
-	}
+	int32_t dt = next - now;
+	if (dt <= 0)
+		return PC_BURST_MIN;
+	uint64_t n = ((uint64_t)dt * pc->burst_ipus) >> 8;
+	if (n < PC_BURST_MIN)
+		return PC_BURST_MIN;
+	if (n > PC_BURST_MAX)
+		return PC_BURST_MAX;
+	return n;
 }
 
-static int pc_io_write_string(void *o, int addr, uint8_t *buf, int size, int count)
+/* Track guest speed; halted bursts retire nothing and are skipped */
+static void pc_burst_account(PC *pc, long cycles, uint32_t dt)
 {
-	debug_write("WS: %ph [%d / %d]\n", addr, size, count);
-	PC *pc = o;
-	switch(addr) {
-	case 0x1f0:
-		return ide_data_write_string(pc->ide, buf, size, count);
-	case 0x170:
-		return ide_data_write_string(pc->ide2, buf, size, count);
-	case 0xf1f4:
-		return emulink_data_write(pc, buf, size, count);
-	}
-	return 0;
+	if (cycles <= 0 || dt == 0)
+		return;
+	uint32_t ipus = ((uint64_t)cycles << 8) / dt;
+	pc->burst_ipus += ((int32_t)(ipus - pc->burst_ipus)) / 8;
+	if (pc->burst_ipus < 1 << 8)
+		pc->burst_ipus = 1 << 8;
 }
 
-void pc_vga_step(void *o)
+/*
+ * The CPU is halted or polling a port, so nothing changes before the next
+ * event. The instruction clock jumps straight there; on the host clock the
+ * core sleeps towards it instead of spinning through pc_step.
+ */
+static void pc_idle(PC *pc, uint32_t when)
 {
-	PC *pc = o;
-	int refresh = vga_step(pc->vga);
-	if (refresh) {
-		vga_refresh(pc->vga, pc->redraw, pc->redraw_data, 0);
+	if (vclock.cpu) {
+		vclock_idle_until(when);
+		return;
 	}
+	int32_t dt = when - get_uticks();
+	if (dt > PC_SLEEP_MAX_US)
+		dt = PC_SLEEP_MAX_US;
+	if (dt > 0)
+		usleep(dt);
 }
+#endif
 
 void __not_in_flash_func(pc_step)(PC *pc)
 {
 	/* reset_request is handled in main.c via load_bios_and_reset() */
-	int refresh = vga_step(pc->vga);
-	i8254_update_irq(pc->pit);
-	cmos_update_irq(pc->cmos);
-	if (pc->enable_serial)
-		u8250_update(pc->serial);
-	kbd_step(pc->i8042);
+	uint32_t now = emu_uticks();
+	uint32_t next = sched_run(&pc->sched, now);
+	STAT_BEGIN();
 	i8257_dma_run(pc->isa_dma);
 	i8257_dma_run(pc->isa_hdma);
-	if (pc->fdc) fdc_tick(pc->fdc);
+	/* DMA completion and FDC commands schedule the FDC irq */
+	if (pc->fdc && fdc_irq_pending(pc->fdc)) {
+		sched_kick(&pc->sched, pc->ev_fdc, now + PC_FDC_PERIOD_US);
+		next = pc->sched.next;
+	}
+	STAT_END(PC_STAT_DMA);
+	int refresh = pc->vga_refresh_due;
+	pc->vga_refresh_due = 0;
 #if !defined(BUILD_ESP32) && !defined(RP2350_BUILD)
 	pc->poll(pc->redraw_data);
+	STAT_END(PC_STAT_POLL);
 	if (refresh) {
 		vga_refresh(pc->vga, pc->redraw, pc->redraw_data,
 			    pc->full_update != 0);
@@ -765,6 +1178,7 @@ void __not_in_flash_func(pc_step)(PC *pc)
 	}
 #else
 	if (pc->poll) pc->poll(pc->redraw_data);
+	STAT_END(PC_STAT_POLL);
 	if (refresh && pc->redraw) {
 		vga_refresh(pc->vga, pc->redraw, pc->redraw_data,
 			    pc->full_update != 0);
@@ -772,33 +1186,33 @@ void __not_in_flash_func(pc_step)(PC *pc)
 			pc->full_update = 0;
 	}
 #endif
+	STAT_END(PC_STAT_REFRESH);
 #ifdef USEKVM
 	cpukvm_step(pc->cpu, 4096);
+	STAT_END(PC_STAT_CPU);
 #else
-#if defined(BUILD_ESP32)
-	cpui386_step(pc->cpu, 512);
-#elif defined(RP2350_BUILD)
-	if (pc->adlib_enabled) {
-		for (int i = 0; i < 409; ++i) {
-			cpui386_step(pc->cpu, 10);
-			adlib_core0(pc->adlib);
-		}
-	} else {
-		cpui386_step(pc->cpu, 4096);
+	int steps = pc_burst_steps(pc, now, next);
+	long cycles = cpui386_get_cycle(pc->cpu);
+	uint32_t t0 = emu_uticks();
+	STAT_RESTART();
+	cpui386_step(pc->cpu, steps);
+	cycles = cpui386_get_cycle(pc->cpu) - cycles;
+	pc_burst_account(pc, cycles, emu_uticks() - t0);
+	STAT_END(PC_STAT_CPU);
+	if (cpui386_is_idle(pc->cpu)) {
+		pc_idle(pc, pc->sched.next);
+		STAT_END(PC_STAT_IDLE);
 	}
-#else
-	cpui386_step(pc->cpu, 10240);
-#endif
 #endif
 
 #ifdef I386_PROFILE
 	/* Dump profile every ~10M instructions */
-	static uint32_t prof_dump_counter = 0;
-	prof_dump_counter += 4096;
-	if (prof_dump_counter >= 10000000) {
-		i386_profile_dump();
-		i386_profile_reset();
-		prof_dump_counter = 0;
+	static long prof_last_cycle = 0;
+	long prof_cycle = cpui386_get_cycle(pc->cpu);
+	if (prof_cycle - prof_last_cycle >= 10000000 || prof_cycle < prof_last_cycle) {
+		i386_profile_dump(pc->cpu);
+		i386_profile_reset(pc->cpu);
+		prof_last_cycle = prof_cycle;
 	}
 #endif
 }
@@ -820,106 +1234,201 @@ static void set_irq(void *o, int irq, int level)
 	return i8259_set_irq(s, irq, level);
 }
 
-static void set_pci_vga_bar(void *opaque, int bar_num, uint32_t addr, bool enabled)
+/* CPU device memory regions */
+enum {
+	PC_MMIO_VGA,	/* legacy VGA window 0xa0000-0xbffff */
+	PC_MMIO_LFB,	/* PCI VGA BAR 0, linear view of vga_mem */
+	PC_MMIO_EMS,	/* Lo-tech EMS page frame */
+};
+
+static u8 vga_window_read8(void *o, uword addr)
 {
-	PC *pc = opaque;
-	if (enabled)
-		pc->pci_vga_ram_addr = addr;
-	else
-		pc->pci_vga_ram_addr = -1;
-#ifdef USEKVM
-	if (enabled)
-		cpukvm_register_mem(pc->cpu, 2, addr, pc->vga_mem_size,
-				    pc->vga_mem);
-	else
-		cpukvm_register_mem(pc->cpu, 2, addr, 0,
-				    NULL);
-#endif
+	PC *pc = o;
+	return vga_mem_read(pc->vga, addr);
 }
 
-static u8 iomem_read8(void *iomem, uword addr)
+static void vga_window_write8(void *o, uword addr, u8 val)
 {
-	PC *pc = iomem;
-	uword vga_addr2 = pc->pci_vga_ram_addr;
-	if (addr >= vga_addr2) {
-		addr -= vga_addr2;
-		if (addr < pc->vga_mem_size)
-			return pc->vga_mem[addr];
-		else
-			return 0;
-	}
-	return vga_mem_read(pc->vga, addr - 0xa0000);
+	PC *pc = o;
+	vga_mem_write(pc->vga, addr, val);
 }
 
-static void iomem_write8(void *iomem, uword addr, u8 val)
+static u16 vga_window_read16(void *o, uword addr)
 {
-	PC *pc = iomem;
-	uword vga_addr2 = pc->pci_vga_ram_addr;
-	if (addr >= vga_addr2) {
-		addr -= vga_addr2;
-		if (addr < pc->vga_mem_size)
-			pc->vga_mem[addr] = val;
-		return;
+	return vga_window_read8(o, addr) |
+		((u16) vga_window_read8(o, addr + 1) << 8);
+}
+
+static void vga_window_write16(void *o, uword addr, u16 val)
+{
+	PC *pc = o;
+	vga_mem_write16(pc->vga, addr, val);
+}
+
+static u32 vga_window_read32(void *o, uword addr)
+{
+	return vga_window_read16(o, addr) |
+		((u32) vga_window_read16(o, addr + 2) << 16);
+}
+
+static void vga_window_write32(void *o, uword addr, u32 val)
+{
+	PC *pc = o;
+	vga_mem_write32(pc->vga, addr, val);
+}
+
+static bool vga_window_write_string(void *o, uword addr, uint8_t *buf, int len)
+{
+	PC *pc = o;
+	return vga_mem_write_string(pc->vga, addr, buf, len);
+}
+
+static bool vga_window_fill(void *o, uword addr, u32 val, int size, int count)
+{
+	PC *pc = o;
+	return vga_mem_fill(pc->vga, addr, val, size, count);
+}
+
+static const CPU_MMIO vga_window_mmio = {
+	vga_window_read8, vga_window_write8,
+	vga_window_read16, vga_window_write16,
+	vga_window_read32, vga_window_write32,
+	vga_window_write_string,
+	vga_window_fill,
+};
+
+static u8 vga_lfb_read8(void *o, uword addr)
+{
+	PC *pc = o;
+	return addr < pc->vga_mem_size ? pc->vga_mem[addr] : 0;
+}
+
+static void vga_lfb_write8(void *o, uword addr, u8 val)
+{
+	PC *pc = o;
+	if (addr < pc->vga_mem_size) {
+		pc->vga_mem[addr] = val;
+		vga_set_dirty(pc->vga, addr, 1);
 	}
-	vga_mem_write(pc->vga, addr - 0xa0000, val);
 }
 
-static u16 iomem_read16(void *iomem, uword addr)
+static u16 vga_lfb_read16(void *o, uword addr)
 {
-	return iomem_read8(iomem, addr) |
-		((u16) iomem_read8(iomem, addr + 1) << 8);
+	return vga_lfb_read8(o, addr) |
+		((u16) vga_lfb_read8(o, addr + 1) << 8);
 }
 
-static void iomem_write16(void *iomem, uword addr, u16 val)
+static void vga_lfb_write16(void *o, uword addr, u16 val)
 {
-	PC *pc = iomem;
-	// fast path for vga ram
-	uword vga_addr2 = pc->pci_vga_ram_addr;
-	if (addr >= vga_addr2) {
-		addr -= vga_addr2;
-		if (addr + 1 < pc->vga_mem_size)
-			*(uint16_t *)&(pc->vga_mem[addr]) = val;
-		return;
+	PC *pc = o;
+	if (addr + 1 < pc->vga_mem_size) {
+		*(uint16_t *)&(pc->vga_mem[addr]) = val;
+		vga_set_dirty(pc->vga, addr, 2);
 	}
-	vga_mem_write16(pc->vga, addr - 0xa0000, val);
 }
 
-static u32 iomem_read32(void *iomem, uword addr)
+static u32 vga_lfb_read32(void *o, uword addr)
 {
-	return iomem_read16(iomem, addr) |
-		((u32) iomem_read16(iomem, addr + 2) << 16);
+	return vga_lfb_read16(o, addr) |
+		((u32) vga_lfb_read16(o, addr + 2) << 16);
 }
 
-static void iomem_write32(void *iomem, uword addr, u32 val)
+static void vga_lfb_write32(void *o, uword addr, u32 val)
 {
-	PC *pc = iomem;
-	// fast path for vga ram
-	uword vga_addr2 = pc->pci_vga_ram_addr;
-	if (addr >= vga_addr2) {
-		uword vga_addr2 = pc->pci_vga_ram_addr;
-		addr -= vga_addr2;
-		if (addr + 3 < pc->vga_mem_size)
-			*(uint32_t *)&(pc->vga_mem[addr]) = val;
-		return;
+	PC *pc = o;
+	if (addr + 3 < pc->vga_mem_size) {
+		*(uint32_t *)&(pc->vga_mem[addr]) = val;
+		vga_set_dirty(pc->vga, addr, 4);
 	}
-	vga_mem_write32(pc->vga, addr - 0xa0000, val);
 }
 
-static bool iomem_write_string(void *iomem, uword addr, uint8_t *buf, int len)
+static bool vga_lfb_write_string(void *o, uword addr, uint8_t *buf, int len)
 {
-	PC *pc = iomem;
-	// fast path for vga ram
-	uword vga_addr2 = pc->pci_vga_ram_addr;
-	if (addr >= vga_addr2) {
-		uword vga_addr2 = pc->pci_vga_ram_addr;
-		addr -= vga_addr2;
-		if (addr + len < pc->vga_mem_size) {
-			memcpy(pc->vga_mem + addr, buf, len);
-			return true;
-		}
-		return false;
+	PC *pc = o;
+	if (addr + len < pc->vga_mem_size) {
+		memcpy(pc->vga_mem + addr, buf, len);
+		vga_set_dirty(pc->vga, addr, len);
+		return true;
+	}
+	return false;
+}
+
+static const CPU_MMIO vga_lfb_mmio = {
+	vga_lfb_read8, vga_lfb_write8,
+	vga_lfb_read16, vga_lfb_write16,
+	vga_lfb_read32, vga_lfb_write32,
+	vga_lfb_write_string,
+};
+
+#if EMULATE_LTEMS
+/* the page frame is banked in 16 KB units, so wider accesses go bytewise */
+static u8 ems_read8(void *o, uword addr)
+{
+	return *ems_host_ptr(EMS_START + addr);
+}
+
+static void ems_write8(void *o, uword addr, u8 val)
+{
+	*ems_host_ptr(EMS_START + addr) = val;
+}
+
+static u16 ems_read16(void *o, uword addr)
+{
+	return ems_read8(o, addr) | ((u16) ems_read8(o, addr + 1) << 8);
+}
+
+static void ems_write16(void *o, uword addr, u16 val)
+{
+	ems_write8(o, addr, val);
+	ems_write8(o, addr + 1, val >> 8);
+}
+
+static u32 ems_read32(void *o, uword addr)
+{
+	return ems_read16(o, addr) | ((u32) ems_read16(o, addr + 2) << 16);
+}
+
+static void ems_write32(void *o, uword addr, u32 val)
+{
+	ems_write16(o, addr, val);
+	ems_write16(o, addr + 2, val >> 16);
+}
+
+static const CPU_MMIO ems_mmio = {
+	ems_read8, ems_write8,
+	ems_read16, ems_write16,
+	ems_read32, ems_write32,
+	NULL,
+};
+#endif
+
+static void set_pci_vga_bar(void *opaque, int bar_num, uint32_t addr, bool enabled)
+{
+	PC *pc = opaque;
+#ifndef USEKVM
+	cpui386_map_mmio(pc->cpu, PC_MMIO_LFB, addr, enabled ? pc->vga_mem_size : 0,
+			 &vga_lfb_mmio, pc);
+#else
+	if (enabled)
+		cpukvm_register_mem(pc->cpu, 2, addr, pc->vga_mem_size,
+				    pc->vga_mem);
+	else
+		cpukvm_register_mem(pc->cpu, 2, addr, 0,
+				    NULL);
+#endif
+}
+
+static void set_pci_ide_bar(void *opaque, int bar_num, uint32_t addr, bool enabled)
+{
+	PC *pc = opaque;
+	uint32_t old = pc->pci_ide_bm_addr;
+	if (old) {
+		ioport_unmap_owned(&pc->io, old, 8, &bmdma_ops, pc->ide);
+		ioport_unmap_owned(&pc->io, old + 8, 8, &bmdma_ops, pc->ide2);
 	}
-	return vga_mem_write_string(pc->vga, addr - 0xa0000, buf, len);
+	/* sizing writes all ones to the BAR; nothing decodes above 64K */
+	pc->pci_ide_bm_addr = enabled && addr <= 0x10000 - 16 ? addr : 0;
+	pc_map_bmdma(pc);
 }
 
 static void pc_reset_request(void *p)
@@ -968,6 +1477,24 @@ static void cdrom_change_notify(int drivenum, const char *filename, int was_pres
     ide_change_cd(ide, ide_drive, f, was_present);
 }
 
+/* HDD eject callback: write back cached sectors before disk.c closes the image */
+static void hdd_eject_notify(int drivenum) {
+    if (!_pc_for_cdrom) return;
+    ide_flush(drivenum < 2 ? _pc_for_cdrom->ide : _pc_for_cdrom->ide2);
+}
+
+void pc_flush_disks(PC *pc)
+{
+	ide_flush(pc->ide);
+	ide_flush(pc->ide2);
+}
+
+/* DMA into guest RAM may overwrite code the CPU has decoded */
+static void dma_mem_written(void *opaque, uint32_t addr, int len)
+{
+	cpu_invalidate_code(opaque, addr, len);
+}
+
 PC *pc_new(SimpleFBDrawFunc *redraw, void (*poll)(void *), void *redraw_data,
 	   u8 *fb, PCConfig *conf)
 {
@@ -975,7 +1502,12 @@ PC *pc_new(SimpleFBDrawFunc *redraw, void (*poll)(void *), void *redraw_data,
 	f_open(&ports_log, "ports.log", FA_WRITE | FA_CREATE_ALWAYS);
 #endif
 	PC *pc = malloc(sizeof(PC));
+	ioport_init(&pc->io);
+#ifdef RP2350_BUILD
     char *mem = (uint8_t*)0x11000000;
+#else
+	char *mem = pcmalloc(conf->mem_size);
+#endif
 	CPU_CB *cb = NULL;
 	memset(mem, 0, conf->mem_size);
 #ifdef BUILD_ESP32
@@ -990,6 +1522,12 @@ PC *pc_new(SimpleFBDrawFunc *redraw, void (*poll)(void *), void *redraw_data,
 	pc->cpu = cpui386_new(conf->cpu_gen, mem, conf->mem_size, &cb);
 	if (conf->fpu)
 		cpui386_enable_fpu(pc->cpu);
+	/* before any device takes a timestamp */
+	if (conf->clock_mhz > 0)
+		vclock_use_instructions(pc->cpu, conf->clock_mhz, conf->clock_catchup);
+	else
+		vclock_use_host();
+	cpui386_set_poll_detect(pc->cpu, conf->idle_poll ? PC_POLL_REPEATS : 0);
 #endif
 	pc->bios = conf->bios;
 	pc->vga_bios = conf->vga_bios;
@@ -1027,6 +1565,7 @@ PC *pc_new(SimpleFBDrawFunc *redraw, void (*poll)(void *), void *redraw_data,
 	 * correctly when insertdisk opens a configured CD image below. */
 	_pc_for_cdrom = pc;
 	disk_set_cdrom_change_callback(cdrom_change_notify);
+	disk_set_hdd_eject_callback(hdd_eject_notify);
 
 	/* Attach hard disks and configured CD-ROMs.
 	 * ide_attach_cd MUST come before insertdisk for CD slots: insertdisk
@@ -1077,7 +1616,9 @@ PC *pc_new(SimpleFBDrawFunc *redraw, void (*poll)(void *), void *redraw_data,
 
 	int piix3_devfn;
 	pc->i440fx = i440fx_init(&pc->pcibus, &piix3_devfn);
-	pc->pci_ide = piix3_ide_init(pc->pcibus, piix3_devfn + 1);
+	pc->pci_ide_bm_addr = 0;
+	pc->pci_ide = piix3_ide_init(pc->pcibus, piix3_devfn + 1,
+				     pc, set_pci_ide_bar);
 
 	pc->phys_mem = mem;
 	pc->phys_mem_size = conf->mem_size;
@@ -1106,7 +1647,6 @@ PC *pc_new(SimpleFBDrawFunc *redraw, void (*poll)(void *), void *redraw_data,
 			   fb, conf->width, conf->height);
 	vga_set_force_8dm(pc->vga, conf->vga_force_8dm);
 	pc->pci_vga = vga_pci_init(pc->vga, pc->pcibus, pc, set_pci_vga_bar);
-	pc->pci_vga_ram_addr = -1;
 	disk_set_vga(pc->vga);
 
 	/* Attach floppy disks using INT 13h disk handler */
@@ -1118,14 +1658,12 @@ PC *pc_new(SimpleFBDrawFunc *redraw, void (*poll)(void *), void *redraw_data,
 		insertdisk(i, true, false, fdd[i]);
 	}
 
-	cb->iomem = pc;
-	cb->iomem_read8 = iomem_read8;
-	cb->iomem_write8 = iomem_write8;
-	cb->iomem_read16 = iomem_read16;
-	cb->iomem_write16 = iomem_write16;
-	cb->iomem_read32 = iomem_read32;
-	cb->iomem_write32 = iomem_write32;
-	cb->iomem_write_string = iomem_write_string;
+#ifndef USEKVM
+	cpui386_map_mmio(pc->cpu, PC_MMIO_VGA, 0xa0000, 0x20000, &vga_window_mmio, pc);
+#if EMULATE_LTEMS
+	cpui386_map_mmio(pc->cpu, PC_MMIO_EMS, EMS_START, EMS_END - EMS_START, &ems_mmio, NULL);
+#endif
+#endif
 
 	pc->redraw = redraw;
 	pc->redraw_data = redraw_data;
@@ -1141,6 +1679,12 @@ PC *pc_new(SimpleFBDrawFunc *redraw, void (*poll)(void *), void *redraw_data,
 				0x00, 0x80, 0x480, 0);
 	pc->isa_hdma = i8257_new(pc->phys_mem, pc->phys_mem_size,
 				 0xc0, 0x88, 0x488, 1);
+	i8257_set_mem_written_cb(pc->isa_dma, dma_mem_written, pc->cpu);
+	i8257_set_mem_written_cb(pc->isa_hdma, dma_mem_written, pc->cpu);
+	ide_set_dma_mem(pc->ide, (uint8_t *)pc->phys_mem, pc->phys_mem_size,
+			dma_mem_written, pc->cpu);
+	ide_set_dma_mem(pc->ide2, (uint8_t *)pc->phys_mem, pc->phys_mem_size,
+			dma_mem_written, pc->cpu);
 	/* Emulink FDD – virtual floppy on ports 0xF1F0/0xF1F4 (required by BIOS) */
 	memset(&pc->emulink, 0, sizeof(pc->emulink));
 	pc->emulink.cmd = -1;
@@ -1165,18 +1709,22 @@ PC *pc_new(SimpleFBDrawFunc *redraw, void (*poll)(void *), void *redraw_data,
 	pc->tandy_enabled = 0;
 	pc->covox_enabled = 1;
 	pc->mpu401_enabled = 1;
-	pc->covox_sample  = 0;
 	pc->dss_enabled = 0;
 	pc->mouse_enabled = 1;
 
 	pc->port92 = 0x2;
 	pc->shutdown_state = 0;
 	pc->reset_request = 0;
+	pc_map_ports(pc);
+	pc_sched_init(pc);
 	return pc;
 }
 
 void load_bios_and_reset(PC *pc)
 {
+	pc_flush_disks(pc);
+	pc_update_io_map(pc);
+
 	int bios_size = 0;
 	if (pc->bios && pc->bios[0])
 		bios_size = load_rom(pc->phys_mem, pc->bios, 0x100000, 1);
@@ -1313,6 +1861,12 @@ int parse_conf_ini(void* user, const char* section,
 			conf->cpu_gen = atoi(value);
 		} else if (NAME("fpu")) {
 			conf->fpu = atoi(value);
+		} else if (NAME("clock_mhz")) {
+			conf->clock_mhz = atoi(value);
+		} else if (NAME("clock_catchup")) {
+			conf->clock_catchup = atoi(value);
+		} else if (NAME("idle_poll")) {
+			conf->idle_poll = atoi(value);
 		}
 	}
 #undef SEC
@@ -20,6 +20,8 @@
 #include "ini.h"
 #include "sn76489.h"
 #include "fdd.h"
+#include "sched.h"
+#include "ioport.h"
 
 /// Platform HAL
 uint32_t get_uticks();
@@ -71,10 +73,7 @@ typedef struct {
 	SB16State *sb16;
 	PCSpkState *pcspk;
 
-	// Covox Speech Thing - no state object needed, just last sample + enable
-	volatile uint8_t covox_sample;      /* last written DAC value */
-
-	// Runtime enable flags for audio devices (checked in mixer_callback)
+	// Runtime enable flags for audio devices (checked in mixer_render)
 	int adlib_enabled;
 	int sb16_enabled;
 	int pcspk_enabled;
@@ -87,11 +86,13 @@ typedef struct {
 	IDEIFState *ide;
 	IDEIFState *ide2;
 	PCIDevice *pci_ide;
+	uword pci_ide_bm_addr;	// bus-master register block (BAR4), 0 = unmapped
+
+	IOPortMap io;
 
 	I440FXState *i440fx;
 	PCIBus *pcibus;
 	PCIDevice *pci_vga;
-	uword pci_vga_ram_addr;
 
 	const char *bios;
 	const char *vga_bios;
@@ -107,6 +108,12 @@ typedef struct {
 	const char *cmdline;
 	int enable_serial;
 	int full_update;
+
+	/* device events, run by pc_step when due */
+	Scheduler sched;
+	int ev_vga, ev_pit, ev_cmos, ev_serial, ev_kbd, ev_fdc, ev_ide;
+	int vga_refresh_due;
+	uint32_t burst_ipus;	// guest instructions per microsecond, Q8
 } PC;
 
 typedef struct {
@@ -126,6 +133,9 @@ typedef struct {
 	int height;
 	int cpu_gen;
 	int fpu;
+	int clock_mhz;		// >0: emulated time from instruction count
+	int clock_catchup;	// ...but never behind the host clock
+	int idle_poll;		// IN polling loops idle like HLT
 	int enable_serial;
 	int vga_force_8dm;
 } PCConfig;
@@ -136,11 +146,39 @@ PC *pc_new(SimpleFBDrawFunc *redraw, void (*poll)(void *), void *redraw_data,
 // XXX: still contains ESP32-specific logic
 void pc_vga_step(void *o);
 void pc_step(PC *pc);
+/// Re-route the ports of sound devices after their *_enabled flag changed
+void pc_update_io_map(PC *pc);
+
+#ifdef PC_STEP_STATS
+/// Wall time spent in each pc_step phase (host benchmark builds)
+enum {
+	PC_STAT_VGA,
+	PC_STAT_TIMERS,
+	PC_STAT_SERIAL,
+	PC_STAT_KBD,
+	PC_STAT_DMA,
+	PC_STAT_FDC,
+	PC_STAT_IDE,
+	PC_STAT_POLL,
+	PC_STAT_REFRESH,
+	PC_STAT_CPU,
+	PC_STAT_IDLE,
+	PC_STAT_COUNT
+};
+extern uint64_t pc_step_stats_ns[PC_STAT_COUNT];
+extern const char *const pc_step_stats_names[PC_STAT_COUNT];
+uint64_t get_nticks(void);
+#endif
 
 int parse_conf_ini(void* user, const char* section,
 		   const char* name, const char* value);
 void load_bios_and_reset(PC *pc);
+/// Write back cached HDD sectors to the image files
+void pc_flush_disks(PC *pc);
 
-int16_t midi_sample(void);
+/// Add n samples of the General MIDI synth to buf (n <= MIXER_BLOCK)
+void midi_render(int32_t *buf, int n);
+/// Limit the General MIDI synth to 1..32 simultaneous voices
+void midi_set_polyphony(int voices);
 
 #endif /* PC_H */
@@ -23,9 +23,11 @@
  */
 
 #include "pcspk.h"
+#include <math.h>
 #include <stdlib.h>
 #include <string.h>
 #include <pico.h>
+#include "mixer.h"
 
 #if defined(BUILD_ESP32) || defined(RP2350_BUILD)
 void *pcmalloc(long size);
@@ -33,119 +35,219 @@ void *pcmalloc(long size);
 #define pcmalloc malloc
 #endif
 
-#define PCSPK_BUF_LEN 4096
-//#define PCSPK_SAMPLE_RATE 32000
-#define PCSPK_SAMPLE_RATE 44100
-#define PCSPK_MAX_FREQ (PCSPK_SAMPLE_RATE >> 1)
+#define PCSPK_MAX_FREQ (SOUND_FREQUENCY >> 1)
 #define PCSPK_MIN_COUNT ((PIT_FREQ + PCSPK_MAX_FREQ - 1) / PCSPK_MAX_FREQ)
 
+#define PCSPK_QUEUE 256         /* state changes between two mixer blocks */
+
+/* Band-limited step: each output edge adds a windowed-sinc impulse to a
+ * delta buffer, and the rendered signal is its running sum. */
+#define BLEP_TAPS 16
+#define BLEP_PHASES 32          /* sub-sample positions of an edge */
+#define EDGE_NONE INT32_MAX
+
+/* one-pole DC blocker at ~20 Hz, Q15: the cone rests wherever port 61h
+ * leaves it, but the output should not carry that offset into the mix */
+#define DC_POLE 32674
+
+/* speaker inputs after a port 61h write or a PIT channel 2 reprogram */
+typedef struct {
+    uint32_t t;                 /* get_uticks() */
+    uint32_t count;
+    uint8_t mode;
+    uint8_t gate;
+    uint8_t data_on;
+    uint8_t reload;             /* PIT_MODE_SET or PIT_COUNT_LOADED, else 0 */
+} PCSpkEvent;
+
 struct PCSpkState {
-    uint8_t sample_buf[PCSPK_BUF_LEN];
-//    QEMUSoundCard card;
-//    SWVoiceOut *voice;
     PITState *pit;
-    unsigned int pit_count;
-    unsigned int samples;
-    unsigned int play_pos;
     int data_on;
     int dummy_refresh_clock;
-    int active_out;
+
+    /* Core 0 -> Core 1, single producer and single consumer */
+    PCSpkEvent queue[PCSPK_QUEUE];
+    volatile uint32_t head;
+    volatile uint32_t tail;
+
+    /* Core 1: channel 2 as seen by the renderer; positions are in frames
+     * from the start of the current block, Q16 */
+    PCSpkEvent cur;
+    int out;                    /* PIT OUT2 */
+    int32_t edge;               /* next OUT2 transition */
+    int32_t half;               /* mode 3 half period */
+    int32_t level;              /* speaker amplitude last emitted */
+    int32_t acc;                /* running sum of delta */
+    int32_t dc_in, dc_out;      /* DC blocker state */
+    int32_t delta[MIXER_BLOCK + BLEP_TAPS];
 };
 
-static inline void generate_samples(PCSpkState *s)
+static int16_t blep[BLEP_PHASES][BLEP_TAPS];
+
+static void blep_init(void)
 {
-    unsigned int i;
-
-    if (s->pit_count) {
-        const uint32_t m = PCSPK_SAMPLE_RATE * s->pit_count;
-        const uint32_t n = ((uint64_t)PIT_FREQ << 32) / m;
-
-        /* multiple of wavelength for gapless looping */
-        s->samples = ((uint64_t)PCSPK_BUF_LEN * PIT_FREQ / m * m / (PIT_FREQ >> 1) + 1) >> 1;
-        if (s->samples == 0) s->samples = 1;
-        for (i = 0; i < s->samples; ++i)
-            s->sample_buf[i] = (64 & (n * i >> 25)) - 32;
-    } else {
-        s->samples = PCSPK_BUF_LEN;
-        for (i = 0; i < PCSPK_BUF_LEN; ++i)
-            s->sample_buf[i] = 128; /* silence */
+    for (int ph = 0; ph < BLEP_PHASES; ph++) {
+        float h[BLEP_TAPS], sum = 0;
+        for (int k = 0; k < BLEP_TAPS; k++) {
+            /* cut off a little below Nyquist, centred half the kernel late */
+            float d = k - (BLEP_TAPS / 2 - 1) - (float)ph / BLEP_PHASES;
+            float x = (float)M_PI * 0.9f * d;
+            float sinc = d == 0 ? 1.0f : sinf(x) / x;
+            float w = fabsf(d) >= BLEP_TAPS / 2 ? 0 :
+                0.42f + 0.5f * cosf((float)M_PI * d / (BLEP_TAPS / 2)) +
+                0.08f * cosf(2 * (float)M_PI * d / (BLEP_TAPS / 2));
+            h[k] = sinc * w;
+            sum += h[k];
+        }
+        for (int k = 0; k < BLEP_TAPS; k++)
+            blep[ph][k] = lrintf(h[k] * 32768 / sum);
     }
 }
 
-#include <stdio.h>
-
-void pcspk_callback(void *opaque, uint8_t *stream, int free)
+/* Q16 frames per PIT tick, scaled by 'num' */
+static inline int32_t ticks_to_pos(uint32_t ticks, uint32_t num)
 {
-    PCSpkState *s = opaque;
-    unsigned int n;
+    return ((uint64_t)ticks * ((uint64_t)SOUND_FREQUENCY << 16) * num) / ((uint64_t)PIT_FREQ * 2);
+}
 
-    if (pit_get_mode(s->pit, 2) != 3)
-        return;
-    if (!s->data_on)
-        return;
+static void __not_in_flash_func(add_step)(PCSpkState *s, int32_t pos, int32_t amp)
+{
+    const int16_t *k = blep[(pos >> (16 - 5)) & (BLEP_PHASES - 1)];
+    int32_t *d = s->delta + (pos >> 16);
+    int32_t left = amp;
+    for (int i = 0; i < BLEP_TAPS - 1; i++) {
+        int32_t v = (amp * k[i]) >> 15;
+        d[i] += v;
+        left -= v;
+    }
+    d[BLEP_TAPS - 1] += left;   /* the steps always sum to amp exactly */
+}
 
-    n = pit_get_initial_count(s->pit, 2);
-    /* avoid frequencies that are not reproducible with sample rate */
-    if (n < PCSPK_MIN_COUNT)
-        n = 0;
+static int32_t speaker_level(const PCSpkState *s)
+{
+    if (!s->cur.data_on)
+        return 0;
+    /* above Nyquist the square wave only shows as its average */
+    if (s->cur.mode == 3 && s->cur.gate && s->cur.count < PCSPK_MIN_COUNT)
+        return PCSPK_AMPLITUDE / 2;
+    return s->out ? PCSPK_AMPLITUDE : 0;
+}
 
-    if (s->pit_count != n) {
-        s->pit_count = n;
-        s->play_pos = 0;
-        generate_samples(s);
+static void __not_in_flash_func(update_level)(PCSpkState *s, int32_t pos)
+{
+    int32_t level = speaker_level(s);
+    if (level != s->level) {
+        add_step(s, pos, level - s->level);
+        s->level = level;
     }
+}
 
-    int k = 0;
-    while (free > 0) {
-        n = s->samples - s->play_pos;
-        if (n > free)
-            n = free;
-        memcpy(stream + k, &s->sample_buf[s->play_pos], n);
-//        n = AUD_write(s->voice, &s->sample_buf[s->play_pos], n);
-        if (!n)
-            break;
-        s->play_pos = (s->play_pos + n) % s->samples;
-        free -= n;
-        k += n;
+/* run OUT2 up to 'until' */
+static void __not_in_flash_func(advance)(PCSpkState *s, int32_t until)
+{
+    while (s->edge < until) {
+        int32_t pos = s->edge;
+        if (s->cur.mode == 3) {
+            s->out ^= 1;
+            s->edge += s->half;
+        } else {
+            s->out = 1;         /* mode 0 terminal count */
+            s->edge = EDGE_NONE;
+        }
+        update_level(s, pos);
     }
 }
 
-uint32_t pcspk_ioport_read(void *opaque)
+static void __not_in_flash_func(apply)(PCSpkState *s, const PCSpkEvent *ev, int32_t pos)
 {
-    PCSpkState *s = opaque;
-    int out;
-
-    s->dummy_refresh_clock ^= (1 << 4);
-    out = pit_get_out(s->pit, 2) << 5;
-
-    return pit_get_gate(s->pit, 2) | (s->data_on << 1) | s->dummy_refresh_clock | out;
+    int rising = ev->gate && !s->cur.gate;
+    s->cur = *ev;
+    if (ev->reload == PIT_MODE_SET) {
+        /* OUT2 waits for the count: low in mode 0, high otherwise */
+        s->out = ev->mode != 0;
+        s->edge = EDGE_NONE;
+    } else if (ev->reload == PIT_COUNT_LOADED || (ev->mode == 3 && rising)) {
+        s->edge = EDGE_NONE;
+        switch (ev->mode) {
+        case 0:
+            s->out = 0;
+            s->edge = pos + ticks_to_pos(ev->count, 2);
+            break;
+        case 3:
+            s->out = 1;
+            s->half = ticks_to_pos(ev->count, 1);
+            if (ev->count >= PCSPK_MIN_COUNT)
+                s->edge = pos + s->half;
+            break;
+        default:
+            s->out = 1;
+            break;
+        }
+    }
+    if (s->cur.mode == 3 && !s->cur.gate) {
+        s->out = 1;             /* gate low holds OUT2 high */
+        s->edge = EDGE_NONE;
+    }
+    update_level(s, pos);
 }
 
-static void AUD_set_active_out (PCSpkState *s, int i)
+/* Core 1: add n band-limited samples ending at get_uticks() time 'now' */
+void __not_in_flash_func(pcspk_render)(PCSpkState *s, int32_t *buf, int n, uint32_t now,
+                                       int enabled)
 {
-    s->active_out = i;
+    uint32_t tail = s->tail;
+    while (tail != s->head) {
+        __dmb();
+        const PCSpkEvent *ev = &s->queue[tail % PCSPK_QUEUE];
+        int32_t pos = mixer_pos_at(now, ev->t, n);
+        if (pos < 0)
+            break;
+        advance(s, pos);
+        apply(s, ev, pos);
+        tail++;
+    }
+    s->tail = tail;
+
+    const int32_t end = n << 16;
+    advance(s, end);
+    if (s->edge != EDGE_NONE)
+        s->edge -= end;
+
+    int32_t acc = s->acc, dc_in = s->dc_in, dc_out = s->dc_out;
+    for (int i = 0; i < n; i++) {
+        acc += s->delta[i];
+        dc_out = acc - dc_in + ((dc_out * DC_POLE) >> 15);
+        dc_in = acc;
+        if (enabled)
+            buf[i] += dc_out;
+    }
+    s->acc = acc;
+    s->dc_in = dc_in;
+    s->dc_out = dc_out;
+    memmove(s->delta, s->delta + n, BLEP_TAPS * sizeof(int32_t));
+    memset(s->delta + BLEP_TAPS, 0, n * sizeof(int32_t));
 }
 
-void pcspk_ioport_write(void *opaque, uint32_t val)
+/* Core 0: record the speaker inputs as they are now */
+static void pcspk_event(PCSpkState *s, int reload)
 {
-    PCSpkState *s = opaque;
-    const int gate = val & 1;
-    int oldout = gate & s->data_on;
-
-    s->data_on = (val >> 1) & 1;
-    pit_set_gate(s->pit, 2, gate);
-    if (gate) /* restart */
-        s->play_pos = 0;
-
-    int newout = gate & s->data_on;
-    if (oldout != newout) {
-        AUD_set_active_out(s, gate & s->data_on);
-    }
+    uint32_t head = s->head;
+    if (head - s->tail >= PCSPK_QUEUE)
+        return;
+    PCSpkEvent *ev = &s->queue[head % PCSPK_QUEUE];
+    ev->t = get_uticks();
+    ev->count = pit_get_initial_count(s->pit, 2);
+    ev->mode = pit_get_mode(s->pit, 2);
+    ev->gate = pit_get_gate(s->pit, 2);
+    ev->data_on = s->data_on;
+    ev->reload = reload;
+    __dmb();
+    s->head = head + 1;
 }
 
-int pcspk_get_active_out(PCSpkState *s)
+static void pcspk_pit_changed(void *opaque, int what)
 {
-    return s->active_out;
+    pcspk_event(opaque, what);
 }
 
 PCSpkState *pcspk_init(PITState *pit)
@@ -154,41 +256,34 @@ PCSpkState *pcspk_init(PITState *pit)
     memset(s, 0, sizeof(PCSpkState));
 
     s->pit = pit;
-//    register_ioport_read(0x61, 1, 1, pcspk_ioport_read, s);
-//    register_ioport_write(0x61, 1, 1, pcspk_ioport_write, s);
+    s->edge = EDGE_NONE;
+    s->cur.mode = pit_get_mode(pit, 2);
+    s->cur.count = pit_get_initial_count(pit, 2);
+    blep_init();
+    i8254_set_notify(pit, 2, pcspk_pit_changed, s);
     return s;
 }
 
-int16_t __not_in_flash_func(pcspk_sample)(PCSpkState *s)
+uint32_t pcspk_ioport_read(void *opaque)
 {
-    if (!s || !s->data_on)
-        return 0;
-
-  //  return pit_get_out(s->pit, 2) ? (1 << 12) - 1 : 0;
-
-    if (pit_get_mode(s->pit, 2) != 3)
-        return 0;
-
-    if (!pit_get_gate(s->pit, 2))
-        return 0;
-
-    uint32_t count = pit_get_initial_count(s->pit, 2);
-    if (count < PCSPK_MIN_COUNT)
-        return 0;
-
-    /* частота PIT */
-    uint32_t freq = PIT_FREQ / count;
+    PCSpkState *s = opaque;
+    int out;
 
-    if (freq == 0)
-        return 0;
+    s->dummy_refresh_clock ^= (1 << 4);
+    out = pit_get_out(s->pit, 2) << 5;
 
-    /* фаза */
-    static uint32_t phase = 0;
+    return pit_get_gate(s->pit, 2) | (s->data_on << 1) | s->dummy_refresh_clock | out;
+}
 
-    /* phase increment в fixed-point 32.32 */
-    uint64_t inc = ((uint64_t)freq << 32) / PCSPK_SAMPLE_RATE;
-    phase += inc;
+void pcspk_ioport_write(void *opaque, uint32_t val)
+{
+    PCSpkState *s = opaque;
+    const int gate = val & 1;
+    const int data_on = (val >> 1) & 1;
 
-    /* квадратная волна */
-    return (phase & 0x80000000) ? 1 : 0;
+    if (gate == pit_get_gate(s->pit, 2) && data_on == s->data_on)
+        return;
+    s->data_on = data_on;
+    pit_set_gate(s->pit, 2, gate);
+    pcspk_event(s, 0);
 }
@@ -3,12 +3,15 @@
 
 #include <stdint.h>
 #include "i8254.h"
+
+#define PCSPK_AMPLITUDE 16384   /* peak-to-peak output level */
+
 typedef struct PCSpkState PCSpkState;
 PCSpkState *pcspk_init(PITState *pit);
-void pcspk_callback(void *opaque, uint8_t *stream, int free);
 uint32_t pcspk_ioport_read(void *opaque);
 void pcspk_ioport_write(void *opaque, uint32_t val);
-int pcspk_get_active_out(PCSpkState *s);
-int16_t pcspk_sample(PCSpkState *s);
+/* add n band-limited samples ending at get_uticks() time 'now' to buf;
+ * when !enabled the queued changes are still consumed, buf is untouched */
+void pcspk_render(PCSpkState *s, int32_t *buf, int n, uint32_t now, int enabled);
 
 #endif /* PCSPK_H */
@@ -114,13 +114,19 @@ struct SB16State {
     int dma_running;
     int bytes_per_second;
     int align;
-    int audio_free;
 #define AUDIO_BUF_LEN 4096
     uint8_t audio_buf[AUDIO_BUF_LEN];
     unsigned int audio_p, audio_q;
     void *voice;
     int active_out;
 
+    /* resampler, owned by the audio core: the output sits rs_frac (Q16)
+     * of the way from input frame rs_prev to rs_next */
+    uint32_t rs_frac;
+    int32_t rs_prev[2];
+    int32_t rs_next[2];
+    volatile int rs_reset;  /* set by a DSP reset, cleared by the audio core */
+
 //    QEMUTimer *aux_ts;
     /* mixer state */
     int mixer_nreg;
@@ -917,6 +923,7 @@ static void reset (SB16State *s)
     dsp_out_data (s, 0xaa);
     speaker (s, 0);
     control (s, 0);
+    s->rs_reset = 1;
     legacy_reset (s);
 }
 
@@ -1243,10 +1250,8 @@ static int write_audio (SB16State *s, int nchan, int dma_pos,
         net += copied;
 
         if (!copied) {
-#if defined(RP2350_BUILD) || defined(BUILD_ESP32)
             // Buffer full: release DREQ to stop DMA spinning
             i8257_dma_release_DREQ(isa_dma, nchan);
-#endif
             break;
         }
     }
@@ -1269,20 +1274,9 @@ static int SB_read_DMA (void *opaque, int nchan, int dma_pos, int dma_len)
         s->left_till_irq = s->block_size;
     }
 
-    if (s->voice) {
-        // RP2350/ESP32: Ignore audio_free, fill buffer as much as possible
-#if !defined(RP2350_BUILD) && !defined(BUILD_ESP32)
-        free = s->audio_free & ~s->align;
-        if ((free <= 0) || !dma_len) {
-            return dma_pos;
-        }
-#else
-        free = dma_len;
-#endif
-    }
-    else {
-        free = dma_len;
-    }
+    /* The mixer drains audio_buf at its own pace; write_audio copies what
+     * fits and releases DREQ once the buffer is full. */
+    free = dma_len;
 
     copy = free;
     till = s->left_till_irq;
@@ -1324,234 +1318,6 @@ static int SB_read_DMA (void *opaque, int nchan, int dma_pos, int dma_len)
     return dma_pos;
 }
 
-static int gcd(int a, int b)
-{
-    while (b != 0) {
-        int temp = b;
-        b = a % b;
-        a = temp;
-    }
-    return a;
-}
-
-// Optimized Resamplers using fixed-point stepping (eliminates large loops for dirty frequencies)
-
-static int resample_s16m(int16_t *out, int olen, int os,
-                         int16_t *in, int ip, int ilen, int itlen, int is)
-{
-    // Mono Input -> Stereo Output
-    // olen: output buffer size in int16_t (pairs)
-    // ilen: input buffer size in int16_t (samples)
-    
-    // Safety check: avoid divide by zero
-    if (os <= 0) return 0;
-    
-    uint64_t step = ((uint64_t)is << 32) / os;
-    uint64_t pos = 0;
-    int j = 0;
-    
-    while (j + 1 < olen) {
-        int input_idx = pos >> 32;
-        if (input_idx >= ilen) break;
-        
-        int16_t val = in[(ip + input_idx) % itlen];
-        out[j++] = val;
-        out[j++] = val;
-        
-        pos += step;
-    }
-    return pos >> 32;
-}
-
-static int resample_s16s(int16_t *out, int olen, int os,
-                         int16_t *in, int ip, int ilen, int itlen, int is)
-{
-    // Stereo Input -> Stereo Output
-    // ilen: input buffer size in int16_t (samples, L+R interleave)
-    // itlen: total buffer size in int16_t
-
-    if (os <= 0) return 0;
-    
-    uint64_t step = ((uint64_t)is << 32) / os;
-    uint64_t pos = 0;
-    int j = 0;
-    
-    while (j + 1 < olen) {
-        int input_idx = (pos >> 32) * 2; // Pairs
-        if (input_idx + 1 >= ilen) break;
-        
-        out[j++] = in[(ip + input_idx) % itlen];
-        out[j++] = in[(ip + input_idx + 1) % itlen];
-        
-        pos += step;
-    }
-    return (pos >> 32) * 2;
-}
-
-static int resample_u16m(int16_t *out, int olen, int os,
-                         int16_t *in, int ip, int ilen, int itlen, int is)
-{
-    // U16 Mono -> Stereo
-    if (os <= 0) return 0;
-    
-    uint64_t step = ((uint64_t)is << 32) / os;
-    uint64_t pos = 0;
-    int j = 0;
-    
-    while (j + 1 < olen) {
-        int input_idx = pos >> 32;
-        if (input_idx >= ilen) break;
-        
-        int16_t val = in[(ip + input_idx) % itlen] - 32768;
-        out[j++] = val;
-        out[j++] = val;
-        
-        pos += step;
-    }
-    return pos >> 32;
-}
-
-static int resample_u16s(int16_t *out, int olen, int os,
-                         int16_t *in, int ip, int ilen, int itlen, int is)
-{
-    // U16 Stereo -> Stereo
-    if (os <= 0) return 0;
-    
-    uint64_t step = ((uint64_t)is << 32) / os;
-    uint64_t pos = 0;
-    int j = 0;
-    
-    while (j + 1 < olen) {
-        int input_idx = (pos >> 32) * 2;
-        if (input_idx + 1 >= ilen) break;
-        
-        out[j++] = in[(ip + input_idx) % itlen] - 32768;
-        out[j++] = in[(ip + input_idx + 1) % itlen] - 32768;
-        
-        pos += step;
-    }
-    return (pos >> 32) * 2;
-}
-
-static int resample_u8m(int16_t *out, int olen, int os,
-                        uint8_t *in, int ip, int ilen, int itlen, int is)
-{
-    // U8 Mono -> Stereo
-    if (os <= 0) return 0;
-
-    uint64_t step = ((uint64_t)is << 32) / os;
-    uint64_t pos = 0;
-    int j = 0;
-
-    while (j + 1 < olen) {
-        int input_idx = pos >> 32;
-        if (input_idx >= ilen) break;
-
-        uint8_t d = in[(ip + input_idx) % itlen];
-        int16_t sample = (int16_t)(d - 128) << 8;
-        out[j++] = sample;
-        out[j++] = sample;
-
-        pos += step;
-    }
-    return pos >> 32;
-}
-
-static int resample_u8s(int16_t *out, int olen, int os,
-                        uint8_t *in, int ip, int ilen, int itlen, int is)
-{
-    // U8 Stereo -> Stereo
-    if (os <= 0) return 0;
-
-    uint64_t step = ((uint64_t)is << 32) / os;
-    uint64_t pos = 0;
-    int j = 0;
-
-    while (j + 1 < olen) {
-        int input_idx = (pos >> 32) * 2;
-        if (input_idx + 1 >= ilen) break;
-
-        uint8_t d1 = in[(ip + input_idx) % itlen];
-        uint8_t d2 = in[(ip + input_idx + 1) % itlen];
-        
-        out[j++] = (int16_t)(d1 - 128) << 8;
-        out[j++] = (int16_t)(d2 - 128) << 8;
-
-        pos += step;
-    }
-    return (pos >> 32) * 2;
-}
-
-void sb16_audio_callback (void *opaque, uint8_t *stream, int free)
-{
-    SB16State *s = opaque;
-    s->audio_free = free;
-
-    // Continue playing if buffer has data, even if DMA (active_out) has stopped
-    if (!s->active_out && s->audio_q == s->audio_p)
-        return;
-
-    unsigned int len = s->audio_q - s->audio_p;
-    if (len > AUDIO_BUF_LEN) {
-        s->audio_p = s->audio_q;
-        return;
-    }
-
-    unsigned int p = s->audio_p % AUDIO_BUF_LEN;
-
-    int i;
-    switch (s->fmt) {
-    case AUDIO_FORMAT_S16:
-        if (s->fmt_stereo) {
-            i = resample_s16s((int16_t *) stream, free / 2, SOUND_FREQUENCY,
-                              (int16_t *) s->audio_buf, p / 2, len / 2,
-                              AUDIO_BUF_LEN / 2, s->freq);
-        } else {
-            i = resample_s16m((int16_t *) stream, free / 2, SOUND_FREQUENCY,
-                              (int16_t *) s->audio_buf, p / 2, len / 2,
-                              AUDIO_BUF_LEN / 2, s->freq);
-        }
-        i *= 2;
-        s->audio_p += i;
-        break;
-    case AUDIO_FORMAT_U16:
-        if (s->fmt_stereo) {
-            i = resample_u16s((int16_t *) stream, free / 2, 44100,
-                              (int16_t *) s->audio_buf, p / 2, len / 2,
-                              AUDIO_BUF_LEN / 2, s->freq);
-        } else {
-            i = resample_u16m((int16_t *) stream, free / 2, 44100,
-                              (int16_t *) s->audio_buf, p / 2, len / 2,
-                              AUDIO_BUF_LEN / 2, s->freq);
-        }
-        i *= 2;
-        s->audio_p += i;
-        break;
-    case AUDIO_FORMAT_U8:
-        if (s->fmt_stereo) {
-            i = resample_u8s((int16_t *) stream, free / 2, 44100,
-                             s->audio_buf, p, len, AUDIO_BUF_LEN, s->freq);
-        } else {
-            i = resample_u8m((int16_t *) stream, free / 2, 44100,
-                             s->audio_buf, p, len, AUDIO_BUF_LEN, s->freq);
-        }
-        s->audio_p += i;
-        break;
-    default:
-        dolog("bad format %d\n", s->fmt);
-        s->audio_p = s->audio_q;
-    }
-
-#if defined(RP2350_BUILD) || defined(BUILD_ESP32)
-        // Buffer space available: re-assert DREQ if DMA is active
-        if (s->dma_running) {
-            int dma = s->use_hdma ? s->hdma : s->dma;
-            IsaDma *isa_dma = s->use_hdma ? s->isa_hdma : s->isa_dma;
-            i8257_dma_hold_DREQ(isa_dma, dma);
-        }
-#endif
-}
-
 #if 0
 static int sb16_post_load (void *opaque, int version_id)
 {
@@ -1632,59 +1398,149 @@ SB16State *sb16_new(
     return s;
 }
 
-// call sb16_getsample 44100 times per second
-void __not_in_flash_func(sb16_getsample)(SB16State *s, int* r_v, int* l_v) {
-    if (!s->active_out && s->audio_q == s->audio_p)
-        return;
+/*
+ * Resampler: the DSP rate is converted to SOUND_FREQUENCY by linear
+ * interpolation between consecutive input frames, position kept in Q16.
+ * sb16_resample is instantiated once per sample format and channel count,
+ * so the decode below folds to a couple of loads and the per-frame loop
+ * carries no format branches.
+ */
+#define RS_FRAC_BITS 16
+#define RS_FRAC_ONE (1u << RS_FRAC_BITS)
 
-    unsigned int len = s->audio_q - s->audio_p;
-    if (len > AUDIO_BUF_LEN) {
-        s->audio_p = s->audio_q;
-        return;
-    }
+/* 16-bit sample at ring offset p; DMA may leave p odd, so the two bytes
+ * are fetched separately and the high one wraps with the ring */
+static __always_inline uint16_t sb16_word(const uint8_t *buf, unsigned int p)
+{
+    return buf[p % AUDIO_BUF_LEN] | (buf[(p + 1) % AUDIO_BUF_LEN] << 8);
+}
 
-    static uint32_t phase = 0;
-    uint32_t step = ((uint32_t)s->freq << 16) / 44100;
+static __always_inline void sb16_fetch(const uint8_t *buf, unsigned int p,
+                                       const int fmt, const int stereo,
+                                       int32_t *l, int32_t *r)
+{
+    const unsigned int p0 = p % AUDIO_BUF_LEN;
+    const unsigned int p1 = (p + 1) % AUDIO_BUF_LEN;
 
-    int frame_size = s->fmt_stereo ?
-        (s->fmt == AUDIO_FORMAT_U8 || s->fmt == AUDIO_FORMAT_S8 ? 2 : 4) :
-        (s->fmt == AUDIO_FORMAT_U8 || s->fmt == AUDIO_FORMAT_S8 ? 1 : 2);
+    switch (fmt) {
+    case AUDIO_FORMAT_S16:
+        *l = (int16_t)sb16_word(buf, p);
+        *r = stereo ? (int16_t)sb16_word(buf, p + 2) : *l;
+        break;
+    case AUDIO_FORMAT_U16:
+        *l = (int32_t)sb16_word(buf, p) - 32768;
+        *r = stereo ? (int32_t)sb16_word(buf, p + 2) - 32768 : *l;
+        break;
+    case AUDIO_FORMAT_U8:
+        *l = ((int32_t)buf[p0] - 128) << 8;
+        *r = stereo ? ((int32_t)buf[p1] - 128) << 8 : *l;
+        break;
+    case AUDIO_FORMAT_S8:
+        *l = (int32_t)(int8_t)buf[p0] << 8;
+        *r = stereo ? (int32_t)(int8_t)buf[p1] << 8 : *l;
+        break;
+    }
+}
 
-    phase += step;
-    int advance = (phase >> 16) * frame_size;
-    phase &= 0xffff;
+/* returns the number of input frames consumed */
+static __always_inline unsigned int sb16_resample(SB16State *s,
+                                                  int32_t *l_v, int32_t *r_v, int n,
+                                                  const int fmt, const int stereo)
+{
+    const unsigned int frame =
+        ((fmt == AUDIO_FORMAT_U16 || fmt == AUDIO_FORMAT_S16) ? 2 : 1) << stereo;
+    const uint32_t step = ((uint32_t)s->freq << RS_FRAC_BITS) / SOUND_FREQUENCY;
+    const uint8_t *buf = s->audio_buf;
+    unsigned int p = s->audio_p;
+    unsigned int avail = (s->audio_q - p) / frame;
+    unsigned int used = 0;
+    uint32_t frac = s->rs_frac;
+    int32_t l0 = s->rs_prev[0], r0 = s->rs_prev[1];
+    int32_t l1 = s->rs_next[0], r1 = s->rs_next[1];
+    int i;
 
-    if (advance > (int)len) advance = len;
-    s->audio_p += advance;
+    for (i = 0; i < n; i++) {
+        while (frac >= RS_FRAC_ONE) {
+            frac -= RS_FRAC_ONE;
+            l0 = l1;
+            r0 = r1;
+            if (used < avail) {
+                sb16_fetch(buf, p, fmt, stereo, &l1, &r1);
+                p += frame;
+                used++;
+            } else if (!s->active_out) {
+                /* drained: rest from silence next time */
+                l0 = r0 = l1 = r1 = 0;
+                frac = 0;
+                goto out;
+            }
+        }
+        /* Q15 weight keeps (x1 - x0) * w within 32 bits */
+        const int32_t w = frac >> 1;
+        const int32_t l = l0 + (((l1 - l0) * w) >> 15);
+        l_v[i] += l;
+        r_v[i] += stereo ? r0 + (((r1 - r0) * w) >> 15) : l;
+        frac += step;
+    }
+out:
+    s->audio_p = p;
+    s->rs_frac = frac;
+    s->rs_prev[0] = l0;
+    s->rs_prev[1] = r0;
+    s->rs_next[0] = l1;
+    s->rs_next[1] = r1;
+    return used;
+}
+
+// called from the audio mixer on core1 with one block at a time
+void __not_in_flash_func(sb16_render)(SB16State *s, int32_t *l_v, int32_t *r_v, int n) {
+    const int stopped = !s->active_out && s->audio_q == s->audio_p;
+    if (stopped || s->rs_reset) {
+        /* the next stream starts from silence, not from where this one
+         * left the interpolator */
+        s->rs_reset = 0;
+        s->rs_frac = 0;
+        s->rs_prev[0] = s->rs_prev[1] = 0;
+        s->rs_next[0] = s->rs_next[1] = 0;
+        if (stopped)
+            return;
+    }
 
-    unsigned int p = s->audio_p % AUDIO_BUF_LEN;
-    int16_t l = 0, r = 0;
+    if (s->audio_q - s->audio_p > AUDIO_BUF_LEN) {
+        s->audio_p = s->audio_q;
+        return;
+    }
+    if (!s->freq)
+        return;
 
+    unsigned int used;
     switch (s->fmt) {
-    case AUDIO_FORMAT_S16:
-        l = *(int16_t *)(s->audio_buf + p);
-        r = s->fmt_stereo ? *(int16_t *)(s->audio_buf + (p + 2) % AUDIO_BUF_LEN) : l;
-        break;
-    case AUDIO_FORMAT_U16:
-        l = *(int16_t *)(s->audio_buf + p) - 32768;
-        r = s->fmt_stereo ? *(int16_t *)(s->audio_buf + (p + 2) % AUDIO_BUF_LEN) - 32768 : l;
-        break;
     case AUDIO_FORMAT_U8:
-        l = (int16_t)(s->audio_buf[p] - 128) << 8;
-        r = s->fmt_stereo ? (int16_t)(s->audio_buf[(p + 1) % AUDIO_BUF_LEN] - 128) << 8 : l;
+        used = s->fmt_stereo ? sb16_resample(s, l_v, r_v, n, AUDIO_FORMAT_U8, 1)
+                             : sb16_resample(s, l_v, r_v, n, AUDIO_FORMAT_U8, 0);
         break;
     case AUDIO_FORMAT_S8:
-        l = (int16_t)(int8_t)s->audio_buf[p] << 8;
-        r = s->fmt_stereo ? (int16_t)(int8_t)s->audio_buf[(p + 1) % AUDIO_BUF_LEN] << 8 : l;
+        used = s->fmt_stereo ? sb16_resample(s, l_v, r_v, n, AUDIO_FORMAT_S8, 1)
+                             : sb16_resample(s, l_v, r_v, n, AUDIO_FORMAT_S8, 0);
+        break;
+    case AUDIO_FORMAT_U16:
+        used = s->fmt_stereo ? sb16_resample(s, l_v, r_v, n, AUDIO_FORMAT_U16, 1)
+                             : sb16_resample(s, l_v, r_v, n, AUDIO_FORMAT_U16, 0);
         break;
+    case AUDIO_FORMAT_S16:
+        used = s->fmt_stereo ? sb16_resample(s, l_v, r_v, n, AUDIO_FORMAT_S16, 1)
+                             : sb16_resample(s, l_v, r_v, n, AUDIO_FORMAT_S16, 0);
+        break;
+    default:
+        dolog("bad format %d\n", s->fmt);
+        s->audio_p = s->audio_q;
+        return;
     }
 
-    if (s->dma_running) {
+    // buffer space available: re-assert DREQ if DMA is active
+    if (used && s->dma_running) {
         int dma = s->use_hdma ? s->hdma : s->dma;
         IsaDma *isa_dma = s->use_hdma ? s->isa_hdma : s->isa_dma;
         i8257_dma_hold_DREQ(isa_dma, dma);
     }
-
-    *l_v += l;
-    *r_v += r;
 }
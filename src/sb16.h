@@ -9,7 +9,6 @@ void sb16_dsp_write(void *opaque, uint32_t nport, uint32_t val);
 uint32_t sb16_mixer_read(void *opaque, uint32_t nport);
 void sb16_mixer_write_indexb(void *opaque, uint32_t nport, uint32_t val);
 void sb16_mixer_write_datab(void *opaque, uint32_t nport, uint32_t val);
-void sb16_audio_callback (void *opaque, uint8_t *stream, int free);
 
 SB16State *sb16_new(
     int port, // 0x220
@@ -19,6 +18,7 @@ SB16State *sb16_new(
     void *pic,
     void (*set_irq)(void *pic, int irq, int level));
 
-void sb16_getsample(SB16State *s, int* r_v, int* l_v);
+/* add n output samples to the left/right accumulators (audio mixer) */
+void sb16_render(SB16State *s, int32_t *l_v, int32_t *r_v, int n);
 
 #endif /* SB16_H */
@@ -0,0 +1,51 @@
+/**
+ * frank-386 - i386 PC Emulator for RP2350
+ *
+ * Device event scheduler. With a handful of events a linear scan beats a
+ * heap; the cached earliest deadline makes the common "nothing due" case a
+ * single compare per CPU burst.
+ *
+ * Copyright (c) 2026 Mikhail Matveev <xtreme@rh1.tech>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <assert.h>
+#include <string.h>
+#include <pico.h>
+
+#include "sched.h"
+
+void sched_init(Scheduler *s, uint32_t now) {
+    memset(s, 0, sizeof(*s));
+    s->next = now;
+}
+
+int sched_add(Scheduler *s, SchedFunc *fn, void *opaque, uint32_t deadline) {
+    assert(s->count < SCHED_MAX_EVENTS);
+    int id = s->count++;
+    s->ev[id].fn = fn;
+    s->ev[id].opaque = opaque;
+    s->ev[id].deadline = deadline;
+    if (id == 0 || !sched_after_eq(deadline, s->next))
+        s->next = deadline;
+    return id;
+}
+
+uint32_t __not_in_flash_func(sched_run)(Scheduler *s, uint32_t now) {
+    if (!sched_after_eq(now, s->next))
+        return s->next;
+
+    for (int i = 0; i < s->count; i++) {
+        SchedEvent *e = &s->ev[i];
+        if (sched_after_eq(now, e->deadline))
+            e->deadline = e->fn(e->opaque, now);
+    }
+    /* second pass: a device may have kicked an event already visited */
+    uint32_t next = s->ev[0].deadline;
+    for (int i = 1; i < s->count; i++) {
+        if (!sched_after_eq(s->ev[i].deadline, next))
+            next = s->ev[i].deadline;
+    }
+    s->next = next;
+    return next;
+}
@@ -0,0 +1,59 @@
+/**
+ * frank-386 - i386 PC Emulator for RP2350
+ *
+ * Device event scheduler. Each timed device (PIT, RTC, keyboard, FDC, VGA
+ * retrace, IDE write-back) is an event with a deadline on the microsecond
+ * clock; pc_step runs only the events that are due and sizes the next CPU
+ * burst to the nearest deadline.
+ *
+ * Copyright (c) 2026 Mikhail Matveev <xtreme@rh1.tech>
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdint.h>
+
+#define SCHED_MAX_EVENTS 8
+
+/// Runs a device that is due and returns its next deadline
+typedef uint32_t SchedFunc(void *opaque, uint32_t now);
+
+typedef struct {
+    SchedFunc *fn;
+    void *opaque;
+    uint32_t deadline;
+} SchedEvent;
+
+typedef struct {
+    SchedEvent ev[SCHED_MAX_EVENTS];
+    int count;
+    uint32_t next;          ///< earliest deadline over all events
+} Scheduler;
+
+/// Wrap-safe "a is at or after b" on the 32-bit microsecond clock
+static inline int sched_after_eq(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) >= 0;
+}
+
+void sched_init(Scheduler *s, uint32_t now);
+
+/// Register an event, first due at deadline; returns its id
+int sched_add(Scheduler *s, SchedFunc *fn, void *opaque, uint32_t deadline);
+
+/// Run every due event; returns the earliest remaining deadline
+uint32_t sched_run(Scheduler *s, uint32_t now);
+
+/**
+ * Pull an event's deadline forward to 'when', e.g. after the guest
+ * reprogrammed the device. Deadlines only move later by running the event.
+ */
+static inline void sched_kick(Scheduler *s, int id, uint32_t when) {
+    if (!sched_after_eq(when, s->ev[id].deadline))
+        s->ev[id].deadline = when;
+    if (!sched_after_eq(when, s->next))
+        s->next = when;
+}
+
+#endif /* SCHED_H */
@@ -122,49 +122,51 @@ void sn76489_out(const uint16_t register_value) {
     }
 }
 
-int16_t __not_in_flash_func(sn76489_sample)(void) {
-    master_counter += clock_increment_base;
-    const uint32_t clock_cycles = master_counter >> GETA_BITS;
-    master_counter &= (1 << GETA_BITS) - 1;
-
-    int32_t mixed_sample = 0; // Accumulate all channels here
-
-    /* Noise */
-    noise_counter += clock_cycles;
-    if (noise_counter & 0x400) {
-        if (noise_type_mode) /* White */
-            noise_lfsr_seed = (noise_lfsr_seed >> 1) | (noise_parity_lookup[noise_lfsr_seed & 0x0009] << 15);
-        else /* Periodic */
-            noise_lfsr_seed = (noise_lfsr_seed >> 1) | ((noise_lfsr_seed & 1) << 15);
-
-        if (noise_uses_tone2_freq)
-            noise_counter -= tone_frequency[2];
-        else
-            noise_counter -= noise_frequency;
-    }
+void __not_in_flash_func(sn76489_render)(int32_t *__restrict buf, int n) {
+    for (int i = 0; i < n; i++) {
+        master_counter += clock_increment_base;
+        const uint32_t clock_cycles = master_counter >> GETA_BITS;
+        master_counter &= (1 << GETA_BITS) - 1;
+
+        int32_t mixed_sample = 0; // Accumulate all channels here
+
+        /* Noise */
+        noise_counter += clock_cycles;
+        if (noise_counter & 0x400) {
+            if (noise_type_mode) /* White */
+                noise_lfsr_seed = (noise_lfsr_seed >> 1) | (noise_parity_lookup[noise_lfsr_seed & 0x0009] << 15);
+            else /* Periodic */
+                noise_lfsr_seed = (noise_lfsr_seed >> 1) | ((noise_lfsr_seed & 1) << 15);
+
+            if (noise_uses_tone2_freq)
+                noise_counter -= tone_frequency[2];
+            else
+                noise_counter -= noise_frequency;
+        }
 
-    if (noise_lfsr_seed & 1) {
-        mixed_sample += volume_table_scaled[noise_volume];
-    }
+        if (noise_lfsr_seed & 1) {
+            mixed_sample += volume_table_scaled[noise_volume];
+        }
 
-    /* Tone */
+        /* Tone */
 #pragma GCC unroll(4)
-    for (int channel_index = 0; channel_index < 3; channel_index++) {
-        tone_counter[channel_index] += clock_cycles;
-        if (tone_counter[channel_index] & 0x400) {
-            if (tone_frequency[channel_index] > 1) {
-                tone_output_state[channel_index] = !tone_output_state[channel_index];
-                tone_counter[channel_index] -= tone_frequency[channel_index];
-            } else {
-                tone_output_state[channel_index] = 1;
+        for (int channel_index = 0; channel_index < 3; channel_index++) {
+            tone_counter[channel_index] += clock_cycles;
+            if (tone_counter[channel_index] & 0x400) {
+                if (tone_frequency[channel_index] > 1) {
+                    tone_output_state[channel_index] = !tone_output_state[channel_index];
+                    tone_counter[channel_index] -= tone_frequency[channel_index];
+                } else {
+                    tone_output_state[channel_index] = 1;
+                }
             }
-        }
 
-        if (tone_output_state[channel_index] && !channel_mute[channel_index]) {
-            mixed_sample += volume_table_scaled[tone_volume[channel_index]];
+            if (tone_output_state[channel_index] && !channel_mute[channel_index]) {
+                mixed_sample += volume_table_scaled[tone_volume[channel_index]];
+            }
         }
-    }
 
-    // Final mixing and scaling (single operation instead of per-channel)
-    return (int16_t) (mixed_sample >> 2); // Divide by 4 for proper scaling
+        // Final mixing and scaling (single operation instead of per-channel)
+        buf[i] += (int16_t) (mixed_sample >> 2); // Divide by 4 for proper scaling
+    }
 }
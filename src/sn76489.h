@@ -14,6 +14,7 @@
 
 void sn76489_reset(void);
 void sn76489_out(const uint16_t register_value);
-int16_t sn76489_sample(void);
+/// Add n samples of the mono output to buf
+void sn76489_render(int32_t *buf, int n);
 
 #endif /* SN76489_H */
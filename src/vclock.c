@@ -0,0 +1,53 @@
+/**
+ * frank-386 - i386 PC Emulator for RP2350
+ *
+ * Emulated time base, see vclock.h.
+ *
+ * Copyright (c) 2026 Mikhail Matveev <xtreme@rh1.tech>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <pico.h>
+
+#include "vclock.h"
+#include "i386.h"
+
+VClock vclock;
+
+uint32_t __not_in_flash_func(vclock_read)(void) {
+    long cycle = cpui386_get_cycle(vclock.cpu);
+    uint32_t n = (uint32_t)(cycle - vclock.last_cycle) + vclock.rem;
+    vclock.last_cycle = cycle;
+    vclock.now += n / vclock.ipus;
+    vclock.rem = n % vclock.ipus;
+    if (vclock.catchup) {
+        uint32_t host = get_uticks() - vclock.host_base;
+        if ((int32_t)(host - vclock.now) > 0)
+            vclock.now = host;
+    }
+    return vclock.now;
+}
+
+void vclock_use_host(void) {
+    vclock.cpu = NULL;
+}
+
+void vclock_use_instructions(struct CPUI386 *cpu, uint32_t mhz, int catchup) {
+    vclock.now = 0;
+    vclock.host_base = get_uticks();
+    vclock.ipus = mhz ? mhz : 1;
+    vclock.catchup = catchup;
+    vclock.last_cycle = cpui386_get_cycle(cpu);
+    vclock.rem = 0;
+    vclock.cpu = cpu;
+}
+
+void vclock_idle_until(uint32_t when) {
+    if (!vclock.cpu)
+        return;
+    vclock_read();
+    if ((int32_t)(when - vclock.now) > 0) {
+        vclock.now = when;
+        vclock.rem = 0;
+    }
+}
@@ -0,0 +1,66 @@
+/**
+ * frank-386 - i386 PC Emulator for RP2350
+ *
+ * Emulated time base. Devices read emu_uticks() instead of the platform
+ * get_uticks(). By default the two are the same; in instruction-count mode
+ * emulated time advances from the CPU's retired instruction count at a fixed
+ * effective clock, so guest timing no longer depends on host speed and runs
+ * are reproducible.
+ *
+ * Copyright (c) 2026 Mikhail Matveev <xtreme@rh1.tech>
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef VCLOCK_H
+#define VCLOCK_H
+
+#include <stdint.h>
+
+struct CPUI386;
+
+uint32_t get_uticks();
+
+typedef struct {
+    struct CPUI386 *cpu;    ///< NULL: emulated time is host time
+    uint32_t ipus;          ///< instructions per emulated microsecond (MHz)
+    int catchup;            ///< never fall behind the host clock
+    long last_cycle;
+    uint32_t rem;           ///< retired instructions not yet a full microsecond
+    uint32_t now;           ///< emulated microseconds since selection
+    uint32_t host_base;     ///< get_uticks() at selection, for catch-up
+} VClock;
+
+extern VClock vclock;
+
+uint32_t vclock_read(void);
+
+/// Current emulated time in microseconds (wraps like get_uticks)
+static inline uint32_t emu_uticks(void) {
+    return vclock.cpu ? vclock_read() : get_uticks();
+}
+
+/**
+ * Emulated time for code on the other core (display drivers): the value
+ * the emulation core last published. Unlike emu_uticks() it does not
+ * advance the clock, which only the emulation core may do.
+ */
+static inline uint32_t emu_uticks_peek(void) {
+    return vclock.cpu ? *(volatile uint32_t *)&vclock.now : get_uticks();
+}
+
+/// Emulated time follows the host clock (default)
+void vclock_use_host(void);
+
+/**
+ * Emulated time follows cpu's instruction count at mhz instructions per
+ * microsecond, starting from zero. With catchup, time still jumps forward
+ * whenever the host clock is ahead, so a slow host keeps real-time guest
+ * clocks. Select before the devices are created: they keep deadlines on
+ * whichever clock was current.
+ */
+void vclock_use_instructions(struct CPUI386 *cpu, uint32_t mhz, int catchup);
+
+/// The CPU is halted: skip emulated time forward to the next device event
+void vclock_idle_until(uint32_t when);
+
+#endif /* VCLOCK_H */
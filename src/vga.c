@@ -33,6 +33,7 @@
 #include <assert.h>
 
 #include "vga.h"
+#include "vclock.h"
 #include "pci.h"
 
 #ifdef BUILD_ESP32
@@ -517,6 +518,8 @@ static void vbe_fixup_regs(VGAState *s)
     s->vbe_start_addr  = offset / 4;
 }
 
+static void vga_update_write_state(VGAState *s);
+
 static void vbe_update_vgaregs(VGAState *s)
 {
     int h, shift_control;
@@ -557,6 +560,7 @@ static void vbe_update_vgaregs(VGAState *s)
     s->gr[VGA_GFX_MODE] = (s->gr[VGA_GFX_MODE] & ~0x60) |
         (shift_control << 5);
     s->cr[VGA_CRTC_MAX_SCAN] &= ~0x9f; /* no double scan */
+    vga_update_write_state(s);
 }
 
 /* the text refresh is just for debugging and initial boot message, so
@@ -572,13 +576,13 @@ static void vga_text_refresh(VGAState *s,
     uint8_t *vga_ram, *dst;
     const uint8_t *font_ptr;
     uint32_t fgcol, bgcol, cursor_offset, cursor_start, cursor_end;
-    uint32_t now = get_uticks();
+    uint32_t now = emu_uticks();
     if (after_eq(now, s->cursor_blink_time)) {
         s->cursor_blink_time = now + 133333;
         s->cursor_visible_phase = !s->cursor_visible_phase;
     }
 
-    full_update = full_update || update_palette16(s, s->last_palette);
+    full_update |= update_palette16(s, s->last_palette);
 
     vga_ram = s->vga_ram;
 
@@ -794,6 +798,23 @@ static void vga_text_refresh(VGAState *s,
     redraw_func(opaque, 0, 0, fb_dev->width, fb_dev->height);
 }
 
+#ifdef VGA_DIRTY_TRACKING
+/* true if any VRAM byte in [addr, addr + len) was written since the last
+   refresh */
+static int vga_range_dirty(VGAState *s, uint32_t addr, uint32_t len)
+{
+    uint32_t page = (addr >> VGA_DIRTY_PAGE_BITS) & (VGA_DIRTY_PAGES - 1);
+    uint32_t last = ((addr + len - 1) >> VGA_DIRTY_PAGE_BITS) & (VGA_DIRTY_PAGES - 1);
+    for (;;) {
+        if (s->vram_dirty[page >> 5] & (1u << (page & 31)))
+            return 1;
+        if (page == last)
+            return 0;
+        page = (page + 1) & (VGA_DIRTY_PAGES - 1);
+    }
+}
+#endif
+
 static void vga_graphic_refresh(VGAState *s,
                                 SimpleFBDrawFunc *redraw_func, void *opaque,
                                 int full_update)
@@ -808,10 +829,11 @@ static void vga_graphic_refresh(VGAState *s,
     int shift_control = (s->gr[0x05] >> 5) & 3;
     int double_scan = (s->cr[0x09] >> 7);
     int multi_scan, multi_run;
-    if (shift_control != 1) {
+    if (shift_control != 1 && (s->cr[0x17] & 1)) {
         multi_scan = (((s->cr[0x09] & 0x1f) + 1) << double_scan) - 1;
     } else {
-        /* in CGA modes, multi_scan is ignored */
+        /* in CGA modes, and in planar modes with CGA addressing
+           (mode 6), multi_scan is ignored */
         /* XXX: is it correct ? */
         multi_scan = double_scan;
     }
@@ -830,30 +852,57 @@ static void vga_graphic_refresh(VGAState *s,
     }
     uint32_t addr1 = 4 * start_addr;
     uint8_t *vram = s->vga_ram;
+#ifdef VGA_DIRTY_TRACKING
+    uint32_t *palette = s->last_gfx_palette;
+#else
     uint32_t palette[256];
+#endif
     int xdiv = 1;
     int bpp = 4;
     if (shift_control == 0 || shift_control == 1) {
-        update_palette16(s, palette);
+        full_update |= update_palette16(s, palette);
         if (s->sr[0x01] & 8) {
+            /* half dot clock: each pixel is drawn twice */
             xdiv = 2;
-            if (shift_control == 1) // XXX
-                w *= 2;
+            w *= 2;
         }
     } else {
         if (!vbe_enabled(s)) {
-            update_palette256(s, palette);
+            full_update |= update_palette256(s, palette);
             xdiv = 2;
             bpp = 8;
         } else {
             bpp = s->vbe_regs[VBE_DISPI_INDEX_BPP];
             if (bpp == 8)
-                update_palette256(s, palette);
+                full_update |= update_palette256(s, palette);
         }
     }
 
+#ifdef VGA_DIRTY_TRACKING
+    /* clean lines are skipped unless the mode, the palette or the
+       position of the picture in VRAM changed */
+    uint32_t format = bpp | (shift_control << 8) | (xdiv << 10) |
+        (multi_scan << 12) | ((s->cr[0x17] & 0x43) << 20);
+    if (s->last_gfx_start != addr1 ||
+        s->last_gfx_line_offset != line_offset ||
+        s->last_gfx_width != w ||
+        s->last_gfx_height != h ||
+        s->last_gfx_format != format) {
+        s->last_gfx_start = addr1;
+        s->last_gfx_line_offset = line_offset;
+        s->last_gfx_width = w;
+        s->last_gfx_height = h;
+        s->last_gfx_format = format;
+        full_update = 1;
+    }
+#if defined(SCALE_3_2) || defined(SWAPXY)
+    full_update = 1;
+#endif
+#endif
+
     int y1 = 0;
     int i0 = 0;
+    int y0 = 0;
 #if defined(SCALE_3_2) || defined(SWAPXY)
 #ifdef SCALE_3_2
     int hx = fb_dev->height * 3 / 2;
@@ -891,15 +940,26 @@ static void vga_graphic_refresh(VGAState *s,
 #else
     int hx = fb_dev->height;
     int wx = fb_dev->width;
-    if (h < hx)
-        i0 += (hx - h) / 2 * fb_dev->stride;
-    else
+    if (h < hx) {
+        y0 = (hx - h) / 2;
+        i0 += y0 * fb_dev->stride;
+    } else {
         h = hx;
+    }
     if (w < wx)
         i0 += (wx - w) / 2 * (BPP / 8);
     else
         w = wx;
 #endif
+#ifdef VGA_DIRTY_TRACKING
+    /* VRAM bytes read for one line */
+    uint32_t span;
+    if (shift_control == 0 || shift_control == 1)
+        span = 4 * ((w / xdiv + 7) >> 3);
+    else
+        span = (w / xdiv) * ((bpp + 7) >> 3);
+#endif
+    int y_min = -1, y_max = -1;
     for (int y = 0; y < h; y++) {
         uint32_t addr = addr1;
         if (!(s->cr[0x17] & 1)) {
@@ -911,7 +971,16 @@ static void vga_graphic_refresh(VGAState *s,
         if (!(s->cr[0x17] & 2)) {
             addr = (addr & ~0x8000) | ((y1 & 2) << 14);
         }
-        for (int x = 0; x < w; x++) {
+        int draw = 1;
+#ifdef VGA_DIRTY_TRACKING
+        draw = full_update || (span && vga_range_dirty(s, addr, span));
+#endif
+        if (draw) {
+            if (y_min < 0)
+                y_min = y;
+            y_max = y;
+        }
+        for (int x = 0; draw && x < w; x++) {
             int x1 = x / xdiv;
             uint32_t color;
             if (shift_control == 0) {
@@ -1079,7 +1148,14 @@ static void vga_graphic_refresh(VGAState *s,
         }
 #endif
     }
+#if defined(SCALE_3_2) || defined(SWAPXY)
+    (void)y0;
+    (void)y_max;
     redraw_func(opaque, 0, 0, fb_dev->width, fb_dev->height);
+#else
+    if (y_min >= 0)
+        redraw_func(opaque, 0, y0 + y_min, fb_dev->width, y_max - y_min + 1);
+#endif
 }
 
 static void simplefb_clear(FBDevice *fb_dev,
@@ -1093,7 +1169,7 @@ static void simplefb_clear(FBDevice *fb_dev,
  * retrace bits toggle. Called from both vga_step() and vga_ioport_read(). */
 static int __not_in_flash_func(vga_update_retrace)(VGAState *s)
 {
-    uint32_t now = get_uticks();
+    uint32_t now = emu_uticks();
     int ret = 0;
     if (after_eq(now, s->retrace_time)) {
         if (s->retrace_phase == 0) {
@@ -1136,6 +1212,17 @@ int __not_in_flash_func(vga_step)(VGAState *s)
 #endif
 }
 
+/* when vga_step next has something to do */
+uint32_t vga_next_deadline(VGAState *s, uint32_t now)
+{
+#ifdef RP2350_BUILD
+    /* poll the ISR-driven st01 well within the ~1.4 ms vblank */
+    return now + 500;
+#else
+    return s->retrace_time;
+#endif
+}
+
 void __not_in_flash_func(vga_refresh)(VGAState *s,
                  SimpleFBDrawFunc *redraw_func, void *opaque, int full_update)
 {
@@ -1163,7 +1250,7 @@ void __not_in_flash_func(vga_refresh)(VGAState *s,
     if (graphic_mode != s->graphic_mode) {
         s->graphic_mode = graphic_mode;
         full_update = 1;
-        s->cursor_blink_time = get_uticks();
+        s->cursor_blink_time = emu_uticks();
 #ifndef RP2350_BUILD
         simplefb_clear(fb_dev, redraw_func, opaque);
 #endif
@@ -1181,6 +1268,9 @@ void __not_in_flash_func(vga_refresh)(VGAState *s,
     } else if (s->graphic_mode == 1) {
         vga_text_refresh(s, redraw_func, opaque, full_update);
     }
+#ifdef VGA_DIRTY_TRACKING
+    memset(s->vram_dirty, 0, sizeof(s->vram_dirty));
+#endif
 #endif
 }
 
@@ -1374,6 +1464,7 @@ void __not_in_flash_func(vga_ioport_write)(VGAState *s, uint32_t addr, uint32_t
         printf("vga: write SR%x = 0x%02x\n", s->sr_index, val);
 #endif
         s->sr[s->sr_index] = val & sr_mask[s->sr_index];
+        vga_update_write_state(s);
         break;
     case 0x3c7:
         s->dac_read_index = val;
@@ -1402,6 +1493,7 @@ void __not_in_flash_func(vga_ioport_write)(VGAState *s, uint32_t addr, uint32_t
         printf("vga: write GR%x = 0x%02x\n", s->gr_index, val);
 #endif
         s->gr[s->gr_index] = val & gr_mask[s->gr_index];
+        vga_update_write_state(s);
         break;
     case 0x3b4:
     case 0x3d4:
@@ -1479,8 +1571,10 @@ void vbe_write(VGAState *s, uint32_t offset, uint32_t val)
             vbe_update_vgaregs(s);
             /* clear the screen */
             if (!(val & VBE_DISPI_NOCLEARMEM)) {
-                memset(s->vga_ram, 0,
-                       s->vbe_regs[VBE_DISPI_INDEX_YRES] * s->vbe_line_offset);
+                uint32_t size = s->vbe_regs[VBE_DISPI_INDEX_YRES] * s->vbe_line_offset;
+                memset(s->vga_ram, 0, size);
+                if (size)
+                    vga_set_dirty(s, 0, size);
             }
             break;
         case VBE_DISPI_INDEX_XRES:
@@ -1609,177 +1703,321 @@ static const uint32_t mask16[16] __not_in_flash("mask16") = {
 
 //#define DEBUG_VGA_MEM
 //#define TARGET_FMT_plx "%x"
-void IRAM_ATTR vga_mem_write16(VGAState *s, uint32_t addr, uint16_t val16)
+
+/* wr_mode for write mode 0 with no rotate, set/reset, logical operation or
+   bit mask: the CPU byte is stored to every enabled plane */
+#define VGA_WR_STORE 4
+
+/* Recompute the planar write state; called whenever SR2 or one of the
+   graphics controller registers it depends on changes */
+static void vga_update_write_state(VGAState *s)
 {
-    if (!(s->sr[VGA_SEQ_MEMORY_MODE] & VGA_SR04_CHN_4M)) {
-        vga_mem_write(s, addr, val16);
-        vga_mem_write(s, addr + 1, val16 >> 8);
-        return;
-    }
-    uint32_t val = val16;
+    s->wr_mode = s->gr[VGA_GFX_MODE] & 3;
+    s->wr_rotate = s->gr[VGA_GFX_DATA_ROTATE] & 7;
+    s->wr_func = s->gr[VGA_GFX_DATA_ROTATE] >> 3;
+    s->wr_set_mask = mask16[s->gr[VGA_GFX_SR_ENABLE]];
+    s->wr_set_value = mask16[s->gr[VGA_GFX_SR_VALUE]];
+    s->wr_bit_mask = s->gr[VGA_GFX_BIT_MASK];
+    s->wr_plane_mask = mask16[s->sr[VGA_SEQ_PLANE_WRITE]];
+    if (s->wr_mode == 0 && !s->gr[VGA_GFX_DATA_ROTATE] &&
+        !s->gr[VGA_GFX_SR_ENABLE] && s->wr_bit_mask == 0xff)
+        s->wr_mode = VGA_WR_STORE;
+}
 
-    int memory_map_mode, plane, mask;
+/* convert a CPU address to a VGA memory offset; false if the memory map
+   does not decode it */
+static inline bool vga_map_addr(VGAState *s, uint32_t *paddr)
+{
+    uint32_t addr = *paddr & 0x1ffff;
 
-#ifdef DEBUG_VGA_MEM
-    printf("vga: [0x" TARGET_FMT_plx "] = 0x%02x\n", addr, val);
-#endif
-    /* convert to VGA memory offset */
-    memory_map_mode = (s->gr[VGA_GFX_MISC] >> 2) & 3;
-    addr &= 0x1ffff;
-    switch(memory_map_mode) {
+    switch((s->gr[VGA_GFX_MISC] >> 2) & 3) {
     case 0:
         break;
     case 1:
         if (addr >= 0x10000)
-            return;
+            return false;
         addr += s->bank_offset;
         break;
     case 2:
         addr -= 0x10000;
         if (addr >= 0x8000)
-            return;
+            return false;
         break;
     default:
     case 3:
         addr -= 0x18000;
         if (addr >= 0x8000)
-            return;
+            return false;
+        break;
+    }
+    *paddr = addr;
+    return true;
+}
+
+/* true if the len bytes at addr map to consecutive VGA memory offsets;
+   *paddr is set to the first one */
+static inline bool vga_map_range(VGAState *s, uint32_t *paddr, int len)
+{
+    uint32_t last = *paddr + len - 1;
+    return vga_map_addr(s, paddr) && vga_map_addr(s, &last) &&
+        last == *paddr + len - 1;
+}
+
+/* standard VGA latched access: one byte, all four planes at once */
+static inline void IRAM_ATTR vga_write_latched(VGAState *s, uint32_t addr,
+                                               uint32_t val)
+{
+    uint32_t bit_mask;
+    int b;
+
+    if (addr * sizeof(uint32_t) >= s->vga_ram_size) {
+        return;
+    }
+    switch(s->wr_mode) {
+    case VGA_WR_STORE:
+        val *= 0x01010101;
+        goto do_write;
+    default:
+    case 0:
+        /* rotate */
+        b = s->wr_rotate;
+        val = ((val >> b) | (val << (8 - b))) & 0xff;
+        val *= 0x01010101;
+
+        /* apply set/reset mask */
+        val = (val & ~s->wr_set_mask) | (s->wr_set_value & s->wr_set_mask);
+        bit_mask = s->wr_bit_mask;
+        break;
+    case 1:
+        val = s->latch;
+        goto do_write;
+    case 2:
+        val = mask16[val & 0x0f];
+        bit_mask = s->wr_bit_mask;
+        break;
+    case 3:
+        /* rotate */
+        b = s->wr_rotate;
+        val = (val >> b) | (val << (8 - b));
+
+        bit_mask = s->wr_bit_mask & val;
+        val = s->wr_set_value;
+        break;
+    }
+
+    /* apply logical operation */
+    switch(s->wr_func) {
+    case 0:
+    default:
+        /* nothing to do */
+        break;
+    case 1:
+        /* and */
+        val &= s->latch;
+        break;
+    case 2:
+        /* or */
+        val |= s->latch;
+        break;
+    case 3:
+        /* xor */
+        val ^= s->latch;
         break;
     }
 
+    /* apply bit mask */
+    bit_mask *= 0x01010101;
+    val = (val & bit_mask) | (s->latch & ~bit_mask);
+
+do_write:
+    /* mask data according to sr[2] */
+    ((uint32_t *)s->vga_ram)[addr] =
+        (((uint32_t *)s->vga_ram)[addr] & ~s->wr_plane_mask) |
+        (val & s->wr_plane_mask);
+#ifdef DEBUG_VGA_MEM
+    printf("vga: latch: [0x" TARGET_FMT_plx "] mask=0x%08x val=0x%08x\n",
+           addr * 4, s->wr_plane_mask, val);
+#endif
+    vga_set_dirty(s, addr << 2, sizeof(uint32_t));
+}
+
+/* odd/even and latched writes to VGA memory offset addr */
+static inline void IRAM_ATTR vga_write_unchained(VGAState *s, uint32_t addr,
+                                                 uint32_t val)
+{
+    int plane, mask;
+
+    if (s->gr[VGA_GFX_MODE] & 0x10) {
+        /* odd/even mode (aka text mode mapping) */
+        plane = (s->gr[VGA_GFX_PLANE_READ] & 2) | (addr & 1);
+        mask = (1 << plane);
+        if (s->sr[VGA_SEQ_PLANE_WRITE] & mask) {
+            addr = ((addr & ~1) << 1) | plane;
+            if (addr >= s->vga_ram_size) {
+                return;
+            }
+            s->vga_ram[addr] = val;
+#ifdef DEBUG_VGA_MEM
+            printf("vga: odd/even: [0x" TARGET_FMT_plx "]\n", addr);
+#endif
+//            s->plane_updated |= mask; /* only used to detect font change */
+            vga_set_dirty(s, addr, 1);
+        }
+    } else {
+        vga_write_latched(s, addr, val);
+    }
+}
+
+void IRAM_ATTR vga_mem_write16(VGAState *s, uint32_t addr, uint16_t val16)
+{
+    if (!(s->sr[VGA_SEQ_MEMORY_MODE] & VGA_SR04_CHN_4M)) {
+        uint32_t offset = addr;
+        if (vga_map_range(s, &offset, 2)) {
+            vga_write_unchained(s, offset, val16 & 0xff);
+            vga_write_unchained(s, offset + 1, val16 >> 8);
+        } else {
+            vga_mem_write(s, addr, val16);
+            vga_mem_write(s, addr + 1, val16 >> 8);
+        }
+        return;
+    }
+    uint32_t val = val16;
+
+    int plane, mask;
+
+#ifdef DEBUG_VGA_MEM
+    printf("vga: [0x" TARGET_FMT_plx "] = 0x%02x\n", addr, val);
+#endif
+    /* convert to VGA memory offset */
+    if (!vga_map_addr(s, &addr))
+        return;
+
     /* chain 4 mode : simplest access */
     plane = addr & 3;
     mask = (1 << plane);
     if (s->sr[VGA_SEQ_PLANE_WRITE] & mask) {
         * (uint16_t *) &(s->vga_ram[addr]) = val;
+        vga_set_dirty(s, addr, 2);
     }
 }
 
 void IRAM_ATTR vga_mem_write32(VGAState *s, uint32_t addr, uint32_t val)
 {
     if (!(s->sr[VGA_SEQ_MEMORY_MODE] & VGA_SR04_CHN_4M)) {
-        vga_mem_write(s, addr, val);
-        vga_mem_write(s, addr + 1, val >> 8);
-        vga_mem_write(s, addr + 2, val >> 16);
-        vga_mem_write(s, addr + 3, val >> 24);
+        uint32_t offset = addr;
+        if (vga_map_range(s, &offset, 4)) {
+            vga_write_unchained(s, offset, val & 0xff);
+            vga_write_unchained(s, offset + 1, (val >> 8) & 0xff);
+            vga_write_unchained(s, offset + 2, (val >> 16) & 0xff);
+            vga_write_unchained(s, offset + 3, val >> 24);
+        } else {
+            vga_mem_write(s, addr, val);
+            vga_mem_write(s, addr + 1, val >> 8);
+            vga_mem_write(s, addr + 2, val >> 16);
+            vga_mem_write(s, addr + 3, val >> 24);
+        }
         return;
     }
 
-    int memory_map_mode, plane, mask;
+    int plane, mask;
 
 #ifdef DEBUG_VGA_MEM
     printf("vga: [0x" TARGET_FMT_plx "] = 0x%02x\n", addr, val);
 #endif
     /* convert to VGA memory offset */
-    memory_map_mode = (s->gr[VGA_GFX_MISC] >> 2) & 3;
-    addr &= 0x1ffff;
-    switch(memory_map_mode) {
-    case 0:
-        break;
-    case 1:
-        if (addr >= 0x10000)
-            return;
-        addr += s->bank_offset;
-        break;
-    case 2:
-        addr -= 0x10000;
-        if (addr >= 0x8000)
-            return;
-        break;
-    default:
-    case 3:
-        addr -= 0x18000;
-        if (addr >= 0x8000)
-            return;
-        break;
-    }
+    if (!vga_map_addr(s, &addr))
+        return;
 
     /* chain 4 mode : simplest access */
     plane = addr & 3;
     mask = (1 << plane);
     if (s->sr[VGA_SEQ_PLANE_WRITE] & mask) {
         * (uint32_t *) &(s->vga_ram[addr]) = val;
+        vga_set_dirty(s, addr, 4);
     }
 }
 
 bool IRAM_ATTR vga_mem_write_string(VGAState *s, uint32_t addr, uint8_t *buf, int len)
 {
-    if (!(s->sr[VGA_SEQ_MEMORY_MODE] & VGA_SR04_CHN_4M)) {
-        return false;
-    }
-
-    int memory_map_mode, plane, mask;
+    int plane, mask;
 
 #ifdef DEBUG_VGA_MEM
     printf("vga: [0x" TARGET_FMT_plx "] = 0x%02x\n", addr, val);
 #endif
-    /* convert to VGA memory offset */
-    memory_map_mode = (s->gr[VGA_GFX_MISC] >> 2) & 3;
-    addr &= 0x1ffff;
-    switch(memory_map_mode) {
-    case 0:
-        break;
-    case 1:
-        if (addr >= 0x10000)
-            return false;
-        addr += s->bank_offset;
-        break;
-    case 2:
-        addr -= 0x10000;
-        if (addr >= 0x8000)
-            return false;
-        break;
-    default:
-    case 3:
-        addr -= 0x18000;
-        if (addr >= 0x8000)
+    if (!(s->sr[VGA_SEQ_MEMORY_MODE] & VGA_SR04_CHN_4M)) {
+        /* planar: REP MOVS from RAM, one byte per VGA address */
+        if (len <= 0 || !vga_map_range(s, &addr, len))
             return false;
-        break;
+        if (s->wr_mode == VGA_WR_STORE && s->wr_plane_mask == 0xffffffff &&
+            !(s->gr[VGA_GFX_MODE] & 0x10) &&
+            (addr + len) * sizeof(uint32_t) <= s->vga_ram_size) {
+            uint32_t *dst = (uint32_t *)s->vga_ram + addr;
+            for (int i = 0; i < len; i++)
+                dst[i] = buf[i] * 0x01010101u;
+            vga_set_dirty(s, addr << 2, len * sizeof(uint32_t));
+        } else {
+            for (int i = 0; i < len; i++)
+                vga_write_unchained(s, addr + i, buf[i]);
+        }
+        return true;
     }
 
+    /* convert to VGA memory offset */
+    if (!vga_map_addr(s, &addr))
+        return false;
+
     /* chain 4 mode : simplest access */
     plane = addr & 3;
     mask = (1 << plane);
     if (s->sr[VGA_SEQ_PLANE_WRITE] & mask) {
         memcpy(s->vga_ram + addr, buf, len);
+        vga_set_dirty(s, addr, len);
         return true;
     }
     return false;
 }
 
+bool IRAM_ATTR vga_mem_fill(VGAState *s, uint32_t addr, uint32_t val, int size, int count)
+{
+    int len = size * count;
+
+    /* planar only: REP STOS, one byte of val per VGA address */
+    if (s->sr[VGA_SEQ_MEMORY_MODE] & VGA_SR04_CHN_4M)
+        return false;
+    if (len <= 0 || !vga_map_range(s, &addr, len))
+        return false;
+    if (s->wr_mode == VGA_WR_STORE && s->wr_plane_mask == 0xffffffff &&
+        !(s->gr[VGA_GFX_MODE] & 0x10) &&
+        (addr + len) * sizeof(uint32_t) <= s->vga_ram_size) {
+        uint32_t *dst = (uint32_t *)s->vga_ram + addr;
+        if (size == 1) {
+            const uint32_t w = (val & 0xff) * 0x01010101u;
+            for (int i = 0; i < len; i++)
+                dst[i] = w;
+        } else {
+            for (int i = 0; i < len; i++)
+                dst[i] = ((val >> (8 * (i & (size - 1)))) & 0xff) * 0x01010101u;
+        }
+        vga_set_dirty(s, addr << 2, len * sizeof(uint32_t));
+    } else {
+        for (int i = 0; i < len; i++)
+            vga_write_unchained(s, addr + i, (val >> (8 * (i & (size - 1)))) & 0xff);
+    }
+    return true;
+}
+
 void IRAM_ATTR vga_mem_write(VGAState *s, uint32_t addr, uint8_t val8)
 {
     uint32_t val = val8;
 
-    int memory_map_mode, plane, write_mode, b, func_select, mask;
-    uint32_t write_mask, bit_mask, set_mask;
+    int plane, mask;
 
 #ifdef DEBUG_VGA_MEM
     printf("vga: [0x" TARGET_FMT_plx "] = 0x%02x\n", addr, val);
 #endif
     /* convert to VGA memory offset */
-    memory_map_mode = (s->gr[VGA_GFX_MISC] >> 2) & 3;
-    addr &= 0x1ffff;
-    switch(memory_map_mode) {
-    case 0:
-        break;
-    case 1:
-        if (addr >= 0x10000)
-            return;
-        addr += s->bank_offset;
-        break;
-    case 2:
-        addr -= 0x10000;
-        if (addr >= 0x8000)
-            return;
-        break;
-    default:
-    case 3:
-        addr -= 0x18000;
-        if (addr >= 0x8000)
-            return;
-        break;
-    }
+    if (!vga_map_addr(s, &addr))
+        return;
 
     if (s->sr[VGA_SEQ_MEMORY_MODE] & VGA_SR04_CHN_4M) {
         /* chain 4 mode : simplest access */
@@ -1791,101 +2029,10 @@ void IRAM_ATTR vga_mem_write(VGAState *s, uint32_t addr, uint8_t val8)
             printf("vga: chain4: [0x" TARGET_FMT_plx "]\n", addr);
 #endif
 //            s->plane_updated |= mask; /* only used to detect font change */
-//            memory_region_set_dirty(&s->vram, addr, 1);
-        }
-    } else if (s->gr[VGA_GFX_MODE] & 0x10) {
-        /* odd/even mode (aka text mode mapping) */
-        plane = (s->gr[VGA_GFX_PLANE_READ] & 2) | (addr & 1);
-        mask = (1 << plane);
-        if (s->sr[VGA_SEQ_PLANE_WRITE] & mask) {
-            addr = ((addr & ~1) << 1) | plane;
-            if (addr >= s->vga_ram_size) {
-                return;
-            }
-            s->vga_ram[addr] = val;
-#ifdef DEBUG_VGA_MEM
-            printf("vga: odd/even: [0x" TARGET_FMT_plx "]\n", addr);
-#endif
-//            s->plane_updated |= mask; /* only used to detect font change */
-//            memory_region_set_dirty(&s->vram, addr, 1);
+            vga_set_dirty(s, addr, 1);
         }
     } else {
-        /* standard VGA latched access */
-        write_mode = s->gr[VGA_GFX_MODE] & 3;
-        switch(write_mode) {
-        default:
-        case 0:
-            /* rotate */
-            b = s->gr[VGA_GFX_DATA_ROTATE] & 7;
-            val = ((val >> b) | (val << (8 - b))) & 0xff;
-            val |= val << 8;
-            val |= val << 16;
-
-            /* apply set/reset mask */
-            set_mask = mask16[s->gr[VGA_GFX_SR_ENABLE]];
-            val = (val & ~set_mask) |
-                (mask16[s->gr[VGA_GFX_SR_VALUE]] & set_mask);
-            bit_mask = s->gr[VGA_GFX_BIT_MASK];
-            break;
-        case 1:
-            val = s->latch;
-            goto do_write;
-        case 2:
-            val = mask16[val & 0x0f];
-            bit_mask = s->gr[VGA_GFX_BIT_MASK];
-            break;
-        case 3:
-            /* rotate */
-            b = s->gr[VGA_GFX_DATA_ROTATE] & 7;
-            val = (val >> b) | (val << (8 - b));
-
-            bit_mask = s->gr[VGA_GFX_BIT_MASK] & val;
-            val = mask16[s->gr[VGA_GFX_SR_VALUE]];
-            break;
-        }
-
-        /* apply logical operation */
-        func_select = s->gr[VGA_GFX_DATA_ROTATE] >> 3;
-        switch(func_select) {
-        case 0:
-        default:
-            /* nothing to do */
-            break;
-        case 1:
-            /* and */
-            val &= s->latch;
-            break;
-        case 2:
-            /* or */
-            val |= s->latch;
-            break;
-        case 3:
-            /* xor */
-            val ^= s->latch;
-            break;
-        }
-
-        /* apply bit mask */
-        bit_mask |= bit_mask << 8;
-        bit_mask |= bit_mask << 16;
-        val = (val & bit_mask) | (s->latch & ~bit_mask);
-
-    do_write:
-        /* mask data according to sr[2] */
-        mask = s->sr[VGA_SEQ_PLANE_WRITE];
-//        s->plane_updated |= mask; /* only used to detect font change */
-        write_mask = mask16[mask];
-        if (addr * sizeof(uint32_t) >= s->vga_ram_size) {
-            return;
-        }
-        ((uint32_t *)s->vga_ram)[addr] =
-            (((uint32_t *)s->vga_ram)[addr] & ~write_mask) |
-            (val & write_mask);
-#ifdef DEBUG_VGA_MEM
-        printf("vga: latch: [0x" TARGET_FMT_plx "] mask=0x%08x val=0x%08x\n",
-               addr * 4, write_mask, val);
-#endif
-//        memory_region_set_dirty(&s->vram, addr << 2, sizeof(uint32_t));
+        vga_write_unchained(s, addr, val);
     }
 }
 
@@ -1966,9 +2113,9 @@ VGAState *vga_init(char *vga_ram, int vga_ram_size,
     s->fb_dev = fb_dev;
     memset(s->fb_dev, 0, sizeof(FBDevice));
     s->graphic_mode = 0;
-    s->cursor_blink_time = get_uticks();
+    s->cursor_blink_time = emu_uticks();
     s->cursor_visible_phase = 1;
-    s->retrace_time = get_uticks();
+    s->retrace_time = emu_uticks();
     s->retrace_phase = 0;
     fb_dev->width = width;
     fb_dev->height = height;
@@ -2320,6 +2467,7 @@ static void vga_initmode(VGAState *s)
 
     for (int i = 0; i <= 8; i++)
         s->gr[i] = grdc[i];
+    vga_update_write_state(s);
 
     for (int i = 0; i <= 0x18; i++)
         s->cr[i] = crtc[i];
@@ -2549,10 +2697,11 @@ bool __not_in_flash_func(vga_in_retrace)(VGAState *s)
 
 /* Get cursor blink phase (1 = visible, 0 = hidden during blink)
  * Also updates the blink state based on time for hardware VGA drivers
- * that don't use vga_display_update_text */
+ * that don't use vga_display_update_text. They call it from core 1, so
+ * it only peeks at the emulated clock. */
 int __time_critical_func(vga_get_cursor_blink_phase)(VGAState *s)
 {
-    uint32_t now = get_uticks();
+    uint32_t now = emu_uticks_peek();
     if (after_eq(now, s->cursor_blink_time)) {
         s->cursor_blink_time = now + 133333;  // ~3.75 Hz blink rate
         s->cursor_visible_phase = !s->cursor_visible_phase;
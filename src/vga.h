@@ -15,6 +15,7 @@ VGAState *vga_init(char *vga_ram, int vga_ram_size,
 void vga_set_force_8dm(VGAState *s, int v);
 
 int vga_step(VGAState *vga);
+uint32_t vga_next_deadline(VGAState *s, uint32_t now);
 void vga_refresh(VGAState *s,
                  SimpleFBDrawFunc *redraw_func, void *opaque, int full_update);
 
@@ -29,6 +30,7 @@ uint8_t vga_mem_read(VGAState *s, uint32_t addr);
 void vga_mem_write16(VGAState *s, uint32_t addr, uint16_t val);
 void vga_mem_write32(VGAState *s, uint32_t addr, uint32_t val);
 bool vga_mem_write_string(VGAState *s, uint32_t addr, uint8_t *buf, int len);
+bool vga_mem_fill(VGAState *s, uint32_t addr, uint32_t val, int size, int count);
 
 typedef struct PCIDevice PCIDevice;
 typedef struct PCIBus PCIBus;
@@ -98,6 +100,15 @@ const uint8_t* vga_get_font_ptr(VGAState *s, uint8_t ch, int attr_bit3);
 #define MAX_TEXT_WIDTH 132
 #define MAX_TEXT_HEIGHT 60
 
+/* VRAM writes mark 256-byte pages dirty so that the software refresh only
+   redraws lines that changed. The RP2350 drivers scan VRAM out every frame
+   and KVM maps the LFB as RAM, so neither tracks writes. */
+#if !defined(RP2350_BUILD) && !defined(USEKVM) && !defined(FULL_UPDATE)
+#define VGA_DIRTY_TRACKING
+#endif
+#define VGA_DIRTY_PAGE_BITS 8
+#define VGA_DIRTY_PAGES ((256 * 1024) >> VGA_DIRTY_PAGE_BITS)
+
 struct FBDevice {
     /* the following is set by the device */
     int width;
@@ -142,6 +153,14 @@ struct VGAState {
     int32_t bank_offset;
 
     uint32_t latch;
+    /* planar write state, derived from SR2 and GR0/1/3/5/8 */
+    uint8_t wr_mode;        /* write mode, or VGA_WR_STORE */
+    uint8_t wr_rotate;
+    uint8_t wr_func;
+    uint32_t wr_set_mask;   /* set/reset enable, per plane */
+    uint32_t wr_set_value;  /* set/reset value, per plane */
+    uint32_t wr_bit_mask;
+    uint32_t wr_plane_mask;
     
     /* text mode state */
     uint32_t last_palette[16];
@@ -156,6 +175,17 @@ struct VGAState {
     uint8_t last_cursor_start;
     uint8_t last_cursor_end;
 
+#ifdef VGA_DIRTY_TRACKING
+    /* graphics refresh state */
+    uint32_t vram_dirty[VGA_DIRTY_PAGES / 32];
+    uint32_t last_gfx_palette[256];
+    uint32_t last_gfx_start;
+    uint32_t last_gfx_line_offset;
+    uint32_t last_gfx_width;
+    uint32_t last_gfx_height;
+    uint32_t last_gfx_format;
+#endif
+
     /* VBE extension */
     uint16_t vbe_index;
     uint16_t vbe_regs[VBE_DISPI_INDEX_NB];
@@ -170,7 +200,22 @@ struct VGAState {
 #endif
 };
 
-uint32_t get_uticks();
-
+/* mark VRAM bytes [addr, addr + len) as changed; len > 0 */
+static inline void vga_set_dirty(VGAState *s, uint32_t addr, uint32_t len)
+{
+#ifdef VGA_DIRTY_TRACKING
+    uint32_t page = (addr >> VGA_DIRTY_PAGE_BITS) & (VGA_DIRTY_PAGES - 1);
+    uint32_t last = ((addr + len - 1) >> VGA_DIRTY_PAGE_BITS) & (VGA_DIRTY_PAGES - 1);
+    s->vram_dirty[page >> 5] |= 1u << (page & 31);
+    while (page != last) {
+        page = (page + 1) & (VGA_DIRTY_PAGES - 1);
+        s->vram_dirty[page >> 5] |= 1u << (page & 31);
+    }
+#else
+    (void)s;
+    (void)addr;
+    (void)len;
+#endif
+}
 
 #endif /* VGA_H */